@@ -59,14 +59,13 @@ struct AnimationDescriptor
 	int32_t GetChannelIndex(uint32_t animationIndex, std::string node)
 	{
 		auto& map = Animations[animationIndex].NodeChannelMap;
-		auto index = -1;
-		while (map.find(node) == map.end())
+		auto channel = map.find(node);
+		if (channel == map.end())
 		{
-			return index;
+			return -1;
 		}
 
-		index = map[node];
-		return index;
+		return (int32_t)channel->second;
 	}
 
 	AnimationChannel* GetChannel(uint32_t animIndex, std::string node)
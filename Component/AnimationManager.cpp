@@ -3,17 +3,14 @@
 #include "ResourceManager.h"
 #include "Utility.h"
 
-void AnimationManager::ReadNodeHeirarchy(uint32_t entityID, HashID meshID, UINT animationIndex, float AnimationTime)
+void AnimationManager::ReadNodeHeirarchy(AnimationDescriptor& Animations, BoneDescriptor& boneDescriptor, UINT animationIndex, float AnimationTime)
 {
-	auto Animations = &animations[meshID];
-	auto& boneData = boneDataMap[entityID];
-
-	auto& boneDescriptor = boneData.MeshBoneDescriptor;
-	auto& nodes = Animations->NodeHeirarchy;
-	auto rootNode = Animations->RootNode;
+	// Only find() on the shared maps, operator[] would insert on a miss while other entities read them
+	auto& nodes = Animations.NodeHeirarchy;
+	auto& rootNode = Animations.RootNode;
 	std::stack<std::string> nodeQueue;
 	std::stack<XMFLOAT4X4> transformationQueue;
-	auto globalInverse = XMLoadFloat4x4(&Animations->GlobalInverseTransform);
+	auto globalInverse = XMLoadFloat4x4(&Animations.GlobalInverseTransform);
 	auto rootTransform = XMMatrixIdentity();
 	XMFLOAT4X4 identity;
 	XMFLOAT4X4 globalFloat4x4;
@@ -25,12 +22,13 @@ void AnimationManager::ReadNodeHeirarchy(uint32_t entityID, HashID meshID, UINT
 	{
 		auto node = nodeQueue.top();
 		auto parentTransformation = XMLoadFloat4x4(&transformationQueue.top());
-		auto nodeTransformation = XMLoadFloat4x4(&Animations->NodeTransformsMap[node]);
+		auto nodeTransform = Animations.NodeTransformsMap.find(node);
+		auto nodeTransformation = nodeTransform != Animations.NodeTransformsMap.end() ? XMLoadFloat4x4(&nodeTransform->second) : XMMatrixIdentity();
 
 		nodeQueue.pop();
 		transformationQueue.pop();
 
-		auto anim = Animations->GetChannel(animationIndex, node);
+		auto anim = Animations.GetChannel(animationIndex, node);
 		if (anim != nullptr)
 		{
 			auto s = InterpolateScaling(AnimationTime, anim);
@@ -46,18 +44,21 @@ void AnimationManager::ReadNodeHeirarchy(uint32_t entityID, HashID meshID, UINT
 		}
 
 		auto globalTransformation = nodeTransformation * parentTransformation;
-		if (boneDescriptor.boneMapping.find(node) != boneDescriptor.boneMapping.end())
+		auto bone = boneDescriptor.boneMapping.find(node);
+		if (bone != boneDescriptor.boneMapping.end())
 		{
-			uint32_t BoneIndex = boneDescriptor.boneMapping[node];
+			uint32_t BoneIndex = bone->second;
 			auto finalTransform = XMMatrixTranspose(OGLtoXM(boneDescriptor.boneInfoList[BoneIndex].Offset)) * globalTransformation * globalInverse;
 			XMStoreFloat4x4(&boneDescriptor.boneInfoList[BoneIndex].FinalTransform, finalTransform);
 		}
 
-		auto children = Animations->NodeHeirarchy[node];
-		for (int i = (int)children.size() - 1; i >= 0; --i)
+		auto children = nodes.find(node);
+		if (children == nodes.end()) //Leaf
+			continue;
+		for (int i = (int)children->second.size() - 1; i >= 0; --i)
 		{
 			XMStoreFloat4x4(&globalFloat4x4, globalTransformation);
-			nodeQueue.push(children[i]);
+			nodeQueue.push(children->second[i]);
 			transformationQueue.push(globalFloat4x4);
 		}
 	}
@@ -89,13 +90,17 @@ void AnimationManager::RegisterEntity(uint32_t entityID, HashID meshID)
 
 void AnimationManager::BoneTransform(uint32_t entityID, HashID meshID, UINT animationIndex, float totalTime, PerArmatureConstantBuffer* cb)
 {
-	auto animation = animations[meshID].GetAnimation(animationIndex);
+	auto meshAnimations = animations.find(meshID);
+	auto boneData = boneDataMap.find(entityID);
+	if (meshAnimations == animations.end() || boneData == boneDataMap.end() || animationIndex >= meshAnimations->second.Animations.size())
+		return;
+
+	auto animation = meshAnimations->second.GetAnimation(animationIndex);
 	float TicksPerSecond = (float)(animation->TicksPerSecond != 0 ? animation->TicksPerSecond : 25.0f);
 	float TimeInTicks = totalTime * TicksPerSecond;
 	float AnimationTime = fmod(TimeInTicks, (float)animation->Duration);
-	auto& boneDescriptor = boneDataMap[entityID].MeshBoneDescriptor;
-	auto& boneCB = boneDataMap[entityID].ConstantBuffer;
-	ReadNodeHeirarchy(entityID, meshID, animationIndex, AnimationTime);
+	auto& boneDescriptor = boneData->second.MeshBoneDescriptor;
+	ReadNodeHeirarchy(meshAnimations->second, boneDescriptor, animationIndex, AnimationTime);
 
 	for (uint32_t i = 0; i < boneDescriptor.boneInfoList.size(); i++)
 	{
@@ -107,7 +112,8 @@ void AnimationManager::BoneTransform(uint32_t entityID, HashID meshID, UINT anim
 
 PerArmatureConstantBuffer* AnimationManager::GetConstantBuffer(uint32_t entityID)
 {
-	return &boneDataMap[entityID].ConstantBuffer;
+	auto boneData = boneDataMap.find(entityID);
+	return boneData != boneDataMap.end() ? &boneData->second.ConstantBuffer : nullptr;
 }
 
 
@@ -21,12 +21,15 @@ class AnimationManager
 	std::unordered_map<uint32_t, BoneData> boneDataMap;
 	ResourceManager* resourceManager;
 
-	void ReadNodeHeirarchy(uint32_t entityID, HashID meshID, UINT animationIndex, float AnimationTime);
+	void ReadNodeHeirarchy(AnimationDescriptor& Animations, BoneDescriptor& boneDescriptor, UINT animationIndex, float AnimationTime);
 public:
 	AnimationManager();
 	void RegisterMeshAnimations(HashID meshID, AnimationDescriptor* meshAnimations);
 	void RegisterEntity(uint32_t entityID, HashID meshID);
+	//! Only looks up the shared maps and writes the entity's own bone data, so different entities can be transformed
+	//! in parallel while nothing is being registered. Entities or meshes that were never registered are skipped.
 	void BoneTransform(uint32_t entityID, HashID meshID, UINT animationIndex, float totalTime, PerArmatureConstantBuffer* cb);
+	//! nullptr for entities that were never registered
 	PerArmatureConstantBuffer* GetConstantBuffer(uint32_t entityID);
 	~AnimationManager();
 };
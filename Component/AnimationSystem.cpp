@@ -16,27 +16,25 @@ AnimationSystem::~AnimationSystem()
 
 void AnimationSystem::Init()
 {
-	RegisterComponent<AnimationComponent>();
-	RegisterComponent<AnimationBufferComponent>();
+	RegisterComponent<AnimationComponent>(ComponentAccessRead);
+	RegisterComponent<AnimationBufferComponent>(ComponentAccessWrite);
+	RegisterTransformAccess(ComponentAccessRead);
+	query = entity->GetQuery<const AnimationComponent, AnimationBufferComponent>();
 	totalTime = 0.f;
 }
 
 void AnimationSystem::PreUpdate()
 {
-	GetEntities<AnimationComponent>(entities);
-	animComponents = entity->GetComponents<AnimationComponent>(componentCount);
 }
 
 void AnimationSystem::Update(float deltaTime)
 {
-	auto buffers = entity->GetComponents<AnimationBufferComponent>(componentCount);
-	for (size_t i = 0; i < entities.size(); ++i)
+	// Skinning is heavy per entity, small batches keep every worker busy
+	query->ForEachParallel([&](EntityID id, const AnimationComponent& anim, AnimationBufferComponent& buffer)
 	{
-		auto component = &animComponents[i];
-		auto animIndex = component->CurrentAnimationIndex;
-		auto sEntity = entity->GetEntity(entities[i]);
-		animManager->BoneTransform(entities[i], sEntity.Mesh, animIndex, totalTime, &buffers[i].ConstantBuffer);
-	}
+		auto sEntity = entity->GetEntity(id);
+		animManager->BoneTransform(id, sEntity.Mesh, anim.CurrentAnimationIndex, totalTime, &buffer.ConstantBuffer);
+	}, 1);
 	totalTime += deltaTime;
 }
 
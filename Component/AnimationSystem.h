@@ -5,9 +5,7 @@
 
 class AnimationSystem : public ISystem
 {
-	std::vector<EntityID> entities;
-	AnimationComponent* animComponents;
-	size_t componentCount;
+	Query<const AnimationComponent, AnimationBufferComponent>* query;
 	AnimationManager* animManager;
 	float totalTime;
 public:
@@ -0,0 +1,431 @@
+#include "stdafx.h"
+#include "Archetype.h"
+#include <algorithm>
+
+static byte* AllocateChunkMemory(size_t size)
+{
+#ifdef _WIN32
+	return (byte*)_aligned_malloc(size, ArchetypeChunkAlignment);
+#else
+	return (byte*)aligned_alloc(ArchetypeChunkAlignment, size);
+#endif
+}
+
+static void FreeChunkMemory(byte* memory)
+{
+#ifdef _WIN32
+	_aligned_free(memory);
+#else
+	free(memory);
+#endif
+}
+
+static size_t AlignOffset(size_t offset, size_t alignment)
+{
+	return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+Archetype::Archetype(const std::vector<ComponentTypeInfo>& componentTypes) :
+	types(componentTypes)
+{
+	std::sort(types.begin(), types.end(), [](const ComponentTypeInfo& a, const ComponentTypeInfo& b) { return a.Type < b.Type; });
+	for (auto& type : types)
+	{
+		signature.push_back(type.Type);
+	}
+	ComputeLayout();
+}
+
+void Archetype::ComputeLayout()
+{
+	size_t bytesPerEntity = sizeof(EntityID);
+	for (auto& type : types)
+	{
+		bytesPerEntity += type.Size;
+	}
+
+	columnOffsets.resize(types.size());
+	chunkSize = ArchetypeChunkSize;
+	chunkCapacity = std::max((uint32_t)(ArchetypeChunkSize / bytesPerEntity), 1u);
+	for (;;) // Shrink until the aligned columns fit in a chunk
+	{
+		size_t offset = 0;
+		entityColumnOffset = offset;
+		offset += sizeof(EntityID) * chunkCapacity;
+		for (size_t i = 0; i < types.size(); ++i)
+		{
+			offset = AlignOffset(offset, types[i].Alignment);
+			columnOffsets[i] = offset;
+			offset += types[i].Size * chunkCapacity;
+		}
+
+		if (offset <= chunkSize)
+			break;
+		if (chunkCapacity == 1) // A row larger than a chunk gets chunks of its own size
+		{
+			chunkSize = AlignOffset(offset, ArchetypeChunkAlignment);
+			break;
+		}
+		chunkCapacity--;
+	}
+}
+
+ArchetypeChunk& Archetype::AllocateRow(uint32_t& outChunk, uint32_t& outRow)
+{
+	if (chunks.empty() || chunks.back().Count == chunkCapacity)
+	{
+		ArchetypeChunk chunk{ AllocateChunkMemory(chunkSize), 0, std::unique_ptr<std::atomic<uint32_t>[]>(new std::atomic<uint32_t>[types.size()]),
+			std::unique_ptr<std::atomic<uint32_t>[]>(new std::atomic<uint32_t>[types.size()]) };
+		for (size_t i = 0; i < types.size(); ++i)
+		{
+			chunk.ChangeVersions[i] = 0;
+			chunk.AddedVersions[i] = 0;
+		}
+		chunks.push_back(std::move(chunk));
+	}
+
+	outChunk = (uint32_t)chunks.size() - 1;
+	auto& chunk = chunks.back();
+	outRow = chunk.Count++;
+	return chunk;
+}
+
+int Archetype::GetColumnIndex(TypeID type) const
+{
+	for (size_t i = 0; i < signature.size(); ++i)
+	{
+		if (signature[i] == type)
+			return (int)i;
+	}
+	return -1;
+}
+
+bool Archetype::Contains(const TypeID * componentTypes, size_t count) const
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (GetColumnIndex(componentTypes[i]) < 0)
+			return false;
+	}
+	return true;
+}
+
+Archetype::~Archetype()
+{
+	for (size_t c = 0; c < chunks.size(); ++c)
+	{
+		for (size_t column = 0; column < types.size(); ++column)
+		{
+			auto data = (byte*)GetColumn(c, (int)column);
+			for (uint32_t row = 0; row < chunks[c].Count; ++row)
+			{
+				types[column].Destroy(data + row * types[column].Size);
+			}
+		}
+		FreeChunkMemory(chunks[c].Memory);
+	}
+	chunks.clear();
+}
+
+ArchetypeStorage::ArchetypeStorage()
+{
+}
+
+Archetype * ArchetypeStorage::GetArchetype(const std::vector<ComponentTypeInfo>& componentTypes)
+{
+	std::vector<TypeID> signature;
+	for (auto& type : componentTypes)
+	{
+		signature.push_back(type.Type);
+	}
+	std::sort(signature.begin(), signature.end());
+
+	auto it = archetypes.find(signature);
+	if (it != archetypes.end())
+		return it->second.get();
+
+	auto archetype = new Archetype(componentTypes);
+	archetypes.insert(std::make_pair(signature, std::unique_ptr<Archetype>(archetype)));
+	archetypeList.push_back(archetype);
+	return archetype;
+}
+
+Archetype * ArchetypeStorage::GetAddTarget(Archetype * source, const ComponentTypeInfo & typeInfo)
+{
+	if (source == nullptr)
+		return GetArchetype({ typeInfo });
+
+	auto edge = source->addEdges.find(typeInfo.Type);
+	if (edge != source->addEdges.end())
+		return edge->second;
+
+	auto targetTypes = source->types;
+	targetTypes.push_back(typeInfo);
+	auto target = GetArchetype(targetTypes);
+	source->addEdges[typeInfo.Type] = target;
+	target->removeEdges[typeInfo.Type] = source;
+	return target;
+}
+
+Archetype * ArchetypeStorage::GetRemoveTarget(Archetype * source, TypeID type)
+{
+	auto edge = source->removeEdges.find(type);
+	if (edge != source->removeEdges.end())
+		return edge->second;
+
+	std::vector<ComponentTypeInfo> targetTypes;
+	for (auto& t : source->types)
+	{
+		if (t.Type != type)
+			targetTypes.push_back(t);
+	}
+
+	Archetype* target = targetTypes.empty() ? nullptr : GetArchetype(targetTypes);
+	source->removeEdges[type] = target;
+	if (target != nullptr)
+		target->addEdges[type] = source;
+	return target;
+}
+
+ArchetypeRecord & ArchetypeStorage::GetRecord(EntityID entity)
+{
+	if ((size_t)entity >= records.size())
+	{
+		records.resize(entity + 1, ArchetypeRecord{ nullptr, 0, 0 });
+	}
+	return records[entity];
+}
+
+// Keeps archetype rows contiguous by moving the last row of the last chunk into the hole
+void ArchetypeStorage::RemoveRow(Archetype * archetype, uint32_t chunk, uint32_t row, bool destroy)
+{
+	auto lastChunk = (uint32_t)archetype->chunks.size() - 1;
+	auto lastRow = archetype->chunks[lastChunk].Count - 1;
+	for (size_t column = 0; column < archetype->types.size(); ++column)
+	{
+		auto& type = archetype->types[column];
+		auto dst = archetype->GetComponent(chunk, row, (int)column);
+		if (destroy)
+			type.Destroy(dst);
+		if (chunk != lastChunk || row != lastRow)
+			type.Move(dst, archetype->GetComponent(lastChunk, lastRow, (int)column));
+	}
+
+	if (chunk != lastChunk)
+	{
+		for (size_t column = 0; column < archetype->types.size(); ++column)
+		{
+			ChangeVersion::Raise(archetype->chunks[chunk].ChangeVersions[column], archetype->GetChangeVersion(lastChunk, (int)column));
+			ChangeVersion::Raise(archetype->chunks[chunk].AddedVersions[column], archetype->GetAddedVersion(lastChunk, (int)column));
+		}
+	}
+
+	if (chunk != lastChunk || row != lastRow)
+	{
+		auto movedEntity = archetype->GetEntities(lastChunk)[lastRow];
+		archetype->GetEntities(chunk)[row] = movedEntity;
+		records[movedEntity].Chunk = chunk;
+		records[movedEntity].Row = row;
+		movedEntities.push_back(movedEntity);
+	}
+
+	if (--archetype->chunks[lastChunk].Count == 0)
+	{
+		FreeChunkMemory(archetype->chunks[lastChunk].Memory);
+		archetype->chunks.pop_back();
+	}
+}
+
+void ArchetypeStorage::Migrate(EntityID entity, Archetype * target, const ComponentTypeInfo * addedType, const void * addedData)
+{
+	auto& record = GetRecord(entity);
+	auto source = record.Owner;
+	auto version = ChangeVersion::Current();
+	uint32_t chunk = 0, row = 0;
+	if (target != nullptr)
+	{
+		target->AllocateRow(chunk, row);
+		target->GetEntities(chunk)[row] = entity;
+		auto& targetChunk = target->chunks[chunk];
+		for (size_t column = 0; column < target->types.size(); ++column)
+		{
+			auto& type = target->types[column];
+			auto dst = target->GetComponent(chunk, row, (int)column);
+			int sourceColumn = source == nullptr ? -1 : source->GetColumnIndex(type.Type);
+			if (sourceColumn >= 0)
+			{
+				type.Move(dst, source->GetComponent(record.Chunk, record.Row, sourceColumn));
+				ChangeVersion::Raise(targetChunk.ChangeVersions[column], source->GetChangeVersion(record.Chunk, sourceColumn));
+				ChangeVersion::Raise(targetChunk.AddedVersions[column], source->GetAddedVersion(record.Chunk, sourceColumn));
+			}
+			else
+			{
+				type.Construct(dst, addedType != nullptr && addedType->Type == type.Type ? addedData : nullptr);
+				ChangeVersion::Raise(targetChunk.ChangeVersions[column], version);
+				ChangeVersion::Raise(targetChunk.AddedVersions[column], version);
+			}
+		}
+	}
+
+	if (source != nullptr)
+	{
+		// Columns that did not move to the target still hold live data
+		for (size_t column = 0; column < source->types.size(); ++column)
+		{
+			auto& type = source->types[column];
+			if (target == nullptr || target->GetColumnIndex(type.Type) < 0)
+				type.Destroy(source->GetComponent(record.Chunk, record.Row, (int)column));
+		}
+		RemoveRow(source, record.Chunk, record.Row, false);
+	}
+
+	record = ArchetypeRecord{ target, chunk, row };
+}
+
+void ArchetypeStorage::Add(EntityID entity, const ComponentTypeInfo & typeInfo, const void * data)
+{
+	auto& record = GetRecord(entity);
+	if (record.Owner != nullptr)
+	{
+		auto column = record.Owner->GetColumnIndex(typeInfo.Type);
+		if (column >= 0) //Already attached, overwrite the data
+		{
+			auto dst = record.Owner->GetComponent(record.Chunk, record.Row, column);
+			typeInfo.Destroy(dst);
+			typeInfo.Construct(dst, data);
+			record.Owner->MarkChanged(record.Chunk, column, ChangeVersion::Current());
+			return;
+		}
+	}
+
+	Migrate(entity, GetAddTarget(record.Owner, typeInfo), &typeInfo, data);
+}
+
+void ArchetypeStorage::Remove(EntityID entity, TypeID type)
+{
+	if (!Has(entity, type))
+		return;
+
+	auto& record = records[entity];
+	Migrate(entity, GetRemoveTarget(record.Owner, type), nullptr, nullptr);
+}
+
+void ArchetypeStorage::RemoveEntity(EntityID entity)
+{
+	if ((size_t)entity >= records.size() || records[entity].Owner == nullptr)
+		return;
+
+	auto& record = records[entity];
+	RemoveRow(record.Owner, record.Chunk, record.Row, true);
+	record = ArchetypeRecord{ nullptr, 0, 0 };
+}
+
+void * ArchetypeStorage::Get(EntityID entity, TypeID type)
+{
+	if ((size_t)entity >= records.size() || records[entity].Owner == nullptr)
+		return nullptr;
+
+	auto& record = records[entity];
+	auto column = record.Owner->GetColumnIndex(type);
+	if (column < 0)
+		return nullptr;
+	return record.Owner->GetComponent(record.Chunk, record.Row, column);
+}
+
+bool ArchetypeStorage::Has(EntityID entity, TypeID type)
+{
+	return Get(entity, type) != nullptr;
+}
+
+void ArchetypeStorage::GetEntities(TypeID type, std::vector<EntityID>& outEntities)
+{
+	for (auto archetype : archetypeList)
+	{
+		if (archetype->GetColumnIndex(type) < 0)
+			continue;
+
+		for (size_t chunk = 0; chunk < archetype->GetChunkCount(); ++chunk)
+		{
+			auto entities = archetype->GetEntities(chunk);
+			outEntities.insert(outEntities.end(), entities, entities + archetype->GetChunkEntityCount(chunk));
+		}
+	}
+}
+
+size_t ArchetypeStorage::Count(TypeID type)
+{
+	size_t count = 0;
+	for (auto archetype : archetypeList)
+	{
+		if (archetype->GetColumnIndex(type) < 0)
+			continue;
+
+		for (size_t chunk = 0; chunk < archetype->GetChunkCount(); ++chunk)
+		{
+			count += archetype->GetChunkEntityCount(chunk);
+		}
+	}
+	return count;
+}
+
+void ArchetypeStorage::TakeMovedEntities(std::vector<EntityID>& outEntities)
+{
+	outEntities.insert(outEntities.end(), movedEntities.begin(), movedEntities.end());
+	movedEntities.clear();
+}
+
+void ArchetypeStorage::MarkChanged(EntityID entity, TypeID type)
+{
+	if ((size_t)entity >= records.size() || records[entity].Owner == nullptr)
+		return;
+
+	auto& record = records[entity];
+	auto column = record.Owner->GetColumnIndex(type);
+	if (column >= 0)
+		record.Owner->MarkChanged(record.Chunk, column, ChangeVersion::Current());
+}
+
+uint32_t ArchetypeStorage::GetChangeVersion(EntityID entity, TypeID type)
+{
+	if ((size_t)entity >= records.size() || records[entity].Owner == nullptr)
+		return 0;
+
+	auto& record = records[entity];
+	auto column = record.Owner->GetColumnIndex(type);
+	return column < 0 ? 0 : record.Owner->GetChangeVersion(record.Chunk, column);
+}
+
+uint32_t ArchetypeStorage::GetAddedVersion(EntityID entity, TypeID type)
+{
+	if ((size_t)entity >= records.size() || records[entity].Owner == nullptr)
+		return 0;
+
+	auto& record = records[entity];
+	auto column = record.Owner->GetColumnIndex(type);
+	return column < 0 ? 0 : record.Owner->GetAddedVersion(record.Chunk, column);
+}
+
+uint32_t ArchetypeStorage::GetColumnVersion(TypeID type)
+{
+	uint32_t version = 0;
+	for (auto archetype : archetypeList)
+	{
+		auto column = archetype->GetColumnIndex(type);
+		if (column < 0)
+			continue;
+
+		for (size_t chunk = 0; chunk < archetype->GetChunkCount(); ++chunk)
+		{
+			auto chunkVersion = archetype->GetChangeVersion(chunk, column);
+			if (chunkVersion > version)
+				version = chunkVersion;
+		}
+	}
+	return version;
+}
+
+ArchetypeStorage::~ArchetypeStorage()
+{
+	archetypeList.clear();
+	archetypes.clear();
+}
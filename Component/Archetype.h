@@ -0,0 +1,177 @@
+#pragma once
+#include <vector>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <typeinfo>
+#include <new>
+#include <atomic>
+#include "SceneCommon.h"
+#include "ComponentType.h"
+
+static const size_t ArchetypeChunkSize = 16 * 1024;
+static const size_t ArchetypeChunkAlignment = 64;
+
+//! Type erased description of a component type so archetype columns can construct, move and destroy it
+struct ComponentTypeInfo
+{
+	TypeID		Type;
+	size_t		Size;
+	size_t		Alignment;
+	void		(*Construct)(void* dst, const void* src); //Copy constructs from src, default constructs if src is null
+	void		(*Move)(void* dst, void* src); //Move constructs into dst and destroys src
+	void		(*Destroy)(void* ptr);
+
+	template<typename T>
+	static ComponentTypeInfo Create();
+};
+
+//! Fixed size block of memory holding one SoA column per component type of the owning archetype
+struct ArchetypeChunk
+{
+	byte*		Memory;
+	uint32_t	Count;
+	//Change tracking per column, a write to any row marks the whole column of this chunk
+	std::unique_ptr<std::atomic<uint32_t>[]> ChangeVersions;
+	std::unique_ptr<std::atomic<uint32_t>[]> AddedVersions;
+};
+
+class Archetype
+{
+	friend class ArchetypeStorage;
+
+	std::vector<TypeID>					signature; //Sorted component type list
+	std::vector<ComponentTypeInfo>		types;
+	std::vector<size_t>					columnOffsets; //Byte offset of each component column inside a chunk
+	size_t								entityColumnOffset;
+	size_t								chunkSize; //ArchetypeChunkSize unless a single row needs more
+	uint32_t							chunkCapacity;
+	std::vector<ArchetypeChunk>			chunks;
+	std::unordered_map<TypeID, Archetype*> addEdges; //Cached migration targets
+	std::unordered_map<TypeID, Archetype*> removeEdges;
+
+	void					ComputeLayout();
+	ArchetypeChunk&			AllocateRow(uint32_t& outChunk, uint32_t& outRow);
+public:
+	Archetype(const std::vector<ComponentTypeInfo>& componentTypes);
+
+	int						GetColumnIndex(TypeID type) const;
+	bool					Contains(const TypeID* componentTypes, size_t count) const;
+	inline void*			GetColumn(size_t chunk, int column) { return chunks[chunk].Memory + columnOffsets[column]; }
+	inline EntityID*		GetEntities(size_t chunk) { return (EntityID*)(chunks[chunk].Memory + entityColumnOffset); }
+	inline void*			GetComponent(uint32_t chunk, uint32_t row, int column) { return (byte*)GetColumn(chunk, column) + row * types[column].Size; }
+	inline size_t			GetChunkCount() const { return chunks.size(); }
+	inline uint32_t			GetChunkEntityCount(size_t chunk) const { return chunks[chunk].Count; }
+	inline uint32_t			GetChunkCapacity() const { return chunkCapacity; }
+	inline const std::vector<TypeID>& GetSignature() const { return signature; }
+	inline uint32_t			GetChangeVersion(size_t chunk, int column) const { return chunks[chunk].ChangeVersions[column].load(std::memory_order_relaxed); }
+	inline uint32_t			GetAddedVersion(size_t chunk, int column) const { return chunks[chunk].AddedVersions[column].load(std::memory_order_relaxed); }
+	inline void				MarkChanged(size_t chunk, int column, uint32_t version) { ChangeVersion::Raise(chunks[chunk].ChangeVersions[column], version); }
+	~Archetype();
+};
+
+//! Location of an entity inside archetype storage
+struct ArchetypeRecord
+{
+	Archetype*	Owner;
+	uint32_t	Chunk;
+	uint32_t	Row;
+};
+
+//! Groups entities with the same component set into fixed size chunks.
+//! Adding or removing a component migrates the entity to the matching archetype.
+class ArchetypeStorage
+{
+	std::map<std::vector<TypeID>, std::unique_ptr<Archetype>> archetypes;
+	std::vector<Archetype*>			archetypeList;
+	std::vector<ArchetypeRecord>	records; //Index of this vector is the EntityID
+	std::vector<EntityID>			movedEntities; //Took a removed row's place since TakeMovedEntities
+
+	Archetype*				GetArchetype(const std::vector<ComponentTypeInfo>& componentTypes);
+	Archetype*				GetAddTarget(Archetype* source, const ComponentTypeInfo& typeInfo);
+	Archetype*				GetRemoveTarget(Archetype* source, TypeID type);
+	void					RemoveRow(Archetype* archetype, uint32_t chunk, uint32_t row, bool destroy);
+	void					Migrate(EntityID entity, Archetype* target, const ComponentTypeInfo* addedType, const void* addedData);
+	ArchetypeRecord&		GetRecord(EntityID entity);
+public:
+	ArchetypeStorage();
+
+	void					Add(EntityID entity, const ComponentTypeInfo& typeInfo, const void* data = nullptr);
+	void					Remove(EntityID entity, TypeID type);
+	void					RemoveEntity(EntityID entity);
+	void*					Get(EntityID entity, TypeID type);
+	bool					Has(EntityID entity, TypeID type);
+	void					GetEntities(TypeID type, std::vector<EntityID>& outEntities);
+	size_t					Count(TypeID type);
+
+	void					MarkChanged(EntityID entity, TypeID type);
+	uint32_t				GetChangeVersion(EntityID entity, TypeID type);
+	uint32_t				GetAddedVersion(EntityID entity, TypeID type);
+	//! Highest change version of any chunk holding the type
+	uint32_t				GetColumnVersion(TypeID type);
+	//! Appends the entities whose row was moved to fill a hole since the last call. Chunks never move, so
+	//! pointers to every other row stay valid.
+	void					TakeMovedEntities(std::vector<EntityID>& outEntities);
+
+	template<typename T>
+	void					Add(EntityID entity, const T& data) { Add(entity, ComponentTypeInfo::Create<T>(), &data); }
+
+	template<typename T>
+	T*						Get(EntityID entity) { return (T*)Get(entity, ComponentType<T>::ID()); }
+
+	//! Calls callback(count, entities, components...) once per chunk holding all of the given component types.
+	//! Columns of non const types are marked changed.
+	template<typename... Args, typename FuncType>
+	void					ForEachChunk(FuncType callback);
+
+	inline const std::vector<Archetype*>& GetArchetypes() const { return archetypeList; }
+	~ArchetypeStorage();
+};
+
+template<typename T>
+inline ComponentTypeInfo ComponentTypeInfo::Create()
+{
+	ComponentTypeInfo info;
+	info.Type = ComponentType<T>::ID();
+	info.Size = sizeof(T);
+	info.Alignment = alignof(T);
+	info.Construct = [](void* dst, const void* src)
+	{
+		if (src == nullptr)
+			new (dst) T();
+		else
+			new (dst) T(*(const T*)src);
+	};
+	info.Move = [](void* dst, void* src)
+	{
+		new (dst) T(std::move(*(T*)src));
+		((T*)src)->~T();
+	};
+	info.Destroy = [](void* ptr)
+	{
+		((T*)ptr)->~T();
+	};
+	return info;
+}
+
+template<typename ...Args, typename FuncType>
+inline void ArchetypeStorage::ForEachChunk(FuncType callback)
+{
+	const TypeID queryTypes[] = { ComponentType<Args>::ID()... };
+	auto version = ChangeVersion::Current();
+	for (auto archetype : archetypeList)
+	{
+		if (!archetype->Contains(queryTypes, sizeof...(Args)))
+			continue;
+
+		for (size_t chunk = 0; chunk < archetype->GetChunkCount(); ++chunk)
+		{
+			auto count = archetype->GetChunkEntityCount(chunk);
+			if (count == 0)
+				continue;
+			auto c = { 0, (std::is_const<Args>::value ? 0 : (archetype->MarkChanged(chunk, archetype->GetColumnIndex(ComponentType<Args>::ID()), version), 0))... };
+			(void)c;
+			callback(count, archetype->GetEntities(chunk), (Args*)archetype->GetColumn(chunk, archetype->GetColumnIndex(ComponentType<Args>::ID()))...);
+		}
+	}
+}
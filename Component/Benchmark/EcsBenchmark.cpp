@@ -0,0 +1,436 @@
+#include "../stdafx.h"
+#include "../EntityManager.h"
+#include "../SystemManager.h"
+#include "../Query.h"
+#include "../Serializable.h"
+#include "../Culling.h"
+#include <chrono>
+#include <random>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+//Headless ECS benchmark, no window or renderer. Times entity creation, removal, queries, hierarchy,
+//transform updates and view culling at several entity counts and writes the results as JSON.
+//Usage: EcsBenchmark [output.json] [iterations]
+
+GameComponent(BenchVelocity)
+	XMFLOAT3 Value;
+	template<class Archive>
+	void serialize(Archive& archive)
+	{
+		archive(cereal::make_nvp("X", Value.x), cereal::make_nvp("Y", Value.y), cereal::make_nvp("Z", Value.z));
+	}
+EndComponent(BenchVelocity)
+
+GameComponent(BenchHealth)
+	float Value;
+	template<class Archive>
+	void serialize(Archive& archive)
+	{
+		archive(CEREAL_NVP(Value));
+	}
+EndComponent(BenchHealth)
+
+RegisterComponent(BenchVelocity)
+RegisterComponent(BenchHealth)
+
+static const size_t EntityCounts[] = { 10000, 100000, 1000000 };
+static const uint32_t HierarchyDepth = 32; //Chain length for the deep hierarchy cases
+static const float RemoveFraction = 0.1f;
+static const uint32_t RandomSeed = 1337;
+
+struct BenchmarkResult
+{
+	std::string	Name;
+	std::string	StorageMode;
+	size_t		EntityCount;
+	uint32_t	Iterations;
+	double		MinMs;
+	double		MedianMs;
+	double		MeanMs;
+	double		NsPerEntity; //From the median
+
+	template<class Archive>
+	void serialize(Archive& archive)
+	{
+		archive(
+			CEREAL_NVP(Name),
+			CEREAL_NVP(StorageMode),
+			CEREAL_NVP(EntityCount),
+			CEREAL_NVP(Iterations),
+			CEREAL_NVP(MinMs),
+			CEREAL_NVP(MedianMs),
+			CEREAL_NVP(MeanMs),
+			CEREAL_NVP(NsPerEntity)
+		);
+	}
+};
+
+//! Fresh scene, entity manager and system manager for one measurement
+struct BenchWorld
+{
+	Scene							SceneGraph;
+	SystemContext					Context;
+	std::unique_ptr<EntityManager>	Entities;
+	std::unique_ptr<SystemManager>	Systems;
+	std::vector<EntityID>			Created;
+
+	BenchWorld(ComponentStorageMode mode)
+	{
+		Context = SystemContext{};
+		Entities = std::unique_ptr<EntityManager>(new EntityManager(&SceneGraph, mode));
+		Context.EntityManager = Entities.get();
+		Systems = std::unique_ptr<SystemManager>(new SystemManager(Entities.get(), &Context));
+	}
+
+	//! count entities under the root, or chains of HierarchyDepth when deep is set
+	void Populate(size_t count, bool deep)
+	{
+		std::vector<EntityDesc> descs(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			auto& desc = descs[i];
+			desc.Name = "e" + std::to_string(i);
+			desc.LocalTransform.Position = XMFLOAT3((float)(i % 100), (float)(i / 100 % 100), 1.f);
+			if (deep && i % HierarchyDepth != 0)
+				desc.ParentIndex = (int32_t)(i - 1);
+		}
+		Created.resize(count);
+		Entities->CreateEntities(descs.data(), count, Created.data());
+	}
+
+	void AddBenchComponents()
+	{
+		std::vector<BenchVelocity> velocities(Created.size());
+		for (size_t i = 0; i < velocities.size(); ++i)
+		{
+			velocities[i].Value = XMFLOAT3(1.f, (float)(i % 7), 0.5f);
+		}
+		Entities->AddComponents<BenchVelocity>(Created.data(), Created.size(), velocities.data());
+
+		// Every other entity gets health so multi component queries actually filter
+		std::vector<EntityID> halfEntities;
+		for (size_t i = 0; i < Created.size(); i += 2)
+		{
+			halfEntities.push_back(Created[i]);
+		}
+		std::vector<BenchHealth> health(halfEntities.size());
+		for (auto& h : health)
+		{
+			h.Value = 1.f;
+		}
+		Entities->AddComponents<BenchHealth>(halfEntities.data(), halfEntities.size(), health.data());
+	}
+};
+
+//! Moves every entity with velocity, used for the SystemManager case
+class BenchMoveSystem : public ISystem
+{
+	Query<BenchVelocity, const BenchHealth>* query;
+public:
+	virtual void Init() override
+	{
+		RegisterComponent<BenchVelocity>(ComponentAccessWrite);
+		RegisterComponent<BenchHealth>(ComponentAccessRead);
+		query = entity->GetQuery<BenchVelocity, const BenchHealth>();
+	}
+
+	virtual void Update(float deltaTime) override
+	{
+		query->ForEachParallel([deltaTime](EntityID e, BenchVelocity& velocity, const BenchHealth& health)
+		{
+			velocity.Value.x += health.Value * deltaTime;
+		});
+	}
+};
+
+class BenchDecaySystem : public ISystem
+{
+	Query<BenchHealth>* query;
+public:
+	virtual void Init() override
+	{
+		RegisterComponent<BenchHealth>(ComponentAccessWrite);
+		query = entity->GetQuery<BenchHealth>();
+	}
+
+	virtual void Update(float deltaTime) override
+	{
+		query->ForEach([deltaTime](EntityID e, BenchHealth& health)
+		{
+			health.Value -= deltaTime;
+		});
+	}
+};
+
+static volatile float sink; //Keeps the optimizer from dropping read only loops
+
+//! Runs setup then the timed func iterations times, each on a fresh world
+template<typename SetupType, typename FuncType>
+static BenchmarkResult Measure(const char* name, ComponentStorageMode mode, size_t count, uint32_t iterations, SetupType setup, FuncType func)
+{
+	std::vector<double> times;
+	for (uint32_t i = 0; i < iterations; ++i)
+	{
+		BenchWorld world(mode);
+		setup(world);
+		auto start = std::chrono::high_resolution_clock::now();
+		func(world);
+		auto end = std::chrono::high_resolution_clock::now();
+		times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+	}
+
+	std::sort(times.begin(), times.end());
+	double total = 0.0;
+	for (auto t : times)
+	{
+		total += t;
+	}
+
+	BenchmarkResult result;
+	result.Name = name;
+	result.StorageMode = mode == StorageModeArchetype ? "Archetype" : "PerComponent";
+	result.EntityCount = count;
+	result.Iterations = iterations;
+	result.MinMs = times.front();
+	result.MedianMs = times[times.size() / 2];
+	result.MeanMs = total / times.size();
+	result.NsPerEntity = result.MedianMs * 1e6 / count;
+	std::cerr << result.Name << " [" << result.StorageMode << ", " << count << "] " << result.MedianMs << " ms" << std::endl;
+	return result;
+}
+
+static void RunBenchmarks(ComponentStorageMode mode, size_t count, uint32_t iterations, std::vector<BenchmarkResult>& outResults)
+{
+	auto none = [](BenchWorld&) {};
+	auto flat = [count](BenchWorld& w) { w.Populate(count, false); };
+	auto deep = [count](BenchWorld& w) { w.Populate(count, true); };
+	auto flatWithComponents = [count](BenchWorld& w) { w.Populate(count, false); w.AddBenchComponents(); };
+
+	outResults.push_back(Measure("CreateEntities", mode, count, iterations, none, [count](BenchWorld& w)
+	{
+		w.Populate(count, false);
+	}));
+
+	outResults.push_back(Measure("CreateEntity", mode, count, iterations, none, [count](BenchWorld& w)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			w.Entities->CreateEntity(-1, "e" + std::to_string(i));
+		}
+	}));
+
+	outResults.push_back(Measure("AddComponents", mode, count, iterations, flat, [](BenchWorld& w)
+	{
+		w.AddBenchComponents();
+	}));
+
+	outResults.push_back(Measure("RemoveEntitiesRandom", mode, count, iterations, flatWithComponents, [](BenchWorld& w)
+	{
+		std::vector<EntityID> removeList = w.Created;
+		std::shuffle(removeList.begin(), removeList.end(), std::mt19937(RandomSeed));
+		removeList.resize((size_t)(removeList.size() * RemoveFraction));
+		w.Entities->RemoveEntities(removeList.data(), removeList.size());
+	}));
+
+	outResults.push_back(Measure("QuerySingle", mode, count, iterations, flatWithComponents, [](BenchWorld& w)
+	{
+		auto query = w.Entities->GetQuery<const BenchVelocity>();
+		float sum = 0.f;
+		query->ForEach([&](EntityID e, const BenchVelocity& velocity) { sum += velocity.Value.y; });
+		sink = sum;
+	}));
+
+	outResults.push_back(Measure("QueryMulti", mode, count, iterations, flatWithComponents, [](BenchWorld& w)
+	{
+		auto query = w.Entities->GetQuery<BenchVelocity, const BenchHealth>();
+		query->ForEach([](EntityID e, BenchVelocity& velocity, const BenchHealth& health) { velocity.Value.x += health.Value; });
+	}));
+
+	// Query construction is excluded, this is the steady state cost a system pays every frame
+	outResults.push_back(Measure("QueryMultiWarm", mode, count, iterations, [&](BenchWorld& w)
+	{
+		flatWithComponents(w);
+		w.Entities->GetQuery<BenchVelocity, const BenchHealth>()->Refresh();
+	}, [](BenchWorld& w)
+	{
+		auto query = w.Entities->GetQuery<BenchVelocity, const BenchHealth>();
+		query->ForEach([](EntityID e, BenchVelocity& velocity, const BenchHealth& health) { velocity.Value.x += health.Value; });
+	}));
+
+	outResults.push_back(Measure("QueryMultiParallel", mode, count, iterations, [&](BenchWorld& w)
+	{
+		flatWithComponents(w);
+		w.Entities->GetQuery<BenchVelocity, const BenchHealth>()->Refresh();
+	}, [](BenchWorld& w)
+	{
+		auto query = w.Entities->GetQuery<BenchVelocity, const BenchHealth>();
+		query->ForEachParallel([](EntityID e, BenchVelocity& velocity, const BenchHealth& health) { velocity.Value.x += health.Value; });
+	}));
+
+	outResults.push_back(Measure("ForEachMulti", mode, count, iterations, flatWithComponents, [](BenchWorld& w)
+	{
+		w.Entities->ForEach<BenchVelocity, const BenchHealth>([](EntityID e, BenchVelocity& velocity, const BenchHealth& health) { velocity.Value.x += health.Value; });
+	}));
+
+	outResults.push_back(Measure("SystemManagerUpdate", mode, count, iterations, [&](BenchWorld& w)
+	{
+		flatWithComponents(w);
+		w.Systems->RegisterSystem<BenchMoveSystem>();
+		w.Systems->RegisterSystem<BenchDecaySystem>();
+		w.Systems->Init();
+		w.Systems->Update(0.016f); //First update builds the schedule and queries
+	}, [](BenchWorld& w)
+	{
+		w.Systems->Update(0.016f);
+	}));
+
+	outResults.push_back(Measure("SetActiveDeepHierarchy", mode, count, iterations, deep, [](BenchWorld& w)
+	{
+		for (size_t i = 0; i < w.Created.size(); i += HierarchyDepth)
+		{
+			w.Entities->SetActive(w.Created[i], false);
+			w.Entities->SetActive(w.Created[i], true);
+		}
+	}));
+
+	outResults.push_back(Measure("UpdateTransformsFlat", mode, count, iterations, flat, [](BenchWorld& w)
+	{
+		w.SceneGraph.UpdateTransforms();
+	}));
+
+	outResults.push_back(Measure("UpdateTransformsDeep", mode, count, iterations, deep, [](BenchWorld& w)
+	{
+		w.SceneGraph.UpdateTransforms();
+	}));
+
+	// Serial against subtree parallel update of the same hierarchy, the parallel mode only kicks in above its node threshold
+	outResults.push_back(Measure("UpdateTransformsDeepSerial", mode, count, iterations, [&](BenchWorld& w)
+	{
+		deep(w);
+		w.SceneGraph.SetParallelUpdate(false);
+	}, [](BenchWorld& w)
+	{
+		w.SceneGraph.UpdateTransforms();
+	}));
+
+	outResults.push_back(Measure("UpdateTransformsDeepParallel", mode, count, iterations, [&](BenchWorld& w)
+	{
+		deep(w);
+		w.SceneGraph.SetParallelUpdate(true);
+	}, [](BenchWorld& w)
+	{
+		w.SceneGraph.UpdateTransforms();
+	}));
+
+	// Nothing moved since the last update, should cost next to nothing
+	outResults.push_back(Measure("UpdateTransformsStatic", mode, count, iterations, [&](BenchWorld& w)
+	{
+		deep(w);
+		w.SceneGraph.UpdateTransforms();
+	}, [](BenchWorld& w)
+	{
+		w.SceneGraph.UpdateTransforms();
+	}));
+
+	// One percent of the nodes moved, each with its subtree
+	outResults.push_back(Measure("UpdateTransformsSparse", mode, count, iterations, [&](BenchWorld& w)
+	{
+		deep(w);
+		w.SceneGraph.UpdateTransforms();
+		for (size_t i = 0; i < w.Created.size(); i += 100)
+		{
+			w.Entities->SetPosition(w.Created[i], XMFLOAT3(0.f, 1.f, 0.f));
+		}
+	}, [](BenchWorld& w)
+	{
+		w.SceneGraph.UpdateTransforms();
+	}));
+}
+
+//! Camera 50 units behind the populated grid looking at it, sees roughly a quarter of it
+static Frustum BenchFrustum()
+{
+	XMFLOAT4X4 viewProjection;
+	auto view = XMMatrixLookAtLH(XMVectorSet(25.f, 25.f, -50.f, 1.f), XMVectorSet(25.f, 25.f, 0.f, 1.f), XMVectorSet(0.f, 1.f, 0.f, 0.f));
+	XMStoreFloat4x4(&viewProjection, view * XMMatrixPerspectiveFovLH(0.8f, 1.f, 0.1f, 1000.f));
+	return Frustum::FromViewProjection(viewProjection);
+}
+
+static void AddCullBoxes(BenchWorld& w, CullBoxList& boxes)
+{
+	const BoundingOrientedBox unitBox(XMFLOAT3(0.f, 0.f, 0.f), XMFLOAT3(0.5f, 0.5f, 0.5f), XMFLOAT4(0.f, 0.f, 0.f, 1.f));
+	boxes.Clear();
+	boxes.Reserve(w.Created.size());
+	for (auto e : w.Created)
+	{
+		boxes.Add(unitBox, w.Entities->GetTransformMatrix(e));
+	}
+}
+
+static void RunCullingBenchmarks(ComponentStorageMode mode, size_t count, uint32_t iterations, std::vector<BenchmarkResult>& outResults)
+{
+	auto flat = [count](BenchWorld& w)
+	{
+		w.Populate(count, false);
+		w.SceneGraph.UpdateTransforms();
+	};
+	CullBoxList boxes;
+	std::vector<uint32_t> visible;
+
+	// Mesh bounds to world space boxes, done every frame before culling
+	outResults.push_back(Measure("CullBoxesBuild", mode, count, iterations, flat, [&](BenchWorld& w)
+	{
+		AddCullBoxes(w, boxes);
+	}));
+
+	auto frustum = BenchFrustum();
+	outResults.push_back(Measure("CullBoxesFrustum", mode, count, iterations, [&](BenchWorld& w)
+	{
+		flat(w);
+		AddCullBoxes(w, boxes);
+	}, [&](BenchWorld& w)
+	{
+		CullBoxes(frustum, boxes, visible);
+		sink = (float)visible.size();
+	}));
+}
+
+int main(int argc, char** argv)
+{
+	const char* outputFile = argc > 1 ? argv[1] : "ecs_benchmark.json";
+	uint32_t iterations = argc > 2 ? (uint32_t)std::stoul(argv[2]) : 5u;
+
+	std::vector<BenchmarkResult> results;
+	const ComponentStorageMode modes[] = { StorageModePerComponent, StorageModeArchetype };
+	for (auto mode : modes)
+	{
+		for (auto count : EntityCounts)
+		{
+			RunBenchmarks(mode, count, iterations, results);
+			if (mode == StorageModePerComponent) //Culling does not touch component storage
+				RunCullingBenchmarks(mode, count, iterations, results);
+		}
+	}
+
+#ifdef _DEBUG
+	std::string configuration = "Debug";
+#else
+	std::string configuration = "Release";
+#endif
+	uint32_t hardwareThreads = std::thread::hardware_concurrency();
+
+	std::ofstream file(outputFile);
+	{
+		cereal::JSONOutputArchive archive(file);
+		archive(
+			cereal::make_nvp("Configuration", configuration),
+			cereal::make_nvp("HardwareThreads", hardwareThreads),
+			cereal::make_nvp("Iterations", iterations),
+			cereal::make_nvp("Results", results)
+		);
+	}
+	std::cerr << "Wrote " << results.size() << " results to " << outputFile << std::endl;
+	return 0;
+}
@@ -1,3 +1,43 @@
 #include "stdafx.h"
 #include "Component.h"
+#include <mutex>
 
+// Id 0 is reserved for AnyComponentType
+static std::unordered_map<size_t, TypeID>& GetTypeIDMap()
+{
+	static std::unordered_map<size_t, TypeID> typeIds;
+	return typeIds;
+}
+
+static std::mutex typeIdLock;
+
+TypeID ComponentTypeRegistry::GetID(size_t typeHash)
+{
+	std::lock_guard<std::mutex> lock(typeIdLock);
+	auto& typeIds = GetTypeIDMap();
+	auto it = typeIds.find(typeHash);
+	if (it != typeIds.end())
+		return it->second;
+
+	TypeID id = (TypeID)typeIds.size() + 1;
+	typeIds.insert(std::pair<size_t, TypeID>(typeHash, id));
+	return id;
+}
+
+TypeID ComponentTypeRegistry::Count()
+{
+	std::lock_guard<std::mutex> lock(typeIdLock);
+	return (TypeID)GetTypeIDMap().size() + 1;
+}
+
+static std::atomic<uint32_t> currentChangeVersion(1); // 0 means never seen, so new systems see everything as changed
+
+uint32_t ChangeVersion::Current()
+{
+	return currentChangeVersion.load(std::memory_order_relaxed);
+}
+
+uint32_t ChangeVersion::Advance()
+{
+	return currentChangeVersion.fetch_add(1);
+}
@@ -1,7 +1,12 @@
 #pragma once
 #include <vector>
+#include <algorithm>
+#include <cassert>
 #include <unordered_map>
 #include "SceneCommon.h"
+#include "Archetype.h"
+#include "SparseSet.h"
+#include "ThreadPool.h"
 #include <cereal/types/complex.hpp>
 #include <cereal/types/common.hpp>
 #include <cereal/types/vector.hpp>
@@ -19,7 +24,9 @@ struct IComponentData
 class IComponent
 {
 public:
+	//! Mutable access, marks the component changed
 	virtual IComponentData* GetComponentData(EntityID entity) = 0;
+	virtual bool Has(EntityID entity) const = 0;
 	virtual void GetEntities(std::vector<EntityID>& outEntities) = 0;
 	virtual void Serialize(cereal::JSONOutputArchive& archive) {};
 	virtual void Serialize(cereal::JSONOutputArchive& archive, EntityID entity) {};
@@ -29,6 +36,16 @@ public:
 	virtual void AddEntity(EntityID entity, IComponentData* data = nullptr) = 0;
 	virtual void RemoveEntity(EntityID entity) = 0;
 	virtual const char* GetComponentName() = 0;
+
+	//Change tracking, versions come from ChangeVersion
+	virtual void MarkChanged(EntityID entity) = 0;
+	virtual uint32_t GetChangeVersion(EntityID entity) = 0;
+	virtual uint32_t GetAddedVersion(EntityID entity) = 0;
+	//! Highest change version in the container, lets filters skip a whole type
+	virtual uint32_t GetColumnVersion() = 0;
+	//! Appends the entities whose data moved to another slot since the last call, so pointers to them can be
+	//! fetched again. Returns false when the whole array moved instead and every pointer into it is stale.
+	virtual bool TakeMovedEntities(std::vector<EntityID>& outEntities) { return true; }
 	virtual ~IComponent() {};
 };
 
@@ -36,17 +53,47 @@ template<typename T>
 class Component : public IComponent
 {
 	std::vector<EntityID> removeList;
+	std::atomic<uint32_t> columnVersion;
+	std::vector<EntityID> movedEntities; //Took a removed entity's slot since TakeMovedEntities
+	bool relocated; //Components reallocated or reloaded since TakeMovedEntities
+
+	inline void Stamp(uint32_t index, uint32_t version)
+	{
+		ChangeVersions[index] = version;
+		ChangeVersion::Raise(columnVersion, version);
+	}
 public:
 	Component();
 	void AddEntity(EntityID id, const T& componentData);
 	void GetData(EntityID* entities, size_t count, T*& outComponentData);
+	//! Mutable access, marks the component changed
 	T&	 GetData(EntityID id);
+	//! Read only access, does not touch change versions
+	inline const T& ReadData(EntityID id) const { return Components[EntityComponentMap.Find(id)]; }
+	//! Returns nullptr if the entity has no component, does not touch change versions
+	inline T* Find(EntityID id)
+	{
+		auto cId = EntityComponentMap.Find(id);
+		return cId == SparseEntityIndex::InvalidIndex ? nullptr : &Components[cId];
+	}
+	void MarkAllChanged();
+	void Reserve(size_t count);
 
 	~Component();
 
+	virtual bool Has(EntityID id) const override { return EntityComponentMap.Find(id) != SparseEntityIndex::InvalidIndex; }
+	inline size_t Count() const { return Components.size(); }
+
+	//! Calls callback(entity, component&) over the dense arrays in cache line aligned batches on the thread pool
+	template<typename FuncType>
+	void ForEachParallel(FuncType callback, size_t batchSize = 0);
+
+	//Dense arrays, Entities[i] owns Components[i]
 	std::vector<T> Components;
 	std::vector<EntityID> Entities;
-	std::unordered_map<EntityID, size_t> EntityComponentMap;
+	std::vector<uint32_t> ChangeVersions;
+	std::vector<uint32_t> AddedVersions;
+	SparseEntityIndex EntityComponentMap;
 
 	// Inherited via IComponent
 	virtual void GetEntities(std::vector<EntityID>& outEntities) override;
@@ -58,7 +105,7 @@ public:
 
 	virtual void Serialize(cereal::JSONOutputArchive& archive, EntityID entity) override
 	{
-		auto compId = EntityComponentMap[entity];
+		auto compId = EntityComponentMap.Find(entity);
 		auto comp = Components[compId];
 		archive(cereal::make_nvp(GetComponentName(), comp));
 	}
@@ -75,13 +122,16 @@ public:
 		try
 		{
 			archive(cereal::make_nvp(GetComponentName(), *this));
-			size_t compIndex = 0;
-			for (auto entity : Entities)
+			relocated = true;
+			EntityComponentMap.Clear();
+			for (size_t compIndex = 0; compIndex < Entities.size(); ++compIndex)
 			{
-				if (EntityComponentMap.find(entity) == EntityComponentMap.end())
-					EntityComponentMap.insert(std::pair<EntityID, size_t>(entity, compIndex));
-				compIndex++;
+				EntityComponentMap.Set(Entities[compIndex], (uint32_t)compIndex);
 			}
+			auto version = ChangeVersion::Current();
+			ChangeVersions.assign(Entities.size(), version);
+			AddedVersions.assign(Entities.size(), version);
+			ChangeVersion::Raise(columnVersion, version);
 		}
 		catch (...)
 		{
@@ -106,7 +156,7 @@ public:
 
 	virtual size_t GetHash() override
 	{
-		return typeid(T).hash_code();
+		return ComponentType<T>::ID();
 	}
 
 	virtual void AddEntity(EntityID entity, IComponentData* data = nullptr) override
@@ -127,42 +177,117 @@ public:
 
 	virtual IComponentData* GetComponentData(EntityID entity) override
 	{
-		if (EntityComponentMap.find(entity) == EntityComponentMap.end())
+		auto cId = EntityComponentMap.Find(entity);
+		if (cId == SparseEntityIndex::InvalidIndex)
 		{
 			return nullptr;
 		}
 
-		auto cId = EntityComponentMap[entity];
+		Stamp(cId, ChangeVersion::Current());
 		auto component = (IComponentData*)&Components[cId];
 		return component;
 	}
 
+	virtual void MarkChanged(EntityID entity) override
+	{
+		auto cId = EntityComponentMap.Find(entity);
+		if (cId != SparseEntityIndex::InvalidIndex)
+			Stamp(cId, ChangeVersion::Current());
+	}
+
+	virtual uint32_t GetChangeVersion(EntityID entity) override
+	{
+		auto cId = EntityComponentMap.Find(entity);
+		return cId == SparseEntityIndex::InvalidIndex ? 0 : ChangeVersions[cId];
+	}
+
+	virtual uint32_t GetAddedVersion(EntityID entity) override
+	{
+		auto cId = EntityComponentMap.Find(entity);
+		return cId == SparseEntityIndex::InvalidIndex ? 0 : AddedVersions[cId];
+	}
+
+	virtual uint32_t GetColumnVersion() override
+	{
+		return columnVersion.load(std::memory_order_relaxed);
+	}
+
+	virtual bool TakeMovedEntities(std::vector<EntityID>& outEntities) override
+	{
+		outEntities.insert(outEntities.end(), movedEntities.begin(), movedEntities.end());
+		movedEntities.clear();
+		bool kept = !relocated;
+		relocated = false;
+		return kept;
+	}
+
 	// Inherited via IComponent
+	// Swap and pop, the last component takes the removed slot so removal stays O(1)
 	virtual void RemoveEntity(EntityID entity) override
 	{
-		if (EntityComponentMap.find(entity) == EntityComponentMap.end())
+		auto index = EntityComponentMap.Find(entity);
+		if (index == SparseEntityIndex::InvalidIndex)
 			return;
-		auto index = EntityComponentMap[entity];
-		Components.erase(Components.begin() + index);
-		Entities.erase(Entities.begin() + index);
-		EntityComponentMap.erase(entity);
 
-		index = 0;
-		for (auto e : Entities)// Need to update the entity component map.
+		auto last = (uint32_t)Components.size() - 1;
+		if (index != last)
 		{
-			EntityComponentMap[e] = index;
-			index++;
+			Components[index] = std::move(Components[last]);
+			Entities[index] = Entities[last];
+			ChangeVersions[index] = ChangeVersions[last];
+			AddedVersions[index] = AddedVersions[last];
+			EntityComponentMap.Set(Entities[index], index);
+			movedEntities.push_back(Entities[index]);
 		}
+		Components.pop_back();
+		Entities.pop_back();
+		ChangeVersions.pop_back();
+		AddedVersions.pop_back();
+		EntityComponentMap.Erase(entity);
 	}
 };
 
 template<typename T>
 inline void Component<T>::AddEntity(EntityID id, const T & componentData)
 {
-	auto cId = Components.size();
+	auto version = ChangeVersion::Current();
+	auto cId = EntityComponentMap.Find(id);
+	if (cId != SparseEntityIndex::InvalidIndex) //Already attached, overwrite the data
+	{
+		Components[cId] = componentData;
+		Stamp(cId, version);
+		return;
+	}
+
+	cId = (uint32_t)Components.size();
+	auto data = Components.data();
 	Entities.push_back(id);
 	Components.push_back(componentData);
-	EntityComponentMap.insert(std::pair<EntityID, size_t>(id, cId));
+	relocated = relocated || Components.data() != data;
+	ChangeVersions.push_back(version);
+	AddedVersions.push_back(version);
+	ChangeVersion::Raise(columnVersion, version);
+	EntityComponentMap.Set(id, cId);
+}
+
+template<typename T>
+template<typename FuncType>
+inline void Component<T>::ForEachParallel(FuncType callback, size_t batchSize)
+{
+	if (batchSize == 0)
+		batchSize = ThreadPool::GetBatchSize(Components.size(), sizeof(T));
+
+	auto version = ChangeVersion::Current();
+	ThreadPool::ParallelFor(Components.size(), batchSize, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			ChangeVersions[i] = version;
+			callback(Entities[i], Components[i]);
+		}
+	});
+	if (!Components.empty())
+		ChangeVersion::Raise(columnVersion, version);
 }
 
 template<typename T>
@@ -174,10 +299,32 @@ inline void Component<T>::GetData(EntityID * entities, size_t count, T *& outCom
 template<typename T>
 inline T & Component<T>::GetData(EntityID id)
 {
-	auto cId = EntityComponentMap[id];
+	auto cId = EntityComponentMap.Find(id);
+	assert(cId != SparseEntityIndex::InvalidIndex && "Entity has no component of this type, use Find");
+	Stamp(cId, ChangeVersion::Current());
 	return Components[cId];
 }
 
+template<typename T>
+inline void Component<T>::Reserve(size_t count)
+{
+	auto data = Components.data();
+	Components.reserve(count);
+	relocated = relocated || Components.data() != data;
+	Entities.reserve(count);
+	ChangeVersions.reserve(count);
+	AddedVersions.reserve(count);
+}
+
+template<typename T>
+inline void Component<T>::MarkAllChanged()
+{
+	auto version = ChangeVersion::Current();
+	std::fill(ChangeVersions.begin(), ChangeVersions.end(), version);
+	if (!ChangeVersions.empty())
+		ChangeVersion::Raise(columnVersion, version);
+}
+
 //template<typename T>
 //void Component<T>::RemoveEntity(EntityID id)
 //{
@@ -188,16 +335,20 @@ inline T & Component<T>::GetData(EntityID id)
 //}
 
 template<typename T>
-Component<T>::Component()
+Component<T>::Component() :
+	columnVersion(0),
+	relocated(false)
 {
 }
 
 template<typename T>
 Component<T>::~Component()
 {
-	EntityComponentMap.clear();
+	EntityComponentMap.Clear();
 	Components.clear();
 	Entities.clear();
+	ChangeVersions.clear();
+	AddedVersions.clear();
 }
 
 template<typename T>
@@ -206,4 +357,108 @@ inline void Component<T>::GetEntities(std::vector<EntityID>& outEntities)
 	outEntities = Entities;
 }
 
+//! IComponent view over archetype storage. Used by EntityManager when running in archetype storage mode
+//! so name based access and serialization keep working.
+template<typename T>
+class ArchetypeComponent : public IComponent
+{
+	ArchetypeStorage*	storage;
+	ComponentTypeInfo	typeInfo;
+public:
+	ArchetypeComponent(ArchetypeStorage* storage) :
+		storage(storage),
+		typeInfo(ComponentTypeInfo::Create<T>())
+	{
+	}
+
+	virtual IComponentData* GetComponentData(EntityID entity) override
+	{
+		storage->MarkChanged(entity, typeInfo.Type);
+		return (IComponentData*)storage->Get<T>(entity);
+	}
+
+	virtual bool Has(EntityID entity) const override
+	{
+		return storage->Has(entity, typeInfo.Type);
+	}
 
+	virtual void MarkChanged(EntityID entity) override
+	{
+		storage->MarkChanged(entity, typeInfo.Type);
+	}
+
+	virtual uint32_t GetChangeVersion(EntityID entity) override
+	{
+		return storage->GetChangeVersion(entity, typeInfo.Type);
+	}
+
+	virtual uint32_t GetAddedVersion(EntityID entity) override
+	{
+		return storage->GetAddedVersion(entity, typeInfo.Type);
+	}
+
+	virtual uint32_t GetColumnVersion() override
+	{
+		return storage->GetColumnVersion(typeInfo.Type);
+	}
+
+	virtual void GetEntities(std::vector<EntityID>& outEntities) override
+	{
+		outEntities.clear();
+		storage->GetEntities(typeInfo.Type, outEntities);
+	}
+
+	virtual void Serialize(cereal::JSONOutputArchive& archive) override
+	{
+		Component<T> container; //Same layout as the per component container
+		GetEntities(container.Entities);
+		for (auto e : container.Entities)
+		{
+			container.Components.push_back(*storage->Get<T>(e));
+		}
+		archive(cereal::make_nvp(GetComponentName(), container));
+	}
+
+	virtual void Serialize(cereal::JSONOutputArchive& archive, EntityID entity) override
+	{
+		auto comp = *storage->Get<T>(entity);
+		archive(cereal::make_nvp(GetComponentName(), comp));
+	}
+
+	virtual void Deserialize(cereal::JSONInputArchive& archive, EntityID entity) override
+	{
+		T comp;
+		archive(cereal::make_nvp(GetComponentName(), comp));
+		storage->Add<T>(entity, comp);
+	}
+
+	virtual void Deserialize(cereal::JSONInputArchive& archive) override
+	{
+		Component<T> container;
+		container.Deserialize(archive);
+		for (size_t i = 0; i < container.Entities.size(); ++i)
+		{
+			storage->Add<T>(container.Entities[i], container.Components[i]);
+		}
+	}
+
+	virtual size_t GetHash() override
+	{
+		return typeInfo.Type;
+	}
+
+	virtual void AddEntity(EntityID entity, IComponentData* data = nullptr) override
+	{
+		storage->Add(entity, typeInfo, data == nullptr ? nullptr : (T*)data);
+	}
+
+	virtual void RemoveEntity(EntityID entity) override
+	{
+		storage->Remove(entity, typeInfo.Type);
+	}
+
+	virtual const char* GetComponentName() override
+	{
+		return T::GetName();
+	}
+};
@@ -1,20 +1,47 @@
 #include "stdafx.h"
 #include "ComponentFactory.h"
+#ifndef ENGINE_HEADLESS
 #include "AnimationComponent.h"
+#endif
 
 
 ComponentFactory cf;
-std::unordered_map<HashID, FactoryFunction> ComponentFactory::factoryMap;
-std::unordered_map<HashID, TypeID> ComponentFactory::typeMap;
+
+std::unordered_map<HashID, FactoryFunction>& ComponentFactory::FactoryMap()
+{
+	static std::unordered_map<HashID, FactoryFunction> factoryMap;
+	return factoryMap;
+}
+
+std::unordered_map<HashID, ArchetypeFactoryFunction>& ComponentFactory::ArchetypeFactoryMap()
+{
+	static std::unordered_map<HashID, ArchetypeFactoryFunction> archetypeFactoryMap;
+	return archetypeFactoryMap;
+}
+
+std::unordered_map<HashID, TypeID>& ComponentFactory::GetTypeMap()
+{
+	static std::unordered_map<HashID, TypeID> typeMap;
+	return typeMap;
+}
 
 void ComponentFactory::RegisterComponentContainer(HashID componentId, FactoryFunction function)
 {
+	auto& factoryMap = FactoryMap();
 	if (factoryMap.find(componentId) == factoryMap.end())
 		factoryMap.insert(std::pair<HashID, FactoryFunction>(componentId, function));
 }
 
+void ComponentFactory::RegisterArchetypeContainer(HashID componentId, ArchetypeFactoryFunction function)
+{
+	auto& archetypeFactoryMap = ArchetypeFactoryMap();
+	if (archetypeFactoryMap.find(componentId) == archetypeFactoryMap.end())
+		archetypeFactoryMap.insert(std::pair<HashID, ArchetypeFactoryFunction>(componentId, function));
+}
+
 void ComponentFactory::RegisterComponentTypeID(HashID componentId, TypeID typeId)
 {
+	auto& typeMap = GetTypeMap();
 	if (typeMap.find(componentId) == typeMap.end())
 	{
 		typeMap.insert(std::pair<HashID, TypeID>(componentId, typeId));
@@ -23,14 +50,29 @@ void ComponentFactory::RegisterComponentTypeID(HashID componentId, TypeID typeId
 
 IComponent * ComponentFactory::Create(HashID componentId)
 {
-	return factoryMap[componentId]();
+	auto& factoryMap = FactoryMap();
+	auto it = factoryMap.find(componentId);
+	assert(it != factoryMap.end() && "Component was never registered");
+	return it != factoryMap.end() ? it->second() : nullptr;
+}
+
+IComponent * ComponentFactory::Create(HashID componentId, ArchetypeStorage * storage)
+{
+	auto& archetypeFactoryMap = ArchetypeFactoryMap();
+	auto it = archetypeFactoryMap.find(componentId);
+	assert(it != archetypeFactoryMap.end() && "Component was never registered");
+	return it != archetypeFactoryMap.end() ? it->second(storage) : nullptr;
 }
 
 TypeID ComponentFactory::GetTypeID(HashID componentId)
 {
-	return typeMap[componentId];
+	auto& typeMap = GetTypeMap();
+	auto it = typeMap.find(componentId);
+	return it != typeMap.end() ? it->second : 0;
 }
 
+#ifndef ENGINE_HEADLESS
 #include "../Engine.Components/Components.inl"
 RegisterComponent(AnimationComponent)
-RegisterComponent(AnimationBufferComponent)
\ No newline at end of file
+RegisterComponent(AnimationBufferComponent)
+#endif
\ No newline at end of file
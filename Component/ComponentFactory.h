@@ -4,15 +4,21 @@
 
 
 typedef std::function<IComponent*()> FactoryFunction;
+typedef std::function<IComponent*(ArchetypeStorage*)> ArchetypeFactoryFunction;
 class ComponentFactory
 {
-	static std::unordered_map<HashID, FactoryFunction> factoryMap;
-	static std::unordered_map<HashID, TypeID> typeMap;
+	//Components register from static initializers in any translation unit, so the maps are built on first use
+	static std::unordered_map<HashID, FactoryFunction>& FactoryMap();
+	static std::unordered_map<HashID, ArchetypeFactoryFunction>& ArchetypeFactoryMap();
 public:
 	static void RegisterComponentContainer(HashID componentId, FactoryFunction function);
+	static void RegisterArchetypeContainer(HashID componentId, ArchetypeFactoryFunction function);
 	static void RegisterComponentTypeID(HashID componentId, TypeID typeId);
-	static std::unordered_map<HashID, TypeID>& GetTypeMap() { return typeMap; }
+	static std::unordered_map<HashID, TypeID>& GetTypeMap();
+	//! nullptr for components that were never registered
 	static IComponent* Create(HashID componentId);
+	static IComponent* Create(HashID componentId, ArchetypeStorage* storage);
+	//! 0 for components that were never registered, no container has that id
 	static TypeID GetTypeID(HashID componentId);
 };
 
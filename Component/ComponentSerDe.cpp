@@ -4,29 +4,35 @@
 #include "Component.h"
 
 
-void ComponentSerDe::Save(std::unordered_map<TypeID, IComponent*>& components, std::string filename)
+void ComponentSerDe::Save(std::vector<IComponent*>& components, std::string filename)
 {
 	std::ofstream os(filename.c_str());
 	cereal::JSONOutputArchive archive(os);
 	
-	for (auto& component : components)
+	for (auto component : components)
 	{
-		component.second->Serialize(archive);
+		if (component != nullptr)
+			component->Serialize(archive);
 	}
 }
 
-void ComponentSerDe::Load(std::unordered_map<TypeID, IComponent*>& components, std::string filename)
+void ComponentSerDe::Load(std::vector<IComponent*>& components, std::string filename)
 {
 	std::ifstream is(filename.c_str());
 	cereal::JSONInputArchive archive(is);
 	auto& typeMap = ComponentFactory::GetTypeMap();
 	for (auto type : typeMap)
 	{
-		if (components.find(type.second) == components.end())
+		if (type.second >= components.size())
+		{
+			components.resize(type.second + 1, nullptr);
+		}
+
+		if (components[type.second] == nullptr)
 		{
 			auto component = ComponentFactory::Create(type.first);
 			component->Deserialize(archive);
-			components.insert(std::pair<TypeID, IComponent*>(type.second, component));
+			components[type.second] = component;
 		}
 		else 
 		{
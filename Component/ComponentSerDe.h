@@ -8,8 +8,8 @@
 class ComponentSerDe
 {
 public:
-	static void Save(std::unordered_map<TypeID, IComponent*>& components, std::string filename);
-	static void Load(std::unordered_map<TypeID, IComponent*>& components, std::string filename);
+	static void Save(std::vector<IComponent*>& components, std::string filename);
+	static void Load(std::vector<IComponent*>& components, std::string filename);
 	ComponentSerDe();
 	~ComponentSerDe();
 };
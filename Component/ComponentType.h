@@ -0,0 +1,40 @@
+#pragma once
+#include <typeinfo>
+#include <atomic>
+#include "SceneCommon.h"
+
+//! Hands out small sequential ids for component types so containers can live in a flat array.
+//! Ids are keyed by typeid hash in one registry, so every module sees the same id for a type.
+class ComponentTypeRegistry
+{
+public:
+	static TypeID GetID(size_t typeHash);
+	static TypeID Count();
+};
+
+template<typename T>
+struct ComponentType
+{
+	//! Resolved once per type, afterwards a single static load
+	static inline TypeID ID()
+	{
+		static const TypeID id = ComponentTypeRegistry::GetID(typeid(T).hash_code());
+		return id;
+	}
+};
+
+//! Global write version. Mutable component access stamps data with the current value, systems keep the value
+//! returned by Advance after they run and pass it to Changed<T>/Added<T> query filters on their next run.
+class ChangeVersion
+{
+public:
+	static uint32_t Current();
+	//! Returns the version in use until now and moves later writes to a newer one
+	static uint32_t Advance();
+	//! Raises version to value if it is lower, safe when several threads stamp the same chunk or column
+	static inline void Raise(std::atomic<uint32_t>& version, uint32_t value)
+	{
+		auto current = version.load(std::memory_order_relaxed);
+		while (current < value && !version.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+	}
+};
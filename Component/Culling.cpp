@@ -0,0 +1,221 @@
+#include "stdafx.h"
+#include "Culling.h"
+#include "MathHelper.h"
+#include "SimdLanes.h"
+
+static const size_t CullBoxPadding = 8; //Widest batch
+
+Frustum Frustum::FromViewProjection(const XMFLOAT4X4 & m)
+{
+	// Clip space x, y and z are dot products of the point with the matrix columns, w with the last one
+	XMVECTOR columns[4];
+	for (int i = 0; i < 4; ++i)
+	{
+		columns[i] = XMVectorSet(m.m[0][i], m.m[1][i], m.m[2][i], m.m[3][i]);
+	}
+	const XMVECTOR planes[FrustumPlaneCount] =
+	{
+		columns[3] + columns[0], //-w <= x
+		columns[3] - columns[0], //x <= w
+		columns[3] + columns[1],
+		columns[3] - columns[1],
+		columns[2], //0 <= z
+		columns[3] - columns[2] //z <= w
+	};
+
+	Frustum frustum;
+	for (uint32_t i = 0; i < FrustumPlaneCount; ++i)
+	{
+		XMStoreFloat4(&frustum.Planes[i], XMPlaneNormalize(planes[i]));
+	}
+	return frustum;
+}
+
+void Frustum::RemoveNearPlane()
+{
+	Planes[FrustumNearPlane] = XMFLOAT4(0.f, 0.f, 0.f, 1.f); //Every point is in front of it
+}
+
+CullBoxList::CullBoxList() :
+	count(0)
+{
+}
+
+void CullBoxList::Append(FXMVECTOR center, FXMVECTOR axis0, FXMVECTOR axis1, GXMVECTOR axis2)
+{
+	if (count % CullBoxPadding == 0)
+	{
+		for (auto& component : components)
+		{
+			component.resize(count + CullBoxPadding, 0.f);
+		}
+	}
+
+	XMFLOAT3 values[4];
+	XMStoreFloat3(&values[0], center);
+	XMStoreFloat3(&values[1], axis0);
+	XMStoreFloat3(&values[2], axis1);
+	XMStoreFloat3(&values[3], axis2);
+	for (int i = 0; i < 4; ++i)
+	{
+		components[i * 3][count] = values[i].x;
+		components[i * 3 + 1][count] = values[i].y;
+		components[i * 3 + 2][count] = values[i].z;
+	}
+	count++;
+}
+
+void CullBoxList::Add(const BoundingOrientedBox & localBox, const XMFLOAT4X4 & world)
+{
+	auto worldMatrix = XMLoadFloat4x4(&world);
+	auto rotation = XMMatrixRotationQuaternion(XMLoadFloat4(&localBox.Orientation));
+	auto center = XMVector3Transform(XMLoadFloat3(&localBox.Center), worldMatrix);
+	Append(center,
+		XMVector3TransformNormal(rotation.r[0] * localBox.Extents.x, worldMatrix),
+		XMVector3TransformNormal(rotation.r[1] * localBox.Extents.y, worldMatrix),
+		XMVector3TransformNormal(rotation.r[2] * localBox.Extents.z, worldMatrix));
+}
+
+void CullBoxList::Add(const BoundingBox & worldBox)
+{
+	Append(XMLoadFloat3(&worldBox.Center),
+		XMVectorSet(worldBox.Extents.x, 0.f, 0.f, 0.f),
+		XMVectorSet(0.f, worldBox.Extents.y, 0.f, 0.f),
+		XMVectorSet(0.f, 0.f, worldBox.Extents.z, 0.f));
+}
+
+void CullBoxList::Clear()
+{
+	for (auto& component : components)
+	{
+		component.clear();
+	}
+	count = 0;
+}
+
+void CullBoxList::Reserve(size_t boxCount)
+{
+	for (auto& component : components)
+	{
+		component.reserve(boxCount + CullBoxPadding);
+	}
+}
+
+//! Runs outside(box) on batches of L::Width boxes, outside returns a comparison mask of the boxes to drop
+template<typename L, typename TestType>
+SIMD_KERNEL_INLINE static inline void CullBatches(const CullBoxList& boxes, TestType outside, std::vector<uint32_t>& outVisible)
+{
+	typedef typename L::Vec Vec;
+	const float* components[CullBoxComponentCount];
+	for (int i = 0; i < CullBoxComponentCount; ++i)
+	{
+		components[i] = boxes.GetComponent((CullBoxComponent)i);
+	}
+
+	auto count = boxes.Size();
+	for (size_t begin = 0; begin < count; begin += L::Width)
+	{
+		Vec box[CullBoxComponentCount];
+		for (int i = 0; i < CullBoxComponentCount; ++i)
+		{
+			box[i] = L::Load(components[i] + begin);
+		}
+
+		auto lanes = count - begin < (size_t)L::Width ? count - begin : (size_t)L::Width;
+		auto visible = ~L::Mask(outside(box)) & ((1u << lanes) - 1u);
+		for (uint32_t i = 0; visible != 0; ++i, visible >>= 1)
+		{
+			if (visible & 1u)
+				outVisible.push_back((uint32_t)begin + i);
+		}
+	}
+	L::Finish();
+}
+
+template<typename L>
+SIMD_KERNEL_INLINE static inline void CullAll(const Frustum& frustum, const CullBoxList& boxes, std::vector<uint32_t>& outVisible)
+{
+	typedef typename L::Vec Vec;
+	auto zero = L::Set1(0.f);
+	CullBatches<L>(boxes, [&](const Vec* box) SIMD_KERNEL_INLINE
+	{
+		// Outside once the whole box is behind one plane, the box reaches sum |n . axis| past its center
+		auto outside = L::Less(zero, zero);
+		for (auto& plane : frustum.Planes)
+		{
+			auto nx = L::Set1(plane.x);
+			auto ny = L::Set1(plane.y);
+			auto nz = L::Set1(plane.z);
+			auto distance = L::Add(L::Add(L::Mul(nx, box[CullBoxCenterX]), L::Mul(ny, box[CullBoxCenterY])), L::Add(L::Mul(nz, box[CullBoxCenterZ]), L::Set1(plane.w)));
+			auto radius = L::Abs(L::Add(L::Add(L::Mul(nx, box[CullBoxAxis0X]), L::Mul(ny, box[CullBoxAxis0Y])), L::Mul(nz, box[CullBoxAxis0Z])));
+			radius = L::Add(radius, L::Abs(L::Add(L::Add(L::Mul(nx, box[CullBoxAxis1X]), L::Mul(ny, box[CullBoxAxis1Y])), L::Mul(nz, box[CullBoxAxis1Z]))));
+			radius = L::Add(radius, L::Abs(L::Add(L::Add(L::Mul(nx, box[CullBoxAxis2X]), L::Mul(ny, box[CullBoxAxis2Y])), L::Mul(nz, box[CullBoxAxis2Z]))));
+			outside = L::Or(outside, L::Less(L::Add(distance, radius), zero));
+		}
+		return outside;
+	}, outVisible);
+}
+
+template<typename L>
+SIMD_KERNEL_INLINE static inline void CullAllSphere(const BoundingSphere& sphere, const CullBoxList& boxes, std::vector<uint32_t>& outVisible)
+{
+	typedef typename L::Vec Vec;
+	auto zero = L::Set1(0.f);
+	const Vec center[3] = { L::Set1(sphere.Center.x), L::Set1(sphere.Center.y), L::Set1(sphere.Center.z) };
+	auto radiusSq = L::Set1(sphere.Radius * sphere.Radius);
+	CullBatches<L>(boxes, [&](const Vec* box) SIMD_KERNEL_INLINE
+	{
+		// Distance from the sphere center to the axis aligned box around each box, which reaches
+		// sum |axis.x| past its center along x
+		auto distanceSq = zero;
+		for (int i = 0; i < 3; ++i)
+		{
+			auto extent = L::Add(L::Add(L::Abs(box[CullBoxAxis0X + i]), L::Abs(box[CullBoxAxis1X + i])), L::Abs(box[CullBoxAxis2X + i]));
+			auto gap = L::Max(L::Sub(L::Abs(L::Sub(box[CullBoxCenterX + i], center[i])), extent), zero);
+			distanceSq = L::Add(distanceSq, L::Mul(gap, gap));
+		}
+		return L::Less(radiusSq, distanceSq);
+	}, outVisible);
+}
+
+#ifdef SIMD_LANES_AVX2
+SIMD_AVX2_KERNEL static void CullAllAvx2(const Frustum& frustum, const CullBoxList& boxes, std::vector<uint32_t>& outVisible)
+{
+	CullAll<Avx2Lanes>(frustum, boxes, outVisible);
+}
+
+SIMD_AVX2_KERNEL static void CullAllSphereAvx2(const BoundingSphere& sphere, const CullBoxList& boxes, std::vector<uint32_t>& outVisible)
+{
+	CullAllSphere<Avx2Lanes>(sphere, boxes, outVisible);
+}
+#endif
+
+void CullBoxes(const Frustum & frustum, const CullBoxList & boxes, std::vector<uint32_t>& outVisible)
+{
+	outVisible.clear();
+	if (boxes.Size() == 0)
+		return;
+#ifdef SIMD_LANES_AVX2
+	if (boxes.Size() > SseLanes::Width && CpuSupportsAvx2())
+	{
+		CullAllAvx2(frustum, boxes, outVisible);
+		return;
+	}
+#endif
+	CullAll<SseLanes>(frustum, boxes, outVisible);
+}
+
+void CullBoxes(const BoundingSphere & sphere, const CullBoxList & boxes, std::vector<uint32_t>& outVisible)
+{
+	outVisible.clear();
+	if (boxes.Size() == 0)
+		return;
+#ifdef SIMD_LANES_AVX2
+	if (boxes.Size() > SseLanes::Width && CpuSupportsAvx2())
+	{
+		CullAllSphereAvx2(sphere, boxes, outVisible);
+		return;
+	}
+#endif
+	CullAllSphere<SseLanes>(sphere, boxes, outVisible);
+}
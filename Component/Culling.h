@@ -0,0 +1,65 @@
+#pragma once
+#include "stdafx.h"
+#include <vector>
+
+static const uint32_t FrustumPlaneCount = 6;
+static const uint32_t FrustumNearPlane = 4;
+
+//! Convex volume bounded by planes with normals pointing inwards, p is inside when dot(plane.xyz, p) + plane.w >= 0
+//! for every plane
+struct Frustum
+{
+	XMFLOAT4 Planes[FrustumPlaneCount]; //Left, right, bottom, top, near, far
+
+	//! Planes of a row vector view * projection matrix with depth in [0, 1], as built by XMMatrixPerspectiveFovLH
+	//! and XMMatrixOrthographicLH
+	static Frustum FromViewProjection(const XMFLOAT4X4& viewProjection);
+	//! Lets the volume reach infinitely far toward the eye, a shadow frustum then also keeps casters between the
+	//! light and the shadowed area
+	void RemoveNearPlane();
+};
+
+enum CullBoxComponent
+{
+	CullBoxCenterX = 0,
+	CullBoxCenterY,
+	CullBoxCenterZ,
+	CullBoxAxis0X, //Three half axes, the box spans center +- each of them
+	CullBoxAxis0Y,
+	CullBoxAxis0Z,
+	CullBoxAxis1X,
+	CullBoxAxis1Y,
+	CullBoxAxis1Z,
+	CullBoxAxis2X,
+	CullBoxAxis2Y,
+	CullBoxAxis2Z,
+	CullBoxComponentCount
+};
+
+//! World space boxes in structure of arrays layout for the SIMD plane tests. Each box is a center and three half
+//! axes, which also describes a box under non uniform scale or shear exactly. Arrays are padded with empty boxes
+//! to a multiple of 8 so kernels always load whole batches.
+class CullBoxList
+{
+	std::vector<float>	components[CullBoxComponentCount];
+	size_t				count;
+
+	void				Append(FXMVECTOR center, FXMVECTOR axis0, FXMVECTOR axis1, GXMVECTOR axis2);
+public:
+	CullBoxList();
+
+	//! localBox transformed by world
+	void				Add(const BoundingOrientedBox& localBox, const XMFLOAT4X4& world);
+	void				Add(const BoundingBox& worldBox);
+	void				Clear();
+	void				Reserve(size_t boxCount);
+	inline size_t		Size() const { return count; }
+	inline const float*	GetComponent(CullBoxComponent component) const { return components[component].data(); }
+};
+
+//! Fills outVisible with the indices of boxes inside or intersecting the frustum, in ascending order.
+//! Tests 8 boxes at a time with AVX2 when supported, 4 with SSE otherwise. Conservative, a box outside the frustum
+//! but not fully behind any single plane is kept.
+void CullBoxes(const Frustum& frustum, const CullBoxList& boxes, std::vector<uint32_t>& outVisible);
+//! Same for boxes within reach of a sphere, tested with the axis aligned box around each box
+void CullBoxes(const BoundingSphere& sphere, const CullBoxList& boxes, std::vector<uint32_t>& outVisible);
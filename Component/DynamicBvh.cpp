@@ -0,0 +1,354 @@
+#include "stdafx.h"
+#include "DynamicBvh.h"
+
+BvhBounds BvhBounds::FromBox(const BoundingBox & box)
+{
+	auto& c = box.Center;
+	auto& e = box.Extents;
+	return BvhBounds{ XMFLOAT3(c.x - e.x, c.y - e.y, c.z - e.z), XMFLOAT3(c.x + e.x, c.y + e.y, c.z + e.z) };
+}
+
+BvhBounds BvhBounds::FromOrientedBox(const BoundingOrientedBox & localBox, const XMFLOAT4X4 & world)
+{
+	// The world box reaches sum |axis| past the center along each axis, exact under scale and shear
+	auto worldMatrix = XMLoadFloat4x4(&world);
+	auto rotation = XMMatrixRotationQuaternion(XMLoadFloat4(&localBox.Orientation));
+	auto center = XMVector3Transform(XMLoadFloat3(&localBox.Center), worldMatrix);
+	auto extents = XMVectorAbs(XMVector3TransformNormal(rotation.r[0] * localBox.Extents.x, worldMatrix));
+	extents += XMVectorAbs(XMVector3TransformNormal(rotation.r[1] * localBox.Extents.y, worldMatrix));
+	extents += XMVectorAbs(XMVector3TransformNormal(rotation.r[2] * localBox.Extents.z, worldMatrix));
+
+	BvhBounds bounds;
+	XMStoreFloat3(&bounds.Min, center - extents);
+	XMStoreFloat3(&bounds.Max, center + extents);
+	return bounds;
+}
+
+BvhBounds BvhBounds::Merge(const BvhBounds & a, const BvhBounds & b)
+{
+	return BvhBounds
+	{
+		XMFLOAT3(std::min(a.Min.x, b.Min.x), std::min(a.Min.y, b.Min.y), std::min(a.Min.z, b.Min.z)),
+		XMFLOAT3(std::max(a.Max.x, b.Max.x), std::max(a.Max.y, b.Max.y), std::max(a.Max.z, b.Max.z))
+	};
+}
+
+BoundingBox BvhBounds::ToBox() const
+{
+	return BoundingBox(
+		XMFLOAT3((Min.x + Max.x) * 0.5f, (Min.y + Max.y) * 0.5f, (Min.z + Max.z) * 0.5f),
+		XMFLOAT3((Max.x - Min.x) * 0.5f, (Max.y - Min.y) * 0.5f, (Max.z - Min.z) * 0.5f));
+}
+
+bool BvhBounds::Contains(const BvhBounds & other) const
+{
+	return Min.x <= other.Min.x && Min.y <= other.Min.y && Min.z <= other.Min.z &&
+		Max.x >= other.Max.x && Max.y >= other.Max.y && Max.z >= other.Max.z;
+}
+
+bool BvhBounds::Intersects(const BvhBounds & other) const
+{
+	return Min.x <= other.Max.x && Min.y <= other.Max.y && Min.z <= other.Max.z &&
+		Max.x >= other.Min.x && Max.y >= other.Min.y && Max.z >= other.Min.z;
+}
+
+float BvhBounds::Area() const
+{
+	auto x = Max.x - Min.x;
+	auto y = Max.y - Min.y;
+	auto z = Max.z - Min.z;
+	return x * y + y * z + z * x;
+}
+
+DynamicBvh::DynamicBvh(float margin) :
+	root(-1),
+	freeList(-1),
+	leafCount(0),
+	margin(margin)
+{
+}
+
+int32_t DynamicBvh::AllocateNode()
+{
+	int32_t node;
+	if (freeList != -1)
+	{
+		node = freeList;
+		freeList = nodes[node].Parent;
+	}
+	else
+	{
+		node = (int32_t)nodes.size();
+		nodes.push_back(BvhNode());
+	}
+
+	auto& n = nodes[node];
+	n.Parent = -1;
+	n.Children[0] = -1;
+	n.Children[1] = -1;
+	n.Height = 0;
+	n.UserData = 0;
+	return node;
+}
+
+void DynamicBvh::FreeNode(int32_t node)
+{
+	nodes[node].Parent = freeList;
+	nodes[node].Height = -1;
+	freeList = node;
+}
+
+void DynamicBvh::SetChild(int32_t parent, int32_t index, int32_t child)
+{
+	nodes[parent].Children[index] = child;
+	nodes[child].Parent = parent;
+}
+
+void DynamicBvh::UpdateNode(int32_t node)
+{
+	auto& n = nodes[node];
+	auto& first = nodes[n.Children[0]];
+	auto& second = nodes[n.Children[1]];
+	n.Bounds = BvhBounds::Merge(first.Bounds, second.Bounds);
+	n.Height = 1 + std::max(first.Height, second.Height);
+}
+
+BvhProxyID DynamicBvh::Insert(const BvhBounds & bounds, uint32_t userData)
+{
+	auto leaf = AllocateNode();
+	auto& n = nodes[leaf];
+	n.Bounds = BvhBounds{ XMFLOAT3(bounds.Min.x - margin, bounds.Min.y - margin, bounds.Min.z - margin),
+		XMFLOAT3(bounds.Max.x + margin, bounds.Max.y + margin, bounds.Max.z + margin) };
+	n.UserData = userData;
+	InsertLeaf(leaf);
+	leafCount++;
+	return leaf;
+}
+
+void DynamicBvh::Remove(BvhProxyID proxy)
+{
+	RemoveLeaf(proxy);
+	FreeNode(proxy);
+	leafCount--;
+}
+
+bool DynamicBvh::Move(BvhProxyID proxy, const BvhBounds & bounds)
+{
+	auto& leaf = nodes[proxy];
+	if (leaf.Bounds.Contains(bounds))
+		return false;
+
+	auto fatBounds = BvhBounds{ XMFLOAT3(bounds.Min.x - margin, bounds.Min.y - margin, bounds.Min.z - margin),
+		XMFLOAT3(bounds.Max.x + margin, bounds.Max.y + margin, bounds.Max.z + margin) };
+	if (leaf.Bounds.Intersects(fatBounds) && leaf.Parent != -1)
+	{
+		// Small steps keep the leaf where it is, the rotations in Refit repair the tree around it
+		leaf.Bounds = fatBounds;
+		Refit(leaf.Parent);
+		return true;
+	}
+
+	RemoveLeaf(proxy);
+	nodes[proxy].Bounds = fatBounds;
+	InsertLeaf(proxy);
+	return true;
+}
+
+void DynamicBvh::Clear()
+{
+	nodes.clear();
+	root = -1;
+	freeList = -1;
+	leafCount = 0;
+}
+
+void DynamicBvh::InsertLeaf(int32_t leaf)
+{
+	if (root == -1)
+	{
+		root = leaf;
+		nodes[leaf].Parent = -1;
+		return;
+	}
+
+	// Walk down while a child is a cheaper sibling than the current node. Every node above the new one grows
+	// by the leaf, that growth is charged to both children as the inherited cost.
+	auto leafBounds = nodes[leaf].Bounds;
+	auto sibling = root;
+	while (!nodes[sibling].IsLeaf())
+	{
+		auto& node = nodes[sibling];
+		auto area = node.Bounds.Area();
+		auto combinedArea = BvhBounds::Merge(node.Bounds, leafBounds).Area();
+		auto cost = 2.f * combinedArea; //New parent of node and leaf
+		auto inheritedCost = 2.f * (combinedArea - area);
+
+		float childCosts[2];
+		for (int i = 0; i < 2; ++i)
+		{
+			auto& child = nodes[node.Children[i]];
+			auto merged = BvhBounds::Merge(child.Bounds, leafBounds).Area();
+			childCosts[i] = (child.IsLeaf() ? merged : merged - child.Bounds.Area()) + inheritedCost;
+		}
+
+		if (cost < childCosts[0] && cost < childCosts[1])
+			break;
+		sibling = childCosts[0] <= childCosts[1] ? node.Children[0] : node.Children[1];
+	}
+
+	auto oldParent = nodes[sibling].Parent;
+	auto newParent = AllocateNode();
+	nodes[newParent].Parent = oldParent;
+	SetChild(newParent, 0, sibling);
+	SetChild(newParent, 1, leaf);
+	if (oldParent == -1)
+		root = newParent;
+	else
+		SetChild(oldParent, nodes[oldParent].Children[0] == sibling ? 0 : 1, newParent);
+	Refit(newParent);
+}
+
+void DynamicBvh::RemoveLeaf(int32_t leaf)
+{
+	if (leaf == root)
+	{
+		root = -1;
+		return;
+	}
+
+	auto parent = nodes[leaf].Parent;
+	auto grandParent = nodes[parent].Parent;
+	auto sibling = nodes[parent].Children[0] == leaf ? nodes[parent].Children[1] : nodes[parent].Children[0];
+	FreeNode(parent);
+	if (grandParent == -1)
+	{
+		root = sibling;
+		nodes[sibling].Parent = -1;
+		return;
+	}
+
+	SetChild(grandParent, nodes[grandParent].Children[0] == parent ? 0 : 1, sibling);
+	Refit(grandParent);
+}
+
+void DynamicBvh::Refit(int32_t node)
+{
+	while (node != -1)
+	{
+		UpdateNode(node);
+		Rotate(node);
+		node = nodes[node].Parent;
+	}
+}
+
+void DynamicBvh::Rotate(int32_t node)
+{
+	// Swaps a child with a grandchild under the other child when that shrinks the other child. The node's own
+	// bounds stay the same, so only the changed child needs updating.
+	auto& n = nodes[node];
+	if (n.Height < 2)
+		return;
+
+	float bestGain = 0.f;
+	int32_t bestChild = -1;
+	int32_t bestGrandChild = -1;
+	for (int i = 0; i < 2; ++i)
+	{
+		auto other = n.Children[1 - i];
+		auto& otherNode = nodes[other];
+		if (otherNode.IsLeaf())
+			continue;
+
+		auto& child = nodes[n.Children[i]];
+		auto otherArea = otherNode.Bounds.Area();
+		for (int j = 0; j < 2; ++j)
+		{
+			// Child takes the grandchild's place, next to the remaining grandchild
+			auto& remaining = nodes[otherNode.Children[1 - j]];
+			auto gain = otherArea - BvhBounds::Merge(child.Bounds, remaining.Bounds).Area();
+			if (gain > bestGain)
+			{
+				bestGain = gain;
+				bestChild = i;
+				bestGrandChild = j;
+			}
+		}
+	}
+
+	if (bestChild == -1)
+		return;
+
+	auto child = n.Children[bestChild];
+	auto other = n.Children[1 - bestChild];
+	auto grandChild = nodes[other].Children[bestGrandChild];
+	SetChild(node, bestChild, grandChild);
+	SetChild(other, bestGrandChild, child);
+	UpdateNode(other);
+	UpdateNode(node); //Height may change
+}
+
+int32_t DynamicBvh::GetHeight() const
+{
+	return root == -1 ? 0 : nodes[root].Height;
+}
+
+float DynamicBvh::GetAreaRatio() const
+{
+	if (root == -1)
+		return 0.f;
+
+	float totalArea = 0.f;
+	for (auto& node : nodes)
+	{
+		if (node.Height > 0)
+			totalArea += node.Bounds.Area();
+	}
+	auto rootArea = nodes[root].Bounds.Area();
+	return rootArea > 0.f ? totalArea / rootArea : 0.f;
+}
+
+
+bool DynamicBvh::IsValid() const
+{
+	size_t leaves = 0;
+	size_t reachable = 0;
+	if (root != -1)
+	{
+		if (nodes[root].Parent != -1)
+			return false;
+		NodeStack stack;
+		stack.Push(root);
+		while (stack.Count > 0)
+		{
+			auto nodeId = stack.Pop();
+			auto& node = nodes[nodeId];
+			if (++reachable > nodes.size())
+				return false; //Cycle
+			if (node.IsLeaf())
+			{
+				if (node.Children[1] != -1 || node.Height != 0)
+					return false;
+				leaves++;
+				continue;
+			}
+
+			auto& first = nodes[node.Children[0]];
+			auto& second = nodes[node.Children[1]];
+			if (first.Parent != nodeId || second.Parent != nodeId || node.Height != 1 + std::max(first.Height, second.Height))
+				return false;
+			auto merged = BvhBounds::Merge(first.Bounds, second.Bounds);
+			if (memcmp(&merged, &node.Bounds, sizeof(BvhBounds)) != 0)
+				return false;
+			stack.Push(node.Children[0]);
+			stack.Push(node.Children[1]);
+		}
+	}
+
+	size_t freeCount = 0;
+	for (auto node = freeList; node != -1; node = nodes[node].Parent)
+	{
+		if (nodes[node].Height != -1 || ++freeCount > nodes.size())
+			return false;
+	}
+	return leaves == leafCount && reachable + freeCount == nodes.size();
+}
@@ -0,0 +1,294 @@
+#pragma once
+#include "stdafx.h"
+#include <vector>
+#include "Culling.h"
+
+typedef int32_t BvhProxyID;
+const BvhProxyID InvalidBvhProxy = -1;
+
+//! Axis aligned box as min and max corners, cheaper to merge than center and extents
+struct BvhBounds
+{
+	XMFLOAT3	Min;
+	XMFLOAT3	Max;
+
+	static BvhBounds	FromBox(const BoundingBox& box);
+	//! World space box around localBox transformed by world
+	static BvhBounds	FromOrientedBox(const BoundingOrientedBox& localBox, const XMFLOAT4X4& world);
+	static BvhBounds	Merge(const BvhBounds& a, const BvhBounds& b);
+	BoundingBox			ToBox() const;
+	bool				Contains(const BvhBounds& other) const;
+	bool				Intersects(const BvhBounds& other) const;
+	//! Surface area up to a constant factor, the cost metric of the tree
+	float				Area() const;
+};
+
+//! Dynamic bounding volume hierarchy of axis aligned boxes. Leaves store a box grown by a margin, so objects
+//! moving a little do not touch the tree. Inserts pick the sibling that grows the tree's area the least,
+//! and every node refitted on the way up is rotated with one of its grandchildren when that lowers the area,
+//! which keeps the tree in shape under continuous motion without rebuilds.
+class DynamicBvh
+{
+	struct BvhNode
+	{
+		BvhBounds	Bounds;
+		int32_t		Parent; //Next free node while the node is free
+		int32_t		Children[2]; //-1 for leaves
+		int32_t		Height; //0 for leaves, -1 while free
+		uint32_t	UserData;
+
+		inline bool	IsLeaf() const { return Children[0] == -1; }
+	};
+
+	std::vector<BvhNode>	nodes;
+	int32_t					root;
+	int32_t					freeList;
+	size_t					leafCount;
+	float					margin;
+
+	int32_t					AllocateNode();
+	void					FreeNode(int32_t node);
+	void					InsertLeaf(int32_t leaf);
+	void					RemoveLeaf(int32_t leaf);
+	//! Recomputes bounds and heights from node up to the root, rotating each node on the way
+	void					Refit(int32_t node);
+	void					Rotate(int32_t node);
+	void					SetChild(int32_t parent, int32_t index, int32_t child);
+	void					UpdateNode(int32_t node);
+
+	//! Traversal stack, on the caller's stack until the tree is deeper than it
+	struct NodeStack
+	{
+		int32_t					Inline[64];
+		std::vector<int32_t>	Spill;
+		int32_t					Count;
+
+		NodeStack() : Count(0) {}
+		inline void Push(int32_t node)
+		{
+			if (Count < 64)
+				Inline[Count] = node;
+			else
+				Spill.push_back(node);
+			Count++;
+		}
+		inline int32_t Pop()
+		{
+			Count--;
+			if (Count < 64)
+				return Inline[Count];
+			auto node = Spill.back();
+			Spill.pop_back();
+			return node;
+		}
+	};
+
+	template<typename FuncType>
+	void					VisitLeaves(int32_t node, FuncType callback) const;
+public:
+	//! margin is added on every side of inserted boxes
+	DynamicBvh(float margin = 0.1f);
+
+	BvhProxyID				Insert(const BvhBounds& bounds, uint32_t userData);
+	void					Remove(BvhProxyID proxy);
+	//! Returns false if bounds still fit the proxy's grown box. Otherwise the leaf is refitted in place when the
+	//! new box overlaps the old one and reinserted when the object jumped away.
+	bool					Move(BvhProxyID proxy, const BvhBounds& bounds);
+	void					Clear();
+
+	inline uint32_t			GetUserData(BvhProxyID proxy) const { return nodes[proxy].UserData; }
+	inline const BvhBounds&	GetFatBounds(BvhProxyID proxy) const { return nodes[proxy].Bounds; }
+	inline size_t			Size() const { return leafCount; }
+	int32_t					GetHeight() const;
+	//! Sum of internal node areas divided by the root area, lower is a better tree
+	float					GetAreaRatio() const;
+	//! Checks parent links, heights and that every internal node's box is exactly the union of its children's,
+	//! and that every node is either in the tree or free. For tests and debugging, walks the whole tree.
+	bool					IsValid() const;
+
+	//! callback(proxy) for every leaf whose grown box overlaps the query. Results are conservative, the
+	//! caller tests the object's own bounds when it needs exact answers.
+	template<typename FuncType>
+	void					QueryBox(const BvhBounds& box, FuncType callback) const;
+	template<typename FuncType>
+	void					QuerySphere(const BoundingSphere& sphere, FuncType callback) const;
+	template<typename FuncType>
+	void					QueryFrustum(const Frustum& frustum, FuncType callback) const;
+	//! callback(proxy, maxDistance) for leaves the ray enters before maxDistance, nearest subtrees first.
+	//! It returns the object's hit distance, or a negative value for a miss, and hits shorten the ray.
+	template<typename FuncType>
+	void					RayCast(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance, FuncType callback) const;
+};
+
+template<typename FuncType>
+inline void DynamicBvh::VisitLeaves(int32_t node, FuncType callback) const
+{
+	NodeStack stack;
+	stack.Push(node);
+	while (stack.Count > 0)
+	{
+		auto nodeId = stack.Pop();
+		auto& current = nodes[nodeId];
+		if (current.IsLeaf())
+		{
+			callback((BvhProxyID)nodeId);
+			continue;
+		}
+		stack.Push(current.Children[0]);
+		stack.Push(current.Children[1]);
+	}
+}
+
+template<typename FuncType>
+inline void DynamicBvh::QueryBox(const BvhBounds & box, FuncType callback) const
+{
+	if (root == -1)
+		return;
+	NodeStack stack;
+	stack.Push(root);
+	while (stack.Count > 0)
+	{
+		auto nodeId = stack.Pop();
+		auto& node = nodes[nodeId];
+		if (!node.Bounds.Intersects(box))
+			continue;
+		if (node.IsLeaf())
+		{
+			callback((BvhProxyID)nodeId);
+			continue;
+		}
+		stack.Push(node.Children[0]);
+		stack.Push(node.Children[1]);
+	}
+}
+
+template<typename FuncType>
+inline void DynamicBvh::QuerySphere(const BoundingSphere & sphere, FuncType callback) const
+{
+	if (root == -1)
+		return;
+	auto center = XMLoadFloat3(&sphere.Center);
+	auto radiusSq = sphere.Radius * sphere.Radius;
+	NodeStack stack;
+	stack.Push(root);
+	while (stack.Count > 0)
+	{
+		auto nodeId = stack.Pop();
+		auto& node = nodes[nodeId];
+		// Distance from the center to the closest point of the box
+		auto closest = XMVectorClamp(center, XMLoadFloat3(&node.Bounds.Min), XMLoadFloat3(&node.Bounds.Max));
+		if (XMVectorGetX(XMVector3LengthSq(closest - center)) > radiusSq)
+			continue;
+		if (node.IsLeaf())
+		{
+			callback((BvhProxyID)nodeId);
+			continue;
+		}
+		stack.Push(node.Children[0]);
+		stack.Push(node.Children[1]);
+	}
+}
+
+template<typename FuncType>
+inline void DynamicBvh::QueryFrustum(const Frustum & frustum, FuncType callback) const
+{
+	if (root == -1)
+		return;
+	NodeStack stack;
+	stack.Push(root);
+	while (stack.Count > 0)
+	{
+		auto nodeId = stack.Pop();
+		auto& node = nodes[nodeId];
+		auto& bounds = node.Bounds;
+		XMFLOAT3 center((bounds.Min.x + bounds.Max.x) * 0.5f, (bounds.Min.y + bounds.Max.y) * 0.5f, (bounds.Min.z + bounds.Max.z) * 0.5f);
+		XMFLOAT3 extents(bounds.Max.x - center.x, bounds.Max.y - center.y, bounds.Max.z - center.z);
+		bool outside = false;
+		bool inside = true;
+		for (auto& plane : frustum.Planes)
+		{
+			auto distance = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+			auto radius = fabsf(plane.x) * extents.x + fabsf(plane.y) * extents.y + fabsf(plane.z) * extents.z;
+			if (distance < -radius)
+			{
+				outside = true;
+				break;
+			}
+			inside = inside && distance >= radius;
+		}
+		if (outside)
+			continue;
+
+		// Everything below a node inside every plane is visible, no more tests needed
+		if (inside || node.IsLeaf())
+		{
+			VisitLeaves(nodeId, callback);
+			continue;
+		}
+		stack.Push(node.Children[0]);
+		stack.Push(node.Children[1]);
+	}
+}
+
+template<typename FuncType>
+inline void DynamicBvh::RayCast(const XMFLOAT3 & origin, const XMFLOAT3 & direction, float maxDistance, FuncType callback) const
+{
+	if (root == -1)
+		return;
+	// Slab test against each box, infinities from zero direction components compare correctly
+	const float inverse[3] = { 1.f / direction.x, 1.f / direction.y, 1.f / direction.z };
+	const float start[3] = { origin.x, origin.y, origin.z };
+	auto entry = [&](const BvhBounds& bounds)
+	{
+		const float minimum[3] = { bounds.Min.x, bounds.Min.y, bounds.Min.z };
+		const float maximum[3] = { bounds.Max.x, bounds.Max.y, bounds.Max.z };
+		float nearest = 0.f;
+		float farthest = maxDistance;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			auto t0 = (minimum[axis] - start[axis]) * inverse[axis];
+			auto t1 = (maximum[axis] - start[axis]) * inverse[axis];
+			if (t0 > t1)
+				std::swap(t0, t1);
+			nearest = t0 > nearest ? t0 : nearest; //NaN from 0 * inf leaves the bound unchanged
+			farthest = t1 < farthest ? t1 : farthest;
+		}
+		return nearest <= farthest ? nearest : -1.f;
+	};
+
+	NodeStack stack;
+	stack.Push(root);
+	while (stack.Count > 0)
+	{
+		auto nodeId = stack.Pop();
+		auto& node = nodes[nodeId];
+		if (entry(node.Bounds) < 0.f)
+			continue;
+		if (node.IsLeaf())
+		{
+			auto hit = callback((BvhProxyID)nodeId, maxDistance);
+			if (hit >= 0.f && hit < maxDistance)
+				maxDistance = hit;
+			continue;
+		}
+
+		// Far child first on the stack so the near one is visited first and shortens the ray sooner
+		auto near0 = entry(nodes[node.Children[0]].Bounds);
+		auto near1 = entry(nodes[node.Children[1]].Bounds);
+		if (near0 < 0.f && near1 < 0.f)
+			continue;
+		bool firstIsNear = near1 < 0.f || (near0 >= 0.f && near0 <= near1);
+		if (firstIsNear)
+		{
+			if (near1 >= 0.f)
+				stack.Push(node.Children[1]);
+			stack.Push(node.Children[0]);
+		}
+		else
+		{
+			if (near0 >= 0.f)
+				stack.Push(node.Children[0]);
+			stack.Push(node.Children[1]);
+		}
+	}
+}
@@ -0,0 +1,119 @@
+#include "stdafx.h"
+#include "EntityCommandBuffer.h"
+#include <algorithm>
+
+static const EntityID FirstPlaceholderID = -2;
+
+EntityCommandBuffer::EntityCommandBuffer()
+{
+}
+
+EntityID EntityCommandBuffer::Resolve(EntityID entity)
+{
+	if (entity > FirstPlaceholderID)
+		return entity;
+	return createdEntities[FirstPlaceholderID - entity];
+}
+
+EntityID EntityCommandBuffer::CreateEntity(std::string name, HashID mesh, HashID material, const Transform & transform, EntityID parent)
+{
+	std::lock_guard<std::mutex> lock(recordLock);
+	creates.push_back(CreateCommand{ parent, name, mesh, material, transform });
+	return FirstPlaceholderID - (EntityID)(creates.size() - 1);
+}
+
+void EntityCommandBuffer::Destroy(EntityID entity)
+{
+	std::lock_guard<std::mutex> lock(recordLock);
+	destroys.push_back(entity);
+}
+
+void EntityCommandBuffer::SetTransform(EntityID entity, const Transform & transform)
+{
+	std::lock_guard<std::mutex> lock(recordLock);
+	transforms.push_back(std::make_pair(entity, transform));
+}
+
+void EntityCommandBuffer::Playback(EntityManager * entityManager)
+{
+	std::lock_guard<std::mutex> lock(recordLock);
+	if (IsEmpty())
+		return;
+
+	std::vector<EntityDesc> descs(creates.size());
+	for (size_t i = 0; i < creates.size(); ++i) //Parents created in this buffer map to their index in the batch
+	{
+		auto& create = creates[i];
+		descs[i].Name = create.Name;
+		descs[i].Mesh = create.Mesh;
+		descs[i].Material = create.Material;
+		descs[i].LocalTransform = create.LocalTransform;
+		if (create.Parent > FirstPlaceholderID)
+			descs[i].Parent = create.Parent;
+		else
+			descs[i].ParentIndex = FirstPlaceholderID - create.Parent;
+	}
+	createdEntities.resize(creates.size());
+	entityManager->CreateEntities(descs.data(), descs.size(), createdEntities.data());
+
+	for (auto& transform : transforms)
+	{
+		entityManager->SetTransform(Resolve(transform.first), transform.second);
+	}
+
+	// Group by component type, then entity, so each container is touched in one run. Stable to keep last write winning.
+	auto byTypeThenEntity = [&](const ComponentCommand& a, const ComponentCommand& b)
+	{
+		return a.Type != b.Type ? a.Type < b.Type : Resolve(a.Entity) < Resolve(b.Entity);
+	};
+
+	std::stable_sort(adds.begin(), adds.end(), byTypeThenEntity);
+	for (size_t i = 0; i < adds.size(); ++i)
+	{
+		auto& add = adds[i];
+		if (i == 0 || adds[i - 1].Type != add.Type)
+			add.Register(entityManager);
+		entityManager->AddComponent(Resolve(add.Entity), add.Type, add.Data);
+	}
+
+	std::sort(removes.begin(), removes.end(), byTypeThenEntity);
+	for (auto& remove : removes)
+	{
+		entityManager->RemoveComponent(Resolve(remove.Entity), remove.Type);
+	}
+
+	for (auto entity : destroys)
+	{
+		entityManager->QueueRemove(Resolve(entity));
+	}
+	entityManager->ExecutePurge();
+
+	for (auto& add : adds)
+	{
+		delete add.Data;
+	}
+	adds.clear();
+	removes.clear();
+	creates.clear();
+	destroys.clear();
+	transforms.clear();
+}
+
+void EntityCommandBuffer::Clear()
+{
+	std::lock_guard<std::mutex> lock(recordLock);
+	for (auto& add : adds)
+	{
+		delete add.Data;
+	}
+	adds.clear();
+	removes.clear();
+	creates.clear();
+	destroys.clear();
+	transforms.clear();
+}
+
+EntityCommandBuffer::~EntityCommandBuffer()
+{
+	Clear();
+}
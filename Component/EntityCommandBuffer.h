@@ -0,0 +1,81 @@
+#pragma once
+#include <mutex>
+#include "EntityManager.h"
+
+//! Records structural entity changes so systems and worker threads do not touch EntityManager directly.
+//! Playback applies everything at once in phases: creates, transforms, component adds (grouped by type),
+//! component removes (grouped by type) and finally destroys through EntityManager::ExecutePurge.
+//! A component removed and added in the same buffer ends up removed.
+class EntityCommandBuffer
+{
+	struct CreateCommand
+	{
+		EntityID	Parent;
+		std::string Name;
+		HashID		Mesh;
+		HashID		Material;
+		Transform	LocalTransform;
+	};
+
+	struct ComponentCommand
+	{
+		EntityID		Entity;
+		TypeID			Type;
+		IComponentData* Data;
+		void			(*Register)(EntityManager* entityManager);
+	};
+
+	std::mutex						recordLock;
+	std::vector<CreateCommand>		creates;
+	std::vector<EntityID>			destroys;
+	std::vector<ComponentCommand>	adds;
+	std::vector<ComponentCommand>	removes;
+	std::vector<std::pair<EntityID, Transform>> transforms;
+	std::vector<EntityID>			createdEntities;
+
+	EntityID		Resolve(EntityID entity);
+public:
+	EntityCommandBuffer();
+
+	//! Returns a placeholder id that can be used by later commands in this buffer. Placeholders are below -1.
+	EntityID		CreateEntity(std::string name, HashID mesh = 0u, HashID material = 0u, const Transform& transform = DefaultTransform, EntityID parent = -1);
+	void			Destroy(EntityID entity);
+	void			SetTransform(EntityID entity, const Transform& transform);
+
+	template<typename T>
+	void			AddComponent(EntityID entity, const T& componentData = T());
+
+	template<typename T>
+	void			RemoveComponent(EntityID entity);
+
+	void			Playback(EntityManager* entityManager);
+	void			Clear();
+	inline bool		IsEmpty() const { return creates.empty() && destroys.empty() && adds.empty() && removes.empty() && transforms.empty(); }
+	~EntityCommandBuffer();
+};
+
+template<typename T>
+inline void EntityCommandBuffer::AddComponent(EntityID entity, const T & componentData)
+{
+	ComponentCommand command;
+	command.Entity = entity;
+	command.Type = ComponentType<T>::ID();
+	command.Data = new T(componentData);
+	command.Register = [](EntityManager* entityManager) { entityManager->RegisterComponent<T>(); };
+
+	std::lock_guard<std::mutex> lock(recordLock);
+	adds.push_back(command);
+}
+
+template<typename T>
+inline void EntityCommandBuffer::RemoveComponent(EntityID entity)
+{
+	ComponentCommand command;
+	command.Entity = entity;
+	command.Type = ComponentType<T>::ID();
+	command.Data = nullptr;
+	command.Register = nullptr;
+
+	std::lock_guard<std::mutex> lock(recordLock);
+	removes.push_back(command);
+}
@@ -1,80 +1,19 @@
 #include "stdafx.h"
 #include "EntityManager.h"
+#include "Query.h"
 #include "ComponentSerDe.h"
-#include "ResourceManager.h"
-#include "AnimationManager.h"
 #include <memory>
 
 EntityManager* EntityManager::Instance = nullptr;
 
-struct EntitySerialInterface
-{
-	EntityID	EntityID;
-	EntityID	ParentID;
-	std::string			Mesh;
-	std::string			Material;
-	Vector3		Position;
-	Vector3		Rotation;
-	Vector3		Scale;
-	std::vector<std::string> AttachedComponents;
-
-	template<class Archive>
-	void save(Archive& archive) const
-	{
-		archive(
-			CEREAL_NVP(EntityID),
-			CEREAL_NVP(ParentID),
-			CEREAL_NVP(Mesh),
-			CEREAL_NVP(Material),
-			CEREAL_NVP(Position),
-			CEREAL_NVP(Rotation),
-			CEREAL_NVP(Scale),
-			CEREAL_NVP(AttachedComponents)
-		);
-
-		auto em = EntityManager::GetInstance();
-		for (auto comp : AttachedComponents)
-		{
-			auto typeId = ComponentFactory::GetTypeID(StringID(comp));
-			auto c = em->GetComponentContainer(comp.c_str());
-			c->Serialize(archive, EntityID);
-		}
-	}
-
-	template<class Archive>
-	void load(Archive& archive)
-	{
-		archive(
-			CEREAL_NVP(EntityID),
-			CEREAL_NVP(ParentID),
-			CEREAL_NVP(Mesh),
-			CEREAL_NVP(Material),
-			CEREAL_NVP(Position),
-			CEREAL_NVP(Rotation),
-			CEREAL_NVP(Scale),
-			CEREAL_NVP(AttachedComponents)
-		);
-
-		auto em = EntityManager::GetInstance();
-		for (auto comp : AttachedComponents)
-		{
-			auto typeId = ComponentFactory::GetTypeID(StringID(comp));
-			auto c = em->GetComponentContainer(comp.c_str());
-			if (c == nullptr)
-			{
-				em->RegisterComponent(comp.c_str());
-				c = em->GetComponentContainer(comp.c_str());
-			}
-			c->Deserialize(archive, EntityID);
-		}
-	}
-};
-
-
-EntityManager::EntityManager(Scene* scene) :
-	scene(scene)
+EntityManager::EntityManager(Scene* scene, ComponentStorageMode storageMode) :
+	scene(scene),
+	storageMode(storageMode),
+	structureVersion(0)
 {
 	Instance = this;
+	if (storageMode == StorageModeArchetype)
+		archetypes = std::unique_ptr<ArchetypeStorage>(new ArchetypeStorage());
 }
 
 EntityID EntityManager::CreateEntity(std::string name, const Transform & transform)
@@ -118,65 +57,349 @@ EntityID EntityManager::CreateEntity(EntityID parentId, std::string name, HashID
 	return entityId;
 }
 
+void EntityManager::CreateEntities(const EntityDesc * descs, size_t count, EntityID * outEntities)
+{
+	if (count == 0)
+		return;
+
+	std::vector<NodeID> nodes(count);
+	scene->AllocateNodes(count, nodes.data());
+
+	auto reused = freeEntityIds.size() < count ? freeEntityIds.size() : count;
+	auto nextId = (EntityID)entities.size();
+	auto newSize = entities.size() + (count - reused);
+	entities.resize(newSize);
+	meshes.resize(newSize);
+	materials.resize(newSize);
+	parents.resize(newSize);
+	active.resize(newSize);
+	nodeMap.reserve(nodeMap.size() + count);
+	entityNameIndexMap.reserve(entityNameIndexMap.size() + count);
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		EntityID entityId;
+		if (i < reused)
+		{
+			entityId = freeEntityIds.back();
+			freeEntityIds.pop_back();
+		}
+		else
+		{
+			entityId = nextId++;
+		}
+
+		auto& desc = descs[i];
+		outEntities[i] = entityId;
+		entities[entityId] = nodes[i];
+		nodeMap.insert_or_assign(nodes[i], entityId);
+		meshes[entityId] = desc.Mesh;
+		materials[entityId] = desc.Material;
+		active[entityId] = true;
+		entityNameIndexMap.insert(std::pair<std::string, EntityID>(desc.Name, entityId));
+	}
+
+	// Every id in the batch is known now, so parents inside the batch resolve to their nodes
+	std::vector<NodeID> parentNodes(count);
+	std::vector<Transform> transforms(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		auto& desc = descs[i];
+		auto parentId = desc.ParentIndex != -1 ? outEntities[desc.ParentIndex] : desc.Parent;
+		parents[outEntities[i]] = parentId;
+		parentNodes[i] = parentId == -1 ? RootNodeID : entities[parentId];
+		transforms[i] = desc.LocalTransform;
+	}
+	scene->InitializeNodes(nodes.data(), parentNodes.data(), transforms.data(), count);
+}
+
 void EntityManager::Remove(EntityID entity)
 {
-	freeEntityIds.push_back(entity);
-	auto node = entities[entity];
+	QueueRemove(entity);
+	ExecutePurge();
+}
+
+void EntityManager::RemoveEntities(const EntityID * removeEntities, size_t count)
+{
+	purgeList.insert(purgeList.end(), removeEntities, removeEntities + count);
+	ExecutePurge();
+}
+
+void EntityManager::QueueRemove(EntityID entity)
+{
+	purgeList.push_back(entity);
+}
+
+void EntityManager::CompactScene()
+{
+	nodeSwaps.clear();
+	scene->Compact(nodeSwaps);
+	ApplyNodeSwaps(nodeSwaps);
+}
+
+bool EntityManager::CompactScene(double budgetMs)
+{
+	nodeSwaps.clear();
+	auto done = scene->CompactIncremental(budgetMs, nodeSwaps);
+	ApplyNodeSwaps(nodeSwaps);
+	return done;
+}
+
+void EntityManager::ApplyNodeSwaps(const std::vector<NodeSwap>& swaps)
+{
+	for (auto& swap : swaps)
+	{
+		auto first = nodeMap.find(swap.First);
+		auto second = nodeMap.find(swap.Second);
+		EntityID firstEntity = first != nodeMap.end() ? first->second : -1;
+		EntityID secondEntity = second != nodeMap.end() ? second->second : -1;
+
+		// Free nodes have no entity, ExecutePurge drops them from nodeMap
+		if (firstEntity != -1)
+			entities[firstEntity] = swap.Second;
+		if (secondEntity != -1)
+			entities[secondEntity] = swap.First;
+
+		if (firstEntity != -1)
+			nodeMap.insert_or_assign(swap.Second, firstEntity);
+		else
+			nodeMap.erase(swap.Second);
+		if (secondEntity != -1)
+			nodeMap.insert_or_assign(swap.First, secondEntity);
+		else
+			nodeMap.erase(swap.First);
+	}
+}
+
+void EntityManager::ExecutePurge()
+{
+	if (purgeList.empty())
+		return;
+
 	std::vector<NodeID> removedChildNodes;
 	std::vector<EntityID> removedEntities;
+	phmap::flat_hash_set<EntityID> removedSet;
+	removedEntities.reserve(purgeList.size());
+	removedSet.reserve(purgeList.size());
+	freeEntityIds.reserve(freeEntityIds.size() + purgeList.size());
+	for (auto entity : purgeList)
+	{
+		if (entities[entity] == InvalidNodeID || !removedSet.insert(entity).second) //Already removed, maybe as a child of an earlier entity
+			continue;
 
-	removedEntities.push_back(entity);
-	scene->RemoveNode(node, removedChildNodes);
+		freeEntityIds.push_back(entity);
+		removedEntities.push_back(entity);
+		scene->RemoveNode(entities[entity], removedChildNodes);
 
-	for (auto node : removedChildNodes)
-	{
-		auto childEntity = nodeMap[node];
-		freeEntityIds.push_back(childEntity);
-		removedEntities.push_back(childEntity);
+		for (auto node : removedChildNodes)
+		{
+			auto childEntity = nodeMap[node];
+			if (!removedSet.insert(childEntity).second)
+				continue;
+			freeEntityIds.push_back(childEntity);
+			removedEntities.push_back(childEntity);
+		}
 	}
+	purgeList.clear();
+	structureVersion++;
 
+	// Freed nodes get reused or renumbered by compaction, removed entities must not follow them
 	for (auto removed : removedEntities)
 	{
+		nodeMap.erase(entities[removed]);
+		entities[removed] = InvalidNodeID;
 		parents[removed] = RootNodeID;
 		active[removed] = false;
-		for (auto comp : components)
+		//entityNameIndexMap.erase() remove from name index map
+	}
+
+	if (storageMode == StorageModeArchetype) //Drops the whole row instead of migrating once per component
+	{
+		for (auto removed : removedEntities)
 		{
-			comp.second->RemoveEntity(removed);
+			archetypes->RemoveEntity(removed);
 		}
-		//entityNameIndexMap.erase() remove from name index map
 	}
+	else
+	{
+		for (auto comp : components) //One container at a time keeps its data hot in cache
+		{
+			if (comp == nullptr)
+				continue;
+			for (auto removed : removedEntities)
+			{
+				comp->RemoveEntity(removed);
+			}
+		}
+	}
+
+	NotifyComponentChanged(removedEntities.data(), removedEntities.size(), AnyComponentType);
 }
 
 void EntityManager::RegisterComponent(const char* componentName)
 {
 	HashID stringHash = StringID(componentName);
 	auto typeId = ComponentFactory::GetTypeID(stringHash);
-	if (components.find(typeId) == components.end())
+	if (typeId != AnyComponentType && GetContainer(typeId) == nullptr)
 	{
-		auto component = ComponentFactory::Create(stringHash);
-		components.insert(std::pair<TypeID, IComponent*>(typeId, component));
+		IComponent* component;
+		if (storageMode == StorageModeArchetype)
+			component = ComponentFactory::Create(stringHash, archetypes.get());
+		else
+			component = ComponentFactory::Create(stringHash);
+		SetContainer(typeId, component);
 	}
-	else if (components[typeId] == nullptr)
+}
+
+void EntityManager::SetContainer(TypeID type, IComponent * component)
+{
+	if (type >= components.size())
 	{
-		components[typeId] = ComponentFactory::Create(stringHash);
+		components.resize(type + 1, nullptr);
 	}
+	components[type] = component;
 }
 
 void EntityManager::AddComponent(EntityID entity, const char * componentName, IComponentData* data)
 {
 	auto typeId = ComponentFactory::GetTypeID(StringID(componentName));
-	if (components.find(typeId) == components.end())
+	if (GetContainer(typeId) == nullptr)
 	{
 		RegisterComponent(componentName);
 	}
-	auto component = components[typeId];
+	auto component = GetContainer(typeId);
+	if (component == nullptr)
+		return;
 	component->AddEntity(entity, data);
+	NotifyComponentChanged(entity, typeId);
+}
+
+void EntityManager::AddComponent(EntityID entity, TypeID type, IComponentData * data)
+{
+	auto component = components[type];
+	component->AddEntity(entity, data);
+	NotifyComponentChanged(entity, type);
+}
+
+void EntityManager::RemoveComponent(EntityID entity, TypeID type)
+{
+	auto component = GetContainer(type);
+	if (component == nullptr)
+		return;
+
+	component->RemoveEntity(entity);
+	NotifyComponentChanged(entity, type);
+}
+
+void EntityManager::NotifyMoves(TypeID type)
+{
+	movedEntities.clear();
+	if (storageMode == StorageModeArchetype)
+		archetypes->TakeMovedEntities(movedEntities);
+	else
+	{
+		// Only a change of one type is known to leave the other containers alone
+		auto first = type == AnyComponentType ? (TypeID)0 : type;
+		auto last = type == AnyComponentType ? (TypeID)components.size() : type + 1;
+		for (auto t = first; t < last; ++t)
+		{
+			auto component = GetContainer(t);
+			if (component == nullptr || component->TakeMovedEntities(movedEntities))
+				continue;
+			for (auto& query : queries)
+			{
+				query.second->OnComponentsMoved(t);
+			}
+		}
+	}
+
+	if (movedEntities.empty())
+		return;
+	for (auto& query : queries)
+	{
+		query.second->OnEntitiesMoved(movedEntities.data(), movedEntities.size());
+	}
+}
+
+void EntityManager::NotifyComponentChanged(EntityID entity, TypeID type)
+{
+	NotifyMoves(type);
+	for (auto& query : queries)
+	{
+		query.second->OnEntityChanged(entity, type);
+	}
+}
+
+void EntityManager::NotifyComponentChanged(const EntityID * changedEntities, size_t count, TypeID type)
+{
+	NotifyMoves(type);
+	for (auto& query : queries) //One query at a time keeps its index hot in cache
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			query.second->OnEntityChanged(changedEntities[i], type);
+		}
+	}
+}
+
+void EntityManager::RefreshQueries()
+{
+	for (auto& query : queries)
+	{
+		query.second->Refresh();
+	}
+}
+
+bool EntityManager::HasComponent(EntityID entity, TypeID type)
+{
+	if (storageMode == StorageModeArchetype)
+		return archetypes->Has(entity, type);
+
+	auto component = GetContainer(type);
+	if (component == nullptr)
+		return false;
+	return component->Has(entity);
+}
+
+void EntityManager::MarkChanged(EntityID entity, TypeID type)
+{
+	if (storageMode == StorageModeArchetype)
+	{
+		archetypes->MarkChanged(entity, type);
+		return;
+	}
+
+	auto component = GetContainer(type);
+	if (component != nullptr)
+		component->MarkChanged(entity);
+}
+
+uint32_t EntityManager::GetChangeVersion(EntityID entity, TypeID type)
+{
+	auto component = GetContainer(type);
+	return component == nullptr ? 0 : component->GetChangeVersion(entity);
+}
+
+uint32_t EntityManager::GetAddedVersion(EntityID entity, TypeID type)
+{
+	auto component = GetContainer(type);
+	return component == nullptr ? 0 : component->GetAddedVersion(entity);
+}
+
+uint32_t EntityManager::GetColumnVersion(TypeID type)
+{
+	auto component = GetContainer(type);
+	return component == nullptr ? 0 : component->GetColumnVersion();
 }
 
 void EntityManager::GetComponentEntities(TypeID componentId, std::vector<EntityID>& outEntities)
 {
+	auto component = GetContainer(componentId);
+	if (component == nullptr)
+		return;
+
 	std::vector<EntityID> compEntities;
-	components[componentId]->GetEntities(compEntities);
+	component->GetEntities(compEntities);
 	for (auto e : compEntities)
 	{
 		if (active[e])
@@ -206,6 +429,17 @@ void EntityManager::GetEntities(std::vector<Entity>& outEntityList)
 	}
 }
 
+void EntityManager::GetChangedEntities(std::vector<EntityID>& outEntities)
+{
+	outEntities.clear();
+	for (auto node : scene->GetChangedNodes())
+	{
+		auto it = nodeMap.find(node);
+		if (it != nodeMap.end())
+			outEntities.push_back(it->second);
+	}
+}
+
 void EntityManager::UpdateEntity(const Entity & entity)
 {
 	SetMesh(entity.EntityID, entity.Mesh);
@@ -214,28 +448,36 @@ void EntityManager::UpdateEntity(const Entity & entity)
 
 EntityManager::~EntityManager()
 {
+	for (auto query : queries)
+	{
+		delete query.second;
+	}
+
 	for (auto component : components)
 	{
-		delete component.second;
+		delete component;
 	}
 }
 
 IComponentData * EntityManager::GetComponent(const char * componentName, EntityID entity)
 {
 	auto type = ComponentFactory::GetTypeID(StringID(componentName));
-	auto data = components[type]->GetComponentData(entity);
-	return data;
+	auto component = GetContainer(type);
+	if (component == nullptr)
+		return nullptr;
+	return component->GetComponentData(entity);
 }
 
 IComponent * EntityManager::GetComponentContainer(const char * componentName)
 {
 	auto type = ComponentFactory::GetTypeID(StringID(componentName));
-	return components[type];
+	return GetContainer(type);
 }
 
 void EntityManager::SetMesh(EntityID entity, HashID mesh)
 {
 	meshes[entity] = mesh;
+	structureVersion++;
 }
 
 void EntityManager::SetMaterial(EntityID entity, HashID material)
@@ -255,6 +497,17 @@ void EntityManager::SetRotation(EntityID entity, const XMFLOAT3 & rotation)
 	scene->SetRotation(node, rotation);
 }
 
+void EntityManager::SetRotationInDegrees(EntityID entity, const XMFLOAT3 & rotation)
+{
+	SetRotation(entity, XMFLOAT3(XMConvertToRadians(rotation.x), XMConvertToRadians(rotation.y), XMConvertToRadians(rotation.z)));
+}
+
+void EntityManager::SetRotationQuaternion(EntityID entity, const XMFLOAT4 & rotation)
+{
+	auto node = entities[entity];
+	scene->SetRotationQuaternion(node, rotation);
+}
+
 void EntityManager::SetScale(EntityID entity, const XMFLOAT3 & scale)
 {
 	auto node = entities[entity];
@@ -270,6 +523,7 @@ void EntityManager::SetTransform(EntityID entity, const Transform & transform)
 void EntityManager::SetActive(EntityID entity, bool enable)
 {
 	active[entity] = (byte)enable;
+	structureVersion++;
 	auto node = entities[entity];
 	std::vector<NodeID> children;
 	scene->GetChildren(node, children);
@@ -278,76 +532,21 @@ void EntityManager::SetActive(EntityID entity, bool enable)
 		auto entity = nodeMap[child];
 		active[entity] = (byte)enable;
 	}
-}
 
-void EntityManager::SaveToFile(const char * filename, ResourceManager* rm)
-{
-	std::vector<EntitySerialInterface> outEntities;
-	std::vector<IComponentData*> comps;
-	EntityID id = 0;
-	for (NodeID entityNode : entities)
-	{
-		EntitySerialInterface e;
-		e.EntityID = id;
-		e.ParentID = parents[id];
-		e.Mesh = rm->GetString(meshes[id]);
-		e.Material = rm->GetString(materials[id]);
-		e.Position.Value = GetPosition(id);
-		e.Scale.Value = GetScale(id);
-		e.Rotation.Value = GetRotationInDegrees(id);
-
-		for (auto comp : components)
-		{
-			auto data = comp.second->GetComponentData(id);
-			if (data != nullptr)
-			{
-				e.AttachedComponents.push_back(comp.second->GetComponentName());
-			}
-		}
-		
-		outEntities.push_back(e);
-		id++;
-	}
-	
+	if (queries.empty())
+		return;
+
+	NotifyComponentChanged(entity, AnyComponentType);
+	for (auto child : children)
 	{
-		std::ofstream os(filename);
-		cereal::JSONOutputArchive archive(os);
-		archive(cereal::make_nvp("Scene", outEntities));
+		NotifyComponentChanged(nodeMap[child], AnyComponentType);
 	}
 }
 
-void ConvertDegreesToRadians(XMFLOAT3& rot)
+void EntityManager::SetParent(EntityID entity, EntityID parent)
 {
-	rot.x = XMConvertToRadians(rot.x);
-	rot.y = XMConvertToRadians(rot.y);
-	rot.z = XMConvertToRadians(rot.z);
-}
-
-void EntityManager::Load(const char * filename, SystemContext context)
-{
-	auto rm = context.ResourceManager;
-	auto am = context.AnimationManager;
-	std::vector<EntitySerialInterface> outEntities;
-	std::ifstream is(filename);
-	cereal::JSONInputArchive archive(is);
-	archive(cereal::make_nvp("Scene", outEntities));
-	int index = 0;
-	for (auto e : outEntities)
-	{
-		auto meshId = StringID(e.Mesh);
-		ConvertDegreesToRadians(e.Rotation.Value);
-		auto id = CreateEntity(e.ParentID, std::to_string(index), meshId, StringID(e.Material), Transform{
-			e.Position.Value,
-			e.Rotation.Value,
-			e.Scale.Value
-			});
-
-		if (rm->GetMesh(meshId)->IsAnimated())
-		{
-			am->RegisterEntity(id, meshId);
-		}
-		index++;
-	}
+	parents[entity] = parent;
+	scene->SetParent(entities[entity], parent == -1 ? RootNodeID : entities[parent]);
 }
 
 const XMFLOAT3 & EntityManager::GetPosition(EntityID entity)
@@ -356,7 +555,7 @@ const XMFLOAT3 & EntityManager::GetPosition(EntityID entity)
 	return scene->GetTranslation(node);
 }
 
-const XMFLOAT3 & EntityManager::GetRotation(EntityID entity)
+XMFLOAT3 EntityManager::GetRotation(EntityID entity)
 {
 	auto node = entities[entity];
 	return scene->GetRotation(node);
@@ -371,6 +570,12 @@ XMFLOAT3 EntityManager::GetRotationInDegrees(EntityID entity)
 	return rotation;
 }
 
+const XMFLOAT4 & EntityManager::GetRotationQuaternion(EntityID entity)
+{
+	auto node = entities[entity];
+	return scene->GetRotationQuaternion(node);
+}
+
 const XMFLOAT3 & EntityManager::GetScale(EntityID entity)
 {
 	auto node = entities[entity];
@@ -15,6 +15,25 @@ class ResourceManager;
 
 class EntityManager;
 
+template<typename... Args>
+class Query;
+
+//! Passed to IQuery::OnEntityChanged when an entity change is not tied to a single component type
+static const TypeID AnyComponentType = 0;
+
+class IQuery
+{
+public:
+	virtual void OnEntityChanged(EntityID entity, TypeID type) = 0;
+	//! The data of these entities moved to other slots of their containers, without changing their components
+	virtual void OnEntitiesMoved(const EntityID* movedEntities, size_t count) = 0;
+	//! Every component of type moved, after its container reallocated
+	virtual void OnComponentsMoved(TypeID type) = 0;
+	//! Refetches the component pointers that went stale
+	virtual void Refresh() = 0;
+	virtual ~IQuery() {};
+};
+
 struct Vector3
 {
 	XMFLOAT3 Value;
@@ -30,15 +49,33 @@ struct Vector3
 	}
 };
 
+//! Selects how EntityManager stores component data
+enum ComponentStorageMode
+{
+	StorageModePerComponent = 0, // One container per component type
+	StorageModeArchetype // Entities with the same component set share fixed size chunks
+};
+
 struct Entity
 {
-	const EntityID	EntityID;
+	const ::EntityID	EntityID;
 	const NodeID	Node;
 	HashID			Mesh;
 	HashID			Material;
 	XMFLOAT4X4		WorldTransform;
 };
 
+//! Input for EntityManager::CreateEntities
+struct EntityDesc
+{
+	std::string	Name;
+	HashID		Mesh = 0u;
+	HashID		Material = 0u;
+	Transform	LocalTransform = DefaultTransform;
+	EntityID	Parent = -1; //Existing entity, -1 for the scene root
+	int32_t		ParentIndex = -1; //Other desc in the same batch, used instead of Parent when not -1
+};
+
 class EntityManager
 {
 	static EntityManager* Instance;
@@ -46,7 +83,10 @@ class EntityManager
 	Scene* scene;
 	phmap::flat_hash_map<NodeID, EntityID> nodeMap;
 	std::unordered_map<std::string, EntityID> entityNameIndexMap;
-	std::unordered_map<TypeID, IComponent*> components;
+	std::vector<IComponent*> components; // Indexed by ComponentType<T>::ID()
+	ComponentStorageMode	storageMode;
+	std::unique_ptr<ArchetypeStorage> archetypes;
+	std::unordered_map<size_t, IQuery*> queries;
 
 	std::vector<NodeID>		entities; // Entity List. Index of this vector will act as EntityID
 	std::vector<HashID>		meshes;
@@ -54,15 +94,34 @@ class EntityManager
 	std::vector<EntityID>	parents;
 	std::vector<byte>		active;
 	std::vector<EntityID>	freeEntityIds;
+	std::vector<EntityID>	purgeList;
+	std::vector<NodeSwap>	nodeSwaps;
+	std::vector<EntityID>	movedEntities; //Scratch of NotifyMoves
+	uint32_t				structureVersion; //Bumped when entities are removed, enabled, disabled or change mesh
+
+	inline IComponent*		GetContainer(TypeID type) const { return type < components.size() ? components[type] : nullptr; }
+	void					SetContainer(TypeID type, IComponent* component);
+	//! Replays the node id exchanges of a scene compaction on nodeMap and entities
+	void					ApplyNodeSwaps(const std::vector<NodeSwap>& swaps);
+	//! Hands the moves the containers of type recorded during a structural change on to the queries
+	void					NotifyMoves(TypeID type);
 
 public:
-	EntityManager(Scene* scene);
+	EntityManager(Scene* scene, ComponentStorageMode storageMode = StorageModePerComponent);
 	static EntityManager*	GetInstance() { return Instance; }
 	EntityID				CreateEntity(std::string name, const Transform& transform = DefaultTransform);
 	EntityID				CreateEntity(std::string name, HashID mesh = 0u, HashID material = 0u, const Transform& transform = DefaultTransform);
 	EntityID				CreateEntity(EntityID parentId, std::string name, HashID mesh = 0u, HashID material = 0u, const Transform& transform = DefaultTransform);
+	//! Creates count entities at once, storage and node hierarchy links are reserved up front
+	void					CreateEntities(const EntityDesc* descs, size_t count, EntityID* outEntities);
 	void					Remove(EntityID entity);
-	//void			ExecutePurge(); //Perform all remove operations at once.
+	void					RemoveEntities(const EntityID* removeEntities, size_t count);
+	void					QueueRemove(EntityID entity);
+	void					ExecutePurge(); //Perform all queued remove operations at once.
+	//! Compacts the scene nodes, see Scene::Compact. Entity ids stay the same, only the nodes behind them move.
+	void					CompactScene();
+	//! Incremental form meant to run once per frame, returns true when no compaction is in progress
+	bool					CompactScene(double budgetMs);
 
 	template<typename T>
 	void			RegisterComponent();
@@ -75,7 +134,17 @@ public:
 	template<typename T>
 	void			AddComponent(EntityID entity, const T& componentData = T());
 
+	//! Attaches T to count entities, data may be null for default constructed components
+	template<typename T>
+	void			AddComponents(const EntityID* targetEntities, size_t count, const T* data = nullptr);
+
 	void			AddComponent(EntityID entity, const char* componentName, IComponentData* data = nullptr);
+	//! Type must already be registered
+	void			AddComponent(EntityID entity, TypeID type, IComponentData* data);
+
+	template<typename T>
+	void			RemoveComponent(EntityID entity);
+	void			RemoveComponent(EntityID entity, TypeID type);
 
 	template<typename T>
 	void			GetComponentEntities(std::vector<EntityID> &outEntities);
@@ -87,13 +156,48 @@ public:
 	template<typename... Args>
 	void			GetMultiComponentEntities(std::vector<EntityID> &outEntities, Args*& ...args);
 
+	//! Returns the cached query for the given component set, creating it on first use
+	template<typename... Args>
+	Query<Args...>*	GetQuery();
+
+	//! Lets registered queries update their entity lists after a structural change
+	void			NotifyComponentChanged(EntityID entity, TypeID type);
+	void			NotifyComponentChanged(const EntityID* changedEntities, size_t count, TypeID type);
+	//! Brings every query up to date so systems running in parallel only read them
+	void			RefreshQueries();
+	bool			HasComponent(EntityID entity, TypeID type);
+
+	//! Change tracking. Mutable accessors stamp ChangeVersion::Current(), read only ones leave versions alone.
+	void			MarkChanged(EntityID entity, TypeID type);
+	template<typename T>
+	void			MarkChanged(EntityID entity) { MarkChanged(entity, ComponentType<T>::ID()); }
+	uint32_t		GetChangeVersion(EntityID entity, TypeID type);
+	uint32_t		GetAddedVersion(EntityID entity, TypeID type);
+	uint32_t		GetColumnVersion(TypeID type);
+
+	//! Calls callback(entity, components&...) for every active entity that has all the given components.
+	//! Pass const component types for read only access, the others are marked changed. The callback must not add
+	//! or remove components, queue structural changes in an EntityCommandBuffer.
+	template<typename... Args, typename FuncType>
+	void			ForEach(FuncType callback);
+
+	//! Mutable access, marks the component changed
 	template<typename T>
 	T&				GetComponent(EntityID entity);
 
+	template<typename T>
+	const T&		ReadComponent(EntityID entity) { return *FindComponent<T>(entity); }
+
+	//! Returns nullptr if the entity does not have the component. Does not mark it changed.
+	template<typename T>
+	T*				FindComponent(EntityID entity);
+
 	IComponentData* GetComponent(const char* componentName, EntityID entity);
 
 	IComponent*		GetComponentContainer(const char* componentName);
 
+	//! Contiguous array of every T, marked changed. Per component storage only, archetype storage spreads
+	//! components over chunks so callers use ForEach there.
 	template<typename T>
 	T*				GetComponents(size_t& outCount);
 
@@ -101,17 +205,23 @@ public:
 	void			SetMesh(EntityID entity, HashID mesh);
 	void			SetMaterial(EntityID entity, HashID material);
 	void			SetPosition(EntityID entity, const XMFLOAT3& position);
+	//! Pitch, yaw and roll in radians
 	void			SetRotation(EntityID entity, const XMFLOAT3& rotation);
+	void			SetRotationInDegrees(EntityID entity, const XMFLOAT3& rotation);
+	void			SetRotationQuaternion(EntityID entity, const XMFLOAT4& rotation);
 	void			SetScale(EntityID entity, const XMFLOAT3& scale);
 	void			SetTransform(EntityID entity, const Transform& transform);
 	void			SetActive(EntityID entity, bool enable);
+	//! parent of -1 moves the entity under the scene root
+	void			SetParent(EntityID entity, EntityID parent);
 	void			SaveToFile(const char* filename, ResourceManager* rm);
 	void			Load(const char* filename, SystemContext context);
 
 	//Getters
 	const XMFLOAT3&		GetPosition(EntityID entity);
-	const XMFLOAT3&		GetRotation(EntityID entity);
+	XMFLOAT3			GetRotation(EntityID entity);
 	XMFLOAT3			GetRotationInDegrees(EntityID entity);
+	const XMFLOAT4&		GetRotationQuaternion(EntityID entity);
 	const XMFLOAT3&		GetScale(EntityID entity);
 	const XMFLOAT4X4&	GetTransformMatrix(EntityID entity);
 	EntityID			GetEntityID(std::string entityName);
@@ -119,48 +229,102 @@ public:
 
 	Entity				GetEntity(EntityID entity);
 	void				GetEntities(std::vector<Entity>& outEntityList);
+	//! Entities whose world transform changed in the last Scene::UpdateTransforms
+	void				GetChangedEntities(std::vector<EntityID>& outEntities);
 	void				UpdateEntity(const Entity& entity);
+	//! Changes on every removal, SetActive and SetMesh. Caches keyed by EntityID compare it to know when
+	//! GetChangedEntities alone does not cover what happened.
+	inline uint32_t		GetStructureVersion() const { return structureVersion; }
 
 	inline size_t		Count() const { return entities.size(); };
+	inline ComponentStorageMode GetStorageMode() const { return storageMode; }
+	inline ArchetypeStorage*	GetArchetypeStorage() { return archetypes.get(); }
 	~EntityManager();
 };
 
 template<typename T>
 inline void EntityManager::RegisterComponent()
 {
-	auto typeHash = typeid(T).hash_code();
-	if (components.find(typeHash) == components.end())
+	auto typeId = ComponentType<T>::ID();
+	if (GetContainer(typeId) == nullptr)
 	{
-		auto component = new Component<T>();
-		components.insert(std::pair<TypeID, IComponent*>(typeHash, (IComponent*)component));
+		IComponent* component;
+		if (storageMode == StorageModeArchetype)
+			component = new ArchetypeComponent<T>(archetypes.get());
+		else
+			component = new Component<T>();
+		SetContainer(typeId, component);
 	}
 }
 
 template<typename T>
 inline void EntityManager::RegisterEntity(EntityID entity, const T & componentData)
 {
-	auto typeHash = typeid(T).hash_code();
-	Component<T>* component = (Component<T>*)components[typeHash];
+	auto typeId = ComponentType<T>::ID();
+	if (storageMode == StorageModeArchetype)
+	{
+		archetypes->Add<T>(entity, componentData);
+		NotifyComponentChanged(entity, typeId);
+		return;
+	}
+
+	Component<T>* component = (Component<T>*)components[typeId];
 	component->AddEntity(entity, componentData);
+	NotifyComponentChanged(entity, typeId);
 }
 
 template<typename T>
 inline void EntityManager::AddComponent(EntityID entity, const T & componentData)
 {
-	std::shared_ptr<T> ptr = std::shared_ptr<T>(&componentData);
-	auto typeHash = typeid(T).hash_code();
-	if (components.find(typeHash) == components.end())
+	auto typeId = ComponentType<T>::ID();
+	if (GetContainer(typeId) == nullptr)
 	{
 		RegisterComponent<T>();
 	}
 	RegisterEntity(entity, componentData);
 }
 
+template<typename T>
+inline void EntityManager::AddComponents(const EntityID * targetEntities, size_t count, const T * data)
+{
+	auto typeId = ComponentType<T>::ID();
+	RegisterComponent<T>();
+	if (storageMode == StorageModeArchetype)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			archetypes->Add<T>(targetEntities[i], data == nullptr ? T() : data[i]);
+		}
+	}
+	else
+	{
+		Component<T>* component = (Component<T>*)components[typeId];
+		component->Reserve(component->Count() + count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			component->AddEntity(targetEntities[i], data == nullptr ? T() : data[i]);
+		}
+	}
+	NotifyComponentChanged(targetEntities, count, typeId);
+}
+
+template<typename T>
+inline void EntityManager::RemoveComponent(EntityID entity)
+{
+	RemoveComponent(entity, ComponentType<T>::ID());
+}
+
 template<typename T>
 inline void EntityManager::GetComponentEntities(std::vector<EntityID>& outEntities)
 {
-	auto typeHash = typeid(T).hash_code();
-	Component<T>* component = (Component<T>*)components[typeHash];
+	auto typeId = ComponentType<T>::ID();
+	if (storageMode == StorageModeArchetype)
+	{
+		GetComponentEntities(typeId, outEntities);
+		return;
+	}
+
+	Component<T>* component = (Component<T>*)components[typeId];
 	for (auto e : component->Entities)
 	{
 		if (active[e])
@@ -171,43 +335,147 @@ inline void EntityManager::GetComponentEntities(std::vector<EntityID>& outEntiti
 template<typename T, typename FuncType>
 inline void EntityManager::GetComponentEntitiesWithCB(FuncType callback)
 {
-	auto typeHash = typeid(T).hash_code();
-	Component<T>* component = (Component<T>*)components[typeHash];
+	auto typeId = ComponentType<T>::ID();
+	if (storageMode == StorageModeArchetype)
+	{
+		std::vector<EntityID> compEntities;
+		archetypes->GetEntities(typeId, compEntities);
+		callback(compEntities);
+		return;
+	}
+
+	Component<T>* component = (Component<T>*)components[typeId];
 	callback(component->Entities);
 }
 
 template<typename ...Args>
 inline void EntityManager::GetMultiComponentEntities(std::vector<EntityID>& outEntities, Args*& ...args)
 {
-	std::vector<size_t> compSizes;
-	std::vector< std::vector<EntityID> > entityList;
+	bool first = true;
 	auto cb = [&](std::vector<EntityID> inEntities) {
 		std::sort(inEntities.begin(), inEntities.end());
-		if (outEntities.size() == 0)
+		if (first)
 			outEntities = inEntities;
 		else
-			std::set_intersection(outEntities.begin(), outEntities.end(), inEntities.begin(), inEntities.end(), outEntities.begin());
+		{
+			std::vector<EntityID> intersection;
+			std::set_intersection(outEntities.begin(), outEntities.end(), inEntities.begin(), inEntities.end(), std::back_inserter(intersection));
+			outEntities.swap(intersection);
+		}
+		first = false;
 	};
 
-	auto list = { (components.find(typeid(Args).hash_code()))... };
 	auto c = { 0, (GetComponentEntitiesWithCB<Args>(cb), 0) ... };
 	(void)c;
 }
 
+template<typename ...Args>
+inline Query<Args...>* EntityManager::GetQuery()
+{
+	auto queryHash = typeid(Query<Args...>).hash_code();
+	auto it = queries.find(queryHash);
+	if (it != queries.end())
+		return (Query<Args...>*)it->second;
+
+	auto r = { 0, (RegisterComponent<typename std::remove_const<Args>::type>(), 0)... };
+	(void)r;
+	auto query = new Query<Args...>(this);
+	queries.insert(std::pair<size_t, IQuery*>(queryHash, (IQuery*)query));
+	return query;
+}
+
 template<typename T>
 inline T & EntityManager::GetComponent(EntityID entity)
 {
-	auto typeHash = typeid(T).hash_code();
-	Component<T>* component = (Component<T>*)components[typeHash];
+	auto typeId = ComponentType<T>::ID();
+	if (storageMode == StorageModeArchetype)
+	{
+		auto data = archetypes->Get<T>(entity);
+		assert(data != nullptr && "Entity has no component of this type, use Find");
+		archetypes->MarkChanged(entity, typeId);
+		return *data;
+	}
+
+	Component<T>* component = (Component<T>*)components[typeId];
 	return component->GetData(entity);
 }
 
+template<typename T>
+inline T * EntityManager::FindComponent(EntityID entity)
+{
+	auto typeId = ComponentType<T>::ID();
+	if (storageMode == StorageModeArchetype)
+		return archetypes->Get<T>(entity);
+
+	Component<T>* component = (Component<T>*)GetContainer(typeId);
+	return component == nullptr ? nullptr : component->Find(entity);
+}
+
 template<typename T>
 inline T * EntityManager::GetComponents(size_t & outCount)
 {
-	auto typeHash = typeid(T).hash_code();
-	Component<T>* component = (Component<T>*)components[typeHash];
+	auto typeId = ComponentType<T>::ID();
+	if (storageMode == StorageModeArchetype)
+	{
+		assert(false && "Components are not contiguous in archetype storage, use ForEach");
+		outCount = 0;
+		return nullptr;
+	}
+
+	Component<T>* component = (Component<T>*)components[typeId];
+	component->MarkAllChanged();
+	outCount = component->Components.size();
 	return component->Components.data();
 }
 
+template<typename ...Args, typename FuncType>
+inline void EntityManager::ForEach(FuncType callback)
+{
+	if (storageMode == StorageModeArchetype)
+	{
+		archetypes->ForEachChunk<Args...>([&](uint32_t count, EntityID* chunkEntities, Args* ...columns)
+		{
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				if (active[chunkEntities[i]])
+					callback(chunkEntities[i], columns[i]...);
+			}
+		});
+		return;
+	}
+
+	const TypeID types[] = { ComponentType<Args>::ID()... };
+	for (auto type : types)
+	{
+		if (GetContainer(type) == nullptr)
+			return;
+	}
+
+	// Walks the entity list of the smallest container in place
+	const std::vector<EntityID>* compEntities = nullptr;
+	auto pick = [&compEntities](const std::vector<EntityID>& entities)
+	{
+		if (compEntities == nullptr || entities.size() < compEntities->size())
+			compEntities = &entities;
+		return 0;
+	};
+	auto s = { 0, pick(((Component<typename std::remove_const<Args>::type>*)components[ComponentType<Args>::ID()])->Entities)... };
+	(void)s;
+	for (auto e : *compEntities)
+	{
+		if (!active[e])
+			continue;
+
+		bool hasAll = true;
+		auto c = { (hasAll = hasAll && components[ComponentType<Args>::ID()]->Has(e))... };
+		(void)c;
+		if (!hasAll)
+			continue;
+
+		auto m = { 0, (std::is_const<Args>::value ? 0 : (components[ComponentType<Args>::ID()]->MarkChanged(e), 0))... };
+		(void)m;
+		callback(e, *FindComponent<typename std::remove_const<Args>::type>(e)...);
+	}
+}
+
 
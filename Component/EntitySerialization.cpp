@@ -0,0 +1,165 @@
+#include "stdafx.h"
+#include "EntityManager.h"
+#include "ComponentSerDe.h"
+#include "ResourceManager.h"
+#include "AnimationManager.h"
+
+//Scene files name meshes and materials, so saving and loading goes through ResourceManager. Kept apart from
+//EntityManager.cpp so the ECS builds without the renderer.
+
+struct EntitySerialInterface
+{
+	::EntityID	EntityID; //Position in the saved list, which is the id the entity gets back on load
+	::EntityID	ParentID;
+	::EntityID	SourceID = -1; //Live entity the components are read from, not saved
+	std::string			Mesh;
+	std::string			Material;
+	Vector3		Position;
+	Vector3		Rotation;
+	Vector3		Scale;
+	std::vector<std::string> AttachedComponents;
+
+	template<class Archive>
+	void save(Archive& archive) const
+	{
+		archive(
+			CEREAL_NVP(EntityID),
+			CEREAL_NVP(ParentID),
+			CEREAL_NVP(Mesh),
+			CEREAL_NVP(Material),
+			CEREAL_NVP(Position),
+			CEREAL_NVP(Rotation),
+			CEREAL_NVP(Scale),
+			CEREAL_NVP(AttachedComponents)
+		);
+
+		auto em = EntityManager::GetInstance();
+		for (auto comp : AttachedComponents)
+		{
+			auto typeId = ComponentFactory::GetTypeID(StringID(comp));
+			auto c = em->GetComponentContainer(comp.c_str());
+			c->Serialize(archive, SourceID);
+		}
+	}
+
+	template<class Archive>
+	void load(Archive& archive)
+	{
+		archive(
+			CEREAL_NVP(EntityID),
+			CEREAL_NVP(ParentID),
+			CEREAL_NVP(Mesh),
+			CEREAL_NVP(Material),
+			CEREAL_NVP(Position),
+			CEREAL_NVP(Rotation),
+			CEREAL_NVP(Scale),
+			CEREAL_NVP(AttachedComponents)
+		);
+
+		auto em = EntityManager::GetInstance();
+		for (auto comp : AttachedComponents)
+		{
+			auto typeId = ComponentFactory::GetTypeID(StringID(comp));
+			auto c = em->GetComponentContainer(comp.c_str());
+			if (c == nullptr)
+			{
+				em->RegisterComponent(comp.c_str());
+				c = em->GetComponentContainer(comp.c_str());
+			}
+			c->Deserialize(archive, EntityID); //Queries are notified by EntityManager::Load once the entity exists
+		}
+	}
+};
+
+void EntityManager::SaveToFile(const char * filename, ResourceManager* rm)
+{
+	// Removed entities have no node and are skipped, ids and parents are renumbered to positions in the saved list
+	std::vector<EntityID> savedIds(entities.size(), -1);
+	EntityID savedCount = 0;
+	for (EntityID id = 0; id < (EntityID)entities.size(); ++id)
+	{
+		if (entities[id] != InvalidNodeID)
+			savedIds[id] = savedCount++;
+	}
+
+	std::vector<EntitySerialInterface> outEntities;
+	outEntities.reserve(savedCount);
+	for (EntityID id = 0; id < (EntityID)entities.size(); ++id)
+	{
+		if (savedIds[id] == -1)
+			continue;
+
+		EntitySerialInterface e;
+		e.EntityID = savedIds[id];
+		e.SourceID = id;
+		e.ParentID = parents[id] != -1 ? savedIds[parents[id]] : -1;
+		e.Mesh = rm->GetString(meshes[id]);
+		e.Material = rm->GetString(materials[id]);
+		e.Position.Value = GetPosition(id);
+		e.Scale.Value = GetScale(id);
+		e.Rotation.Value = GetRotationInDegrees(id);
+
+		for (auto comp : components)
+		{
+			if (comp == nullptr)
+				continue;
+			if (comp->Has(id))
+			{
+				e.AttachedComponents.push_back(comp->GetComponentName());
+			}
+		}
+		
+		outEntities.push_back(e);
+	}
+	
+	{
+		std::ofstream os(filename);
+		cereal::JSONOutputArchive archive(os);
+		archive(cereal::make_nvp("Scene", outEntities));
+	}
+}
+
+void ConvertDegreesToRadians(XMFLOAT3& rot)
+{
+	rot.x = XMConvertToRadians(rot.x);
+	rot.y = XMConvertToRadians(rot.y);
+	rot.z = XMConvertToRadians(rot.z);
+}
+
+void EntityManager::Load(const char * filename, SystemContext context)
+{
+	auto rm = context.ResourceManager;
+	auto am = context.AnimationManager;
+	std::vector<EntitySerialInterface> outEntities;
+	std::ifstream is(filename);
+	cereal::JSONInputArchive archive(is);
+	archive(cereal::make_nvp("Scene", outEntities));
+
+	// Saved parent ids are positions in the saved list
+	std::vector<EntityDesc> descs(outEntities.size());
+	for (size_t index = 0; index < outEntities.size(); ++index)
+	{
+		auto& e = outEntities[index];
+		auto& desc = descs[index];
+		ConvertDegreesToRadians(e.Rotation.Value);
+		desc.Name = std::to_string(index);
+		desc.Mesh = StringID(e.Mesh);
+		desc.Material = StringID(e.Material);
+		desc.LocalTransform = Transform{ e.Position.Value, e.Rotation.Value, e.Scale.Value };
+		if (e.ParentID >= 0 && (size_t)e.ParentID < outEntities.size())
+			desc.ParentIndex = e.ParentID;
+	}
+
+	std::vector<EntityID> ids(descs.size());
+	CreateEntities(descs.data(), descs.size(), ids.data());
+	NotifyComponentChanged(ids.data(), ids.size(), AnyComponentType);
+
+	for (size_t index = 0; index < ids.size(); ++index)
+	{
+		auto meshId = descs[index].Mesh;
+		if (rm->GetMesh(meshId)->IsAnimated())
+		{
+			am->RegisterEntity(ids[index], meshId);
+		}
+	}
+}
@@ -10,7 +10,7 @@ struct FrameHeapParameters
 	uint32_t BoneCB;
 	uint32_t Textures;
 	uint32_t PixelCB;
-	uint32_t LightShapes;
+	uint32_t LightClusters;
 	uint32_t PerFrameCB;
 	uint32_t ShadowCB;
 	uint32_t SkyCB;
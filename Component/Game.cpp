@@ -7,6 +7,11 @@
 #include "Utility.h"
 #include "../Engine.Components/Components.h"
 
+static const double SceneCompactBudgetMs = 0.25; //Per frame time given to renumbering scene nodes
+static const uint32_t MaxOccluders = 16; //Meshes rasterized for occlusion culling every frame
+static const uint32_t MaxOccluderTriangles = 4096; //Detailed meshes cost more to rasterize than they hide
+static const float MinOccluderSize = 0.1f; //Bounding radius over distance to the camera
+
 //Initializes assets. This function's scope has access to commandList which is not closed. 
 void Game::InitializeAssets()
 {
@@ -20,6 +25,7 @@ void Game::InitializeAssets()
 	context.AnimationManager = animationManager.get();
 	context.MainCamera = camera;
 	context.Input = inputManager;
+	context.Spatial = &spatialIndex;
 
 	deferredRenderer->SetAnimationManager(animationManager.get());
 	deferredRenderer->SetEntityManager(&entityManager);
@@ -46,6 +52,7 @@ void Game::InitializeAssets()
 
 	texturePool = new TexturePool(device, deferredRenderer, 24);
 	isBlurEnabled = false;
+	isOcclusionCullingEnabled = true;
 	computeCore = new ComputeCore(device, deferredRenderer);
 
 	dofPass = std::unique_ptr<DepthOfFieldPass>(new DepthOfFieldPass(computeCore));
@@ -70,10 +77,8 @@ void Game::InitializeAssets()
 	pixelCb.dirLightCount = 1;
 	pixelCb.dirLightIndex = 0;
 
-	pixelCb.pointLight[0] = PointLight{ {0.99f, 0.2f, 0.2f, 0.f} , {0.0f, 0.0f, -1.f}, 16.f , 2.f };
-	pixelCb.pointLight[1] = PointLight{ {0.0f, 0.99f, 0.2f, 0.f} , {5.0f, 0.0f, -1.f}, 6.f , 2.f };
-	pixelCb.pointLightCount = 2u;
-	pixelCb.pointLightIndex = 0;
+	pointLights.push_back(PointLight{ {0.99f, 0.2f, 0.2f, 0.f} , {0.0f, 0.0f, -1.f}, 16.f , 2.f });
+	pointLights.push_back(PointLight{ {0.0f, 0.99f, 0.2f, 0.f} , {5.0f, 0.0f, -1.f}, 6.f , 2.f });
 
 	deferredRenderer->SetIBLTextures(
 		rm->GetTexture(StringID("Irradiance"))->GetTextureResource(),
@@ -92,10 +97,12 @@ void Game::InitializeAssets()
 
 Game::Game(HINSTANCE hInstance, int ShowWnd, int width, int height, bool fullscreen) :
 	Core(hInstance, ShowWnd, width, height, fullscreen),
+	resourceManager(ResourceManager::CreateInstance(device)),
+	selectedEntity(-1),
 	entityManager(&scene),
-	systemManager(&entityManager, &context)
+	systemManager(&entityManager, &context),
+	spatialIndex(&entityManager, resourceManager)
 {
-	resourceManager = ResourceManager::CreateInstance(device);
 	animationManager = std::make_unique<AnimationManager>();
 }
 
@@ -107,6 +114,7 @@ void Game::Initialize()
 }
 
 float CurrentTime = 0.f;
+float LightTime = 0.f; //Advanced per tick, so the lights move with the simulation and not the wall clock
 float delay = 0.2f;
 int animIndex = 0;
 bool debugMode = false;
@@ -115,13 +123,15 @@ int gBufferIndex = RTV_ORDER_ALBEDO;
 void Game::Update()
 {
 	inputManager->Update();
+	entityManager.CompactScene(SceneCompactBudgetMs);
 	systemManager.Update(deltaTime);
 	auto& entity = entityManager;
 	CurrentTime += deltaTime;
+	LightTime += deltaTime;
 	camera->Update(deltaTime);
 
-	pixelCb.pointLight[1].Position = XMFLOAT3(2 * sin(totalTime * 2) + 1, 0, -1);
-	pixelCb.pointLight[0].Position = XMFLOAT3(2 * sin(totalTime * 2) + 5, 1.0f, -2 + -2 * cos(totalTime));
+	pointLights[1].Position = XMFLOAT3(2 * sin(LightTime * 2) + 1, 0, -1);
+	pointLights[0].Position = XMFLOAT3(2 * sin(LightTime * 2) + 5, 1.0f, -2 + -2 * cos(LightTime));
 	if (Input::IsKeyDown(Keyboard::Q))
 	{
 		isBlurEnabled = true;
@@ -160,6 +170,18 @@ void Game::Update()
 		CurrentTime = 0.f;
 	}
 
+	if (GetAsyncKeyState(VK_F2) & 0xFFFF8000 && CurrentTime > delay)
+	{
+		occlusionCuller.WriteDepthImage("occlusionDepth.pgm"); //Depth buffer of the last frame
+		CurrentTime = 0.f;
+	}
+
+	if (GetAsyncKeyState(VK_F3) & 0xFFFF8000 && CurrentTime > delay)
+	{
+		isOcclusionCullingEnabled = !isOcclusionCullingEnabled;
+		CurrentTime = 0.f;
+	}
+
 	if (GetAsyncKeyState(VK_F6) & 0xFFFF8000 && CurrentTime > delay)
 	{
 		OnLoadSystems();
@@ -174,6 +196,11 @@ void Game::Update()
 	}
 
 	scene.UpdateTransforms();
+	spatialIndex.Sync();
+	// Proxies cover the last two ticks, so the candidates hold wherever Draw interpolates to
+	auto viewFrustum = camera->GetFrustum();
+	spatialIndex.QueryFrustum(viewFrustum, viewCandidates);
+	renderStates.Publish(&entityManager, &viewFrustum, &viewCandidates);
 }
 
 bool a = true;
@@ -187,10 +214,36 @@ void Game::Draw()
 	//resourceManager->GetMesh(StringID("man"))->BoneTransform(0, totalTime, 0);
 	//entities[8]->UpdateAnimation(totalTime, animIndex);
 
-	std::vector<Entity> eEntities;
-	entityManager.GetEntities(eEntities);
+	auto& renderState = renderStates.Acquire();
+	renderState.Interpolate(interpolationAlpha, drawEntities); //Drawn between the last two ticks
+	auto& eEntities = drawEntities;
+
+	deferredRenderer->PrepareFrame(eEntities, renderState, camera, pointLights, pixelCb);
 
-	deferredRenderer->PrepareFrame(eEntities, camera, pixelCb);
+	//View frustum culling, shadow passes cull against their own light volumes. The tree rejects whole groups
+	//of entities when the state is published, the interpolated boxes of the remaining ones are tested exactly.
+	//If the camera moved since then the candidates are for another view and every entity is tested.
+	auto frustum = camera->GetFrustum();
+	auto useCandidates = renderState.HasViewCandidates && memcmp(&frustum, &renderState.ViewFrustum, sizeof(Frustum)) == 0;
+	viewBoxes.Clear();
+	viewBoxEntities.clear();
+	for (uint32_t i = 0; i < (uint32_t)eEntities.size(); ++i)
+	{
+		auto& e = eEntities[i];
+		if (useCandidates && !renderState.IsViewCandidate[i])
+			continue;
+		viewBoxes.Add(resourceManager->GetMesh(e.Mesh)->GetBoundingOrientedBox(), e.WorldTransform);
+		viewBoxEntities.push_back(i);
+	}
+	CullBoxes(frustum, viewBoxes, visibleIndices);
+
+	//Occlusion culling, the occluders are rasterized on a worker while the shadow maps are recorded
+	if (isOcclusionCullingEnabled)
+	{
+		occlusionCuller.BeginFrame(camera->GetViewProjectionMatrix());
+		AddOccluders(eEntities);
+		occlusionCuller.RasterizeAsync();
+	}
 	commandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
 	//Render shadow Map before setting viewport and scissor rect
@@ -206,14 +259,25 @@ void Game::Draw()
 	commandList->RSSetViewports(1, &viewport);
 	commandList->RSSetScissorRects(1, &scissorRect);
 
+	if (isOcclusionCullingEnabled)
+	{
+		occlusionCuller.Wait();
+		occlusionCuller.CullBoxes(viewBoxes, visibleIndices);
+	}
+	visibleEntities.clear();
+	for (auto index : visibleIndices)
+	{
+		visibleEntities.push_back(eEntities[viewBoxEntities[index]]);
+	}
+
 	// draw
 	deferredRenderer->RenderSelectionDepthBuffer(commandList, selectedEntities, camera);
 	deferredRenderer->SetGBUfferPSO(commandList, camera, pixelCb);
-	deferredRenderer->Draw(commandList, eEntities);
-	deferredRenderer->DrawAnimated(commandList, eEntities);
+	deferredRenderer->Draw(commandList, visibleEntities);
+	deferredRenderer->DrawAnimated(commandList, visibleEntities);
 	deferredRenderer->DrawInstanced(commandList, { instanced });
 
-	deferredRenderer->RenderLightShapePass(commandList, pixelCb);
+	deferredRenderer->RenderLightShapePass(commandList);
 	deferredRenderer->RenderLightPass(commandList, pixelCb);
 	deferredRenderer->RenderAmbientPass(commandList);
 	deferredRenderer->DrawSkybox(commandList, skyTexture);
@@ -244,6 +308,57 @@ void Game::Draw()
 	deferredRenderer->EndFrame(commandList);
 }
 
+void Game::AddOccluders(const std::vector<Entity>& entities)
+{
+	// The visible meshes that look largest from the camera, by the radius of their box over its distance
+	auto cameraPosition = camera->GetPosition();
+	auto eye = XMLoadFloat3(&cameraPosition);
+	occluderCandidates.clear();
+	for (auto index : visibleIndices)
+	{
+		auto mesh = resourceManager->GetMesh(entities[viewBoxEntities[index]].Mesh);
+		if (mesh->IsAnimated())
+			continue; //The CPU vertices are the bind pose
+		UINT triangleCount = 0;
+		for (UINT i = 0; i < mesh->GetSubMeshCount(); ++i)
+		{
+			triangleCount += mesh->GetIndexCount(i) / 3;
+		}
+		if (triangleCount > MaxOccluderTriangles)
+			continue;
+
+		auto center = XMVectorSet(viewBoxes.GetComponent(CullBoxCenterX)[index], viewBoxes.GetComponent(CullBoxCenterY)[index],
+			viewBoxes.GetComponent(CullBoxCenterZ)[index], 0.f);
+		float radiusSq = 0.f;
+		for (int c = CullBoxAxis0X; c <= CullBoxAxis2Z; ++c)
+		{
+			auto value = viewBoxes.GetComponent((CullBoxComponent)c)[index];
+			radiusSq += value * value;
+		}
+		auto distance = std::max(XMVectorGetX(XMVector3Length(center - eye)), camera->GetNearZ());
+		auto size = sqrtf(radiusSq) / distance;
+		if (size >= MinOccluderSize)
+			occluderCandidates.push_back(std::make_pair(size, index));
+	}
+
+	auto count = std::min(occluderCandidates.size(), (size_t)MaxOccluders);
+	std::partial_sort(occluderCandidates.begin(), occluderCandidates.begin() + count, occluderCandidates.end(),
+		std::greater<std::pair<float, uint32_t>>());
+	for (size_t i = 0; i < count; ++i)
+	{
+		auto& e = entities[viewBoxEntities[occluderCandidates[i].second]];
+		auto mesh = resourceManager->GetMesh(e.Mesh);
+		for (UINT sub = 0; sub < mesh->GetSubMeshCount(); ++sub)
+		{
+			auto& vertices = mesh->GetVertices(sub);
+			auto& indices = mesh->GetIndices(sub);
+			if (vertices.empty())
+				continue;
+			occlusionCuller.AddOccluder(&vertices[0].pos, sizeof(Vertex), indices.data(), (uint32_t)indices.size(), e.WorldTransform);
+		}
+	}
+}
+
 void Game::Shutdown()
 {
 	systemManager.Shutdown();
@@ -263,16 +378,12 @@ void Game::OnMouseDown(WPARAM buttonState, int x, int y)
 	prevMousePos.y = y;
 	SetCapture(hwnd);
 	selectedEntities.clear();
-	for (int i = 0; i < entities.size(); ++i)
-	{
-		float distance;
-		if (IsIntersecting(entities[i]->GetBoundingBox(), camera, x, y, distance))
-		{
-			selectedEntities.push_back(entities[i]);
-			printf("Intersecting %d\n", i);
-			break;
-		}
-	}
+	XMFLOAT3 origin, direction;
+	GetPickRay(camera, x, y, (float)Width, (float)Height, origin, direction);
+	float distance;
+	selectedEntity = spatialIndex.RayCast(origin, direction, FLT_MAX, distance);
+	if (selectedEntity != -1)
+		printf("Intersecting %d\n", selectedEntity);
 
 }
 
@@ -18,6 +18,10 @@
 #include "SystemManager.h"
 #include "SystemContext.h"
 #include "Input.h"
+#include "RenderState.h"
+#include "Culling.h"
+#include "SpatialIndex.h"
+#include "OcclusionCuller.h"
 
 typedef std::function<void(std::vector<ISystem*>&)> SystemsCallback;
 
@@ -36,6 +40,7 @@ protected:
 	
 	std::vector<Entity*> selectedEntities;
 	std::vector<Entity*> entities;
+	EntityID			selectedEntity;
 	MeshInstanceGroupEntity* instanced;
 
 	BlurFilter*							blurFilter;
@@ -50,11 +55,24 @@ protected:
 	SystemManager				systemManager;
 	SystemContext				context;
 	InputManager*				inputManager;
+	RenderStateBuffer			renderStates; //Published at the end of Update, Draw only reads from here
+	std::vector<Entity>			drawEntities;
+	SpatialIndex				spatialIndex; //Synced with the scene after every UpdateTransforms
+	std::vector<EntityID>		viewCandidates; //Queried in Update and published with the render state
+	std::vector<uint32_t>		viewBoxEntities; //Index into drawEntities of each box in viewBoxes
+	CullBoxList					viewBoxes;
+	std::vector<uint32_t>		visibleIndices;
+	std::vector<Entity>			visibleEntities;
+	OcclusionCuller				occlusionCuller; //Filled with the largest visible meshes every frame
+	std::vector<std::pair<float, uint32_t>>	occluderCandidates; //Estimated screen size and index into viewBoxes
+	std::vector<PointLight>		pointLights; //Binned into light clusters by the renderer, the first one casts the point shadow
 
 	bool isBlurEnabled;
+	bool isOcclusionCullingEnabled;
 	SystemsCallback SystemsLoadCallback;
 	SystemsCallback SystemsUnloadCallback;
 	void InitializeAssets();
+	void AddOccluders(const std::vector<Entity>& entities);
 public:
 	Game(HINSTANCE hInstance, int ShowWnd, int width, int height, bool fullscreen);
 	virtual void Initialize() override;
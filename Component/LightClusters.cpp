@@ -0,0 +1,183 @@
+#include "stdafx.h"
+#include "LightClusters.h"
+#include "MathHelper.h"
+#include "SimdLanes.h"
+
+static const uint32_t ClusterRowPadding = 8; //Widest batch
+
+LightClusterGrid::LightClusterGrid(uint32_t tilesX, uint32_t tilesY, uint32_t slices, uint32_t maxLightsPerCluster) :
+	tilesX(tilesX),
+	tilesY(tilesY),
+	slices(slices),
+	rowStride((tilesX + ClusterRowPadding - 1) / ClusterRowPadding * ClusterRowPadding),
+	maxLightsPerCluster(maxLightsPerCluster),
+	nearZ(0.f),
+	farZ(0.f),
+	depthScale(0.f),
+	depthBias(0.f),
+	projectionScale(0.f, 0.f)
+{
+	for (auto& component : bounds)
+	{
+		component.resize(rowStride * tilesY * slices, 0.f);
+	}
+	clusters.resize(GetClusterCount(), LightCluster{ 0, 0 });
+}
+
+void LightClusterGrid::SetProjection(const XMFLOAT4X4 & projection, float nearZ, float farZ)
+{
+	// A view space point at depth d lands at x * scale.x / d in clip space, so the edges of a tile are lines
+	// through the eye and each cluster box is spanned by its corners at the near and far depth of the slice
+	XMFLOAT2 scale(projection._11, projection._22);
+	if (scale.x == projectionScale.x && scale.y == projectionScale.y && nearZ == this->nearZ && farZ == this->farZ)
+		return;
+	projectionScale = scale;
+	this->nearZ = nearZ;
+	this->farZ = farZ;
+
+	auto logRange = logf(farZ / nearZ);
+	depthScale = (float)slices / logRange;
+	depthBias = -(float)slices * logf(nearZ) / logRange;
+
+	for (uint32_t slice = 0; slice < slices; ++slice)
+	{
+		auto sliceNear = nearZ * powf(farZ / nearZ, (float)slice / slices);
+		auto sliceFar = nearZ * powf(farZ / nearZ, (float)(slice + 1) / slices);
+		for (uint32_t y = 0; y < tilesY; ++y)
+		{
+			auto bottom = 1.f - 2.f * (y + 1) / tilesY;
+			auto top = 1.f - 2.f * y / tilesY;
+			auto row = (slice * tilesY + y) * rowStride;
+			for (uint32_t x = 0; x < tilesX; ++x)
+			{
+				auto left = -1.f + 2.f * x / tilesX;
+				auto right = -1.f + 2.f * (x + 1) / tilesX;
+				bounds[0][row + x] = std::min(left * sliceNear, left * sliceFar) / scale.x;
+				bounds[1][row + x] = std::min(bottom * sliceNear, bottom * sliceFar) / scale.y;
+				bounds[2][row + x] = sliceNear;
+				bounds[3][row + x] = std::max(right * sliceNear, right * sliceFar) / scale.x;
+				bounds[4][row + x] = std::max(top * sliceNear, top * sliceFar) / scale.y;
+				bounds[5][row + x] = sliceFar;
+			}
+		}
+	}
+}
+
+uint32_t LightClusterGrid::GetSlice(float viewDepth) const
+{
+	if (viewDepth <= nearZ)
+		return 0;
+	auto slice = (int32_t)floorf(logf(viewDepth) * depthScale + depthBias);
+	return (uint32_t)std::min(std::max(slice, 0), (int32_t)slices - 1);
+}
+
+BoundingBox LightClusterGrid::GetClusterBounds(uint32_t x, uint32_t y, uint32_t slice) const
+{
+	auto i = (slice * tilesY + y) * rowStride + x;
+	return BoundingBox(
+		XMFLOAT3((bounds[0][i] + bounds[3][i]) * 0.5f, (bounds[1][i] + bounds[4][i]) * 0.5f, (bounds[2][i] + bounds[5][i]) * 0.5f),
+		XMFLOAT3((bounds[3][i] - bounds[0][i]) * 0.5f, (bounds[4][i] - bounds[1][i]) * 0.5f, (bounds[5][i] - bounds[2][i]) * 0.5f));
+}
+
+template<typename L>
+SIMD_KERNEL_INLINE inline void LightClusterGrid::BinLights(const PointLight * lights, uint32_t count, const XMFLOAT4X4 & view)
+{
+	typedef typename L::Vec Vec;
+	auto viewMatrix = XMLoadFloat4x4(&view);
+	auto zero = L::Set1(0.f);
+	for (uint32_t light = 0; light < count; ++light)
+	{
+		XMFLOAT3 center;
+		XMStoreFloat3(&center, XMVector3Transform(XMLoadFloat3(&lights[light].Position), viewMatrix));
+		auto radius = lights[light].Range;
+		if (center.z + radius < nearZ || center.z - radius > farZ)
+			continue;
+
+		const Vec centers[3] = { L::Set1(center.x), L::Set1(center.y), L::Set1(center.z) };
+		auto radiusSq = L::Set1(radius * radius);
+		auto lastSlice = GetSlice(center.z + radius);
+		for (auto slice = GetSlice(center.z - radius); slice <= lastSlice; ++slice)
+		{
+			for (uint32_t y = 0; y < tilesY; ++y)
+			{
+				// Boxes of a row share their y range, which rejects most rows without looking at the tiles
+				auto row = (slice * tilesY + y) * rowStride;
+				if (center.y + radius < bounds[1][row] || center.y - radius > bounds[4][row])
+					continue;
+
+				for (uint32_t x = 0; x < tilesX; x += L::Width)
+				{
+					// Distance from the center to the closest point of each box
+					auto distanceSq = zero;
+					for (int axis = 0; axis < 3; ++axis)
+					{
+						auto below = L::Sub(L::Load(&bounds[axis][row + x]), centers[axis]);
+						auto above = L::Sub(centers[axis], L::Load(&bounds[axis + 3][row + x]));
+						auto gap = L::Max(L::Max(below, above), zero);
+						distanceSq = L::Add(distanceSq, L::Mul(gap, gap));
+					}
+
+					auto lanes = tilesX - x < (uint32_t)L::Width ? tilesX - x : (uint32_t)L::Width;
+					auto hits = L::Mask(L::LessEqual(distanceSq, radiusSq)) & ((1u << lanes) - 1u);
+					for (uint32_t i = 0; hits != 0; ++i, hits >>= 1)
+					{
+						if (hits & 1u)
+						{
+							hitClusters.push_back(GetClusterIndex(x + i, y, slice));
+							hitLights.push_back(light);
+						}
+					}
+				}
+			}
+		}
+	}
+	L::Finish();
+}
+
+#ifdef SIMD_LANES_AVX2
+SIMD_AVX2_KERNEL void LightClusterGrid::BinLightsAvx2(const PointLight * lights, uint32_t count, const XMFLOAT4X4 & view)
+{
+	BinLights<Avx2Lanes>(lights, count, view);
+}
+#endif
+
+void LightClusterGrid::Build(const PointLight * lights, uint32_t count, const XMFLOAT4X4 & view)
+{
+	hitClusters.clear();
+	hitLights.clear();
+	if (count > 0 && farZ > nearZ)
+	{
+#ifdef SIMD_LANES_AVX2
+		if (tilesX > SseLanes::Width && CpuSupportsAvx2())
+			BinLightsAvx2(lights, count, view);
+		else
+#endif
+			BinLights<SseLanes>(lights, count, view);
+	}
+
+	// Counting sort of the overlaps by cluster. Overlaps were found light after light, so each cluster's lights
+	// come out in light order and the ones past the cap are the last lights.
+	for (auto& cluster : clusters)
+	{
+		cluster.Count = 0;
+	}
+	for (auto cluster : hitClusters)
+	{
+		clusters[cluster].Count++;
+	}
+	uint32_t offset = 0;
+	for (auto& cluster : clusters)
+	{
+		cluster.Offset = offset;
+		offset += std::min(cluster.Count, maxLightsPerCluster);
+		cluster.Count = 0;
+	}
+
+	lightIndices.resize(offset);
+	for (size_t i = 0; i < hitClusters.size(); ++i)
+	{
+		auto& cluster = clusters[hitClusters[i]];
+		if (cluster.Count < maxLightsPerCluster)
+			lightIndices[cluster.Offset + cluster.Count++] = hitLights[i];
+	}
+}
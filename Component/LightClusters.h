@@ -0,0 +1,70 @@
+#pragma once
+#include "stdafx.h"
+#include <vector>
+#include "Core/Light.h"
+
+static const uint32_t DefaultClusterTilesX = 16;
+static const uint32_t DefaultClusterTilesY = 9;
+static const uint32_t DefaultClusterSlices = 24;
+static const uint32_t DefaultMaxLightsPerCluster = 128;
+
+//! Range of one cluster in the light index list
+struct LightCluster
+{
+	uint32_t	Offset;
+	uint32_t	Count;
+};
+
+//! Bins point lights into view space clusters, screen tiles split into depth slices that grow exponentially with
+//! distance. Every cluster lists the lights whose sphere overlaps its box, so a pixel only shades the lights of
+//! the cluster it falls into. Clusters are indexed (slice * tilesY + y) * tilesX + x, with tile row 0 at the top
+//! of the screen.
+class LightClusterGrid
+{
+	uint32_t					tilesX;
+	uint32_t					tilesY;
+	uint32_t					slices;
+	uint32_t					rowStride; //tilesX padded to the widest batch
+	uint32_t					maxLightsPerCluster;
+	float						nearZ;
+	float						farZ;
+	float						depthScale;
+	float						depthBias;
+	XMFLOAT2					projectionScale;
+
+	std::vector<float>			bounds[6]; //Min xyz and max xyz of every cluster box, one row of tiles after another
+	std::vector<LightCluster>	clusters;
+	std::vector<uint32_t>		lightIndices;
+	std::vector<uint32_t>		hitClusters; //Cluster and light of every overlap found while binning
+	std::vector<uint32_t>		hitLights;
+
+	template<typename L>
+	void						BinLights(const PointLight* lights, uint32_t count, const XMFLOAT4X4& view);
+	//! BinLights over Avx2Lanes compiled for AVX2, only called when the CPU supports it
+	void						BinLightsAvx2(const PointLight* lights, uint32_t count, const XMFLOAT4X4& view);
+public:
+	LightClusterGrid(uint32_t tilesX = DefaultClusterTilesX, uint32_t tilesY = DefaultClusterTilesY, uint32_t slices = DefaultClusterSlices,
+		uint32_t maxLightsPerCluster = DefaultMaxLightsPerCluster);
+
+	//! Rebuilds the cluster boxes, cheap to call every frame as nothing happens while the projection stays the same.
+	//! projection is a symmetric perspective projection like XMMatrixPerspectiveFovLH builds.
+	void						SetProjection(const XMFLOAT4X4& projection, float nearZ, float farZ);
+	//! Fills the cluster ranges and light index list for lights in world space, seen through view. A cluster
+	//! keeps the first maxLightsPerCluster lights that reach it, in light order.
+	void						Build(const PointLight* lights, uint32_t count, const XMFLOAT4X4& view);
+
+	//! Slice of a view space depth, clamped to the grid
+	uint32_t					GetSlice(float viewDepth) const;
+	BoundingBox					GetClusterBounds(uint32_t x, uint32_t y, uint32_t slice) const;
+	inline uint32_t				GetClusterIndex(uint32_t x, uint32_t y, uint32_t slice) const { return (slice * tilesY + y) * tilesX + x; }
+	inline uint32_t				GetClusterCount() const { return tilesX * tilesY * slices; }
+	inline uint32_t				GetTilesX() const { return tilesX; }
+	inline uint32_t				GetTilesY() const { return tilesY; }
+	inline uint32_t				GetSlices() const { return slices; }
+	inline uint32_t				GetMaxLightsPerCluster() const { return maxLightsPerCluster; }
+	//! slice = log(viewDepth) * depthScale + depthBias, for shaders finding the cluster of a pixel
+	inline float				GetDepthScale() const { return depthScale; }
+	inline float				GetDepthBias() const { return depthBias; }
+	inline const std::vector<LightCluster>&	GetClusters() const { return clusters; }
+	inline const std::vector<uint32_t>&		GetLightIndices() const { return lightIndices; }
+};
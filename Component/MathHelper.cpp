@@ -1,5 +1,9 @@
 #include "stdafx.h"
 #include "MathHelper.h"
+#include <atomic>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 XMFLOAT4X4 GetWorldViewProjectionTransposed(const XMFLOAT4X4 & world, const XMFLOAT4X4 & view, const XMFLOAT4X4 & projection)
 {
@@ -19,3 +23,82 @@ XMFLOAT4X4 Transpose(const XMFLOAT4X4 & matrix)
 	XMStoreFloat4x4(&matT, XMMatrixTranspose(mat));
 	return matT;
 }
+
+XMFLOAT4 QuaternionFromEuler(const XMFLOAT3 & rotation)
+{
+	XMFLOAT4 quaternion;
+	XMStoreFloat4(&quaternion, XMQuaternionRotationRollPitchYawFromVector(XMLoadFloat3(&rotation)));
+	return quaternion;
+}
+
+XMFLOAT3 EulerFromQuaternion(const XMFLOAT4 & q)
+{
+	// Pitch, yaw and roll read back from the rotation matrix XMMatrixRotationRollPitchYaw builds
+	auto m20 = 2.f * (q.x * q.z + q.y * q.w);
+	auto m21 = 2.f * (q.y * q.z - q.x * q.w);
+	auto m22 = 1.f - 2.f * (q.x * q.x + q.y * q.y);
+	auto cosPitch = sqrtf(m20 * m20 + m22 * m22);
+	XMFLOAT3 rotation;
+	rotation.x = atan2f(-m21, cosPitch); //atan2 instead of asin keeps precision close to the poles
+	if (cosPitch > 1e-5f)
+	{
+		rotation.y = atan2f(m20, m22);
+		rotation.z = atan2f(2.f * (q.x * q.y + q.z * q.w), 1.f - 2.f * (q.x * q.x + q.z * q.z));
+	}
+	else
+	{
+		rotation.y = atan2f(-2.f * (q.x * q.z - q.y * q.w), 1.f - 2.f * (q.y * q.y + q.z * q.z));
+		rotation.z = 0.f;
+	}
+	return rotation;
+}
+
+XMFLOAT4X4 InterpolateTransform(const XMFLOAT4X4 & from, const XMFLOAT4X4 & to, float alpha)
+{
+	// Most entities did not move between two ticks
+	if (memcmp(&from, &to, sizeof(XMFLOAT4X4)) == 0)
+		return to;
+
+	XMVECTOR fromScale, fromRotation, fromTranslation, toScale, toRotation, toTranslation;
+	if (!XMMatrixDecompose(&fromScale, &fromRotation, &fromTranslation, XMLoadFloat4x4(&from)) ||
+		!XMMatrixDecompose(&toScale, &toRotation, &toTranslation, XMLoadFloat4x4(&to)))
+		return to;
+
+	auto scale = XMVectorLerp(fromScale, toScale, alpha);
+	auto rotation = XMQuaternionSlerp(fromRotation, toRotation, alpha);
+	auto translation = XMVectorLerp(fromTranslation, toTranslation, alpha);
+	XMFLOAT4X4 result;
+	XMStoreFloat4x4(&result, XMMatrixScalingFromVector(scale) * XMMatrixRotationQuaternion(rotation) * XMMatrixTranslationFromVector(translation));
+	return result;
+}
+
+static bool DetectAvx2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+	__cpuid(info, 1);
+	bool osSavesYmm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6; //OSXSAVE, then XMM and YMM state enabled
+	if (!osSavesYmm || (info[2] & (1 << 28)) == 0)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+static std::atomic<bool> avx2Enabled(true);
+
+bool CpuSupportsAvx2()
+{
+	static const bool supported = DetectAvx2();
+	return supported && avx2Enabled.load(std::memory_order_relaxed);
+}
+
+void SetAvx2Enabled(bool enabled)
+{
+	avx2Enabled.store(enabled, std::memory_order_relaxed);
+}
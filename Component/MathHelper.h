@@ -4,3 +4,15 @@
 
 XMFLOAT4X4 GetWorldViewProjectionTransposed(const XMFLOAT4X4& world, const XMFLOAT4X4& view, const XMFLOAT4X4& projection);
 XMFLOAT4X4 Transpose(const XMFLOAT4X4& matrix);
+
+//! Unit quaternion of XMMatrixRotationRollPitchYaw for pitch, yaw and roll in radians
+XMFLOAT4 QuaternionFromEuler(const XMFLOAT3& rotation);
+//! Pitch, yaw and roll in radians of a unit quaternion. Roll is 0 at gimbal lock.
+XMFLOAT3 EulerFromQuaternion(const XMFLOAT4& quaternion);
+//! Blends two scale, rotation, translation matrices, lerping scale and translation and slerping rotation
+XMFLOAT4X4 InterpolateTransform(const XMFLOAT4X4& from, const XMFLOAT4X4& to, float alpha);
+
+//! True when the CPU and OS support AVX2, checked once, and the AVX2 kernels are enabled
+bool CpuSupportsAvx2();
+//! Enabled by default. Disabling makes every batch kernel take its SSE path, to compare the two.
+void SetAvx2Enabled(bool enabled);
@@ -0,0 +1,249 @@
+#include "stdafx.h"
+#include "MemoryPool.h"
+
+static const size_t MinPageSize = 64 * 1024;
+static const size_t MinPageBlocks = 16;
+static const uint32_t CacheBatch = 32; //Blocks moved between a thread cache and its pool at once
+
+static std::mutex registryLock;
+static std::vector<FixedBlockPool*>& GetRegistry()
+{
+	static std::vector<FixedBlockPool*> pools; //Indexed by pool index, null once a pool is destroyed
+	return pools;
+}
+
+static byte* AllocatePageMemory(size_t size, size_t alignment)
+{
+#ifdef _WIN32
+	return (byte*)_aligned_malloc(size, alignment);
+#else
+	return (byte*)aligned_alloc(alignment, size);
+#endif
+}
+
+static void FreePageMemory(byte* memory)
+{
+#ifdef _WIN32
+	_aligned_free(memory);
+#else
+	free(memory);
+#endif
+}
+
+//! Thread caches of every pool. Blocks still cached when a thread exits go back to their pool if it is alive.
+struct PoolThreadCaches
+{
+	std::vector<FixedBlockPool::ThreadCache> Caches;
+
+	~PoolThreadCaches()
+	{
+		std::lock_guard<std::mutex> lock(registryLock);
+		auto& registry = GetRegistry();
+		for (uint32_t i = 0; i < Caches.size(); ++i)
+		{
+			auto pool = registry[i];
+			auto& cache = Caches[i];
+			if (pool == nullptr || cache.Generation != pool->generation)
+				continue;
+			pool->Flush(cache, cache.Count);
+		}
+	}
+};
+
+static thread_local PoolThreadCaches threadCaches;
+
+FixedBlockPool::FixedBlockPool(const char * name, size_t blockSize, size_t blockAlignment) :
+	name(name),
+	generation(0),
+	freeList(nullptr),
+	freeCount(0),
+	allocations(0),
+	frees(0),
+	peakLiveBlocks(0)
+{
+	// Free blocks hold the next pointer, so blocks are at least pointer sized
+	this->blockAlignment = blockAlignment < alignof(BlockLink) ? alignof(BlockLink) : blockAlignment;
+	this->blockSize = blockSize < sizeof(BlockLink) ? sizeof(BlockLink) : blockSize;
+	this->blockSize = (this->blockSize + this->blockAlignment - 1) / this->blockAlignment * this->blockAlignment;
+
+	pageSize = this->blockSize * MinPageBlocks;
+	if (pageSize < MinPageSize)
+		pageSize = MinPageSize;
+	pageSize = (pageSize + this->blockAlignment - 1) / this->blockAlignment * this->blockAlignment;
+
+	std::lock_guard<std::mutex> lock(registryLock);
+	auto& registry = GetRegistry();
+	poolIndex = (uint32_t)registry.size();
+	registry.push_back(this);
+}
+
+FixedBlockPool::ThreadCache & FixedBlockPool::GetThreadCache()
+{
+	auto& caches = threadCaches.Caches;
+	if (poolIndex >= caches.size())
+	{
+		caches.resize(poolIndex + 1, ThreadCache{ nullptr, 0, 0, 0, 0 });
+	}
+
+	auto& cache = caches[poolIndex];
+	auto currentGeneration = generation.load(std::memory_order_acquire);
+	if (cache.Generation != currentGeneration) //Pool was reset, cached blocks are gone
+	{
+		cache = ThreadCache{ nullptr, 0, currentGeneration, 0, 0 };
+	}
+	return cache;
+}
+
+void FixedBlockPool::AllocatePage()
+{
+	auto page = AllocatePageMemory(pageSize, blockAlignment);
+	pages.push_back(page);
+	auto blockCount = pageSize / blockSize;
+	for (size_t i = blockCount; i > 0; --i) //Linked in reverse so blocks are handed out in address order
+	{
+		auto block = (BlockLink*)(page + (i - 1) * blockSize);
+		block->Next = freeList;
+		freeList = block;
+	}
+	freeCount += blockCount;
+}
+
+void FixedBlockPool::ReportCounts(ThreadCache & cache)
+{
+	allocations += cache.Allocations;
+	frees += cache.Frees;
+	cache.Allocations = 0;
+	cache.Frees = 0;
+	auto live = allocations > frees ? allocations - frees : 0;
+	if (live > peakLiveBlocks)
+		peakLiveBlocks = live;
+}
+
+void FixedBlockPool::Refill(ThreadCache & cache)
+{
+	std::lock_guard<std::mutex> lock(poolLock);
+	ReportCounts(cache);
+	while (freeCount < CacheBatch)
+	{
+		AllocatePage();
+	}
+
+	for (uint32_t i = 0; i < CacheBatch; ++i)
+	{
+		auto block = freeList;
+		freeList = block->Next;
+		block->Next = cache.Head;
+		cache.Head = block;
+	}
+	freeCount -= CacheBatch;
+	cache.Count += CacheBatch;
+}
+
+void FixedBlockPool::Flush(ThreadCache & cache, uint32_t count)
+{
+	std::lock_guard<std::mutex> lock(poolLock);
+	ReportCounts(cache);
+	for (uint32_t i = 0; i < count && cache.Head != nullptr; ++i)
+	{
+		auto block = cache.Head;
+		cache.Head = block->Next;
+		block->Next = freeList;
+		freeList = block;
+		cache.Count--;
+		freeCount++;
+	}
+}
+
+void * FixedBlockPool::AllocateBlock()
+{
+	auto& cache = GetThreadCache();
+	if (cache.Head == nullptr)
+		Refill(cache);
+
+	auto block = cache.Head;
+	cache.Head = block->Next;
+	cache.Count--;
+	cache.Allocations++;
+	return block;
+}
+
+void FixedBlockPool::FreeBlock(void * block)
+{
+	if (block == nullptr)
+		return;
+
+	auto& cache = GetThreadCache();
+	auto freeBlock = (BlockLink*)block;
+	freeBlock->Next = cache.Head;
+	cache.Head = freeBlock;
+	cache.Count++;
+	cache.Frees++;
+	if (cache.Count >= CacheBatch * 2)
+		Flush(cache, CacheBatch);
+}
+
+void FixedBlockPool::FreeBlocks(void ** blocks, size_t count)
+{
+	std::lock_guard<std::mutex> lock(poolLock);
+	for (size_t i = 0; i < count; ++i)
+	{
+		auto block = (BlockLink*)blocks[i];
+		block->Next = freeList;
+		freeList = block;
+	}
+	freeCount += count;
+	frees += count;
+}
+
+void FixedBlockPool::Reset()
+{
+	std::lock_guard<std::mutex> lock(poolLock);
+	for (auto page : pages)
+	{
+		FreePageMemory(page);
+	}
+	pages.clear();
+	freeList = nullptr;
+	freeCount = 0;
+	frees = allocations;
+	generation++;
+}
+
+void FixedBlockPool::GetStats(MemoryPoolStats & outStats)
+{
+	std::lock_guard<std::mutex> lock(poolLock);
+	outStats.Name = name;
+	outStats.BlockSize = blockSize;
+	outStats.Allocations = allocations;
+	outStats.Frees = frees;
+	outStats.LiveBlocks = allocations > frees ? allocations - frees : 0;
+	outStats.PeakLiveBlocks = peakLiveBlocks;
+	outStats.PageCount = pages.size();
+	outStats.ReservedBytes = pages.size() * pageSize;
+}
+
+void FixedBlockPool::GetAllStats(std::vector<MemoryPoolStats>& outStats)
+{
+	std::lock_guard<std::mutex> lock(registryLock);
+	for (auto pool : GetRegistry())
+	{
+		if (pool == nullptr)
+			continue;
+		MemoryPoolStats stats;
+		pool->GetStats(stats);
+		outStats.push_back(stats);
+	}
+}
+
+FixedBlockPool::~FixedBlockPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(registryLock);
+		GetRegistry()[poolIndex] = nullptr;
+	}
+
+	for (auto page : pages)
+	{
+		FreePageMemory(page);
+	}
+}
@@ -0,0 +1,164 @@
+#pragma once
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <new>
+#include <typeinfo>
+#include <utility>
+
+//! Counters of one pool. Thread caches report in batches, so values can lag by one batch per thread.
+struct MemoryPoolStats
+{
+	const char*	Name;
+	size_t		BlockSize;
+	size_t		Allocations;
+	size_t		Frees;
+	size_t		LiveBlocks;
+	size_t		PeakLiveBlocks;
+	size_t		PageCount;
+	size_t		ReservedBytes;
+};
+
+//! Type erased fixed size block pool. Blocks are carved from large pages and handed out through a
+//! small per thread cache, so the pool lock is only taken once per batch of allocations or frees.
+class FixedBlockPool
+{
+	friend struct PoolThreadCaches;
+
+	struct BlockLink
+	{
+		BlockLink* Next;
+	};
+
+	//! Per thread, per pool list of free blocks
+	struct ThreadCache
+	{
+		BlockLink*	Head;
+		uint32_t	Count;
+		uint32_t	Generation;
+		size_t		Allocations;
+		size_t		Frees;
+	};
+
+	const char*				name;
+	size_t					blockSize;
+	size_t					blockAlignment;
+	size_t					pageSize;
+	uint32_t				poolIndex;
+	std::atomic<uint32_t>	generation; //Bumped by Reset so thread caches drop blocks of freed pages
+
+	std::mutex				poolLock;
+	BlockLink*				freeList;
+	size_t					freeCount;
+	std::vector<byte*>		pages;
+	size_t					allocations;
+	size_t					frees;
+	size_t					peakLiveBlocks;
+
+	ThreadCache&			GetThreadCache();
+	void					Refill(ThreadCache& cache);
+	void					Flush(ThreadCache& cache, uint32_t count);
+	void					ReportCounts(ThreadCache& cache);
+	void					AllocatePage();
+public:
+	FixedBlockPool(const char* name, size_t blockSize, size_t blockAlignment);
+
+	void*					AllocateBlock();
+	void					FreeBlock(void* block);
+	//! Returns many blocks under a single lock, bypassing the thread cache
+	void					FreeBlocks(void** blocks, size_t count);
+	//! Releases every page at once. Only valid when no block is in use anymore.
+	void					Reset();
+	void					GetStats(MemoryPoolStats& outStats);
+
+	//! Stats of every pool alive in the process
+	static void				GetAllStats(std::vector<MemoryPoolStats>& outStats);
+	virtual ~FixedBlockPool();
+};
+
+template<typename T>
+class MemoryPool : public FixedBlockPool
+{
+public:
+	MemoryPool() : FixedBlockPool(typeid(T).name(), sizeof(T), alignof(T)) {}
+
+	//! Uninitialized storage for one T
+	T* Allocate()
+	{
+		return (T*)AllocateBlock();
+	}
+
+	template<typename... Args>
+	T* New(Args&&... args)
+	{
+		return new (AllocateBlock()) T(std::forward<Args>(args)...);
+	}
+
+	void Destroy(T* block)
+	{
+		if (block == nullptr)
+			return;
+		block->~T();
+		FreeBlock(block);
+	}
+
+	void Destroy(T** blocks, size_t count)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			blocks[i]->~T();
+		}
+		FreeBlocks((void**)blocks, count);
+	}
+};
+
+//! One pool per type, created on first use
+class PoolAllocator
+{
+public:
+	template<typename T>
+	static MemoryPool<T>& GetPool()
+	{
+		static MemoryPool<T> pool;
+		return pool;
+	}
+
+	template<typename T, typename... Args>
+	static T* New(Args&&... args)
+	{
+		return GetPool<T>().New(std::forward<Args>(args)...);
+	}
+
+	template<typename T>
+	static void Delete(T* object)
+	{
+		GetPool<T>().Destroy(object);
+	}
+
+	static void GetStats(std::vector<MemoryPoolStats>& outStats)
+	{
+		FixedBlockPool::GetAllStats(outStats);
+	}
+};
+
+//! Routes a class's new/delete through its pool. Used by GameComponent so Clone results and command
+//! buffer copies do not hit the global heap. Placement new is redeclared since the class overloads hide it.
+#define PooledAllocation(type) \
+static void* operator new(size_t size) \
+{ \
+	return size == sizeof(type) ? PoolAllocator::GetPool<type>().AllocateBlock() : ::operator new(size); \
+} \
+static void operator delete(void* block, size_t size) \
+{ \
+	if (size == sizeof(type)) \
+		PoolAllocator::GetPool<type>().FreeBlock(block); \
+	else \
+		::operator delete(block); \
+} \
+static void* operator new(size_t, void* where) \
+{ \
+	return where; \
+} \
+static void operator delete(void*, void*) \
+{ \
+}
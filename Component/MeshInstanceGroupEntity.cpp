@@ -77,6 +77,11 @@ const uint32_t MeshInstanceGroupEntity::GetInstanceCount()
 	return (uint32_t)transforms.size();
 }
 
+const std::vector<XMFLOAT4X4>& MeshInstanceGroupEntity::GetInstanceTransforms()
+{
+	return transforms;
+}
+
 const D3D12_VERTEX_BUFFER_VIEW & MeshInstanceGroupEntity::GetInstanceBufferView()
 {
 	return vBufferView;
@@ -26,6 +26,8 @@ public:
 	const std::vector<HashID>& GetMeshIDs();
 	const std::vector<HashID>& GetMaterialIDs();
 	const uint32_t GetInstanceCount();
+	//! Transposed world matrices, as uploaded to the instance buffer
+	const std::vector<XMFLOAT4X4>& GetInstanceTransforms();
 	const D3D12_VERTEX_BUFFER_VIEW& GetInstanceBufferView();
 	const bool& CastsShadow();
 	void SetCastsShadow(bool enable);
@@ -1,8 +1,14 @@
 #include "stdafx.h"
 #include "Node.h"
-#include <queue>
+#include "ThreadPool.h"
+#include "TransformBatch.h"
+#include <algorithm>
 
-Node::Node()
+static const size_t ComposeBlockSize = 64; //Sorted entries whose changed transforms are composed in one batch
+
+Node::Node() :
+	parent(-1),
+	childIndex(0)
 {
 }
 
@@ -11,52 +17,128 @@ Node::~Node()
 {
 }
 
-XMMATRIX XM_CALLCONV GetTransformation(const XMFLOAT3 & position, const XMFLOAT3 & scale, const XMFLOAT3 & rotation)
+XMMATRIX XM_CALLCONV GetTransformation(const XMFLOAT3 & position, const XMFLOAT3 & scale, const XMFLOAT4 & rotation)
 {
-	XMMATRIX translationM = XMMatrixTranslationFromVector(XMLoadFloat3(&position));
-	XMMATRIX rotationM = XMMatrixRotationRollPitchYawFromVector(XMLoadFloat3(&rotation));
-	XMMATRIX scaleM = XMMatrixScalingFromVector(XMLoadFloat3(&scale));
-	auto transformation =  scaleM * rotationM * translationM;
-	return transformation;
+	// Same kernel as the batched updates so single node and batched results match
+	TransformSOA transform = { const_cast<XMFLOAT3*>(&position), const_cast<XMFLOAT4*>(&rotation), const_cast<XMFLOAT3*>(&scale), 1 };
+	XMFLOAT4X4 transformation;
+	ComposeTransforms(transform, &transformation);
+	return XMLoadFloat4x4(&transformation);
 }
 
-void UpdateNode(Node & node, const Node& parentNode, const XMFLOAT3 & position, const XMFLOAT3 & scale, const XMFLOAT3 & rotation)
+//! Arrays shared by every entry of one update
+struct NodeUpdateArrays
 {
-	auto transformation = GetTransformation(position, scale, rotation);
-	XMStoreFloat4x4(&node.localTransform, transformation);
-	transformation = transformation * XMLoadFloat4x4(&parentNode.worldTransform) ;
-	XMStoreFloat4x4(&node.worldTransform, transformation);
-}
+	const NodeID*	SortedNodes;
+	const uint32_t*	SortedParents;
+	TransformSOA	Transforms;
+	const byte*		IsActive;
+	const byte*		Dirty;
+	byte*			NodeStates;
+	XMFLOAT4X4*		WorldTransforms;
+};
 
-void UpdateRootNode(Node & node, const XMFLOAT3 & position, const XMFLOAT3 & scale, const XMFLOAT3 & rotation)
+//! Sets the state of one sorted entry from its parent's, returns true if its world transform has to be recomputed
+static inline bool UpdateEntryState(size_t i, const NodeUpdateArrays& arrays)
 {
-	auto transformation = GetTransformation(position, scale, rotation);
-	XMStoreFloat4x4(&node.localTransform, transformation);
-	node.worldTransform = node.localTransform;
-}
+	auto nodeId = arrays.SortedNodes[i];
+	auto parentState = arrays.NodeStates[arrays.SortedParents[i]];
+	if (!arrays.IsActive[nodeId] || !(parentState & NodeStateActive))
+	{
+		arrays.NodeStates[i] = NodeStateInactive;
+		return false;
+	}
 
-void UpdateNodes(Node* nodes, size_t count, XMFLOAT3 * positions, XMFLOAT3 * scales, XMFLOAT3 * rotations, byte* isActive)
-{
-	UpdateRootNode(nodes[0], positions[0], scales[0], rotations[0]);
-	std::queue<NodeID> nodeQueue;
-	for (auto child : nodes[0].children) //Skip root node
+	if (!arrays.Dirty[nodeId] && !(parentState & NodeStateChanged))
 	{
-		nodeQueue.push(child);
+		arrays.NodeStates[i] = NodeStateActive;
+		return false;
 	}
 
-	while (!nodeQueue.empty()) //TODO: Serialize this further to update nodes without queue
+	arrays.NodeStates[i] = NodeStateActive | NodeStateChanged;
+	return true;
+}
+
+//! Updates count sorted entries, the j-th being entryAt(j), in order. Local transforms of the changed entries of a block are
+//! composed together and then multiplied by their parents in order, so a parent in the same block is done first.
+//! Shared by the serial and subtree passes so both give identical results.
+template<typename EntryFunc>
+static void UpdateEntries(size_t count, EntryFunc entryAt, const NodeUpdateArrays& arrays, std::vector<NodeID>* outChangedNodes)
+{
+	NodeID changedNodes[ComposeBlockSize];
+	size_t changedEntries[ComposeBlockSize];
+	XMFLOAT4X4 localTransforms[ComposeBlockSize];
+	for (size_t begin = 0; begin < count; begin += ComposeBlockSize)
 	{
-		auto nodeId = nodeQueue.front();
-		nodeQueue.pop();
-		auto &node = nodes[nodeId];
-		auto parent = nodes[node.parent];
-		if (isActive[nodeId])
+		auto end = begin + ComposeBlockSize < count ? begin + ComposeBlockSize : count;
+		size_t changedCount = 0;
+		for (auto j = begin; j < end; ++j)
+		{
+			auto i = entryAt(j);
+			if (!UpdateEntryState(i, arrays))
+				continue;
+			changedEntries[changedCount] = i;
+			changedNodes[changedCount++] = arrays.SortedNodes[i];
+		}
+
+		ComposeTransforms(arrays.Transforms, changedNodes, changedCount, localTransforms);
+		for (size_t k = 0; k < changedCount; ++k)
 		{
-			UpdateNode(node, parent, positions[nodeId], scales[nodeId], rotations[nodeId]);
-			for (auto child : node.children) //Skip root node
-			{
-				nodeQueue.push(child);
-			}
+			auto parent = arrays.SortedNodes[arrays.SortedParents[changedEntries[k]]];
+			auto transformation = XMLoadFloat4x4(&localTransforms[k]) * XMLoadFloat4x4(&arrays.WorldTransforms[parent]);
+			XMStoreFloat4x4(&arrays.WorldTransforms[changedNodes[k]], transformation);
 		}
+		if (outChangedNodes != nullptr)
+			outChangedNodes->insert(outChangedNodes->end(), changedNodes, changedNodes + changedCount);
 	}
 }
+
+static void UpdateRootEntry(const NodeUpdateArrays& arrays)
+{
+	auto root = arrays.SortedNodes[0];
+	arrays.NodeStates[0] = NodeStateActive;
+	if (arrays.Dirty[root])
+	{
+		XMStoreFloat4x4(&arrays.WorldTransforms[root], GetTransformation(arrays.Transforms.Position[root], arrays.Transforms.Scale[root], arrays.Transforms.Rotation[root]));
+		arrays.NodeStates[0] |= NodeStateChanged;
+	}
+}
+
+static NodeUpdateArrays MakeUpdateArrays(const NodeID* sortedNodes, const uint32_t* sortedParents, const XMFLOAT3* positions, const XMFLOAT3* scales,
+	const XMFLOAT4* rotations, const byte* isActive, const byte* dirty, byte* nodeStates, XMFLOAT4X4* worldTransforms)
+{
+	TransformSOA transforms = { const_cast<XMFLOAT3*>(positions), const_cast<XMFLOAT4*>(rotations), const_cast<XMFLOAT3*>(scales), 0 };
+	return NodeUpdateArrays{ sortedNodes, sortedParents, transforms, isActive, dirty, nodeStates, worldTransforms };
+}
+
+void UpdateNodes(const NodeID* sortedNodes, const uint32_t* sortedParents, size_t count, const XMFLOAT3* positions, const XMFLOAT3* scales,
+	const XMFLOAT4* rotations, const byte* isActive, const byte* dirty, byte* nodeStates, XMFLOAT4X4* worldTransforms,
+	std::vector<NodeID>& outChangedNodes)
+{
+	auto arrays = MakeUpdateArrays(sortedNodes, sortedParents, positions, scales, rotations, isActive, dirty, nodeStates, worldTransforms);
+	UpdateRootEntry(arrays);
+	if (nodeStates[0] & NodeStateChanged)
+		outChangedNodes.push_back(sortedNodes[0]);
+
+	UpdateEntries(count - 1, [](size_t j) { return j + 1; }, arrays, &outChangedNodes);
+}
+
+void UpdateNodesBySubtree(const NodeID* sortedNodes, const uint32_t* sortedParents, const uint32_t* subtreeEntries, const uint32_t* subtreeStarts, size_t subtreeCount,
+	const XMFLOAT3* positions, const XMFLOAT3* scales, const XMFLOAT4* rotations, const byte* isActive, const byte* dirty, byte* nodeStates,
+	XMFLOAT4X4* worldTransforms)
+{
+	auto arrays = MakeUpdateArrays(sortedNodes, sortedParents, positions, scales, rotations, isActive, dirty, nodeStates, worldTransforms);
+	UpdateRootEntry(arrays);
+
+	// Batches are sized in entries, not subtrees, so a few large subtrees still spread over the workers. A subtree
+	// goes to the batch its first entry falls in, batches past the end of a large subtree are left empty.
+	size_t entryCount = subtreeStarts[subtreeCount];
+	auto batchSize = ThreadPool::GetBatchSize(entryCount, sizeof(XMFLOAT4X4));
+	ThreadPool::ParallelFor((entryCount + batchSize - 1) / batchSize, 1, [&](size_t begin, size_t end)
+	{
+		auto firstSubtree = std::lower_bound(subtreeStarts, subtreeStarts + subtreeCount, (uint32_t)(begin * batchSize)) - subtreeStarts;
+		auto lastSubtree = std::lower_bound(subtreeStarts, subtreeStarts + subtreeCount, (uint32_t)(end * batchSize)) - subtreeStarts;
+		auto first = subtreeStarts[firstSubtree];
+		UpdateEntries(subtreeStarts[lastSubtree] - first, [&](size_t j) { return (size_t)subtreeEntries[first + j]; }, arrays, nullptr);
+	});
+}
@@ -5,21 +5,38 @@
 struct Node
 {
 public:
-
-	//Actual Transforms
-	XMFLOAT4X4			localTransform;
-	XMFLOAT4X4			worldTransform;
-
 	//Node information
 	std::vector<NodeID>	children;
 	NodeID				parent;
+	uint32_t			childIndex; //Position in the parent's children, or in Scene's free list while the node is free
 
 	Node();
 	~Node();
 };
 
-void UpdateNode(Node& node, const Node& parentNode, const XMFLOAT3& position, const XMFLOAT3& scale, const XMFLOAT3& rotation);
-void UpdateRootNode(Node& node, const XMFLOAT3& position, const XMFLOAT3& scale, const XMFLOAT3& rotation);
-void UpdateNodes(Node* nodes, size_t count, XMFLOAT3* positions, XMFLOAT3* scales, XMFLOAT3* rotation, byte* isActive);
+//! scale * rotation * translation, rotation is a unit quaternion
+XMMATRIX XM_CALLCONV GetTransformation(const XMFLOAT3& position, const XMFLOAT3& scale, const XMFLOAT4& rotation);
+
+//! Per sorted entry state written by UpdateNodes
+enum NodeUpdateState
+{
+	NodeStateInactive = 0,
+	NodeStateActive = 1,
+	NodeStateChanged = 2 // World transform was recomputed this update
+};
 
+//! Dense transform update over nodes sorted parent before child. sortedParents holds the index in sortedNodes
+//! of each entry's parent, entry 0 is the root. Transform data and dirty flags are indexed by NodeID.
+//! Only dirty nodes and nodes under a changed parent are recomputed and appended to outChangedNodes.
+//! Inactive nodes and their descendants keep their last world transform.
+void UpdateNodes(const NodeID* sortedNodes, const uint32_t* sortedParents, size_t count, const XMFLOAT3* positions, const XMFLOAT3* scales,
+	const XMFLOAT4* rotations, const byte* isActive, const byte* dirty, byte* nodeStates, XMFLOAT4X4* worldTransforms,
+	std::vector<NodeID>& outChangedNodes);
 
+//! Same result as UpdateNodes, bit for bit, with the root's subtrees spread across the thread pool. subtreeEntries lists
+//! the sorted entry indices below the root grouped by the root child they descend from, in sorted order within a group.
+//! Group g spans [subtreeStarts[g], subtreeStarts[g + 1]). Groups are batched by entry count, a single group is never
+//! split. Changed entries are flagged in nodeStates only.
+void UpdateNodesBySubtree(const NodeID* sortedNodes, const uint32_t* sortedParents, const uint32_t* subtreeEntries, const uint32_t* subtreeStarts, size_t subtreeCount,
+	const XMFLOAT3* positions, const XMFLOAT3* scales, const XMFLOAT4* rotations, const byte* isActive, const byte* dirty, byte* nodeStates,
+	XMFLOAT4X4* worldTransforms);
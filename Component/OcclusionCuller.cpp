@@ -0,0 +1,417 @@
+#include "stdafx.h"
+#include "OcclusionCuller.h"
+#include <fstream>
+#include "MathHelper.h"
+#include "SimdLanes.h"
+
+static const uint32_t OcclusionClipPlaneCount = 5;
+static const uint32_t MaxClippedVertices = 3 + OcclusionClipPlaneCount; //Every plane adds at most one vertex
+static const float LaneCenters[8] = { 0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f }; //Pixel centers of a batch
+
+//! Clip space planes a point is inside of when dot(plane, point) >= 0. Near first so the others see w > 0, there
+//! is no far plane as depth past 1 never wins against the cleared buffer.
+static const XMFLOAT4 OcclusionClipPlanes[OcclusionClipPlaneCount] =
+{
+	XMFLOAT4(0.f, 0.f, 1.f, 0.f), //0 <= z
+	XMFLOAT4(1.f, 0.f, 0.f, 1.f), //-w <= x
+	XMFLOAT4(-1.f, 0.f, 0.f, 1.f), //x <= w
+	XMFLOAT4(0.f, 1.f, 0.f, 1.f),
+	XMFLOAT4(0.f, -1.f, 0.f, 1.f)
+};
+
+static inline float PlaneDistance(const XMFLOAT4& plane, const XMFLOAT4& point)
+{
+	return plane.x * point.x + plane.y * point.y + plane.z * point.z + plane.w * point.w;
+}
+
+OcclusionCuller::OcclusionCuller(uint32_t width, uint32_t height) :
+	width((width + OcclusionTileWidth - 1) / OcclusionTileWidth * OcclusionTileWidth),
+	height((height + OcclusionTileHeight - 1) / OcclusionTileHeight * OcclusionTileHeight),
+	workerThreads(true)
+{
+	tilesX = this->width / OcclusionTileWidth;
+	tilesY = this->height / OcclusionTileHeight;
+	tileBins.resize(tilesX * tilesY);
+	XMStoreFloat4x4(&viewProjection, XMMatrixIdentity());
+
+	auto levelWidth = this->width;
+	auto levelHeight = this->height;
+	while (true)
+	{
+		levels.emplace_back(levelWidth * levelHeight, 1.f);
+		levelWidths.push_back(levelWidth);
+		levelHeights.push_back(levelHeight);
+		if (levelWidth == 1 && levelHeight == 1)
+			break;
+		levelWidth = (levelWidth + 1) / 2;
+		levelHeight = (levelHeight + 1) / 2;
+	}
+}
+
+void OcclusionCuller::BeginFrame(const XMFLOAT4X4 & viewProjection)
+{
+	Wait();
+	this->viewProjection = viewProjection;
+	triangles.clear();
+	for (auto& bin : tileBins)
+	{
+		bin.clear();
+	}
+	for (auto& level : levels)
+	{
+		std::fill(level.begin(), level.end(), 1.f);
+	}
+}
+
+void OcclusionCuller::AddOccluder(const XMFLOAT3 * positions, uint32_t stride, const uint32_t * indices, uint32_t indexCount, const XMFLOAT4X4 & world)
+{
+	auto worldViewProjection = XMLoadFloat4x4(&world) * XMLoadFloat4x4(&viewProjection);
+	auto bytes = reinterpret_cast<const uint8_t*>(positions);
+	for (uint32_t i = 0; i + 2 < indexCount; i += 3)
+	{
+		XMFLOAT4 vertices[3];
+		for (uint32_t v = 0; v < 3; ++v)
+		{
+			auto position = reinterpret_cast<const XMFLOAT3*>(bytes + (size_t)indices[i + v] * stride);
+			XMStoreFloat4(&vertices[v], XMVector3Transform(XMLoadFloat3(position), worldViewProjection));
+		}
+		ClipTriangle(vertices);
+	}
+}
+
+void OcclusionCuller::ClipTriangle(const XMFLOAT4 * vertices)
+{
+	uint32_t outside[3] = { 0, 0, 0 };
+	for (uint32_t v = 0; v < 3; ++v)
+	{
+		for (uint32_t plane = 0; plane < OcclusionClipPlaneCount; ++plane)
+		{
+			if (PlaneDistance(OcclusionClipPlanes[plane], vertices[v]) < 0.f)
+				outside[v] |= 1u << plane;
+		}
+	}
+	if (outside[0] & outside[1] & outside[2])
+		return;
+	if ((outside[0] | outside[1] | outside[2]) == 0)
+	{
+		AddTriangle(vertices);
+		return;
+	}
+
+	// Sutherland-Hodgman against the planes the triangle crosses, then a fan over the polygon left
+	XMFLOAT4 buffers[2][MaxClippedVertices];
+	uint32_t count = 3;
+	std::copy(vertices, vertices + 3, buffers[0]);
+	auto input = buffers[0];
+	auto output = buffers[1];
+	for (uint32_t plane = 0; plane < OcclusionClipPlaneCount && count >= 3; ++plane)
+	{
+		if (((outside[0] | outside[1] | outside[2]) & (1u << plane)) == 0)
+			continue;
+
+		uint32_t outputCount = 0;
+		for (uint32_t v = 0; v < count; ++v)
+		{
+			auto& current = input[v];
+			auto& next = input[(v + 1) % count];
+			auto currentDistance = PlaneDistance(OcclusionClipPlanes[plane], current);
+			auto nextDistance = PlaneDistance(OcclusionClipPlanes[plane], next);
+			if (currentDistance >= 0.f)
+				output[outputCount++] = current;
+			if ((currentDistance >= 0.f) != (nextDistance >= 0.f))
+			{
+				auto t = currentDistance / (currentDistance - nextDistance);
+				XMStoreFloat4(&output[outputCount++], XMVectorLerp(XMLoadFloat4(&current), XMLoadFloat4(&next), t));
+			}
+		}
+		count = outputCount;
+		std::swap(input, output);
+	}
+
+	for (uint32_t v = 1; v + 1 < count; ++v)
+	{
+		const XMFLOAT4 triangle[3] = { input[0], input[v], input[v + 1] };
+		AddTriangle(triangle);
+	}
+}
+
+void OcclusionCuller::AddTriangle(const XMFLOAT4 * vertices)
+{
+	float x[3], y[3], z[3];
+	for (uint32_t v = 0; v < 3; ++v)
+	{
+		auto invW = 1.f / vertices[v].w;
+		x[v] = (vertices[v].x * invW * 0.5f + 0.5f) * width;
+		y[v] = (0.5f - vertices[v].y * invW * 0.5f) * height;
+		z[v] = vertices[v].z * invW;
+	}
+
+	// Both windings are drawn, flipping the edges of the negative ones keeps the inside positive
+	auto area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+	if (fabsf(area) < 1e-6f)
+		return;
+
+	Triangle triangle;
+	auto sign = area > 0.f ? 1.f : -1.f;
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		auto j = (i + 1) % 3;
+		triangle.EdgeA[i] = sign * (y[i] - y[j]);
+		triangle.EdgeB[i] = sign * (x[j] - x[i]);
+		triangle.EdgeC[i] = -(triangle.EdgeA[i] * x[i] + triangle.EdgeB[i] * y[i]);
+	}
+	triangle.DepthX = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) / area;
+	triangle.DepthY = ((z[2] - z[0]) * (x[1] - x[0]) - (z[1] - z[0]) * (x[2] - x[0])) / area;
+	triangle.DepthOrigin = z[0] - triangle.DepthX * x[0] - triangle.DepthY * y[0];
+
+	// Pixels are sampled at their centers
+	auto minX = std::min(std::min(x[0], x[1]), x[2]);
+	auto minY = std::min(std::min(y[0], y[1]), y[2]);
+	auto maxX = std::max(std::max(x[0], x[1]), x[2]);
+	auto maxY = std::max(std::max(y[0], y[1]), y[2]);
+	triangle.MinX = std::max((int32_t)ceilf(minX - 0.5f), 0);
+	triangle.MinY = std::max((int32_t)ceilf(minY - 0.5f), 0);
+	triangle.MaxX = std::min((int32_t)floorf(maxX - 0.5f), (int32_t)width - 1);
+	triangle.MaxY = std::min((int32_t)floorf(maxY - 0.5f), (int32_t)height - 1);
+	if (triangle.MinX > triangle.MaxX || triangle.MinY > triangle.MaxY)
+		return;
+
+	auto index = (uint32_t)triangles.size();
+	triangles.push_back(triangle);
+	for (auto tileY = triangle.MinY / OcclusionTileHeight; tileY <= triangle.MaxY / OcclusionTileHeight; ++tileY)
+	{
+		for (auto tileX = triangle.MinX / OcclusionTileWidth; tileX <= triangle.MaxX / OcclusionTileWidth; ++tileX)
+		{
+			tileBins[tileY * tilesX + tileX].push_back(index);
+		}
+	}
+}
+
+template<typename L>
+SIMD_KERNEL_INLINE inline void OcclusionCuller::RasterizeTiles(size_t begin, size_t end)
+{
+	typedef typename L::Vec Vec;
+	auto zero = L::Set1(0.f);
+	auto centers = L::Load(LaneCenters);
+	auto& depth = levels[0];
+	for (auto tile = begin; tile < end; ++tile)
+	{
+		auto tileX = (int32_t)(tile % tilesX * OcclusionTileWidth);
+		auto tileY = (int32_t)(tile / tilesX * OcclusionTileHeight);
+		for (auto index : tileBins[tile])
+		{
+			auto& triangle = triangles[index];
+			// Batches start on a multiple of the width, so they never leave the tile. Lanes before the triangle's
+			// first pixel are outside of it.
+			auto startX = std::max(triangle.MinX, tileX) & ~((int32_t)L::Width - 1);
+			auto endX = std::min(triangle.MaxX, tileX + (int32_t)OcclusionTileWidth - 1);
+			auto startY = std::max(triangle.MinY, tileY);
+			auto endY = std::min(triangle.MaxY, tileY + (int32_t)OcclusionTileHeight - 1);
+
+			const Vec edgeA[3] = { L::Set1(triangle.EdgeA[0]), L::Set1(triangle.EdgeA[1]), L::Set1(triangle.EdgeA[2]) };
+			auto depthX = L::Set1(triangle.DepthX);
+			for (auto y = startY; y <= endY; ++y)
+			{
+				auto pixelY = y + 0.5f;
+				const Vec rowEdge[3] =
+				{
+					L::Set1(triangle.EdgeB[0] * pixelY + triangle.EdgeC[0]),
+					L::Set1(triangle.EdgeB[1] * pixelY + triangle.EdgeC[1]),
+					L::Set1(triangle.EdgeB[2] * pixelY + triangle.EdgeC[2])
+				};
+				auto rowDepth = L::Set1(triangle.DepthOrigin + triangle.DepthY * pixelY);
+				auto row = &depth[y * width];
+				for (auto x = startX; x <= endX; x += L::Width)
+				{
+					auto pixelX = L::Add(L::Set1((float)x), centers);
+					auto inside = L::LessEqual(zero, L::Add(L::Mul(edgeA[0], pixelX), rowEdge[0]));
+					inside = L::And(inside, L::LessEqual(zero, L::Add(L::Mul(edgeA[1], pixelX), rowEdge[1])));
+					inside = L::And(inside, L::LessEqual(zero, L::Add(L::Mul(edgeA[2], pixelX), rowEdge[2])));
+					if (L::Mask(inside) == 0)
+						continue;
+
+					auto z = L::Add(L::Mul(depthX, pixelX), rowDepth);
+					auto current = L::Load(row + x);
+					L::Store(row + x, L::Select(inside, L::Min(current, z), current));
+				}
+			}
+		}
+	}
+	L::Finish();
+}
+
+void OcclusionCuller::BuildPyramid()
+{
+	for (size_t level = 1; level < levels.size(); ++level)
+	{
+		auto& source = levels[level - 1];
+		auto sourceWidth = levelWidths[level - 1];
+		auto sourceHeight = levelHeights[level - 1];
+		auto& target = levels[level];
+		for (uint32_t y = 0; y < levelHeights[level]; ++y)
+		{
+			// Odd sizes repeat the last row or column
+			auto row0 = &source[y * 2 * sourceWidth];
+			auto row1 = &source[std::min(y * 2 + 1, sourceHeight - 1) * sourceWidth];
+			for (uint32_t x = 0; x < levelWidths[level]; ++x)
+			{
+				auto x0 = x * 2;
+				auto x1 = std::min(x0 + 1, sourceWidth - 1);
+				target[y * levelWidths[level] + x] = std::max(std::max(row0[x0], row0[x1]), std::max(row1[x0], row1[x1]));
+			}
+		}
+	}
+}
+
+#ifdef SIMD_LANES_AVX2
+SIMD_AVX2_KERNEL void OcclusionCuller::RasterizeTilesAvx2(size_t begin, size_t end)
+{
+	RasterizeTiles<Avx2Lanes>(begin, end);
+}
+#endif
+
+void OcclusionCuller::Rasterize()
+{
+	auto rasterize = [this](size_t begin, size_t end)
+	{
+#ifdef SIMD_LANES_AVX2
+		if (CpuSupportsAvx2())
+			RasterizeTilesAvx2(begin, end);
+		else
+#endif
+			RasterizeTiles<SseLanes>(begin, end);
+	};
+
+	if (!triangles.empty())
+	{
+		// One row of tiles per job
+		if (workerThreads)
+			ThreadPool::ParallelFor(tileBins.size(), tilesX, rasterize);
+		else
+			rasterize(0, tileBins.size());
+	}
+	BuildPyramid();
+}
+
+void OcclusionCuller::RasterizeAsync()
+{
+	auto pool = ThreadPool::GetInstance();
+	if (!workerThreads || pool == nullptr || pool->GetThreadCount() == 0)
+	{
+		Rasterize();
+		return;
+	}
+	pool->Submit([this]() { Rasterize(); }, rasterizeJob);
+}
+
+void OcclusionCuller::Wait()
+{
+	auto pool = ThreadPool::GetInstance();
+	if (pool != nullptr)
+		pool->Wait(rasterizeJob);
+}
+
+bool OcclusionCuller::IsVisible(FXMVECTOR center, FXMVECTOR axis0, FXMVECTOR axis1, GXMVECTOR axis2) const
+{
+	auto matrix = XMLoadFloat4x4(&viewProjection);
+	auto clipCenter = XMVector3Transform(center, matrix);
+	const XMVECTOR clipAxes[3] = { XMVector3TransformNormal(axis0, matrix), XMVector3TransformNormal(axis1, matrix), XMVector3TransformNormal(axis2, matrix) };
+
+	// Screen rect and nearest depth of the corners
+	float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, minZ = FLT_MAX;
+	for (uint32_t i = 0; i < 8; ++i)
+	{
+		auto corner = clipCenter;
+		for (uint32_t axis = 0; axis < 3; ++axis)
+		{
+			corner = (i & (1u << axis)) ? corner + clipAxes[axis] : corner - clipAxes[axis];
+		}
+		XMFLOAT4 point;
+		XMStoreFloat4(&point, corner);
+		if (point.z < 0.f || point.w <= 0.f)
+			return true;
+
+		auto invW = 1.f / point.w;
+		auto x = (point.x * invW * 0.5f + 0.5f) * width;
+		auto y = (0.5f - point.y * invW * 0.5f) * height;
+		minX = std::min(minX, x);
+		minY = std::min(minY, y);
+		maxX = std::max(maxX, x);
+		maxY = std::max(maxY, y);
+		minZ = std::min(minZ, point.z * invW);
+	}
+	if (maxX < 0.f || maxY < 0.f || minX >= width || minY >= height)
+		return true;
+
+	// Every pixel the rect touches, read from the first level where it spans at most 4 texels each way
+	auto x0 = (uint32_t)std::max(minX, 0.f);
+	auto y0 = (uint32_t)std::max(minY, 0.f);
+	auto x1 = (uint32_t)std::min(maxX, width - 1.f);
+	auto y1 = (uint32_t)std::min(maxY, height - 1.f);
+	uint32_t level = 0;
+	while (level + 1 < levels.size() && ((x1 >> level) - (x0 >> level) > 3 || (y1 >> level) - (y0 >> level) > 3))
+	{
+		level++;
+	}
+
+	auto& depth = levels[level];
+	for (auto y = y0 >> level; y <= y1 >> level; ++y)
+	{
+		for (auto x = x0 >> level; x <= x1 >> level; ++x)
+		{
+			if (depth[y * levelWidths[level] + x] >= minZ)
+				return true;
+		}
+	}
+	return false;
+}
+
+void OcclusionCuller::CullBoxes(const CullBoxList & boxes, std::vector<uint32_t>& visible) const
+{
+	if (triangles.empty())
+		return;
+
+	size_t kept = 0;
+	for (auto index : visible)
+	{
+		auto component = [&](CullBoxComponent c) { return boxes.GetComponent(c)[index]; };
+		auto center = XMVectorSet(component(CullBoxCenterX), component(CullBoxCenterY), component(CullBoxCenterZ), 0.f);
+		auto axis0 = XMVectorSet(component(CullBoxAxis0X), component(CullBoxAxis0Y), component(CullBoxAxis0Z), 0.f);
+		auto axis1 = XMVectorSet(component(CullBoxAxis1X), component(CullBoxAxis1Y), component(CullBoxAxis1Z), 0.f);
+		auto axis2 = XMVectorSet(component(CullBoxAxis2X), component(CullBoxAxis2Y), component(CullBoxAxis2Z), 0.f);
+		if (IsVisible(center, axis0, axis1, axis2))
+			visible[kept++] = index;
+	}
+	visible.resize(kept);
+}
+
+bool OcclusionCuller::WriteDepthImage(const std::string & filename, uint32_t level) const
+{
+	if (level >= levels.size())
+		return false;
+	std::ofstream os(filename, std::ios::binary);
+	if (!os)
+		return false;
+
+	// Stretches the covered depths over the gray range, they are all close to 1 with a perspective projection
+	auto& depth = levels[level];
+	float nearest = 1.f, farthest = 0.f;
+	for (auto d : depth)
+	{
+		if (d < 1.f)
+		{
+			nearest = std::min(nearest, d);
+			farthest = std::max(farthest, d);
+		}
+	}
+	auto scale = farthest > nearest ? 223.f / (farthest - nearest) : 0.f;
+
+	std::vector<uint8_t> pixels(depth.size());
+	for (size_t i = 0; i < depth.size(); ++i)
+	{
+		pixels[i] = depth[i] < 1.f ? (uint8_t)(255.f - (depth[i] - nearest) * scale) : 0;
+	}
+	os << "P5\n" << levelWidths[level] << " " << levelHeights[level] << "\n255\n";
+	os.write(reinterpret_cast<const char*>(pixels.data()), pixels.size());
+	return os.good();
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "stdafx.h"
+#include <string>
+#include <vector>
+#include "Culling.h"
+#include "ThreadPool.h"
+
+static const uint32_t DefaultOcclusionWidth = 320;
+static const uint32_t DefaultOcclusionHeight = 192;
+static const uint32_t OcclusionTileWidth = 32; //Multiple of the widest batch
+static const uint32_t OcclusionTileHeight = 16;
+
+//! Software depth buffer for occlusion culling. A few large opaque meshes are rasterized into a low resolution
+//! buffer on the CPU, then boxes are tested against a pyramid where every texel holds the farthest depth of the
+//! texels below it. A box is hidden when its nearest point is behind the farthest occluder over its screen rect.
+//! Depth is in [0, 1] like the frustum in Culling.h expects, the buffer is cleared to 1.
+class OcclusionCuller
+{
+	//! Screen space triangle, inside where all three edge functions A * x + B * y + C are >= 0
+	struct Triangle
+	{
+		float	EdgeA[3];
+		float	EdgeB[3];
+		float	EdgeC[3];
+		float	DepthOrigin; //Depth at pixel 0, 0 and its change per pixel
+		float	DepthX;
+		float	DepthY;
+		int32_t	MinX; //Inclusive range of pixels whose center may be inside
+		int32_t	MinY;
+		int32_t	MaxX;
+		int32_t	MaxY;
+	};
+
+	uint32_t							width; //Rounded up to whole tiles
+	uint32_t							height;
+	uint32_t							tilesX;
+	uint32_t							tilesY;
+	bool								workerThreads;
+	XMFLOAT4X4							viewProjection;
+
+	std::vector<Triangle>				triangles;
+	std::vector<std::vector<uint32_t>>	tileBins; //Triangles overlapping every tile, row after row
+	std::vector<std::vector<float>>		levels; //Depth buffer followed by the max depth pyramid
+	std::vector<uint32_t>				levelWidths;
+	std::vector<uint32_t>				levelHeights;
+	JobCounter							rasterizeJob;
+
+	void								AddTriangle(const XMFLOAT4* vertices);
+	void								ClipTriangle(const XMFLOAT4* vertices);
+	template<typename L>
+	void								RasterizeTiles(size_t begin, size_t end);
+	//! RasterizeTiles over Avx2Lanes compiled for AVX2, only called when the CPU supports it
+	void								RasterizeTilesAvx2(size_t begin, size_t end);
+	void								BuildPyramid();
+public:
+	OcclusionCuller(uint32_t width = DefaultOcclusionWidth, uint32_t height = DefaultOcclusionHeight);
+
+	//! With worker threads tiles are rasterized in parallel and RasterizeAsync runs on the thread pool
+	inline void							SetWorkerThreads(bool enable) { workerThreads = enable; }
+	//! Clears the buffer and the occluders. viewProjection is a row vector matrix like Frustum::FromViewProjection takes.
+	void								BeginFrame(const XMFLOAT4X4& viewProjection);
+	//! Transforms the triangle list by world, clips it and bins it into tiles. positions are stride bytes apart.
+	void								AddOccluder(const XMFLOAT3* positions, uint32_t stride, const uint32_t* indices, uint32_t indexCount,
+											const XMFLOAT4X4& world);
+	//! Rasterizes the occluders added since BeginFrame and builds the pyramid
+	void								Rasterize();
+	//! Rasterize on the thread pool, Wait must return before testing boxes or starting the next frame
+	void								RasterizeAsync();
+	void								Wait();
+
+	//! False when every point of the box is hidden, the box reaches center +- axis0 +- axis1 +- axis2. Boxes
+	//! crossing the near plane are always visible.
+	bool								IsVisible(FXMVECTOR center, FXMVECTOR axis0, FXMVECTOR axis1, GXMVECTOR axis2) const;
+	//! Drops the indices of hidden boxes from visible, keeping the order of the others
+	void								CullBoxes(const CullBoxList& boxes, std::vector<uint32_t>& visible) const;
+
+	//! Writes a pyramid level as a binary PGM image, near depth bright, far depth dark and empty texels black
+	bool								WriteDepthImage(const std::string& filename, uint32_t level = 0) const;
+
+	inline uint32_t						GetWidth() const { return width; }
+	inline uint32_t						GetHeight() const { return height; }
+	inline uint32_t						GetLevelCount() const { return (uint32_t)levels.size(); }
+	inline uint32_t						GetTriangleCount() const { return (uint32_t)triangles.size(); }
+	inline const std::vector<float>&	GetDepth(uint32_t level = 0) const { return levels[level]; }
+};
@@ -0,0 +1,296 @@
+#pragma once
+#include <tuple>
+#include "EntityManager.h"
+#include "ThreadPool.h"
+
+enum ComponentFilterType
+{
+	ComponentFilterChanged = 0,
+	ComponentFilterAdded
+};
+
+//! Query filter passing entities whose T component was changed (or added) after sinceVersion.
+//! Systems pass their GetLastVersion() to only see what happened since they last ran.
+template<typename T, ComponentFilterType FilterType>
+struct ComponentFilter
+{
+	uint32_t SinceVersion;
+
+	explicit ComponentFilter(uint32_t sinceVersion) : SinceVersion(sinceVersion) {}
+
+	//! False when no entity can pass, so the whole query can be skipped
+	inline bool MayMatch(EntityManager* manager) const
+	{
+		return manager->GetColumnVersion(ComponentType<T>::ID()) > SinceVersion;
+	}
+
+	inline bool Matches(EntityManager* manager, EntityID entity) const
+	{
+		auto type = ComponentType<T>::ID();
+		auto version = FilterType == ComponentFilterChanged ? manager->GetChangeVersion(entity, type) : manager->GetAddedVersion(entity, type);
+		return version > SinceVersion;
+	}
+};
+
+template<typename T>
+using Changed = ComponentFilter<T, ComponentFilterChanged>;
+
+template<typename T>
+using Added = ComponentFilter<T, ComponentFilterAdded>;
+
+//! Persistent multi component query. Created once through EntityManager::GetQuery and kept up to date
+//! when components are added or removed, so iterating it does not allocate or sort. Only the rows of entities
+//! whose data moved fetch their component pointers again, all rows only after a container reallocated.
+//! Const component types are read only, iterating marks the others changed.
+template<typename... Args>
+class Query : public IQuery
+{
+	EntityManager*						manager;
+	std::vector<EntityID>				entities;
+	SparseEntityIndex					entityIndex;
+	std::tuple<std::vector<Args*>...>	componentPointers; //Parallel to entities
+	std::vector<EntityID>				staleEntities; //Members whose pointers need fetching again
+	bool								dirty; //Every row needs fetching again
+
+	bool			Matches(EntityID entity);
+	void			Insert(EntityID entity);
+	void			Erase(EntityID entity);
+	void			MarkStale(EntityID entity);
+	inline void		FetchRow(size_t index)
+	{
+		auto f = { 0, (std::get<std::vector<Args*>>(componentPointers)[index] = manager->FindComponent<typename std::remove_const<Args>::type>(entities[index]), 0)... };
+		(void)f;
+	}
+	inline void		MarkWritten(EntityID entity)
+	{
+		auto c = { 0, (std::is_const<Args>::value ? 0 : (manager->MarkChanged(entity, ComponentType<Args>::ID()), 0))... };
+		(void)c;
+	}
+public:
+	Query(EntityManager* entityManager);
+
+	virtual void	OnEntityChanged(EntityID entity, TypeID type) override;
+	virtual void	OnEntitiesMoved(const EntityID* movedEntities, size_t count) override;
+	virtual void	OnComponentsMoved(TypeID type) override;
+	virtual void	Refresh() override;
+
+	//! Entity list, parallel to every GetComponents<T>() array
+	inline const std::vector<EntityID>&	GetEntities() { Refresh(); return entities; }
+
+	template<typename T>
+	inline const std::vector<T*>&		GetComponents() { Refresh(); return std::get<std::vector<T*>>(componentPointers); }
+
+	inline size_t						Count() const { return entities.size(); }
+
+	//! Calls callback(entity, components&...) for every matching entity
+	template<typename FuncType>
+	void								ForEach(FuncType callback);
+
+	//! ForEach split into batches on the thread pool. The callback must only touch the entity it is given,
+	//! structural changes go through the system command buffer. batchSize of 0 picks ThreadPool::GetBatchSize.
+	template<typename FuncType>
+	void								ForEachParallel(FuncType callback, size_t batchSize = 0);
+
+	//! ForEach restricted to entities passing a Changed<T> or Added<T> filter
+	template<typename T, ComponentFilterType FilterType, typename FuncType>
+	void								ForEach(const ComponentFilter<T, FilterType>& filter, FuncType callback);
+
+	template<typename T, ComponentFilterType FilterType, typename FuncType>
+	void								ForEachParallel(const ComponentFilter<T, FilterType>& filter, FuncType callback, size_t batchSize = 0);
+};
+
+template<typename ...Args>
+inline Query<Args...>::Query(EntityManager * entityManager) :
+	manager(entityManager),
+	dirty(true)
+{
+	const TypeID types[] = { ComponentType<Args>::ID()... };
+	std::vector<EntityID> candidates;
+	manager->GetComponentEntities(types[0], candidates);
+	for (auto e : candidates)
+	{
+		if (Matches(e))
+			Insert(e);
+	}
+}
+
+template<typename ...Args>
+inline bool Query<Args...>::Matches(EntityID entity)
+{
+	if (!manager->IsActive(entity))
+		return false;
+
+	bool hasAll = true;
+	auto c = { (hasAll = hasAll && manager->HasComponent(entity, ComponentType<Args>::ID()))... };
+	(void)c;
+	return hasAll;
+}
+
+template<typename ...Args>
+inline void Query<Args...>::Insert(EntityID entity)
+{
+	entityIndex.Set(entity, (uint32_t)entities.size());
+	entities.push_back(entity);
+	auto c = { 0, (std::get<std::vector<Args*>>(componentPointers).push_back(nullptr), 0)... };
+	(void)c;
+	MarkStale(entity);
+}
+
+template<typename ...Args>
+inline void Query<Args...>::Erase(EntityID entity)
+{
+	auto index = entityIndex.Find(entity);
+	auto last = entities.back();
+	entities[index] = last;
+	entityIndex.Set(last, index);
+	entities.pop_back();
+	entityIndex.Erase(entity);
+	// The last row takes the erased one's place along with its pointers, which stay valid
+	auto c = { 0, (std::get<std::vector<Args*>>(componentPointers)[index] = std::get<std::vector<Args*>>(componentPointers).back(),
+		std::get<std::vector<Args*>>(componentPointers).pop_back(), 0)... };
+	(void)c;
+}
+
+template<typename ...Args>
+inline void Query<Args...>::MarkStale(EntityID entity)
+{
+	if (dirty)
+		return;
+	// Past one per row fetching every row is cheaper than remembering them
+	if (staleEntities.size() >= entities.size())
+	{
+		staleEntities.clear();
+		dirty = true;
+		return;
+	}
+	staleEntities.push_back(entity);
+}
+
+template<typename ...Args>
+inline void Query<Args...>::OnEntityChanged(EntityID entity, TypeID type)
+{
+	bool isMember = entityIndex.Find(entity) != SparseEntityIndex::InvalidIndex;
+	bool matches = Matches(entity);
+	if (matches && !isMember)
+		Insert(entity);
+	else if (!matches && isMember)
+		Erase(entity);
+	else if (matches && manager->GetStorageMode() == StorageModeArchetype)
+		MarkStale(entity); //Adding or removing another component migrates the whole row
+}
+
+template<typename ...Args>
+inline void Query<Args...>::OnEntitiesMoved(const EntityID * movedEntities, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (entityIndex.Find(movedEntities[i]) != SparseEntityIndex::InvalidIndex)
+			MarkStale(movedEntities[i]);
+	}
+}
+
+template<typename ...Args>
+inline void Query<Args...>::OnComponentsMoved(TypeID type)
+{
+	bool relevant = false;
+	auto c = { (relevant = relevant || type == ComponentType<Args>::ID())... };
+	(void)c;
+	if (relevant)
+	{
+		staleEntities.clear();
+		dirty = true;
+	}
+}
+
+template<typename ...Args>
+inline void Query<Args...>::Refresh()
+{
+	if (dirty)
+	{
+		for (size_t i = 0; i < entities.size(); ++i)
+		{
+			FetchRow(i);
+		}
+		dirty = false;
+		return;
+	}
+
+	for (auto entity : staleEntities)
+	{
+		// Entities erased since they were marked are skipped
+		auto index = entityIndex.Find(entity);
+		if (index != SparseEntityIndex::InvalidIndex)
+			FetchRow(index);
+	}
+	staleEntities.clear();
+}
+
+template<typename ...Args>
+template<typename FuncType>
+inline void Query<Args...>::ForEach(FuncType callback)
+{
+	Refresh();
+	for (size_t i = 0; i < entities.size(); ++i)
+	{
+		MarkWritten(entities[i]);
+		callback(entities[i], *std::get<std::vector<Args*>>(componentPointers)[i]...);
+	}
+}
+
+template<typename ...Args>
+template<typename FuncType>
+inline void Query<Args...>::ForEachParallel(FuncType callback, size_t batchSize)
+{
+	Refresh();
+	if (batchSize == 0)
+		batchSize = ThreadPool::GetBatchSize(entities.size(), sizeof(EntityID));
+
+	ThreadPool::ParallelFor(entities.size(), batchSize, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			MarkWritten(entities[i]);
+			callback(entities[i], *std::get<std::vector<Args*>>(componentPointers)[i]...);
+		}
+	});
+}
+
+template<typename ...Args>
+template<typename T, ComponentFilterType FilterType, typename FuncType>
+inline void Query<Args...>::ForEach(const ComponentFilter<T, FilterType>& filter, FuncType callback)
+{
+	if (!filter.MayMatch(manager))
+		return;
+
+	Refresh();
+	for (size_t i = 0; i < entities.size(); ++i)
+	{
+		if (!filter.Matches(manager, entities[i]))
+			continue;
+		MarkWritten(entities[i]);
+		callback(entities[i], *std::get<std::vector<Args*>>(componentPointers)[i]...);
+	}
+}
+
+template<typename ...Args>
+template<typename T, ComponentFilterType FilterType, typename FuncType>
+inline void Query<Args...>::ForEachParallel(const ComponentFilter<T, FilterType>& filter, FuncType callback, size_t batchSize)
+{
+	if (!filter.MayMatch(manager))
+		return;
+
+	Refresh();
+	if (batchSize == 0)
+		batchSize = ThreadPool::GetBatchSize(entities.size(), sizeof(EntityID));
+
+	ThreadPool::ParallelFor(entities.size(), batchSize, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			if (!filter.Matches(manager, entities[i]))
+				continue;
+			MarkWritten(entities[i]);
+			callback(entities[i], *std::get<std::vector<Args*>>(componentPointers)[i]...);
+		}
+	});
+}
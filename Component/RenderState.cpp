@@ -0,0 +1,97 @@
+#include "stdafx.h"
+#include "RenderState.h"
+#include "AnimationComponent.h"
+#include "MathHelper.h"
+
+void RenderState::Clear()
+{
+	// Keeps capacity, the buffers are refilled every frame
+	Entities.clear();
+	PreviousWorldTransforms.clear();
+	BoneIndices.clear();
+	BonePalettes.clear();
+	IsViewCandidate.clear();
+	HasViewCandidates = false;
+}
+
+void RenderState::Interpolate(float alpha, std::vector<Entity>& outEntities) const
+{
+	outEntities.clear();
+	for (size_t i = 0; i < Entities.size(); ++i)
+	{
+		auto& e = Entities[i];
+		outEntities.push_back(Entity{ e.EntityID, e.Node, e.Mesh, e.Material, InterpolateTransform(PreviousWorldTransforms[i], e.WorldTransform, alpha) });
+	}
+}
+
+RenderStateBuffer::RenderStateBuffer() :
+	writeSlot(0),
+	readSlot(1),
+	sharedSlot(2),
+	frameCounter(0)
+{
+}
+
+void RenderStateBuffer::Publish(EntityManager* entityManager, const Frustum* viewFrustum, const std::vector<EntityID>* viewCandidates)
+{
+	auto& state = states[writeSlot];
+	state.Clear();
+	entityManager->GetEntities(state.Entities);
+	state.BoneIndices.resize(state.Entities.size());
+	state.PreviousWorldTransforms.resize(state.Entities.size());
+	state.IsViewCandidate.resize(state.Entities.size());
+
+	// Stamped with the frame instead of cleared, so the EntityID sized array only grows
+	auto candidateFrame = frameCounter + 1;
+	state.HasViewCandidates = viewCandidates != nullptr;
+	if (viewCandidates != nullptr)
+	{
+		state.ViewFrustum = *viewFrustum;
+		for (auto e : *viewCandidates)
+		{
+			if ((size_t)e >= candidateFrameNumbers.size())
+				candidateFrameNumbers.resize(e + 1, 0);
+			candidateFrameNumbers[e] = candidateFrame;
+		}
+	}
+
+	for (size_t i = 0; i < state.Entities.size(); ++i)
+	{
+		auto& e = state.Entities[i];
+		if ((size_t)e.EntityID >= lastFrameNumbers.size())
+		{
+			lastWorldTransforms.resize(e.EntityID + 1);
+			lastFrameNumbers.resize(e.EntityID + 1, 0);
+		}
+		// Entities missing from the last publish, new or reused ids, start without motion
+		state.PreviousWorldTransforms[i] = lastFrameNumbers[e.EntityID] == frameCounter && frameCounter > 0 ? lastWorldTransforms[e.EntityID] : e.WorldTransform;
+		lastWorldTransforms[e.EntityID] = e.WorldTransform;
+		lastFrameNumbers[e.EntityID] = frameCounter + 1;
+		state.IsViewCandidate[i] = (size_t)e.EntityID < candidateFrameNumbers.size() && candidateFrameNumbers[e.EntityID] == candidateFrame;
+
+		auto bones = entityManager->FindComponent<AnimationBufferComponent>(e.EntityID);
+		state.BoneIndices[i] = bones != nullptr ? (int32_t)state.BonePalettes.size() : -1;
+		if (bones != nullptr)
+			state.BonePalettes.push_back(bones->ConstantBuffer);
+	}
+	state.FrameNumber = ++frameCounter;
+
+	// Release makes the filled slot visible to the renderer, acquire gets back a slot it no longer reads
+	auto previous = sharedSlot.exchange(writeSlot | FreshBit, std::memory_order_acq_rel);
+	writeSlot = previous & ~FreshBit;
+}
+
+const RenderState & RenderStateBuffer::Acquire()
+{
+	if (HasNewState())
+	{
+		auto previous = sharedSlot.exchange(readSlot, std::memory_order_acq_rel);
+		readSlot = previous & ~FreshBit;
+	}
+	return states[readSlot];
+}
+
+bool RenderStateBuffer::HasNewState() const
+{
+	return (sharedSlot.load(std::memory_order_relaxed) & FreshBit) != 0;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include "Core/ConstantBuffer.h"
+#include "EntityManager.h"
+#include "Culling.h"
+
+//! Everything the renderer reads about entities for one simulated frame, copied out of EntityManager and Scene
+//! so render prep never touches simulation state
+struct RenderState
+{
+	uint64_t								FrameNumber; //0 until the first publish
+	std::vector<Entity>						Entities; //Active entities with their mesh, material and world matrix
+	std::vector<XMFLOAT4X4>					PreviousWorldTransforms; //Per entity world matrix of the publish before, the current one for new entities
+	std::vector<int32_t>					BoneIndices; //Per entity index into BonePalettes, -1 without a skeleton
+	std::vector<PerArmatureConstantBuffer>	BonePalettes;
+	std::vector<byte>						IsViewCandidate; //Per entity, found in ViewFrustum by the spatial index
+	Frustum									ViewFrustum; //Frustum the candidates were queried with
+	bool									HasViewCandidates;
+
+	RenderState() : FrameNumber(0), HasViewCandidates(false) {}
+	void Clear();
+	//! Entities with world matrices blended from the previous publish (alpha 0) to this one (alpha 1)
+	void Interpolate(float alpha, std::vector<Entity>& outEntities) const;
+};
+
+//! Triple buffered RenderState handoff between the simulation thread and the render prep thread. The simulation
+//! writes into its own slot and publishes it, the renderer takes the newest published slot. Neither side waits
+//! for the other, a slow renderer skips frames and a slow simulation makes the renderer reuse the last one.
+//! Publish must only be called from one thread at a time, same for Acquire.
+class RenderStateBuffer
+{
+	static const uint32_t	SlotCount = 3;
+	static const uint32_t	FreshBit = 4; //Set on the shared slot while the renderer has not taken it
+
+	RenderState				states[SlotCount];
+	uint32_t				writeSlot;
+	uint32_t				readSlot;
+	std::atomic<uint32_t>	sharedSlot; //Slot neither side owns, plus FreshBit
+	uint64_t				frameCounter;
+
+	//Simulation side, by EntityID, world matrices of the last publish
+	std::vector<XMFLOAT4X4>	lastWorldTransforms;
+	std::vector<uint64_t>	lastFrameNumbers;
+	std::vector<uint64_t>	candidateFrameNumbers; //Frame an entity was last passed as a view candidate
+public:
+	RenderStateBuffer();
+
+	//! Copies the active entities, their world matrices and bone palettes into the simulation's slot and
+	//! publishes it. Call after the frame's Scene::UpdateTransforms. viewCandidates are the entities found in
+	//! viewFrustum, either both or neither are given.
+	void					Publish(EntityManager* entityManager, const Frustum* viewFrustum = nullptr, const std::vector<EntityID>* viewCandidates = nullptr);
+	//! Newest published state, the previous one again if nothing new was published. The reference stays valid
+	//! until the next Acquire.
+	const RenderState&		Acquire();
+	bool					HasNewState() const;
+};
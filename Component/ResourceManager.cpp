@@ -42,7 +42,7 @@ void ResourceManager::LoadTexture(
 	TextureViewType viewType
 )
 {
-	auto texture = new Texture(renderer, device);
+	auto texture = PoolAllocator::New<Texture>(renderer, device);
 	texture->CreateTexture(filepath, texFileType, commandQueue, isCubeMap);
 	textures.insert(std::pair<HashID, Texture*>(textureID, texture));
 }
@@ -53,7 +53,7 @@ void ResourceManager::LoadTextures(ID3D12CommandQueue* commandQueue, DeferredRen
 	uploadBatch.Begin();
 	for (auto& t : textureLoadData)
 	{
-		auto texture = new Texture(renderer, device);
+		auto texture = PoolAllocator::New<Texture>(renderer, device);
 		texture->CreateTexture(t.FilePath, t.FileType, commandQueue, uploadBatch, t.IsCubeMap);
 		textures.insert(std::pair<HashID, Texture*>(t.TextureID, texture));
 	}
@@ -65,7 +65,7 @@ void ResourceManager::LoadMaterial(ID3D12CommandQueue* commandQueue, DeferredRen
 {
 	auto hash = StringID(loadData.MaterialID.c_str());
 	strings.insert(std::pair<HashID, std::string>(hash, loadData.MaterialID));
-	auto material = new Material(
+	auto material = PoolAllocator::New<Material>(
 		renderer,
 		{
 			loadData.AlbedoFile,
@@ -196,11 +196,11 @@ ResourceManager::~ResourceManager()
 
 	for (auto& m : materials)
 	{
-		delete m.second;
+		PoolAllocator::Delete(m.second);
 	}
 
 	for (auto& m : textures)
 	{
-		delete m.second;
+		PoolAllocator::Delete(m.second);
 	}
 }
@@ -11,6 +11,7 @@
 #include "AnimationManager.h"
 #include "Core/Entity.h"
 #include "EntityManager.h"
+#include "MemoryPool.h"
 
 // Engine Specific
 typedef std::unordered_map<unsigned int, Mesh*> MeshMap;
@@ -72,58 +73,3 @@ public:
 	void		LoadResources(std::string filename, ID3D12CommandQueue* cqueue, ID3D12GraphicsCommandList* clist, DeferredRenderer* renderer);
 	~ResourceManager();
 };
-
-/*TODO*/
-
-class IMemoryPool
-{
-};
-
-template<typename T>
-class MemoryPool : public IMemoryPool
-{
-public:
-	T* Allocate()
-	{
-		return nullptr;
-	}
-
-	void Destroy(T* block)
-	{
-
-	}
-};
-
-class PoolAllocator
-{
-	std::unordered_map<size_t, IMemoryPool*> memoryPools;
-public:
-	template<typename T>
-	void RegisterType() 
-	{
-		memoryPools.insert(std::pair<size_t, IMemoryPool*>(typeid(T).hash_code(), new MemoryPool<T>()));
-	}
-
-	template<typename T>
-	T* GetNew()
-	{
-		auto pool = (MemoryPool<T>*)memoryPools[typeid(T).hash_code()];
-		return pool->Allocate();
-	}
-
-	template<typename T>
-	void Destroy(T* block)
-	{
-		auto pool = (MemoryPool<T>*)memoryPools[typeid(T).hash_code()];
-		pool->Destroy(block);
-	}
-
-	~PoolAllocator()
-	{
-		for (auto& pool : memoryPools)
-		{
-			delete pool.second;
-		}
-	}
-};
-
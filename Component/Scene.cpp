@@ -1,92 +1,635 @@
 #include "stdafx.h"
 #include "Scene.h"
+#include "ThreadPool.h"
+#include "TransformBatch.h"
+#include "MathHelper.h"
 #include <queue>
+#include <algorithm>
+#include <chrono>
+#include <limits>
 
 static const size_t MaxNodeCount = 1024u;
+static const size_t DenseUpdateRatio = 8; //Walk every node once more than 1 in 8 are dirty
+static const size_t ParallelUpdateMinNodes = 16384; //Below this handing out subtrees costs more than it saves
+static const size_t CompactChangeRatio = 8; //Start an incremental compaction once 1 in 8 nodes came or went
+static const size_t CompactClockInterval = 256; //Swaps between two budget checks
 
-const Node Scene::CreateNode(Transform transform)
+void Scene::InsertTransform(const Transform& transform)
 {
-	Node node;
-	XMMATRIX translation = XMMatrixTranslationFromVector(XMLoadFloat3(&transform.Position));
-	XMMATRIX rotation = XMMatrixRotationRollPitchYawFromVector(XMLoadFloat3(&transform.Rotation));
-	XMMATRIX scale = XMMatrixScalingFromVector(XMLoadFloat3(&transform.Scale));
-	XMMATRIX transformation = scale * rotation * translation;
+	position.push_back(transform.Position);
+	rotation.push_back(QuaternionFromEuler(transform.Rotation));
+	scale.push_back(transform.Scale);
+}
 
-	XMStoreFloat4x4(&node.localTransform, transformation);
-	return node;
+void Scene::AppendSorted(NodeID nodeId)
+{
+	auto parent = nodeList[nodeId].parent;
+	sortedIndex[nodeId] = (uint32_t)sortedNodes.size();
+	sortedParents.push_back(parent < 0 ? 0u : sortedIndex[parent]);
+	sortedNodes.push_back(nodeId);
+	subtreesDirty = true;
+	orderChanges++;
 }
 
-void Scene::InsertTransform(Transform transform)
+void Scene::UnlinkSorted(NodeID nodeId)
 {
-	position.push_back(transform.Position);
-	rotation.push_back(transform.Rotation);
-	scale.push_back(transform.Scale);
+	auto index = sortedIndex[nodeId];
+	if (index == InvalidSortIndex)
+		return;
+
+	sortedNodes[index] = -1;
+	sortedIndex[nodeId] = InvalidSortIndex;
+	subtreesDirty = true;
+	orderChanges++;
+	if (index < firstStaleIndex)
+		firstStaleIndex = index;
+}
+
+void Scene::CompactSorted()
+{
+	if (firstStaleIndex == InvalidSortIndex)
+		return;
+
+	// Entries before the first hole keep their index, so only the tail is moved and relinked
+	auto write = firstStaleIndex;
+	for (auto read = firstStaleIndex; read < sortedNodes.size(); ++read)
+	{
+		auto nodeId = sortedNodes[read];
+		if (nodeId < 0)
+			continue;
+		sortedNodes[write] = nodeId;
+		sortedIndex[nodeId] = write;
+		sortedParents[write] = sortedIndex[nodeList[nodeId].parent];
+		write++;
+	}
+	sortedNodes.resize(write);
+	sortedParents.resize(write);
+	firstStaleIndex = InvalidSortIndex;
+}
+
+void Scene::UpdateWorldTransform(NodeID nodeId)
+{
+	auto transformation = GetTransformation(position[nodeId], scale[nodeId], rotation[nodeId]);
+	transformation = transformation * XMLoadFloat4x4(&worldTransforms[nodeList[nodeId].parent]);
+	XMStoreFloat4x4(&worldTransforms[nodeId], transformation);
 }
 
 Scene::Scene() :
-	rootNode(0u)
+	rootNode(0u),
+	subtreesDirty(true),
+	parallelUpdate(true),
+	firstStaleIndex(InvalidSortIndex),
+	compactCursor(0),
+	compactActive(false),
+	orderChanges(0)
 {
-	auto node = CreateNode(DefaultTransform);
+	Node node;
 	node.parent = -1;
-	node.worldTransform = node.localTransform;
 	nodeList.push_back(node);
 	InsertTransform(DefaultTransform);
 	isActive.push_back(true);
+	XMFLOAT4X4 identity;
+	XMStoreFloat4x4(&identity, XMMatrixIdentity());
+	worldTransforms.push_back(identity);
+	dirty.push_back(0);
+	sortedIndex.push_back(InvalidSortIndex);
+	AppendSorted(rootNode);
 }
 
 NodeID Scene::CreateNode(NodeID parent, Transform transform)
 {
-	auto node = CreateNode(transform);
-	node.parent = parent;
-	XMMATRIX parentTransform = XMLoadFloat4x4(&nodeList[parent].worldTransform);
-	XMMATRIX worldTransform = parentTransform * XMLoadFloat4x4(&node.localTransform);
-	XMStoreFloat4x4(&node.worldTransform, worldTransform);
-	
 	NodeID nodeId = (NodeID)nodeList.size();
 	if (freeNodes.size() > 0)
 	{
 		nodeId = freeNodes.back();
 		freeNodes.pop_back();
-		nodeList[nodeId] = node;
+		nodeList[nodeId].children.clear();
 		isActive[nodeId] = true;
 		SetTransform(nodeId, transform);
 	}
 	else
 	{
-		nodeList.push_back(node);
+		nodeList.push_back(Node());
 		isActive.push_back(true);
 		InsertTransform(transform);
+		worldTransforms.push_back(XMFLOAT4X4());
+		dirty.push_back(0);
+		sortedIndex.push_back(InvalidSortIndex);
 	}
 
-	nodeList[parent].children.push_back(nodeId);
+	AttachToParent(nodeId, parent);
+	AppendSorted(nodeId);
+	UpdateWorldTransform(nodeId);
+	MarkDirty(nodeId);
 	return nodeId;
 }
 
+void Scene::AllocateNodes(size_t count, NodeID * outNodes)
+{
+	size_t i = 0;
+	for (; i < count && !freeNodes.empty(); ++i)
+	{
+		outNodes[i] = freeNodes.back();
+		freeNodes.pop_back();
+	}
+
+	auto first = (NodeID)nodeList.size();
+	auto newSize = nodeList.size() + (count - i);
+	nodeList.resize(newSize);
+	position.resize(newSize);
+	rotation.resize(newSize);
+	scale.resize(newSize);
+	isActive.resize(newSize);
+	worldTransforms.resize(newSize);
+	dirty.resize(newSize, 0);
+	sortedIndex.resize(newSize, InvalidSortIndex);
+	for (; i < count; ++i)
+	{
+		outNodes[i] = first++;
+	}
+}
+
+void Scene::InitializeNodes(const NodeID * nodes, const NodeID * parents, const Transform * transforms, size_t count)
+{
+	// Count children first so every parent's list grows once. The counts are reset as they are used, so the
+	// scratch only grows with the node count and small batches do not touch the whole array.
+	if (childCountScratch.size() < nodeList.size())
+		childCountScratch.resize(nodeList.size(), 0);
+	auto childCounts = childCountScratch.data();
+	for (size_t i = 0; i < count; ++i)
+	{
+		childCounts[parents[i]]++;
+		nodeList[nodes[i]].children.clear();
+	}
+	for (size_t i = 0; i < count; ++i)
+	{
+		auto& children = nodeList[parents[i]].children;
+		if (childCounts[parents[i]] > 0)
+		{
+			children.reserve(children.size() + childCounts[parents[i]]);
+			childCounts[parents[i]] = 0;
+		}
+	}
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		auto nodeId = nodes[i];
+		AttachToParent(nodeId, parents[i]);
+		isActive[nodeId] = true;
+		SetTransform(nodeId, transforms[i]);
+	}
+
+	// Parents later in the batch are placed before their children, then the new tail is transformed in order
+	auto firstNew = sortedNodes.size();
+	for (size_t i = 0; i < count; ++i)
+	{
+		sortScratch.clear();
+		for (auto nodeId = nodes[i]; sortedIndex[nodeId] == InvalidSortIndex; nodeId = nodeList[nodeId].parent)
+		{
+			sortScratch.push_back(nodeId);
+		}
+		for (auto it = sortScratch.rbegin(); it != sortScratch.rend(); ++it)
+		{
+			AppendSorted(*it);
+		}
+	}
+
+	auto newCount = sortedNodes.size() - firstNew;
+	if (localTransformScratch.size() < newCount)
+		localTransformScratch.resize(newCount);
+	TransformSOA nodeTransforms = { position.data(), rotation.data(), scale.data(), position.size() };
+	ComposeTransforms(nodeTransforms, sortedNodes.data() + firstNew, newCount, localTransformScratch.data());
+	for (size_t i = 0; i < newCount; ++i)
+	{
+		auto nodeId = sortedNodes[firstNew + i];
+		auto transformation = XMLoadFloat4x4(&localTransformScratch[i]) * XMLoadFloat4x4(&worldTransforms[nodeList[nodeId].parent]);
+		XMStoreFloat4x4(&worldTransforms[nodeId], transformation);
+	}
+}
+
+bool Scene::IsActiveInHierarchy(NodeID nodeId)
+{
+	for (; nodeId != rootNode; nodeId = nodeList[nodeId].parent)
+	{
+		if (!isActive[nodeId])
+			return false;
+	}
+	return true;
+}
+
+void Scene::UpdateDirtySubtrees()
+{
+	// Ancestors first, a dirty node inside an already updated subtree has its flag cleared by then
+	std::sort(dirtyNodes.begin(), dirtyNodes.end(), [this](NodeID a, NodeID b) { return sortedIndex[a] < sortedIndex[b]; });
+	for (auto dirtyNode : dirtyNodes)
+	{
+		if (!dirty[dirtyNode])
+			continue;
+		// Removed nodes, and nodes in a disabled branch which is marked dirty again when enabled
+		if (sortedIndex[dirtyNode] == InvalidSortIndex || !IsActiveInHierarchy(dirtyNode))
+		{
+			dirty[dirtyNode] = 0;
+			continue;
+		}
+
+		sortScratch.clear();
+		sortScratch.push_back(dirtyNode);
+		for (size_t i = 0; i < sortScratch.size(); ++i)
+		{
+			auto nodeId = sortScratch[i];
+			dirty[nodeId] = 0;
+			if (nodeId == rootNode)
+				XMStoreFloat4x4(&worldTransforms[nodeId], GetTransformation(position[nodeId], scale[nodeId], rotation[nodeId]));
+			else
+				UpdateWorldTransform(nodeId);
+			changedNodes.push_back(nodeId);
+
+			for (auto child : nodeList[nodeId].children)
+			{
+				if (isActive[child])
+					sortScratch.push_back(child);
+			}
+		}
+	}
+}
+
+void Scene::RebuildSubtrees()
+{
+	if (!subtreesDirty)
+		return;
+
+	// Parents come first in sorted order, so every entry finds its root child in one pass
+	auto count = sortedNodes.size();
+	entrySubtrees.resize(count);
+	subtreeStarts.assign(1, 0);
+	for (size_t i = 1; i < count; ++i)
+	{
+		if (sortedParents[i] == 0)
+		{
+			entrySubtrees[i] = (uint32_t)subtreeStarts.size() - 1;
+			subtreeStarts.push_back(0);
+		}
+		else
+		{
+			entrySubtrees[i] = entrySubtrees[sortedParents[i]];
+		}
+		subtreeStarts[entrySubtrees[i] + 1]++;
+	}
+
+	// Counting sort by subtree, stable so parents stay ahead of children inside a group
+	for (size_t group = 1; group < subtreeStarts.size(); ++group)
+	{
+		subtreeStarts[group] += subtreeStarts[group - 1];
+	}
+	subtreeEntries.resize(count - 1);
+	for (size_t i = 1; i < count; ++i)
+	{
+		subtreeEntries[subtreeStarts[entrySubtrees[i]]++] = (uint32_t)i;
+	}
+	// The fill advanced every start to the next group's, shift them back
+	for (size_t group = subtreeStarts.size() - 1; group > 0; --group)
+	{
+		subtreeStarts[group] = subtreeStarts[group - 1];
+	}
+	subtreeStarts[0] = 0;
+	subtreesDirty = false;
+}
+
+void Scene::UpdateTransforms()
+{
+	CompactSorted();
+	changedNodes.clear();
+	if (dirtyNodes.empty())
+		return;
+
+	if (dirtyNodes.size() * DenseUpdateRatio < sortedNodes.size() && !dirty[rootNode])
+	{
+		UpdateDirtySubtrees();
+	}
+	else if (parallelUpdate && sortedNodes.size() >= ParallelUpdateMinNodes && ThreadPool::GetInstance() != nullptr && ThreadPool::GetInstance()->GetThreadCount() > 0)
+	{
+		RebuildSubtrees();
+		nodeStates.resize(sortedNodes.size());
+		UpdateNodesBySubtree(sortedNodes.data(), sortedParents.data(), subtreeEntries.data(), subtreeStarts.data(), subtreeStarts.size() - 1,
+			position.data(), scale.data(), rotation.data(), isActive.data(), dirty.data(), nodeStates.data(), worldTransforms.data());
+
+		// Collected in sorted order so the list matches the serial update
+		for (size_t i = 0; i < sortedNodes.size(); ++i)
+		{
+			if (nodeStates[i] & NodeStateChanged)
+				changedNodes.push_back(sortedNodes[i]);
+		}
+		for (auto nodeId : dirtyNodes)
+		{
+			dirty[nodeId] = 0;
+		}
+	}
+	else
+	{
+		nodeStates.resize(sortedNodes.size());
+		UpdateNodes(sortedNodes.data(), sortedParents.data(), sortedNodes.size(), position.data(), scale.data(), rotation.data(),
+			isActive.data(), dirty.data(), nodeStates.data(), worldTransforms.data(), changedNodes);
+		for (auto nodeId : dirtyNodes)
+		{
+			dirty[nodeId] = 0;
+		}
+	}
+	dirtyNodes.clear();
+}
+
+void Scene::SetParent(NodeID nodeId, NodeID parent)
+{
+	DetachFromParent(nodeId);
+	AttachToParent(nodeId, parent);
+	MarkDirty(nodeId);
+
+	subtreesDirty = true;
+	if (sortedIndex[parent] < sortedIndex[nodeId])
+	{
+		sortedParents[sortedIndex[nodeId]] = sortedIndex[parent];
+		return;
+	}
+
+	// The new parent comes later, move the subtree behind it. Breadth first keeps parents ahead of children.
+	sortScratch.clear();
+	sortScratch.push_back(nodeId);
+	for (size_t i = 0; i < sortScratch.size(); ++i)
+	{
+		auto& children = nodeList[sortScratch[i]].children;
+		sortScratch.insert(sortScratch.end(), children.begin(), children.end());
+	}
+
+	for (auto moved : sortScratch)
+	{
+		UnlinkSorted(moved);
+	}
+	for (auto moved : sortScratch)
+	{
+		AppendSorted(moved);
+	}
+}
+
+void Scene::AttachToParent(NodeID nodeId, NodeID parent)
+{
+	auto& siblings = nodeList[parent].children;
+	nodeList[nodeId].parent = parent;
+	nodeList[nodeId].childIndex = (uint32_t)siblings.size();
+	siblings.push_back(nodeId);
+}
+
+void Scene::DetachFromParent(NodeID nodeId)
+{
+	// Swap with the last sibling so removing a child does not depend on the number of siblings
+	auto& siblings = nodeList[nodeList[nodeId].parent].children;
+	auto index = nodeList[nodeId].childIndex;
+	auto last = siblings.back();
+	siblings[index] = last;
+	nodeList[last].childIndex = index;
+	siblings.pop_back();
+}
+
+void Scene::PushFreeNode(NodeID nodeId)
+{
+	nodeList[nodeId].childIndex = (uint32_t)freeNodes.size();
+	freeNodes.push_back(nodeId);
+	if ((size_t)nodeId < compactPosition.size())
+		compactPosition[nodeId] = InvalidSortIndex;
+}
+
+void Scene::SwapNodeIds(NodeID a, NodeID b)
+{
+	std::swap(nodeList[a], nodeList[b]);
+	std::swap(position[a], position[b]);
+	std::swap(rotation[a], rotation[b]);
+	std::swap(scale[a], scale[b]);
+	std::swap(isActive[a], isActive[b]);
+	std::swap(worldTransforms[a], worldTransforms[b]);
+	std::swap(dirty[a], dirty[b]);
+	std::swap(sortedIndex[a], sortedIndex[b]);
+	std::swap(compactPosition[a], compactPosition[b]);
+
+	// Own links first, then the neighbours pointing back, so it also holds when a is b's parent
+	auto remap = [a, b](NodeID id) { return id == a ? b : (id == b ? a : id); };
+	const NodeID swapped[] = { a, b };
+	for (auto nodeId : swapped)
+	{
+		if (sortedIndex[nodeId] == InvalidSortIndex)
+			continue;
+		auto& node = nodeList[nodeId];
+		node.parent = remap(node.parent);
+		for (auto& child : node.children)
+		{
+			child = remap(child);
+		}
+	}
+
+	for (auto nodeId : swapped)
+	{
+		auto& node = nodeList[nodeId];
+		if (sortedIndex[nodeId] == InvalidSortIndex)
+		{
+			freeNodes[node.childIndex] = nodeId;
+		}
+		else
+		{
+			nodeList[node.parent].children[node.childIndex] = nodeId;
+			for (auto child : node.children)
+			{
+				nodeList[child].parent = nodeId;
+			}
+			sortedNodes[sortedIndex[nodeId]] = nodeId;
+		}
+
+		if (compactPosition[nodeId] != InvalidSortIndex)
+			compactOrder[compactPosition[nodeId]] = nodeId;
+		if (dirty[nodeId])
+			dirtyNodes.push_back(nodeId); //Deduplicated once the step is done
+	}
+}
+
+void Scene::BeginCompact()
+{
+	CompactSorted();
+
+	// Depth first, so each subtree gets a contiguous range of ids
+	compactOrder.clear();
+	sortScratch.clear();
+	sortScratch.push_back(rootNode);
+	while (!sortScratch.empty())
+	{
+		auto nodeId = sortScratch.back();
+		sortScratch.pop_back();
+		compactOrder.push_back(nodeId);
+		auto& children = nodeList[nodeId].children;
+		sortScratch.insert(sortScratch.end(), children.rbegin(), children.rend());
+	}
+
+	compactPosition.assign(nodeList.size(), InvalidSortIndex);
+	for (size_t i = 0; i < compactOrder.size(); ++i)
+	{
+		compactPosition[compactOrder[i]] = (uint32_t)i;
+	}
+	compactCursor = 0;
+	compactActive = true;
+	orderChanges = 0;
+}
+
+bool Scene::RunCompact(double budgetMs, std::vector<NodeSwap>& outSwaps)
+{
+	// Nodes created since the snapshot are left where they are
+	if (compactPosition.size() < nodeList.size())
+		compactPosition.resize(nodeList.size(), InvalidSortIndex);
+
+	auto start = std::chrono::high_resolution_clock::now();
+	auto firstSwap = outSwaps.size();
+	size_t steps = 0;
+	while (compactCursor < compactOrder.size())
+	{
+		auto target = (NodeID)compactCursor;
+		auto nodeId = compactOrder[compactCursor];
+		// Removed nodes leave stale entries behind, their position no longer points back here
+		if (nodeId != target && compactPosition[nodeId] == compactCursor)
+		{
+			SwapNodeIds(nodeId, target);
+			outSwaps.push_back(NodeSwap{ nodeId, target });
+		}
+		compactCursor++;
+
+		if (++steps % CompactClockInterval == 0 &&
+			std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() >= budgetMs)
+			break;
+	}
+
+	if (outSwaps.size() > firstSwap)
+	{
+		// Ids the dirty nodes moved to were appended by SwapNodeIds, keep every flagged id once
+		size_t write = 0;
+		for (auto nodeId : dirtyNodes)
+		{
+			if (dirty[nodeId] != 1)
+				continue;
+			dirty[nodeId] = 2;
+			dirtyNodes[write++] = nodeId;
+		}
+		dirtyNodes.resize(write);
+		for (auto nodeId : dirtyNodes)
+		{
+			dirty[nodeId] = 1;
+		}
+		changedNodes.clear();
+	}
+
+	if (compactCursor < compactOrder.size())
+		return false;
+	FinishCompact();
+	return true;
+}
+
+void Scene::FinishCompact()
+{
+	// Free ids at the end of the range are dropped
+	auto count = nodeList.size();
+	while (count > 1 && sortedIndex[count - 1] == InvalidSortIndex)
+	{
+		auto index = nodeList[count - 1].childIndex;
+		auto last = freeNodes.back();
+		freeNodes[index] = last;
+		nodeList[last].childIndex = index;
+		freeNodes.pop_back();
+		count--;
+	}
+	if (count < nodeList.size())
+	{
+		nodeList.resize(count);
+		position.resize(count);
+		rotation.resize(count);
+		scale.resize(count);
+		isActive.resize(count);
+		worldTransforms.resize(count);
+		dirty.resize(count);
+		sortedIndex.resize(count);
+		dirtyNodes.erase(std::remove_if(dirtyNodes.begin(), dirtyNodes.end(), [count](NodeID nodeId) { return (size_t)nodeId >= count; }), dirtyNodes.end());
+	}
+
+	// Hierarchy order again from the renumbered nodes, which is mostly ascending ids now
+	sortedNodes.clear();
+	sortedParents.clear();
+	sortScratch.clear();
+	sortScratch.push_back(rootNode);
+	while (!sortScratch.empty())
+	{
+		auto nodeId = sortScratch.back();
+		sortScratch.pop_back();
+		sortedIndex[nodeId] = (uint32_t)sortedNodes.size();
+		sortedParents.push_back(nodeId == rootNode ? 0u : sortedIndex[nodeList[nodeId].parent]);
+		sortedNodes.push_back(nodeId);
+		auto& children = nodeList[nodeId].children;
+		sortScratch.insert(sortScratch.end(), children.rbegin(), children.rend());
+	}
+	firstStaleIndex = InvalidSortIndex;
+	subtreesDirty = true;
+
+	compactOrder.clear();
+	compactPosition.clear();
+	compactCursor = 0;
+	compactActive = false;
+}
+
+void Scene::Compact(std::vector<NodeSwap>& outSwaps)
+{
+	// A fresh snapshot, a pass in progress does not know about nodes added or moved since it started
+	BeginCompact();
+	RunCompact(std::numeric_limits<double>::max(), outSwaps);
+}
+
+bool Scene::CompactIncremental(double budgetMs, std::vector<NodeSwap>& outSwaps)
+{
+	if (!compactActive)
+	{
+		if (orderChanges * CompactChangeRatio < sortedNodes.size())
+			return true;
+		BeginCompact();
+	}
+	return RunCompact(budgetMs, outSwaps);
+}
 
 void Scene::SetTransform(NodeID nodeId, const Transform & transform)
 {
 	position[nodeId] = transform.Position;
-	rotation[nodeId] = transform.Rotation;
+	rotation[nodeId] = QuaternionFromEuler(transform.Rotation);
 	scale[nodeId] = transform.Scale;
+	MarkDirty(nodeId);
 }
 
 void Scene::SetTranslation(NodeID nodeId, const XMFLOAT3 & translation)
 {
 	position[nodeId] = translation;
+	MarkDirty(nodeId);
 }
 
 void Scene::SetRotation(NodeID nodeId, const XMFLOAT3 & rotationV)
 {
-	rotation[nodeId] = rotationV;
+	rotation[nodeId] = QuaternionFromEuler(rotationV);
+	MarkDirty(nodeId);
+}
+
+void Scene::SetRotationQuaternion(NodeID nodeId, const XMFLOAT4 & quaternion)
+{
+	XMStoreFloat4(&rotation[nodeId], XMQuaternionNormalize(XMLoadFloat4(&quaternion)));
+	MarkDirty(nodeId);
 }
 
 void Scene::SetScale(NodeID nodeId, const XMFLOAT3 & scaleV)
 {
 	scale[nodeId] = scaleV;
+	MarkDirty(nodeId);
 }
 
 void Scene::SetActive(NodeID nodeId, bool enabled)
 {
+	// Disabled branches keep stale transforms, so enabling one recomputes it
+	if (enabled && !isActive[nodeId])
+		MarkDirty(nodeId);
 	isActive[nodeId] = enabled;
 }
 
@@ -94,17 +637,18 @@ void Scene::RemoveNode(NodeID nodeId, std::vector<NodeID>& outRemovedChildren)
 {
 	std::vector<NodeID> removed;
 	GetChildren(nodeId, removed);
-	isActive[nodeId] = false; //Current node is not enabled in scene;
-	SetTransform(nodeId, DefaultTransform);
-	freeNodes.push_back(nodeId);
+	DetachFromParent(nodeId);
+	removed.push_back(nodeId);
 	for (auto node : removed)
 	{
 		nodeList[node].parent = RootNodeID;
 		nodeList[node].children.clear();
 		isActive[node] = false; //Current node is not enabled in scene;
 		SetTransform(node, DefaultTransform);
-		freeNodes.push_back(node);
+		UnlinkSorted(node);
+		PushFreeNode(node);
 	}
+	removed.pop_back();
 
 	outRemovedChildren = removed;
 }
@@ -142,9 +686,14 @@ const XMFLOAT3 & Scene::GetTranslation(NodeID nodeId)
 	return position[nodeId];
 }
 
-const XMFLOAT3 & Scene::GetRotation(NodeID nodeId)
+XMFLOAT3 Scene::GetRotation(NodeID nodeId)
+{
+	return EulerFromQuaternion(rotation[nodeId]);
+}
+
+const XMFLOAT4 & Scene::GetRotationQuaternion(NodeID nodeId)
 {
-	return rotation[nodeId]; 
+	return rotation[nodeId];
 }
 
 const XMFLOAT3 & Scene::GetScale(NodeID nodeId)
@@ -154,12 +703,12 @@ const XMFLOAT3 & Scene::GetScale(NodeID nodeId)
 
 const XMFLOAT4X4 & Scene::GetTransformMatrix(NodeID nodeId)
 {
-	return nodeList[nodeId].worldTransform;
+	return worldTransforms[nodeId];
 }
 
 Transform Scene::GetTransform(NodeID nodeId)
 {
-	return Transform{ position[nodeId], rotation[nodeId], scale[nodeId] };
+	return Transform{ position[nodeId], EulerFromQuaternion(rotation[nodeId]), scale[nodeId] };
 }
 
 Scene::~Scene()
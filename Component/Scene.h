@@ -4,6 +4,15 @@
 
 
 const NodeID RootNodeID = 0;
+const NodeID InvalidNodeID = -1; //Node of a removed entity
+const uint32_t InvalidSortIndex = UINT32_MAX;
+
+//! Two node ids exchanged by Scene::Compact, whatever referred to one now refers to the other
+struct NodeSwap
+{
+	NodeID	First;
+	NodeID	Second;
+};
 
 class Scene
 {
@@ -11,31 +20,109 @@ protected:
 	NodeID					rootNode; //Would be 0 always
 	std::vector<Node>		nodeList;
 
-	//Transform Data
+	//Transform Data, indexed by NodeID
 	std::vector<XMFLOAT3>	position;
-	std::vector<XMFLOAT3>	rotation;
+	std::vector<XMFLOAT4>	rotation; //Unit quaternions, Euler angles are only converted in the setters and getters
 	std::vector<XMFLOAT3>	scale;
 	std::vector<byte>		isActive;
+	std::vector<XMFLOAT4X4>	worldTransforms;
 	std::vector<NodeID>		freeNodes;
 
-	const Node				CreateNode(Transform transform);
-	void					InsertTransform(Transform transform);
+	//Change tracking, setters mark nodes dirty and UpdateTransforms only recomputes their subtrees
+	std::vector<byte>		dirty;
+	std::vector<NodeID>		dirtyNodes;
+	std::vector<NodeID>		changedNodes; //Nodes whose world transform changed in the last UpdateTransforms
+
+	//Hierarchy order, parents always come before their children so UpdateTransforms is a single pass
+	std::vector<NodeID>		sortedNodes;
+	std::vector<uint32_t>	sortedParents; //Index in sortedNodes of each entry's parent
+	std::vector<uint32_t>	sortedIndex; //NodeID to index in sortedNodes, InvalidSortIndex when not in the hierarchy
+	std::vector<byte>		nodeStates; //NodeUpdateState per sorted entry, written by the dense update
+
+	//Sorted entries grouped by root child for the parallel update, rebuilt after the hierarchy changes
+	std::vector<uint32_t>	subtreeEntries;
+	std::vector<uint32_t>	subtreeStarts;
+	std::vector<uint32_t>	entrySubtrees;
+	bool					subtreesDirty;
+	bool					parallelUpdate;
+	std::vector<NodeID>		sortScratch;
+	std::vector<uint32_t>	childCountScratch; //By NodeID, all zero outside InitializeNodes
+	std::vector<XMFLOAT4X4>	localTransformScratch;
+	uint32_t				firstStaleIndex; //First hole left in sortedNodes by removed or moved nodes
+
+	//Compaction, nodes are swapped one at a time into the slot of their depth first position
+	std::vector<NodeID>		compactOrder; //Depth first snapshot, compactOrder[i] moves to NodeID i
+	std::vector<uint32_t>	compactPosition; //NodeID to index in compactOrder, InvalidSortIndex for nodes outside the snapshot
+	size_t					compactCursor;
+	bool					compactActive;
+	size_t					orderChanges; //Nodes added to or removed from the hierarchy order since the last compaction
+
+	void					InsertTransform(const Transform& transform);
+	void					AppendSorted(NodeID nodeId);
+	void					UnlinkSorted(NodeID nodeId);
+	//! Closes the holes in sortedNodes, order of the remaining nodes is kept
+	void					CompactSorted();
+	void					UpdateWorldTransform(NodeID nodeId);
+	inline void				MarkDirty(NodeID nodeId)
+	{
+		if (dirty[nodeId])
+			return;
+		dirty[nodeId] = 1;
+		dirtyNodes.push_back(nodeId);
+	}
+	bool					IsActiveInHierarchy(NodeID nodeId);
+	//! Recomputes each dirty subtree, cost depends on the dirty nodes only
+	void					UpdateDirtySubtrees();
+	void					RebuildSubtrees();
+	void					AttachToParent(NodeID nodeId, NodeID parent);
+	void					DetachFromParent(NodeID nodeId);
+	void					PushFreeNode(NodeID nodeId);
+	//! Exchanges every piece of data of two nodes and relinks their neighbours, either node may be free
+	void					SwapNodeIds(NodeID a, NodeID b);
+	void					BeginCompact();
+	//! Returns true once every node of the snapshot is in place
+	bool					RunCompact(double budgetMs, std::vector<NodeSwap>& outSwaps);
+	void					FinishCompact();
 public:
 	Scene();
 	NodeID					CreateNode(NodeID parent, Transform transform = DefaultTransform);
-	inline void				UpdateTransforms() { UpdateNodes(nodeList.data(), nodeList.size(), position.data(), scale.data(), rotation.data(), isActive.data()); };
+	//! Hands out count node ids, reusing free ones first. Set them up with InitializeNodes before use.
+	void					AllocateNodes(size_t count, NodeID* outNodes);
+	//! Links and transforms allocated nodes in one pass. Parents can be anywhere in the batch.
+	void					InitializeNodes(const NodeID* nodes, const NodeID* parents, const Transform* transforms, size_t count);
+	//! Recomputes world transforms of dirty nodes and their descendants
+	void					UpdateTransforms();
+	//! Nodes whose world transform changed in the last UpdateTransforms, parents before children
+	inline const std::vector<NodeID>& GetChangedNodes() const { return changedNodes; }
+	//! Hands the root's subtrees of large updates to the thread pool, results match the serial update exactly
+	inline void				SetParallelUpdate(bool enable) { parallelUpdate = enable; }
 
+	//! Moves a node and its subtree under parent. parent must not be inside the subtree.
+	void					SetParent(NodeID nodeId, NodeID parent);
 	void					SetTransform(NodeID nodeId, const Transform& transform);
 	void					SetTranslation(NodeID nodeId, const XMFLOAT3& translation);
+	//! Pitch, yaw and roll in radians
 	void					SetRotation(NodeID nodeId, const XMFLOAT3& rotationV);
+	//! Stored as is after normalizing, for animation and other code that already works in quaternions
+	void					SetRotationQuaternion(NodeID nodeId, const XMFLOAT4& quaternion);
 	void					SetScale(NodeID nodeId, const XMFLOAT3& scaleV);
 	void					SetActive(NodeID nodeId, bool enabled);
 	void					RemoveNode(NodeID nodeId, std::vector<NodeID>& outRemovedChildren);
 
+	//! Renumbers nodes in depth first hierarchy order and drops trailing free ids, so updates walk memory in order.
+	//! Node ids change, every exchange is appended to outSwaps in the order it was made. Clears GetChangedNodes,
+	//! so run it before the frame's UpdateTransforms.
+	void					Compact(std::vector<NodeSwap>& outSwaps);
+	//! Compact spread over several calls, each stopping after about budgetMs. A pass starts once enough nodes were
+	//! added or removed since the last one. Returns true when no pass is in progress.
+	bool					CompactIncremental(double budgetMs, std::vector<NodeSwap>& outSwaps);
+
 	void					GetChildren(NodeID nodeId, std::vector<NodeID>& children);
 	const bool				IsActive(NodeID nodeId);
 	const XMFLOAT3&			GetTranslation(NodeID nodeId);
-	const XMFLOAT3&			GetRotation(NodeID nodeId);
+	//! Pitch, yaw and roll in radians, converted from the stored quaternion
+	XMFLOAT3				GetRotation(NodeID nodeId);
+	const XMFLOAT4&			GetRotationQuaternion(NodeID nodeId);
 	const XMFLOAT3&			GetScale(NodeID nodeId);
 	const XMFLOAT4X4&		GetTransformMatrix(NodeID nodeId);
 	Transform				GetTransform(NodeID nodeId);
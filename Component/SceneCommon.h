@@ -4,6 +4,7 @@
 typedef int32_t EntityID;
 typedef int32_t NodeID;
 typedef size_t	TypeID;
+//! Authoring form of a node transform, Rotation is pitch, yaw and roll in radians. Scene stores it as a quaternion.
 struct Transform
 {
 	XMFLOAT3 Position;
@@ -23,7 +24,7 @@ struct Transform
 struct TransformSOA
 {
 	XMFLOAT3*	Position;
-	XMFLOAT3*	Rotation;
+	XMFLOAT4*	Rotation; //Unit quaternions
 	XMFLOAT3*	Scale;
 	size_t		Count;
 };
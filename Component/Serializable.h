@@ -1,5 +1,6 @@
 #pragma once
 #include "ComponentFactory.h"
+#include "MemoryPool.h"
 #include <cereal/types/complex.hpp>
 #include <cereal/types/common.hpp>
 #include <cereal/types/vector.hpp>
@@ -21,7 +22,15 @@ class Serializable
 			}
 		);
 
-		ComponentFactory::RegisterComponentTypeID(StringID(name), typeid(T).hash_code());
+		ComponentFactory::RegisterArchetypeContainer(
+			StringID(name),
+			[&](ArchetypeStorage* storage)->IComponent*
+			{
+				return (IComponent*)new ArchetypeComponent<T>(storage);
+			}
+		);
+
+		ComponentFactory::RegisterComponentTypeID(StringID(name), ComponentType<T>::ID());
 	};
 
 public:
@@ -42,6 +51,7 @@ static const char* GetName() \
 { \
 	return #name ; \
 } \
+PooledAllocation(name) \
 virtual IComponentData* Clone() override \
 { \
 	name* val = new name(); \
@@ -54,7 +64,7 @@ virtual IComponentData* Clone() override \
 
 
 #define RegisterComponent(name)\
-Serializable<name> name ## ::Reflectable_ ## name = Serializable<name>(#name); 
+Serializable<name> name::Reflectable_ ## name = Serializable<name>(#name); 
 
 
 #define Construct(type) \
@@ -0,0 +1,160 @@
+#pragma once
+#include "stdafx.h"
+#include <immintrin.h>
+
+// The AVX2 path is picked at runtime with CpuSupportsAvx2. MSVC emits AVX2 intrinsics without /arch:AVX2, GCC and
+// Clang compile only the functions marked for AVX2 so the rest of the build still runs on any x64 CPU.
+#if defined(_MSC_VER)
+#define SIMD_LANES_AVX2 1
+#define SIMD_AVX2_TARGET
+#define SIMD_AVX2_KERNEL
+#define SIMD_KERNEL_INLINE
+#elif defined(__GNUC__)
+#define SIMD_LANES_AVX2 1
+#define SIMD_AVX2_TARGET __attribute__((target("avx2")))
+//! The non template function running a kernel over Avx2Lanes, flattening inlines the lane operations as well
+#define SIMD_AVX2_KERNEL __attribute__((target("avx2"), flatten))
+//! Kernel templates over the lanes and the lambdas inside them. The Avx2Lanes instantiation must end up in its
+//! SIMD_AVX2_KERNEL caller even without optimization, a call from code not compiled for AVX2 passes __m256 the
+//! wrong way.
+#define SIMD_KERNEL_INLINE __attribute__((always_inline))
+#endif
+
+//! Lane operations shared by the batch kernels. Kernels are templates over SseLanes or Avx2Lanes, so the 4 and
+//! 8 wide versions run the same operations in the same order and give identical results.
+
+//! x, y, z and a zero w without reading past the element
+inline __m128 LoadFloat3(const XMFLOAT3* element)
+{
+	auto xy = _mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)element));
+	return _mm_movelh_ps(xy, _mm_load_ss(&element->z));
+}
+
+//! Lane operations on 4 floats
+struct SseLanes
+{
+	typedef __m128 Vec;
+	enum { Width = 4 };
+
+	static inline Vec Set1(float v) { return _mm_set1_ps(v); }
+	static inline Vec Load(const float* v) { return _mm_loadu_ps(v); }
+	static inline void Store(float* out, Vec v) { _mm_storeu_ps(out, v); }
+	static inline Vec Add(Vec a, Vec b) { return _mm_add_ps(a, b); }
+	static inline Vec Sub(Vec a, Vec b) { return _mm_sub_ps(a, b); }
+	static inline Vec Mul(Vec a, Vec b) { return _mm_mul_ps(a, b); }
+	static inline Vec Min(Vec a, Vec b) { return _mm_min_ps(a, b); }
+	static inline Vec Max(Vec a, Vec b) { return _mm_max_ps(a, b); }
+	static inline Vec Abs(Vec a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a); }
+	static inline Vec Or(Vec a, Vec b) { return _mm_or_ps(a, b); }
+	static inline Vec And(Vec a, Vec b) { return _mm_and_ps(a, b); }
+	//! a in lanes where mask is set, b in the others
+	static inline Vec Select(Vec mask, Vec a, Vec b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+	//! All bits set in lanes where a < b
+	static inline Vec Less(Vec a, Vec b) { return _mm_cmplt_ps(a, b); }
+	static inline Vec LessEqual(Vec a, Vec b) { return _mm_cmple_ps(a, b); }
+	//! Bit i set when lane i of a comparison result is set
+	static inline uint32_t Mask(Vec a) { return (uint32_t)_mm_movemask_ps(a); }
+
+	//! Loads base[indices[i]] into lane i of x, y and z
+	static inline void Gather(const XMFLOAT3* base, const int32_t* indices, Vec& x, Vec& y, Vec& z)
+	{
+		auto w = LoadFloat3(&base[indices[3]]);
+		x = LoadFloat3(&base[indices[0]]);
+		y = LoadFloat3(&base[indices[1]]);
+		z = LoadFloat3(&base[indices[2]]);
+		_MM_TRANSPOSE4_PS(x, y, z, w);
+	}
+
+	static inline void Gather(const XMFLOAT4* base, const int32_t* indices, Vec& x, Vec& y, Vec& z, Vec& w)
+	{
+		x = _mm_loadu_ps(&base[indices[0]].x);
+		y = _mm_loadu_ps(&base[indices[1]].x);
+		z = _mm_loadu_ps(&base[indices[2]].x);
+		w = _mm_loadu_ps(&base[indices[3]].x);
+		_MM_TRANSPOSE4_PS(x, y, z, w);
+	}
+
+	//! Transposes lanes of x, y, z, w into count row vectors and stores them to row of each matrix
+	static inline void StoreRow(Vec x, Vec y, Vec z, Vec w, size_t row, XMFLOAT4X4* outMatrices, size_t count)
+	{
+		_MM_TRANSPOSE4_PS(x, y, z, w);
+		const Vec rows[] = { x, y, z, w };
+		for (size_t i = 0; i < count; ++i)
+		{
+			_mm_storeu_ps(&outMatrices[i].m[row][0], rows[i]);
+		}
+	}
+
+	static inline void Finish() {}
+};
+
+#ifdef SIMD_LANES_AVX2
+//! Lane operations on 8 floats
+struct Avx2Lanes
+{
+	typedef __m256 Vec;
+	enum { Width = 8 };
+
+	SIMD_AVX2_TARGET static inline Vec Set1(float v) { return _mm256_set1_ps(v); }
+	SIMD_AVX2_TARGET static inline Vec Load(const float* v) { return _mm256_loadu_ps(v); }
+	SIMD_AVX2_TARGET static inline void Store(float* out, Vec v) { _mm256_storeu_ps(out, v); }
+	SIMD_AVX2_TARGET static inline Vec Add(Vec a, Vec b) { return _mm256_add_ps(a, b); }
+	SIMD_AVX2_TARGET static inline Vec Sub(Vec a, Vec b) { return _mm256_sub_ps(a, b); }
+	SIMD_AVX2_TARGET static inline Vec Mul(Vec a, Vec b) { return _mm256_mul_ps(a, b); }
+	SIMD_AVX2_TARGET static inline Vec Min(Vec a, Vec b) { return _mm256_min_ps(a, b); }
+	SIMD_AVX2_TARGET static inline Vec Max(Vec a, Vec b) { return _mm256_max_ps(a, b); }
+	SIMD_AVX2_TARGET static inline Vec Abs(Vec a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a); }
+	SIMD_AVX2_TARGET static inline Vec Or(Vec a, Vec b) { return _mm256_or_ps(a, b); }
+	SIMD_AVX2_TARGET static inline Vec And(Vec a, Vec b) { return _mm256_and_ps(a, b); }
+	SIMD_AVX2_TARGET static inline Vec Select(Vec mask, Vec a, Vec b) { return _mm256_blendv_ps(b, a, mask); }
+	SIMD_AVX2_TARGET static inline Vec Less(Vec a, Vec b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+	SIMD_AVX2_TARGET static inline Vec LessEqual(Vec a, Vec b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+	SIMD_AVX2_TARGET static inline uint32_t Mask(Vec a) { return (uint32_t)_mm256_movemask_ps(a); }
+
+	SIMD_AVX2_TARGET static inline void Gather(const XMFLOAT3* base, const int32_t* indices, Vec& x, Vec& y, Vec& z)
+	{
+		// Two SSE transposes instead of hardware gathers, which are slow on many CPUs
+		__m128 low[3], high[3];
+		SseLanes::Gather(base, indices, low[0], low[1], low[2]);
+		SseLanes::Gather(base, indices + 4, high[0], high[1], high[2]);
+		x = _mm256_insertf128_ps(_mm256_castps128_ps256(low[0]), high[0], 1);
+		y = _mm256_insertf128_ps(_mm256_castps128_ps256(low[1]), high[1], 1);
+		z = _mm256_insertf128_ps(_mm256_castps128_ps256(low[2]), high[2], 1);
+	}
+
+	SIMD_AVX2_TARGET static inline void Gather(const XMFLOAT4* base, const int32_t* indices, Vec& x, Vec& y, Vec& z, Vec& w)
+	{
+		__m128 low[4], high[4];
+		SseLanes::Gather(base, indices, low[0], low[1], low[2], low[3]);
+		SseLanes::Gather(base, indices + 4, high[0], high[1], high[2], high[3]);
+		x = _mm256_insertf128_ps(_mm256_castps128_ps256(low[0]), high[0], 1);
+		y = _mm256_insertf128_ps(_mm256_castps128_ps256(low[1]), high[1], 1);
+		z = _mm256_insertf128_ps(_mm256_castps128_ps256(low[2]), high[2], 1);
+		w = _mm256_insertf128_ps(_mm256_castps128_ps256(low[3]), high[3], 1);
+	}
+
+	SIMD_AVX2_TARGET static inline void StoreRow(Vec x, Vec y, Vec z, Vec w, size_t row, XMFLOAT4X4* outMatrices, size_t count)
+	{
+		// Per 128 bit half transpose, the low half holds lanes 0-3 and the high half lanes 4-7
+		auto xy0 = _mm256_unpacklo_ps(x, y);
+		auto xy1 = _mm256_unpackhi_ps(x, y);
+		auto zw0 = _mm256_unpacklo_ps(z, w);
+		auto zw1 = _mm256_unpackhi_ps(z, w);
+		const Vec rows[] =
+		{
+			_mm256_shuffle_ps(xy0, zw0, _MM_SHUFFLE(1, 0, 1, 0)),
+			_mm256_shuffle_ps(xy0, zw0, _MM_SHUFFLE(3, 2, 3, 2)),
+			_mm256_shuffle_ps(xy1, zw1, _MM_SHUFFLE(1, 0, 1, 0)),
+			_mm256_shuffle_ps(xy1, zw1, _MM_SHUFFLE(3, 2, 3, 2))
+		};
+		for (size_t i = 0; i < count; ++i)
+		{
+			auto half = i < 4 ? _mm256_castps256_ps128(rows[i]) : _mm256_extractf128_ps(rows[i - 4], 1);
+			_mm_storeu_ps(&outMatrices[i].m[row][0], half);
+		}
+	}
+
+	//! Avoids the AVX to SSE transition penalty in the caller
+	SIMD_AVX2_TARGET static inline void Finish() { _mm256_zeroupper(); }
+};
+#endif
@@ -0,0 +1,50 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include "SceneCommon.h"
+
+//! Paged EntityID -> dense index lookup. Pages are allocated on first use so sparse id ranges stay cheap.
+class SparseEntityIndex
+{
+	static const uint32_t PageShift = 12;
+	static const uint32_t PageSize = 1u << PageShift;
+	static const uint32_t PageMask = PageSize - 1;
+
+	std::vector<std::unique_ptr<uint32_t[]>> pages;
+public:
+	static const uint32_t InvalidIndex = 0xFFFFFFFFu;
+
+	inline uint32_t Find(EntityID entity) const
+	{
+		auto page = (uint32_t)entity >> PageShift;
+		if (page >= pages.size() || !pages[page])
+			return InvalidIndex;
+		return pages[page][(uint32_t)entity & PageMask];
+	}
+
+	inline void Set(EntityID entity, uint32_t index)
+	{
+		auto page = (uint32_t)entity >> PageShift;
+		if (page >= pages.size())
+			pages.resize(page + 1);
+		if (!pages[page])
+		{
+			pages[page] = std::unique_ptr<uint32_t[]>(new uint32_t[PageSize]);
+			std::fill(pages[page].get(), pages[page].get() + PageSize, (uint32_t)InvalidIndex);
+		}
+		pages[page][(uint32_t)entity & PageMask] = index;
+	}
+
+	inline void Erase(EntityID entity)
+	{
+		auto page = (uint32_t)entity >> PageShift;
+		if (page < pages.size() && pages[page])
+			pages[page][(uint32_t)entity & PageMask] = InvalidIndex;
+	}
+
+	inline void Clear()
+	{
+		pages.clear();
+	}
+};
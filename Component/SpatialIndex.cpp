@@ -0,0 +1,166 @@
+#include "stdafx.h"
+#include "SpatialIndex.h"
+#include "ResourceManager.h"
+
+//! Distance along the ray to where it enters localBox transformed by world, -1 for a miss
+static float IntersectRay(const BoundingOrientedBox& localBox, const XMFLOAT4X4& world, FXMVECTOR origin, FXMVECTOR direction, float maxDistance)
+{
+	// In the box's own space it is axis aligned around the origin. Ray parameters do not change under the affine
+	// transform, so the hit distance is still in world units, also under non uniform scale.
+	auto boxToWorld = XMMatrixRotationQuaternion(XMLoadFloat4(&localBox.Orientation)) * XMMatrixTranslationFromVector(XMLoadFloat3(&localBox.Center)) * XMLoadFloat4x4(&world);
+	XMVECTOR determinant;
+	auto worldToBox = XMMatrixInverse(&determinant, boxToWorld);
+	if (XMVectorGetX(determinant) == 0.f)
+		return -1.f;
+
+	XMFLOAT3 start, step;
+	XMStoreFloat3(&start, XMVector3Transform(origin, worldToBox));
+	XMStoreFloat3(&step, XMVector3TransformNormal(direction, worldToBox));
+	const float starts[3] = { start.x, start.y, start.z };
+	const float steps[3] = { step.x, step.y, step.z };
+	const float extents[3] = { localBox.Extents.x, localBox.Extents.y, localBox.Extents.z };
+	float nearest = 0.f;
+	float farthest = maxDistance;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		if (steps[axis] == 0.f)
+		{
+			if (fabsf(starts[axis]) > extents[axis])
+				return -1.f;
+			continue;
+		}
+		auto t0 = (-extents[axis] - starts[axis]) / steps[axis];
+		auto t1 = (extents[axis] - starts[axis]) / steps[axis];
+		if (t0 > t1)
+			std::swap(t0, t1);
+		nearest = std::max(nearest, t0);
+		farthest = std::min(farthest, t1);
+		if (nearest > farthest)
+			return -1.f;
+	}
+	return nearest;
+}
+
+SpatialIndex::SpatialIndex(EntityManager * entityManager, ResourceManager * resourceManager, float margin) :
+	entityManager(entityManager),
+	resourceManager(resourceManager),
+	tree(margin),
+	structureVersion(0)
+{
+}
+
+const BoundingOrientedBox * SpatialIndex::GetMeshBounds(EntityID entity)
+{
+	if (!entityManager->IsActive(entity))
+		return nullptr;
+	auto mesh = entityManager->GetEntity(entity).Mesh;
+	if (mesh == 0u)
+		return nullptr;
+	auto meshData = resourceManager->GetMesh(mesh);
+	return meshData != nullptr ? &meshData->GetBoundingOrientedBox() : nullptr;
+}
+
+void SpatialIndex::UpdateProxy(EntityID entity)
+{
+	auto meshBounds = GetMeshBounds(entity);
+	if (meshBounds == nullptr)
+	{
+		RemoveProxy(entity);
+		return;
+	}
+
+	if ((size_t)entity >= proxies.size())
+	{
+		proxies.resize(entity + 1, InvalidBvhProxy);
+		lastBounds.resize(entity + 1);
+	}
+
+	auto bounds = BvhBounds::FromOrientedBox(*meshBounds, entityManager->GetTransformMatrix(entity));
+	auto& proxy = proxies[entity];
+	if (proxy == InvalidBvhProxy)
+	{
+		proxy = tree.Insert(bounds, (uint32_t)entity);
+	}
+	else
+	{
+		// Also covers the last position, the renderer draws somewhere between the last two ticks
+		tree.Move(proxy, BvhBounds::Merge(lastBounds[entity], bounds));
+	}
+	lastBounds[entity] = bounds;
+}
+
+void SpatialIndex::RemoveProxy(EntityID entity)
+{
+	if ((size_t)entity >= proxies.size() || proxies[entity] == InvalidBvhProxy)
+		return;
+	tree.Remove(proxies[entity]);
+	proxies[entity] = InvalidBvhProxy;
+}
+
+void SpatialIndex::Sync()
+{
+	// Version 0 means nothing was indexed yet
+	auto version = entityManager->GetStructureVersion() + 1;
+	if (version != structureVersion)
+	{
+		structureVersion = version;
+		auto count = (EntityID)entityManager->Count();
+		for (EntityID e = 0; e < count; ++e)
+		{
+			UpdateProxy(e);
+		}
+		for (auto e = count; e < (EntityID)proxies.size(); ++e)
+		{
+			RemoveProxy(e);
+		}
+		return;
+	}
+
+	// New entities start with a dirty node, so they show up here too
+	entityManager->GetChangedEntities(changedEntities);
+	for (auto e : changedEntities)
+	{
+		UpdateProxy(e);
+	}
+}
+
+void SpatialIndex::QueryFrustum(const Frustum & frustum, std::vector<EntityID>& outEntities) const
+{
+	outEntities.clear();
+	tree.QueryFrustum(frustum, [&](BvhProxyID proxy) { outEntities.push_back((EntityID)tree.GetUserData(proxy)); });
+}
+
+void SpatialIndex::QuerySphere(const BoundingSphere & sphere, std::vector<EntityID>& outEntities) const
+{
+	outEntities.clear();
+	tree.QuerySphere(sphere, [&](BvhProxyID proxy) { outEntities.push_back((EntityID)tree.GetUserData(proxy)); });
+}
+
+void SpatialIndex::QueryBox(const BoundingBox & box, std::vector<EntityID>& outEntities) const
+{
+	outEntities.clear();
+	tree.QueryBox(BvhBounds::FromBox(box), [&](BvhProxyID proxy) { outEntities.push_back((EntityID)tree.GetUserData(proxy)); });
+}
+
+EntityID SpatialIndex::RayCast(const XMFLOAT3 & origin, const XMFLOAT3 & direction, float maxDistance, float & outDistance)
+{
+	auto rayOrigin = XMLoadFloat3(&origin);
+	auto rayDirection = XMLoadFloat3(&direction);
+	EntityID nearest = -1;
+	tree.RayCast(origin, direction, maxDistance, [&](BvhProxyID proxy, float distance)
+	{
+		auto entity = (EntityID)tree.GetUserData(proxy);
+		// The proxy stays until the next Sync after the entity was removed or lost its mesh
+		auto meshBounds = GetMeshBounds(entity);
+		if (meshBounds == nullptr)
+			return -1.f;
+		auto hit = IntersectRay(*meshBounds, entityManager->GetTransformMatrix(entity), rayOrigin, rayDirection, distance);
+		if (hit >= 0.f)
+		{
+			nearest = entity;
+			outDistance = hit;
+		}
+		return hit;
+	});
+	return nearest;
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include "stdafx.h"
+#include <vector>
+#include "DynamicBvh.h"
+#include "EntityManager.h"
+
+class ResourceManager;
+
+//! World space bounds of every active entity with a mesh, kept in a DynamicBvh. Sync after
+//! Scene::UpdateTransforms moves only the entities whose transforms changed.
+class SpatialIndex
+{
+	EntityManager*			entityManager;
+	ResourceManager*		resourceManager;
+	DynamicBvh				tree;
+	std::vector<BvhProxyID>	proxies; //Indexed by EntityID
+	std::vector<BvhBounds>	lastBounds; //Tight bounds at the last Sync, indexed by EntityID
+	std::vector<EntityID>	changedEntities;
+	uint32_t				structureVersion;
+
+	const BoundingOrientedBox*	GetMeshBounds(EntityID entity);
+	void						UpdateProxy(EntityID entity);
+	void						RemoveProxy(EntityID entity);
+public:
+	SpatialIndex(EntityManager* entityManager, ResourceManager* resourceManager, float margin = 0.1f);
+
+	//! Catches up with new entities and transform changes. Removing, enabling, disabling or changing the mesh of an
+	//! entity makes the next call go over every entity.
+	void					Sync();
+
+	//! Entities whose bounds may overlap the volume. Conservative, test the entity's own bounds for exact results.
+	void					QueryFrustum(const Frustum& frustum, std::vector<EntityID>& outEntities) const;
+	void					QuerySphere(const BoundingSphere& sphere, std::vector<EntityID>& outEntities) const;
+	void					QueryBox(const BoundingBox& box, std::vector<EntityID>& outEntities) const;
+	//! Nearest entity whose oriented mesh box the ray hits within maxDistance, -1 for none. direction must be
+	//! normalized.
+	EntityID				RayCast(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance, float& outDistance);
+
+	inline const DynamicBvh&	GetTree() const { return tree; }
+};
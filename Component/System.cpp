@@ -2,21 +2,30 @@
 #include "System.h"
 
 ISystem::ISystem(EntityManager * entityManager):
-	entity(entityManager)
+	entity(entityManager),
+	commands(nullptr),
+	lastVersion(0)
 {
 }
 
 void ISystem::GetEntities(std::vector<EntityID>& outEntities)
 {
 	std::vector<EntityID> entities;
-	for (auto component : components)
+	std::vector<EntityID> intersection;
+	outEntities.clear();
+	for (size_t i = 0; i < components.size(); ++i)
 	{
-		entity->GetComponentEntities(component, entities);
+		entities.clear();
+		entity->GetComponentEntities(components[i], entities);
 		std::sort(entities.begin(), entities.end());
-		if (outEntities.size() == 0)
+		if (i == 0)
 			outEntities = entities;
 		else //Get only intersecting entity list
-			std::set_intersection(outEntities.begin(), outEntities.end(), entities.begin(), entities.end(), outEntities.begin()); 
+		{
+			intersection.clear();
+			std::set_intersection(outEntities.begin(), outEntities.end(), entities.begin(), entities.end(), std::back_inserter(intersection));
+			outEntities.swap(intersection);
+		}
 	}
 }
 
@@ -1,14 +1,29 @@
 #pragma once
 #include "stdafx.h"
 #include "EntityManager.h"
+#include "Query.h"
+#include "EntityCommandBuffer.h"
 #include "SystemContext.h"
 
+enum ComponentAccess
+{
+	ComponentAccessRead = 0,
+	ComponentAccessWrite
+};
+
+//! Stands in for Scene transform data when declaring system access
+struct TransformAccess {};
+
 class ISystem
 {
 protected:
 	EntityManager*		entity;
+	EntityCommandBuffer* commands; //Structural changes recorded here are applied after all systems have updated
 	SystemContext		context;
 	std::vector<TypeID> components;
+	std::vector<TypeID> readComponents;
+	std::vector<TypeID> writeComponents;
+	uint32_t			lastVersion; //ChangeVersion at the end of the previous update, 0 before the first one
 
 	template<typename T>
 	void			GetEntities(std::vector<EntityID>& outEntities);
@@ -17,12 +32,25 @@ protected:
 	void			GetComponents(std::vector<T*>& outComponents, const std::vector<EntityID>& entities);
 public:
 	ISystem(EntityManager* entityManager);
-	ISystem() { entity = nullptr; };
+	ISystem() { entity = nullptr; commands = nullptr; lastVersion = 0; };
 
 	void SetEntityManager(EntityManager* manager) { entity = manager; }
+	void SetCommandBuffer(EntityCommandBuffer* commandBuffer) { commands = commandBuffer; }
 	void SetContext(const SystemContext& context) { this->context = context; };
+	//! Declares a component this system uses. SystemManager runs systems with non conflicting access in parallel.
 	template<typename T>
-	void			RegisterComponent();
+	void			RegisterComponent(ComponentAccess access = ComponentAccessWrite);
+	void			RegisterTransformAccess(ComponentAccess access);
+
+	//! Systems that declare nothing are treated as touching everything and never run alongside others
+	inline bool		DeclaresAccess() const { return !readComponents.empty() || !writeComponents.empty(); }
+	inline const std::vector<TypeID>& GetReadComponents() const { return readComponents; }
+	inline const std::vector<TypeID>& GetWriteComponents() const { return writeComponents; }
+	virtual const char* GetName() { return typeid(*this).name(); }
+	//! Pass to Changed<T>/Added<T> filters to only process what changed since this system last ran
+	inline uint32_t	GetLastVersion() const { return lastVersion; }
+	inline void		SetLastVersion(uint32_t version) { lastVersion = version; }
+
 	virtual void	Init() {};
 	virtual void	PreUpdate() {};
 	virtual void	Update(float deltaTime) = 0;
@@ -32,10 +60,22 @@ public:
 };
 
 template<typename T>
-inline void ISystem::RegisterComponent()
+inline void ISystem::RegisterComponent(ComponentAccess access)
+{
+	entity->RegisterComponent<typename std::remove_const<T>::type>();
+	components.push_back(ComponentType<T>::ID());
+	if (access == ComponentAccessWrite)
+		writeComponents.push_back(ComponentType<T>::ID());
+	else
+		readComponents.push_back(ComponentType<T>::ID());
+}
+
+inline void ISystem::RegisterTransformAccess(ComponentAccess access)
 {
-	entity->RegisterComponent<T>();
-	components.push_back(typeid(T).hash_code());
+	if (access == ComponentAccessWrite)
+		writeComponents.push_back(ComponentType<TransformAccess>::ID());
+	else
+		readComponents.push_back(ComponentType<TransformAccess>::ID());
 }
 
 template<typename T>
@@ -9,14 +9,16 @@ class AnimationManager;
 
 class EntityManager;
 class InputManager;
+class SpatialIndex;
 
 struct SystemContext
 {
 	Camera*					MainCamera;
 	Game*					GameInstance;
-	ResourceManager*		ResourceManager;
-	EntityManager*			EntityManager;
-	SystemResourceManager*	SystemResourceManager;
-	AnimationManager*		AnimationManager;
+	::ResourceManager*		ResourceManager;
+	::EntityManager*		EntityManager;
+	::SystemResourceManager*	SystemResourceManager;
+	::AnimationManager*		AnimationManager;
 	InputManager*			Input;
+	SpatialIndex*			Spatial; //Bounds of entities with meshes, for proximity queries
 };
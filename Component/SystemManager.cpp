@@ -1,11 +1,16 @@
 #include "stdafx.h"
 #include "SystemManager.h"
+#include <sstream>
+#include <algorithm>
 
 
 SystemManager::SystemManager(EntityManager * entityMgr, SystemContext* context) :
+	context(context),
 	entityManager(entityMgr),
-	context(context)
+	scheduleDirty(true),
+	parallelUpdate(true)
 {
+	threadPool = std::unique_ptr<ThreadPool>(new ThreadPool());
 }
 
 SystemManager::~SystemManager()
@@ -22,8 +27,10 @@ void SystemManager::RegisterSystems(std::vector<ISystem*>&& systems)
 	for (auto system : this->systems)
 	{
 		system->SetEntityManager(entityManager);
+		system->SetCommandBuffer(&commandBuffer);
 		system->SetContext(*context);
 	}
+	scheduleDirty = true;
 }
 
 void SystemManager::RegisterSystems()
@@ -31,9 +38,11 @@ void SystemManager::RegisterSystems()
 	for (auto system : systems)
 	{
 		system->SetEntityManager(entityManager);
+		system->SetCommandBuffer(&commandBuffer);
 		system->SetContext(*context);
 		system->Init();
 	}
+	scheduleDirty = true;
 }
 
 std::vector<ISystem*>& SystemManager::GetSystems()
@@ -52,23 +61,168 @@ void SystemManager::Init()
 	{
 		system->Init();
 	}
+	scheduleDirty = true;
 }
 
-void SystemManager::Update(float deltaTime)
+bool SystemManager::Conflicts(ISystem * a, ISystem * b)
+{
+	if (!a->DeclaresAccess() || !b->DeclaresAccess())
+		return true;
+
+	auto overlaps = [](const std::vector<TypeID>& x, const std::vector<TypeID>& y)
+	{
+		for (auto type : x)
+		{
+			if (std::find(y.begin(), y.end(), type) != y.end())
+				return true;
+		}
+		return false;
+	};
+
+	return overlaps(a->GetWriteComponents(), b->GetWriteComponents()) ||
+		overlaps(a->GetWriteComponents(), b->GetReadComponents()) ||
+		overlaps(b->GetWriteComponents(), a->GetReadComponents());
+}
+
+void SystemManager::BuildSchedule()
 {
+	schedule.clear();
 	for (auto system : systems)
 	{
-		system->PreUpdate();
-		system->Update(deltaTime);
-		system->PostUpdate();
+		schedule.push_back(SystemScheduleNode{ system, {}, {}, 0, 0.0, 0.0 });
 	}
-
 	for (auto system : internalSystems)
 	{
-		system->PreUpdate();
-		system->Update(deltaTime);
-		system->PostUpdate();
+		schedule.push_back(SystemScheduleNode{ system, {}, {}, 0, 0.0, 0.0 });
+	}
+
+	// Registration order decides who runs first when two systems conflict
+	for (uint32_t j = 0; j < schedule.size(); ++j)
+	{
+		for (uint32_t i = 0; i < j; ++i)
+		{
+			if (Conflicts(schedule[i].System, schedule[j].System))
+			{
+				schedule[i].Dependents.push_back(j);
+				schedule[j].Dependencies.push_back(i);
+				schedule[j].DependencyCount++;
+			}
+		}
 	}
+
+	remainingDependencies = std::unique_ptr<std::atomic<int>[]>(new std::atomic<int>[schedule.size()]);
+	scheduleDirty = false;
+}
+
+void SystemManager::RunSystem(SystemScheduleNode & node, float deltaTime, std::chrono::high_resolution_clock::time_point frameStart)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	node.System->PreUpdate();
+	node.System->Update(deltaTime);
+	node.System->PostUpdate();
+	auto end = std::chrono::high_resolution_clock::now();
+	node.StartTime = std::chrono::duration<double, std::milli>(start - frameStart).count();
+	node.EndTime = std::chrono::duration<double, std::milli>(end - frameStart).count();
+
+	// Writes from this update are at or below the returned version, later writes from anyone are above it
+	node.System->SetLastVersion(ChangeVersion::Advance());
+}
+
+void SystemManager::RunScheduled(uint32_t nodeIndex, float deltaTime, JobCounter & counter, std::chrono::high_resolution_clock::time_point frameStart)
+{
+	auto& node = schedule[nodeIndex];
+	RunSystem(node, deltaTime, frameStart);
+
+	for (auto dependent : node.Dependents)
+	{
+		if (--remainingDependencies[dependent] == 0)
+		{
+			threadPool->Submit([this, dependent, deltaTime, &counter, frameStart]() { RunScheduled(dependent, deltaTime, counter, frameStart); }, counter);
+		}
+	}
+}
+
+std::string SystemManager::GetScheduleDump()
+{
+	if (scheduleDirty)
+		BuildSchedule();
+
+	std::stringstream dump;
+	std::vector<double> pathLength(schedule.size());
+	std::vector<int> pathPrevious(schedule.size(), -1);
+	int pathEnd = -1;
+	for (uint32_t i = 0; i < schedule.size(); ++i) //Nodes are already in topological order
+	{
+		auto& node = schedule[i];
+		auto duration = node.EndTime - node.StartTime;
+		pathLength[i] = duration;
+		for (auto dependency : node.Dependencies)
+		{
+			if (pathLength[dependency] + duration > pathLength[i])
+			{
+				pathLength[i] = pathLength[dependency] + duration;
+				pathPrevious[i] = dependency;
+			}
+		}
+		if (pathEnd < 0 || pathLength[i] > pathLength[pathEnd])
+			pathEnd = i;
+
+		dump << "[" << i << "] " << node.System->GetName()
+			<< " start " << node.StartTime << "ms duration " << duration << "ms after {";
+		for (auto dependency : node.Dependencies)
+		{
+			dump << " " << dependency;
+		}
+		dump << " }\n";
+	}
+
+	dump << "Critical path";
+	if (pathEnd >= 0)
+		dump << " (" << pathLength[pathEnd] << "ms):";
+	std::vector<int> path;
+	for (int i = pathEnd; i >= 0; i = pathPrevious[i])
+	{
+		path.push_back(i);
+	}
+	for (auto it = path.rbegin(); it != path.rend(); ++it)
+	{
+		dump << " " << schedule[*it].System->GetName();
+	}
+	dump << "\n";
+	return dump.str();
+}
+
+void SystemManager::Update(float deltaTime)
+{
+	if (scheduleDirty)
+		BuildSchedule();
+
+	entityManager->RefreshQueries();
+	auto frameStart = std::chrono::high_resolution_clock::now();
+	if (!parallelUpdate || threadPool->GetThreadCount() == 0)
+	{
+		for (uint32_t i = 0; i < schedule.size(); ++i)
+		{
+			RunSystem(schedule[i], deltaTime, frameStart);
+		}
+	}
+	else
+	{
+		JobCounter counter;
+		for (uint32_t i = 0; i < schedule.size(); ++i)
+		{
+			remainingDependencies[i] = schedule[i].DependencyCount;
+		}
+
+		for (uint32_t i = 0; i < schedule.size(); ++i)
+		{
+			if (schedule[i].DependencyCount == 0)
+				threadPool->Submit([this, i, deltaTime, &counter, frameStart]() { RunScheduled(i, deltaTime, counter, frameStart); }, counter);
+		}
+		threadPool->Wait(counter);
+	}
+
+	commandBuffer.Playback(entityManager); //Sync point for structural changes
 }
 
 void SystemManager::Shutdown()
@@ -1,7 +1,20 @@
 #pragma once
 #include "System.h"
 #include "SystemContext.h"
+#include "ThreadPool.h"
+#include <string>
+#include <chrono>
 
+//! One system in the update DAG. Systems only depend on earlier registered systems they conflict with.
+struct SystemScheduleNode
+{
+	ISystem*				System;
+	std::vector<uint32_t>	Dependents;
+	std::vector<uint32_t>	Dependencies;
+	int						DependencyCount;
+	double					StartTime; //Milliseconds since the start of the last Update
+	double					EndTime;
+};
 
 class SystemManager
 {
@@ -9,6 +22,18 @@ class SystemManager
 	EntityManager*			entityManager;
 	std::vector<ISystem*>	systems;
 	std::vector<ISystem*>	internalSystems;
+	EntityCommandBuffer		commandBuffer;
+
+	std::unique_ptr<ThreadPool>			threadPool;
+	std::vector<SystemScheduleNode>		schedule;
+	std::unique_ptr<std::atomic<int>[]>	remainingDependencies;
+	bool								scheduleDirty;
+	bool								parallelUpdate;
+
+	static bool				Conflicts(ISystem* a, ISystem* b);
+	void					BuildSchedule();
+	void					RunSystem(SystemScheduleNode& node, float deltaTime, std::chrono::high_resolution_clock::time_point frameStart);
+	void					RunScheduled(uint32_t nodeIndex, float deltaTime, JobCounter& counter, std::chrono::high_resolution_clock::time_point frameStart);
 public:
 	SystemManager(EntityManager* entityMgr, SystemContext* context);
 	~SystemManager();
@@ -19,6 +44,10 @@ public:
 	void RegisterSystems(std::vector<ISystem*>&& systems);
 	void RegisterSystems();
 	std::vector<ISystem*>& GetSystems();
+	EntityCommandBuffer*	GetCommandBuffer() { return &commandBuffer; }
+	void					SetParallelUpdate(bool enable) { parallelUpdate = enable; }
+	//! Systems, their dependencies and last frame timings, ending with the critical path
+	std::string				GetScheduleDump();
 
 	void Init();
 	void Update(float deltaTime);
@@ -34,8 +63,10 @@ inline void SystemManager::RegisterSystem(Args&& ...args)
 
 	ISystem* system = (ISystem*)new SysType(args...);
 	system->SetEntityManager(entityManager);
+	system->SetCommandBuffer(&commandBuffer);
 	system->SetContext(*context);
 	internalSystems.push_back(system);
+	scheduleDirty = true;
 }
 
 
@@ -0,0 +1,100 @@
+#include "stdafx.h"
+#include <gtest/gtest.h>
+#include "Culling.h"
+
+//Camera at the origin looking down +z, 90 degree field of view so the side planes are x = +-z and y = +-z
+static Frustum MakeFrustum()
+{
+	XMFLOAT4X4 viewProjection;
+	XMStoreFloat4x4(&viewProjection, XMMatrixPerspectiveFovLH(XM_PIDIV2, 1.f, 1.f, 100.f));
+	return Frustum::FromViewProjection(viewProjection);
+}
+
+static std::vector<uint32_t> Cull(const Frustum& frustum, const std::vector<BoundingBox>& worldBoxes)
+{
+	CullBoxList boxes;
+	for (auto& box : worldBoxes)
+	{
+		boxes.Add(box);
+	}
+	std::vector<uint32_t> visible;
+	CullBoxes(frustum, boxes, visible);
+	return visible;
+}
+
+TEST(CullBoxes, BoxInsideIsVisible)
+{
+	auto visible = Cull(MakeFrustum(), { BoundingBox(XMFLOAT3(0.f, 0.f, 10.f), XMFLOAT3(1.f, 1.f, 1.f)) });
+	EXPECT_EQ(visible, std::vector<uint32_t>({ 0 }));
+}
+
+TEST(CullBoxes, BoxStraddlingPlanesIsVisible)
+{
+	auto visible = Cull(MakeFrustum(), {
+		BoundingBox(XMFLOAT3(-10.f, 0.f, 10.f), XMFLOAT3(1.f, 1.f, 1.f)), //Left
+		BoundingBox(XMFLOAT3(0.f, 10.f, 10.f), XMFLOAT3(1.f, 1.f, 1.f)), //Top
+		BoundingBox(XMFLOAT3(0.f, 0.f, 1.f), XMFLOAT3(0.5f, 0.5f, 0.5f)), //Near
+		BoundingBox(XMFLOAT3(0.f, 0.f, 100.f), XMFLOAT3(1.f, 1.f, 1.f)) //Far
+	});
+	EXPECT_EQ(visible, std::vector<uint32_t>({ 0, 1, 2, 3 }));
+}
+
+TEST(CullBoxes, BoxOutsideIsCulled)
+{
+	auto visible = Cull(MakeFrustum(), {
+		BoundingBox(XMFLOAT3(20.f, 0.f, 10.f), XMFLOAT3(1.f, 1.f, 1.f)), //Right
+		BoundingBox(XMFLOAT3(0.f, -20.f, 10.f), XMFLOAT3(1.f, 1.f, 1.f)), //Bottom
+		BoundingBox(XMFLOAT3(0.f, 0.f, -5.f), XMFLOAT3(1.f, 1.f, 1.f)), //Behind the eye
+		BoundingBox(XMFLOAT3(0.f, 0.f, 150.f), XMFLOAT3(1.f, 1.f, 1.f)) //Past the far plane
+	});
+	EXPECT_TRUE(visible.empty());
+}
+
+TEST(CullBoxes, RotatedBoxReachingIntoFrustumIsVisible)
+{
+	//Center outside the left plane, rotated so one corner reaches across it
+	BoundingOrientedBox localBox(XMFLOAT3(0.f, 0.f, 0.f), XMFLOAT3(4.f, 0.5f, 0.5f), XMFLOAT4(0.f, 0.f, 0.f, 1.f));
+	XMFLOAT4X4 inside, outside;
+	XMStoreFloat4x4(&inside, XMMatrixRotationY(-XM_PIDIV4) * XMMatrixTranslation(-13.f, 0.f, 10.f));
+	XMStoreFloat4x4(&outside, XMMatrixRotationY(XM_PIDIV4) * XMMatrixTranslation(-13.f, 0.f, 10.f));
+
+	CullBoxList boxes;
+	boxes.Add(localBox, inside);
+	boxes.Add(localBox, outside);
+	std::vector<uint32_t> visible;
+	CullBoxes(MakeFrustum(), boxes, visible);
+	EXPECT_EQ(visible, std::vector<uint32_t>({ 0 }));
+}
+
+TEST(CullBoxes, IndicesAscendAcrossBatches)
+{
+	//More than one batch of 8, every third box outside, and a partial last batch
+	std::vector<BoundingBox> worldBoxes;
+	std::vector<uint32_t> expected;
+	for (uint32_t i = 0; i < 21; ++i)
+	{
+		auto hidden = i % 3 == 0;
+		worldBoxes.push_back(BoundingBox(XMFLOAT3(hidden ? 50.f : 0.f, 0.f, 10.f + i), XMFLOAT3(1.f, 1.f, 1.f)));
+		if (!hidden)
+			expected.push_back(i);
+	}
+	EXPECT_EQ(Cull(MakeFrustum(), worldBoxes), expected);
+}
+
+TEST(CullBoxes, SphereKeepsBoxesWithinReach)
+{
+	CullBoxList boxes;
+	boxes.Add(BoundingBox(XMFLOAT3(0.f, 0.f, 0.f), XMFLOAT3(1.f, 1.f, 1.f))); //Inside
+	boxes.Add(BoundingBox(XMFLOAT3(5.5f, 0.f, 0.f), XMFLOAT3(1.f, 1.f, 1.f))); //Straddling the surface
+	boxes.Add(BoundingBox(XMFLOAT3(0.f, 20.f, 0.f), XMFLOAT3(1.f, 1.f, 1.f))); //Outside
+	std::vector<uint32_t> visible;
+	CullBoxes(BoundingSphere(XMFLOAT3(0.f, 0.f, 0.f), 5.f), boxes, visible);
+	EXPECT_EQ(visible, std::vector<uint32_t>({ 0, 1 }));
+}
+
+TEST(CullBoxes, EmptyListHasNoVisibleBoxes)
+{
+	std::vector<uint32_t> visible = { 7 };
+	CullBoxes(MakeFrustum(), CullBoxList(), visible);
+	EXPECT_TRUE(visible.empty());
+}
@@ -0,0 +1,321 @@
+#include "stdafx.h"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <random>
+#include "DynamicBvh.h"
+
+static BvhBounds MakeBounds(float x, float y, float z, float halfSize)
+{
+	return BvhBounds{ XMFLOAT3(x - halfSize, y - halfSize, z - halfSize), XMFLOAT3(x + halfSize, y + halfSize, z + halfSize) };
+}
+
+//Same slab test as DynamicBvh::RayCast, entry distance or -1 for a miss
+static float RayEntry(const BvhBounds& bounds, const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance)
+{
+	const float start[3] = { origin.x, origin.y, origin.z };
+	const float inverse[3] = { 1.f / direction.x, 1.f / direction.y, 1.f / direction.z };
+	const float minimum[3] = { bounds.Min.x, bounds.Min.y, bounds.Min.z };
+	const float maximum[3] = { bounds.Max.x, bounds.Max.y, bounds.Max.z };
+	float nearest = 0.f;
+	float farthest = maxDistance;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		auto t0 = (minimum[axis] - start[axis]) * inverse[axis];
+		auto t1 = (maximum[axis] - start[axis]) * inverse[axis];
+		if (t0 > t1)
+			std::swap(t0, t1);
+		nearest = t0 > nearest ? t0 : nearest;
+		farthest = t1 < farthest ? t1 : farthest;
+	}
+	return nearest <= farthest ? nearest : -1.f;
+}
+
+static bool OutsideFrustum(const Frustum& frustum, const BvhBounds& bounds)
+{
+	XMFLOAT3 center((bounds.Min.x + bounds.Max.x) * 0.5f, (bounds.Min.y + bounds.Max.y) * 0.5f, (bounds.Min.z + bounds.Max.z) * 0.5f);
+	XMFLOAT3 extents(bounds.Max.x - center.x, bounds.Max.y - center.y, bounds.Max.z - center.z);
+	for (auto& plane : frustum.Planes)
+	{
+		auto distance = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+		auto radius = fabsf(plane.x) * extents.x + fabsf(plane.y) * extents.y + fabsf(plane.z) * extents.z;
+		if (distance < -radius)
+			return true;
+	}
+	return false;
+}
+
+//Tree driven by random inserts, moves and removes, next to the list of live proxies and their exact bounds
+class DynamicBvhRandom : public ::testing::Test
+{
+protected:
+	DynamicBvh						tree;
+	std::vector<BvhProxyID>			proxies;
+	std::vector<BvhBounds>			bounds; //Indexed by proxy
+	std::mt19937					random;
+
+	DynamicBvhRandom() : tree(0.5f), random(42) {}
+
+	BvhBounds RandomBounds()
+	{
+		std::uniform_real_distribution<float> position(-100.f, 100.f);
+		std::uniform_real_distribution<float> size(0.1f, 5.f);
+		return MakeBounds(position(random), position(random), position(random), size(random));
+	}
+
+	void Insert()
+	{
+		auto box = RandomBounds();
+		auto proxy = tree.Insert(box, (uint32_t)proxies.size());
+		if ((size_t)proxy >= bounds.size())
+			bounds.resize(proxy + 1);
+		bounds[proxy] = box;
+		proxies.push_back(proxy);
+	}
+
+	void Move(size_t index, bool jump)
+	{
+		auto proxy = proxies[index];
+		auto box = bounds[proxy];
+		if (jump)
+			box = RandomBounds();
+		else
+		{
+			std::uniform_real_distribution<float> step(-1.f, 1.f);
+			XMFLOAT3 offset(step(random), step(random), step(random));
+			box.Min = XMFLOAT3(box.Min.x + offset.x, box.Min.y + offset.y, box.Min.z + offset.z);
+			box.Max = XMFLOAT3(box.Max.x + offset.x, box.Max.y + offset.y, box.Max.z + offset.z);
+		}
+		tree.Move(proxy, box);
+		bounds[proxy] = box;
+	}
+
+	void Remove(size_t index)
+	{
+		tree.Remove(proxies[index]);
+		proxies[index] = proxies.back();
+		proxies.pop_back();
+	}
+
+	void RunRandomOperations(int count)
+	{
+		std::uniform_int_distribution<int> operation(0, 9);
+		for (int i = 0; i < count; ++i)
+		{
+			auto op = operation(random);
+			if (proxies.empty() || op < 3)
+				Insert();
+			else
+			{
+				auto index = std::uniform_int_distribution<size_t>(0, proxies.size() - 1)(random);
+				if (op < 7)
+					Move(index, false);
+				else if (op < 9)
+					Move(index, true);
+				else
+					Remove(index);
+			}
+			ASSERT_TRUE(tree.IsValid()) << "after operation " << i;
+		}
+	}
+
+	std::vector<BvhProxyID> Sorted(std::vector<BvhProxyID> result)
+	{
+		std::sort(result.begin(), result.end());
+		return result;
+	}
+};
+
+TEST_F(DynamicBvhRandom, InvariantsHoldAfterRandomOperations)
+{
+	RunRandomOperations(3000);
+	EXPECT_EQ(tree.Size(), proxies.size());
+	for (auto proxy : proxies)
+	{
+		EXPECT_TRUE(tree.GetFatBounds(proxy).Contains(bounds[proxy])) << "proxy " << proxy;
+	}
+
+	while (!proxies.empty())
+	{
+		Remove(proxies.size() - 1);
+		ASSERT_TRUE(tree.IsValid());
+	}
+	EXPECT_EQ(tree.Size(), 0u);
+	EXPECT_EQ(tree.GetHeight(), 0);
+}
+
+TEST_F(DynamicBvhRandom, QueryBoxMatchesBruteForce)
+{
+	RunRandomOperations(1500);
+	for (int query = 0; query < 50; ++query)
+	{
+		auto box = RandomBounds();
+		box.Min = XMFLOAT3(box.Min.x - 10.f, box.Min.y - 10.f, box.Min.z - 10.f);
+		box.Max = XMFLOAT3(box.Max.x + 10.f, box.Max.y + 10.f, box.Max.z + 10.f);
+		std::vector<BvhProxyID> found, expected;
+		tree.QueryBox(box, [&](BvhProxyID proxy) { found.push_back(proxy); });
+		for (auto proxy : proxies)
+		{
+			if (tree.GetFatBounds(proxy).Intersects(box))
+				expected.push_back(proxy);
+		}
+		EXPECT_EQ(Sorted(found), Sorted(expected)) << "query " << query;
+	}
+}
+
+TEST_F(DynamicBvhRandom, QueryFrustumMatchesBruteForce)
+{
+	RunRandomOperations(1500);
+	std::uniform_real_distribution<float> angle(-XM_PI, XM_PI);
+	for (int query = 0; query < 20; ++query)
+	{
+		XMFLOAT4X4 viewProjection;
+		XMStoreFloat4x4(&viewProjection, XMMatrixRotationY(angle(random)) * XMMatrixPerspectiveFovLH(XM_PIDIV4, 1.f, 1.f, 80.f));
+		auto frustum = Frustum::FromViewProjection(viewProjection);
+		std::vector<BvhProxyID> found, expected;
+		tree.QueryFrustum(frustum, [&](BvhProxyID proxy) { found.push_back(proxy); });
+		for (auto proxy : proxies)
+		{
+			if (!OutsideFrustum(frustum, tree.GetFatBounds(proxy)))
+				expected.push_back(proxy);
+		}
+		EXPECT_FALSE(expected.empty());
+		EXPECT_EQ(Sorted(found), Sorted(expected)) << "query " << query;
+	}
+}
+
+TEST_F(DynamicBvhRandom, RayCastMatchesBruteForce)
+{
+	RunRandomOperations(1500);
+	std::uniform_real_distribution<float> coordinate(-1.f, 1.f);
+	for (int query = 0; query < 50; ++query)
+	{
+		XMFLOAT3 origin(coordinate(random) * 100.f, coordinate(random) * 100.f, coordinate(random) * 100.f);
+		XMFLOAT3 direction;
+		XMStoreFloat3(&direction, XMVector3Normalize(XMVectorSet(coordinate(random), coordinate(random), coordinate(random), 0.f)));
+
+		//A callback that never hits visits every leaf the ray enters
+		std::vector<BvhProxyID> visited, expected;
+		tree.RayCast(origin, direction, 150.f, [&](BvhProxyID proxy, float) { visited.push_back(proxy); return -1.f; });
+		BvhProxyID nearest = InvalidBvhProxy;
+		float nearestDistance = 150.f;
+		for (auto proxy : proxies)
+		{
+			auto entry = RayEntry(tree.GetFatBounds(proxy), origin, direction, 150.f);
+			if (entry < 0.f)
+				continue;
+			expected.push_back(proxy);
+			if (entry < nearestDistance)
+			{
+				nearest = proxy;
+				nearestDistance = entry;
+			}
+		}
+		EXPECT_EQ(Sorted(visited), Sorted(expected)) << "ray " << query;
+
+		//Hitting the grown boxes, hits shorten the ray so the last hit is the nearest one
+		BvhProxyID hit = InvalidBvhProxy;
+		tree.RayCast(origin, direction, 150.f, [&](BvhProxyID proxy, float maxDistance)
+		{
+			auto entry = RayEntry(tree.GetFatBounds(proxy), origin, direction, maxDistance);
+			if (entry >= 0.f)
+				hit = proxy;
+			return entry;
+		});
+		EXPECT_EQ(hit, nearest) << "ray " << query;
+	}
+}
+
+TEST(DynamicBvh, RayCastVisitsNearestLeafFirst)
+{
+	DynamicBvh tree;
+	std::vector<BvhProxyID> proxies;
+	const int order[] = { 6, 2, 9, 0, 4, 7, 1, 8, 3, 5 };
+	for (auto i : order)
+	{
+		proxies.push_back(tree.Insert(MakeBounds(10.f + i * 10.f, 0.f, 0.f, 1.f), i));
+	}
+
+	//The first leaf reached is the nearest box, its hit then cuts off every box behind it
+	XMFLOAT3 origin(0.f, 0.f, 0.f), direction(1.f, 0.f, 0.f);
+	std::vector<uint32_t> visited;
+	tree.RayCast(origin, direction, 1000.f, [&](BvhProxyID proxy, float maxDistance)
+	{
+		visited.push_back(tree.GetUserData(proxy));
+		return RayEntry(tree.GetFatBounds(proxy), origin, direction, maxDistance);
+	});
+	EXPECT_EQ(visited, std::vector<uint32_t>({ 0 }));
+
+	//From the other end the box at 100 is nearest
+	XMFLOAT3 farOrigin(200.f, 0.f, 0.f), backward(-1.f, 0.f, 0.f);
+	visited.clear();
+	tree.RayCast(farOrigin, backward, 1000.f, [&](BvhProxyID proxy, float maxDistance)
+	{
+		visited.push_back(tree.GetUserData(proxy));
+		return RayEntry(tree.GetFatBounds(proxy), farOrigin, backward, maxDistance);
+	});
+	EXPECT_EQ(visited, std::vector<uint32_t>({ 9 }));
+}
+
+TEST(DynamicBvh, SmallMoveStaysInsideGrownBox)
+{
+	DynamicBvh tree(1.f);
+	auto a = tree.Insert(MakeBounds(0.f, 0.f, 0.f, 1.f), 0);
+	tree.Insert(MakeBounds(10.f, 0.f, 0.f, 1.f), 1);
+	auto fatBounds = tree.GetFatBounds(a);
+	EXPECT_FALSE(tree.Move(a, MakeBounds(0.5f, 0.f, 0.f, 1.f)));
+	EXPECT_EQ(memcmp(&fatBounds, &tree.GetFatBounds(a), sizeof(BvhBounds)), 0);
+	EXPECT_TRUE(tree.IsValid());
+}
+
+TEST(DynamicBvh, MoveRefitsInPlaceAndReinserts)
+{
+	DynamicBvh tree(1.f);
+	std::vector<BvhProxyID> proxies;
+	for (int i = 0; i < 8; ++i)
+	{
+		proxies.push_back(tree.Insert(MakeBounds(i * 10.f, 0.f, 0.f, 1.f), i));
+	}
+
+	//Overlapping its grown box, the leaf is refitted where it is
+	auto moved = MakeBounds(1.5f, 0.f, 0.f, 1.f);
+	EXPECT_TRUE(tree.Move(proxies[0], moved));
+	EXPECT_TRUE(tree.GetFatBounds(proxies[0]).Contains(moved));
+	EXPECT_TRUE(tree.IsValid());
+
+	//Jumping away, the leaf is reinserted next to its new neighbours
+	auto jumped = MakeBounds(70.f, 5.f, 0.f, 1.f);
+	EXPECT_TRUE(tree.Move(proxies[0], jumped));
+	EXPECT_TRUE(tree.GetFatBounds(proxies[0]).Contains(jumped));
+	EXPECT_TRUE(tree.IsValid());
+
+	std::vector<uint32_t> found;
+	tree.QueryBox(MakeBounds(70.f, 2.5f, 0.f, 3.f), [&](BvhProxyID proxy) { found.push_back(tree.GetUserData(proxy)); });
+	std::sort(found.begin(), found.end());
+	EXPECT_EQ(found, std::vector<uint32_t>({ 0, 7 }));
+	EXPECT_EQ(tree.Size(), 8u);
+}
+
+TEST(DynamicBvh, RotationMovesLeafNextToItsNewNeighbours)
+{
+	//Two pairs far apart, then one leaf of the first pair walks over to the second pair in small steps. The leaf
+	//stays under its old parent, so only the rotations at the root can pull it away from the leaf left behind.
+	DynamicBvh tree(1.f);
+	auto walker = tree.Insert(MakeBounds(0.f, 0.f, 0.f, 0.5f), 0);
+	tree.Insert(MakeBounds(2.f, 0.f, 0.f, 0.5f), 1);
+	tree.Insert(MakeBounds(100.f, 0.f, 0.f, 0.5f), 2);
+	tree.Insert(MakeBounds(102.f, 0.f, 0.f, 0.5f), 3);
+	ASSERT_EQ(tree.GetHeight(), 2);
+
+	for (float x = 0.f; x < 104.f; x += 1.5f)
+	{
+		tree.Move(walker, MakeBounds(x, 0.f, 0.f, 0.5f));
+		ASSERT_TRUE(tree.IsValid());
+	}
+
+	//The root spans both groups, every other internal node only one of them
+	EXPECT_LT(tree.GetAreaRatio(), 1.2f);
+	std::vector<uint32_t> found;
+	tree.QueryBox(MakeBounds(103.f, 0.f, 0.f, 3.f), [&](BvhProxyID proxy) { found.push_back(tree.GetUserData(proxy)); });
+	std::sort(found.begin(), found.end());
+	EXPECT_EQ(found, std::vector<uint32_t>({ 0, 2, 3 }));
+}
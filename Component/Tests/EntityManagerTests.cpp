@@ -0,0 +1,162 @@
+#include "stdafx.h"
+#include <gtest/gtest.h>
+#include <set>
+#include "EntityManager.h"
+#include "Serializable.h"
+
+GameComponent(LargeTestComponent)
+	float Values[6000]; //Larger than an archetype chunk
+	template<class Archive>
+	void serialize(Archive& archive)
+	{
+		archive(cereal::make_nvp("First", Values[0]));
+	}
+EndComponent(LargeTestComponent)
+
+GameComponent(HealthTestComponent)
+	float Value;
+	template<class Archive>
+	void serialize(Archive& archive)
+	{
+		archive(CEREAL_NVP(Value));
+	}
+EndComponent(HealthTestComponent)
+
+RegisterComponent(LargeTestComponent)
+RegisterComponent(HealthTestComponent)
+
+//! Entities at x = 0 to count - 1 under the root
+static std::vector<EntityID> CreateRow(EntityManager& entityManager, size_t count, float firstX = 0.f)
+{
+	std::vector<EntityDesc> descs(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		descs[i].Name = "e" + std::to_string(i);
+		descs[i].LocalTransform.Position = XMFLOAT3(firstX + i, 0.f, 0.f);
+	}
+	std::vector<EntityID> ids(count);
+	entityManager.CreateEntities(descs.data(), count, ids.data());
+	return ids;
+}
+
+TEST(EntityManager, CompactionKeepsLiveEntitiesOnTheirNodes)
+{
+	Scene scene;
+	EntityManager entityManager(&scene);
+	auto ids = CreateRow(entityManager, 10);
+	auto child = entityManager.CreateEntity(ids[3], "child", 0u, 0u, Transform::Create(XMFLOAT3(100.f, 0.f, 0.f)));
+
+	// Removing 3 also removes its child, the freed nodes include the last ones so compaction drops them
+	const EntityID removed[] = { ids[1], ids[3], ids[5], ids[9] };
+	entityManager.RemoveEntities(removed, 4);
+	entityManager.CompactScene();
+	scene.UpdateTransforms();
+
+	std::vector<EntityID> changed;
+	entityManager.GetChangedEntities(changed);
+	for (auto entity : changed)
+	{
+		EXPECT_TRUE(entityManager.IsActive(entity)) << entity;
+	}
+
+	std::vector<Entity> live;
+	entityManager.GetEntities(live);
+	ASSERT_EQ(live.size(), 6u);
+	std::set<NodeID> nodes;
+	for (auto& entity : live)
+	{
+		EXPECT_NE(entity.EntityID, child);
+		EXPECT_EQ(entityManager.GetPosition(entity.EntityID).x, (float)entity.EntityID);
+		EXPECT_TRUE(nodes.insert(entity.Node).second);
+	}
+
+	// Freed entity ids and nodes come back without disturbing the others
+	auto reused = CreateRow(entityManager, 5, 50.f);
+	for (size_t i = 0; i < reused.size(); ++i)
+	{
+		EXPECT_EQ(entityManager.GetPosition(reused[i]).x, 50.f + i);
+	}
+	for (auto& entity : live)
+	{
+		EXPECT_EQ(entityManager.GetPosition(entity.EntityID).x, (float)entity.EntityID);
+	}
+}
+
+TEST(EntityManager, UnknownComponentNamesAreIgnored)
+{
+	Scene scene;
+	EntityManager entityManager(&scene);
+	auto ids = CreateRow(entityManager, 1);
+	auto registered = ComponentFactory::GetTypeMap().size();
+
+	EXPECT_EQ(ComponentFactory::GetTypeID(StringID("NotAComponent")), 0u);
+	EXPECT_EQ(entityManager.GetComponent("NotAComponent", ids[0]), nullptr);
+	EXPECT_EQ(entityManager.GetComponentContainer("NotAComponent"), nullptr);
+	EXPECT_EQ(ComponentFactory::GetTypeMap().size(), registered);
+	EXPECT_NE(ComponentFactory::GetTypeID(StringID("HealthTestComponent")), 0u);
+}
+
+TEST(EntityManager, RemovingTwiceIsIgnored)
+{
+	Scene scene;
+	EntityManager entityManager(&scene);
+	auto ids = CreateRow(entityManager, 3);
+	entityManager.Remove(ids[1]);
+	entityManager.Remove(ids[1]);
+
+	auto reused = CreateRow(entityManager, 2, 10.f);
+	EXPECT_EQ(entityManager.GetPosition(ids[0]).x, 0.f);
+	EXPECT_EQ(entityManager.GetPosition(ids[2]).x, 2.f);
+	EXPECT_EQ(entityManager.GetPosition(reused[0]).x, 10.f);
+	EXPECT_EQ(entityManager.GetPosition(reused[1]).x, 11.f);
+	EXPECT_NE(reused[0], reused[1]);
+}
+
+TEST(EntityManager, ArchetypeRowsLargerThanAChunk)
+{
+	Scene scene;
+	EntityManager entityManager(&scene, StorageModeArchetype);
+	auto ids = CreateRow(entityManager, 3);
+	for (auto id : ids)
+	{
+		LargeTestComponent component;
+		std::fill(std::begin(component.Values), std::end(component.Values), (float)id);
+		entityManager.AddComponent(id, component);
+	}
+
+	for (auto id : ids)
+	{
+		auto& component = entityManager.GetComponent<LargeTestComponent>(id);
+		EXPECT_EQ(component.Values[0], (float)id);
+		EXPECT_EQ(component.Values[5999], (float)id);
+	}
+}
+
+TEST(EntityManager, ForEachVisitsEntitiesWithEveryComponent)
+{
+	const ComponentStorageMode modes[] = { StorageModePerComponent, StorageModeArchetype };
+	for (auto mode : modes)
+	{
+		Scene scene;
+		EntityManager entityManager(&scene, mode);
+		auto ids = CreateRow(entityManager, 6);
+		for (auto id : ids)
+		{
+			HealthTestComponent health;
+			health.Value = (float)id;
+			entityManager.AddComponent(id, health);
+		}
+		// Fewer large components than health ones, so the per component mode walks the large container
+		entityManager.AddComponent<LargeTestComponent>(ids[1]);
+		entityManager.AddComponent<LargeTestComponent>(ids[4]);
+
+		std::vector<EntityID> seen;
+		entityManager.ForEach<HealthTestComponent, const LargeTestComponent>([&](EntityID e, HealthTestComponent& health, const LargeTestComponent&)
+		{
+			EXPECT_EQ(health.Value, (float)e);
+			seen.push_back(e);
+		});
+		std::sort(seen.begin(), seen.end());
+		EXPECT_EQ(seen, std::vector<EntityID>({ ids[1], ids[4] })) << mode;
+	}
+}
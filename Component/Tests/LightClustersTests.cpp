@@ -0,0 +1,127 @@
+#include "stdafx.h"
+#include <gtest/gtest.h>
+#include "LightClusters.h"
+
+//4 x 4 tiles and 4 slices from 1 to 16 with a 90 degree field of view, so slices split at depths 2, 4 and 8 and
+//tile edges at depth d are x and y = -d, -d / 2, 0, d / 2 and d. The view is the identity, lights are given in
+//view space.
+static LightClusterGrid MakeGrid(uint32_t maxLightsPerCluster = DefaultMaxLightsPerCluster)
+{
+	LightClusterGrid grid(4, 4, 4, maxLightsPerCluster);
+	XMFLOAT4X4 projection;
+	XMStoreFloat4x4(&projection, XMMatrixPerspectiveFovLH(XM_PIDIV2, 1.f, 1.f, 16.f));
+	grid.SetProjection(projection, 1.f, 16.f);
+	return grid;
+}
+
+static XMFLOAT4X4 Identity()
+{
+	XMFLOAT4X4 view;
+	XMStoreFloat4x4(&view, XMMatrixIdentity());
+	return view;
+}
+
+static PointLight MakeLight(float x, float y, float z, float range)
+{
+	PointLight light = {};
+	light.Color = XMFLOAT4(1.f, 1.f, 1.f, 1.f);
+	light.Position = XMFLOAT3(x, y, z);
+	light.Range = range;
+	light.Intensity = 1.f;
+	return light;
+}
+
+static std::vector<uint32_t> GetLights(const LightClusterGrid& grid, uint32_t cluster)
+{
+	auto& range = grid.GetClusters()[cluster];
+	auto& indices = grid.GetLightIndices();
+	return std::vector<uint32_t>(indices.begin() + range.Offset, indices.begin() + range.Offset + range.Count);
+}
+
+TEST(LightClusterGrid, SliceFollowsDepth)
+{
+	auto grid = MakeGrid();
+	EXPECT_EQ(grid.GetSlice(0.5f), 0u);
+	EXPECT_EQ(grid.GetSlice(1.5f), 0u);
+	EXPECT_EQ(grid.GetSlice(3.9f), 1u);
+	EXPECT_EQ(grid.GetSlice(4.1f), 2u);
+	EXPECT_EQ(grid.GetSlice(15.f), 3u);
+	EXPECT_EQ(grid.GetSlice(100.f), 3u);
+}
+
+TEST(LightClusterGrid, LightOnClusterBoundaryReachesEveryNeighbour)
+{
+	//On the corner shared by tiles 1 and 2 in x and y and slices 1 and 2, small enough to stay within them
+	auto grid = MakeGrid();
+	auto light = MakeLight(0.f, 0.f, 4.f, 0.5f);
+	grid.Build(&light, 1, Identity());
+
+	for (uint32_t slice = 0; slice < grid.GetSlices(); ++slice)
+	{
+		for (uint32_t y = 0; y < grid.GetTilesY(); ++y)
+		{
+			for (uint32_t x = 0; x < grid.GetTilesX(); ++x)
+			{
+				auto expected = (x == 1 || x == 2) && (y == 1 || y == 2) && (slice == 1 || slice == 2);
+				EXPECT_EQ(GetLights(grid, grid.GetClusterIndex(x, y, slice)),
+					expected ? std::vector<uint32_t>({ 0 }) : std::vector<uint32_t>())
+					<< "cluster " << x << ", " << y << ", " << slice;
+			}
+		}
+	}
+	EXPECT_EQ(grid.GetLightIndices().size(), 8u);
+}
+
+TEST(LightClusterGrid, LightInsideOneClusterOnlyReachesIt)
+{
+	//Top left tile of slice 2, which spans x and y from -d to -d / 2 and d / 2 to d at depth d
+	auto grid = MakeGrid();
+	auto light = MakeLight(-4.5f, 4.5f, 6.f, 0.25f);
+	grid.Build(&light, 1, Identity());
+
+	EXPECT_EQ(GetLights(grid, grid.GetClusterIndex(0, 0, 2)), std::vector<uint32_t>({ 0 }));
+	EXPECT_EQ(grid.GetLightIndices().size(), 1u);
+}
+
+TEST(LightClusterGrid, ClustersWithoutLightsAreEmpty)
+{
+	auto grid = MakeGrid();
+	grid.Build(nullptr, 0, Identity());
+	for (auto& cluster : grid.GetClusters())
+	{
+		EXPECT_EQ(cluster.Count, 0u);
+	}
+	EXPECT_TRUE(grid.GetLightIndices().empty());
+
+	//Behind the eye, past the far plane and beside the view
+	PointLight lights[] = { MakeLight(0.f, 0.f, -5.f, 2.f), MakeLight(0.f, 0.f, 30.f, 2.f), MakeLight(40.f, 0.f, 6.f, 2.f) };
+	grid.Build(lights, 3, Identity());
+	for (auto& cluster : grid.GetClusters())
+	{
+		EXPECT_EQ(cluster.Count, 0u);
+	}
+	EXPECT_TRUE(grid.GetLightIndices().empty());
+}
+
+TEST(LightClusterGrid, ClusterKeepsFirstLightsUpToCap)
+{
+	auto grid = MakeGrid(2);
+	PointLight lights[] = { MakeLight(-4.5f, 4.5f, 6.f, 0.25f), MakeLight(-4.5f, 4.5f, 6.f, 0.25f), MakeLight(-4.5f, 4.5f, 6.f, 0.25f) };
+	grid.Build(lights, 3, Identity());
+	EXPECT_EQ(GetLights(grid, grid.GetClusterIndex(0, 0, 2)), std::vector<uint32_t>({ 0, 1 }));
+}
+
+TEST(LightClusterGrid, LightInPaddedLastColumn)
+{
+	//12 tiles pad rows to 16, a light in the last tile must not spill into the padding
+	LightClusterGrid grid(12, 1, 4);
+	XMFLOAT4X4 projection;
+	XMStoreFloat4x4(&projection, XMMatrixPerspectiveFovLH(XM_PIDIV2, 1.f, 1.f, 16.f));
+	grid.SetProjection(projection, 1.f, 16.f);
+
+	//Tile 11 spans x from 5 / 6 * d to d, its box in slice 2 reaches down to x = 10 / 3 and tile 10's up to 20 / 3
+	auto light = MakeLight(7.2f, 0.f, 7.5f, 0.1f);
+	grid.Build(&light, 1, Identity());
+	EXPECT_EQ(GetLights(grid, grid.GetClusterIndex(11, 0, 2)), std::vector<uint32_t>({ 0 }));
+	EXPECT_EQ(grid.GetLightIndices().size(), 1u);
+}
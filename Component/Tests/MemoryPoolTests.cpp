@@ -0,0 +1,217 @@
+#include "stdafx.h"
+#include <gtest/gtest.h>
+#include <set>
+#include <thread>
+#include "MemoryPool.h"
+
+struct PoolTestObject
+{
+	static int	Live;
+	int			Value;
+	double		Padding;
+
+	PoolTestObject(int value) : Value(value), Padding(0.0) { Live++; }
+	~PoolTestObject() { Live--; }
+};
+
+int PoolTestObject::Live = 0;
+
+struct PoolTestSmall
+{
+	char Value;
+};
+
+struct alignas(64) PoolTestAligned
+{
+	float Values[20];
+};
+
+//! Thread caches only report their counters to the pool in batches and when the thread exits, so work that
+//! stats are checked for runs on a thread of its own
+template<typename FuncType>
+static void RunOnThread(FuncType func)
+{
+	std::thread thread(func);
+	thread.join();
+}
+
+static MemoryPoolStats GetStats(FixedBlockPool& pool)
+{
+	MemoryPoolStats stats;
+	pool.GetStats(stats);
+	return stats;
+}
+
+//! Allocates every block of the pool's first page, so later allocations can only reuse them or add pages
+template<typename T>
+static std::vector<T*> AllocatePage(MemoryPool<T>& pool)
+{
+	std::vector<T*> blocks;
+	blocks.push_back(pool.Allocate());
+	auto stats = GetStats(pool);
+	EXPECT_EQ(stats.PageCount, 1u);
+	auto count = stats.ReservedBytes / stats.BlockSize;
+	while (blocks.size() < count)
+	{
+		blocks.push_back(pool.Allocate());
+	}
+	return blocks;
+}
+
+TEST(MemoryPool, ExitingThreadHandsCachedBlocksBack)
+{
+	MemoryPool<PoolTestObject> pool;
+	std::vector<PoolTestObject*> blocks;
+	RunOnThread([&]()
+	{
+		blocks = AllocatePage(pool);
+		for (auto block : blocks)
+		{
+			new (block) PoolTestObject(0);
+			pool.Destroy(block);
+		}
+	});
+	EXPECT_EQ(PoolTestObject::Live, 0);
+	EXPECT_EQ(GetStats(pool).LiveBlocks, 0u);
+
+	// The blocks the first thread still had cached went back to the pool, or the second one would need a new page
+	std::vector<PoolTestObject*> reused;
+	RunOnThread([&]()
+	{
+		reused = AllocatePage(pool);
+	});
+	EXPECT_EQ(std::set<PoolTestObject*>(reused.begin(), reused.end()), std::set<PoolTestObject*>(blocks.begin(), blocks.end()));
+	EXPECT_EQ(GetStats(pool).PageCount, 1u);
+	EXPECT_EQ(GetStats(pool).LiveBlocks, blocks.size());
+}
+
+TEST(MemoryPool, BlocksFreedOnAnotherThread)
+{
+	MemoryPool<PoolTestObject> pool;
+	const size_t count = 500;
+	std::vector<PoolTestObject*> objects;
+	RunOnThread([&]()
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			objects.push_back(pool.New((int)i));
+		}
+	});
+
+	RunOnThread([&]()
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			EXPECT_EQ(objects[i]->Value, (int)i);
+			pool.Destroy(objects[i]);
+		}
+	});
+
+	auto stats = GetStats(pool);
+	EXPECT_EQ(stats.Allocations, count);
+	EXPECT_EQ(stats.Frees, count);
+	EXPECT_EQ(stats.LiveBlocks, 0u);
+	EXPECT_EQ(stats.PeakLiveBlocks, count);
+
+	// Two threads allocating at once from blocks that came back through the freeing thread never share one
+	std::vector<void*> blocks[2];
+	std::thread threads[2];
+	for (int t = 0; t < 2; ++t)
+	{
+		threads[t] = std::thread([&pool, &blocks, t]()
+		{
+			for (size_t i = 0; i < count; ++i)
+			{
+				blocks[t].push_back(pool.Allocate());
+			}
+		});
+	}
+	threads[0].join();
+	threads[1].join();
+	std::set<void*> unique(blocks[0].begin(), blocks[0].end());
+	unique.insert(blocks[1].begin(), blocks[1].end());
+	EXPECT_EQ(unique.size(), count * 2);
+	EXPECT_EQ(GetStats(pool).LiveBlocks, count * 2);
+}
+
+TEST(MemoryPool, BulkFreeDestroysAndCountsAtOnce)
+{
+	MemoryPool<PoolTestObject> pool;
+	std::vector<PoolTestObject*> objects;
+	RunOnThread([&]()
+	{
+		objects = AllocatePage(pool);
+		for (size_t i = 0; i < objects.size(); ++i)
+		{
+			new (objects[i]) PoolTestObject((int)i);
+		}
+	});
+	EXPECT_EQ(PoolTestObject::Live, (int)objects.size());
+
+	// FreeBlocks goes straight to the pool, the frees show up before any thread cache reports
+	pool.Destroy(objects.data(), objects.size());
+	EXPECT_EQ(PoolTestObject::Live, 0);
+	auto stats = GetStats(pool);
+	EXPECT_EQ(stats.Frees, objects.size());
+	EXPECT_EQ(stats.LiveBlocks, 0u);
+
+	std::vector<PoolTestObject*> reused;
+	RunOnThread([&]()
+	{
+		reused = AllocatePage(pool);
+	});
+	EXPECT_EQ(std::set<PoolTestObject*>(reused.begin(), reused.end()), std::set<PoolTestObject*>(objects.begin(), objects.end()));
+	EXPECT_EQ(GetStats(pool).PageCount, 1u);
+}
+
+TEST(MemoryPool, StatsArePerType)
+{
+	RunOnThread([]()
+	{
+		std::vector<PoolTestSmall*> small;
+		for (int i = 0; i < 100; ++i)
+		{
+			small.push_back(PoolAllocator::New<PoolTestSmall>());
+		}
+		for (int i = 0; i < 40; ++i)
+		{
+			PoolAllocator::Delete(small[i]);
+		}
+
+		for (int i = 0; i < 10; ++i)
+		{
+			auto aligned = PoolAllocator::New<PoolTestAligned>();
+			EXPECT_EQ((size_t)aligned % alignof(PoolTestAligned), 0u);
+			PoolAllocator::Delete(aligned);
+		}
+	});
+
+	std::vector<MemoryPoolStats> allStats;
+	PoolAllocator::GetStats(allStats);
+	const MemoryPoolStats* small = nullptr;
+	const MemoryPoolStats* aligned = nullptr;
+	for (auto& stats : allStats)
+	{
+		if (strcmp(stats.Name, typeid(PoolTestSmall).name()) == 0)
+			small = &stats;
+		else if (strcmp(stats.Name, typeid(PoolTestAligned).name()) == 0)
+			aligned = &stats;
+	}
+	ASSERT_NE(small, nullptr);
+	ASSERT_NE(aligned, nullptr);
+
+	// Blocks hold the free list link, so they are never smaller than a pointer
+	EXPECT_EQ(small->BlockSize, sizeof(void*));
+	EXPECT_EQ(small->Allocations, 100u);
+	EXPECT_EQ(small->Frees, 40u);
+	EXPECT_EQ(small->LiveBlocks, 60u);
+	EXPECT_GE(small->PeakLiveBlocks, small->LiveBlocks); //Sampled when a cache reports, so it can miss the last batch
+	EXPECT_LE(small->PeakLiveBlocks, small->Allocations);
+	EXPECT_EQ(small->PageCount, 1u);
+
+	EXPECT_EQ(aligned->BlockSize, sizeof(PoolTestAligned));
+	EXPECT_EQ(aligned->Allocations, 10u);
+	EXPECT_EQ(aligned->Frees, 10u);
+	EXPECT_EQ(aligned->LiveBlocks, 0u);
+	EXPECT_GE(aligned->ReservedBytes, aligned->PageCount * sizeof(PoolTestAligned));
+}
@@ -0,0 +1,375 @@
+#include "stdafx.h"
+#include <gtest/gtest.h>
+#include "EntityManager.h"
+#include "Query.h"
+#include "SystemManager.h"
+#include "Serializable.h"
+
+GameComponent(QueryTestValue)
+	int Value;
+	template<class Archive>
+	void serialize(Archive& archive)
+	{
+		archive(CEREAL_NVP(Value));
+	}
+EndComponent(QueryTestValue)
+
+GameComponent(QueryTestTag)
+	int Value;
+	template<class Archive>
+	void serialize(Archive& archive)
+	{
+		archive(CEREAL_NVP(Value));
+	}
+EndComponent(QueryTestTag)
+
+RegisterComponent(QueryTestValue)
+RegisterComponent(QueryTestTag)
+
+class QueryTest : public ::testing::TestWithParam<ComponentStorageMode>
+{
+protected:
+	Scene			scene;
+	EntityManager	entityManager;
+	EntityID		entities[3];
+
+	QueryTest() :
+		entityManager(&scene, GetParam())
+	{
+	}
+
+	//! Three entities with values 0, 1 and 2, the first and last are also tagged
+	void Populate()
+	{
+		EntityDesc descs[3];
+		for (int i = 0; i < 3; ++i)
+		{
+			descs[i].Name = "e" + std::to_string(i);
+		}
+		entityManager.CreateEntities(descs, 3, entities);
+
+		QueryTestValue values[3];
+		for (int i = 0; i < 3; ++i)
+		{
+			values[i].Value = i;
+		}
+		entityManager.AddComponents<QueryTestValue>(entities, 3, values);
+		entityManager.AddComponent<QueryTestTag>(entities[0]);
+		entityManager.AddComponent<QueryTestTag>(entities[2]);
+	}
+
+	//! Archetype storage tracks versions per chunk, so filters there may also pass rows sharing a chunk with a match
+	void ExpectFiltered(std::vector<EntityID> seen, std::vector<EntityID> expected)
+	{
+		std::sort(seen.begin(), seen.end());
+		std::sort(expected.begin(), expected.end());
+		if (GetParam() == StorageModePerComponent || expected.empty())
+			EXPECT_EQ(seen, expected);
+		else
+			EXPECT_TRUE(std::includes(seen.begin(), seen.end(), expected.begin(), expected.end()));
+	}
+};
+
+TEST_P(QueryTest, ForEachVisitsMatchingEntities)
+{
+	Populate();
+	auto query = entityManager.GetQuery<QueryTestValue, QueryTestTag>();
+	std::vector<int> seen;
+	query->ForEach([&](EntityID entity, QueryTestValue& value, QueryTestTag&)
+	{
+		EXPECT_EQ(entityManager.GetComponent<QueryTestValue>(entity).Value, value.Value);
+		seen.push_back(value.Value);
+	});
+	std::sort(seen.begin(), seen.end());
+	EXPECT_EQ(seen, std::vector<int>({ 0, 2 }));
+}
+
+TEST_P(QueryTest, RemovingNonMemberKeepsComponentsValid)
+{
+	Populate();
+	auto query = entityManager.GetQuery<QueryTestValue, QueryTestTag>();
+	query->ForEach([](EntityID, QueryTestValue&, QueryTestTag&) {});
+
+	// The untagged entity is not in the query, removing it moves the last value into its slot
+	entityManager.RemoveEntities(&entities[1], 1);
+	entityManager.ExecutePurge();
+	entityManager.GetComponent<QueryTestValue>(entities[2]).Value = 42;
+
+	std::vector<int> seen;
+	query->ForEach([&](EntityID entity, QueryTestValue& value, QueryTestTag&)
+	{
+		EXPECT_EQ(&entityManager.GetComponent<QueryTestValue>(entity), &value);
+		seen.push_back(value.Value);
+	});
+	std::sort(seen.begin(), seen.end());
+	EXPECT_EQ(seen, std::vector<int>({ 0, 42 }));
+}
+
+TEST_P(QueryTest, RemovingMemberDropsIt)
+{
+	Populate();
+	auto query = entityManager.GetQuery<QueryTestValue, QueryTestTag>();
+	query->ForEach([](EntityID, QueryTestValue&, QueryTestTag&) {});
+
+	entityManager.RemoveEntities(&entities[0], 1);
+	entityManager.ExecutePurge();
+
+	std::vector<EntityID> seen;
+	query->ForEach([&](EntityID entity, QueryTestValue& value, QueryTestTag&)
+	{
+		EXPECT_EQ(value.Value, 2);
+		seen.push_back(entity);
+	});
+	EXPECT_EQ(seen, std::vector<EntityID>({ entities[2] }));
+}
+
+TEST_P(QueryTest, PointersFollowMovedComponents)
+{
+	// Random structural changes move components around through swap and pop, archetype migration and container
+	// growth, every row must still point at its entity's components afterwards
+	const size_t count = 64;
+	std::vector<EntityDesc> descs(count);
+	std::vector<EntityID> ids(count);
+	entityManager.CreateEntities(descs.data(), count, ids.data());
+	for (size_t i = 0; i < count; ++i)
+	{
+		QueryTestValue value;
+		value.Value = (int)i;
+		entityManager.AddComponent(ids[i], value);
+		if (i % 2 == 0)
+			entityManager.AddComponent<QueryTestTag>(ids[i]);
+	}
+
+	auto query = entityManager.GetQuery<QueryTestValue, const QueryTestTag>();
+	std::vector<bool> removed(count, false);
+	uint32_t random = 12345;
+	for (int step = 0; step < 400; ++step)
+	{
+		random = random * 1664525u + 1013904223u;
+		auto entity = ids[(random >> 8) % count];
+		if (removed[entity - ids[0]])
+			continue;
+		switch ((random >> 4) % 5)
+		{
+		case 0:
+			entityManager.AddComponent<QueryTestTag>(entity);
+			break;
+		case 1:
+			entityManager.RemoveComponent<QueryTestTag>(entity);
+			break;
+		case 2:
+			entityManager.RemoveComponent<QueryTestValue>(entity);
+			break;
+		case 3:
+		{
+			QueryTestValue value;
+			value.Value = (int)(entity - ids[0]);
+			entityManager.AddComponent(entity, value);
+			break;
+		}
+		default:
+			if (step % 10 == 0)
+			{
+				entityManager.RemoveEntities(&entity, 1);
+				entityManager.ExecutePurge();
+				removed[entity - ids[0]] = true;
+			}
+		}
+
+		size_t expected = 0;
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (!removed[i] && entityManager.FindComponent<QueryTestValue>(ids[i]) != nullptr && entityManager.FindComponent<QueryTestTag>(ids[i]) != nullptr)
+				expected++;
+		}
+		size_t seen = 0;
+		query->ForEach([&](EntityID e, QueryTestValue& value, const QueryTestTag& tag)
+		{
+			ASSERT_EQ(&value, entityManager.FindComponent<QueryTestValue>(e)) << "step " << step;
+			ASSERT_EQ(&tag, entityManager.FindComponent<QueryTestTag>(e)) << "step " << step;
+			EXPECT_EQ(value.Value, (int)(e - ids[0]));
+			seen++;
+		});
+		ASSERT_EQ(seen, expected) << "step " << step;
+	}
+}
+
+TEST_P(QueryTest, PointersFollowGrowingContainers)
+{
+	Populate();
+	auto query = entityManager.GetQuery<QueryTestValue, QueryTestTag>();
+	query->ForEach([](EntityID, QueryTestValue&, QueryTestTag&) {});
+
+	// Enough new components to reallocate the per component arrays under the existing rows
+	const size_t count = 100;
+	std::vector<EntityDesc> descs(count);
+	std::vector<EntityID> ids(count);
+	entityManager.CreateEntities(descs.data(), count, ids.data());
+	for (auto id : ids)
+	{
+		entityManager.AddComponent<QueryTestValue>(id);
+		entityManager.AddComponent<QueryTestTag>(id);
+	}
+
+	size_t seen = 0;
+	query->ForEach([&](EntityID entity, QueryTestValue& value, QueryTestTag& tag)
+	{
+		EXPECT_EQ(&value, entityManager.FindComponent<QueryTestValue>(entity));
+		EXPECT_EQ(&tag, entityManager.FindComponent<QueryTestTag>(entity));
+		seen++;
+	});
+	EXPECT_EQ(seen, count + 2);
+}
+
+TEST_P(QueryTest, ChangedSeesOnlyWritesSinceVersion)
+{
+	Populate();
+	auto since = ChangeVersion::Advance();
+	entityManager.GetComponent<QueryTestValue>(entities[1]).Value = 10;
+
+	auto query = entityManager.GetQuery<const QueryTestValue>();
+	std::vector<EntityID> seen;
+	query->ForEach(Changed<QueryTestValue>(since), [&](EntityID entity, const QueryTestValue& value)
+	{
+		seen.push_back(entity);
+	});
+	ExpectFiltered(seen, { entities[1] });
+
+	seen.clear();
+	query->ForEach(Changed<QueryTestValue>(ChangeVersion::Advance()), [&](EntityID entity, const QueryTestValue& value)
+	{
+		seen.push_back(entity);
+	});
+	EXPECT_TRUE(seen.empty());
+}
+
+TEST_P(QueryTest, ConstArgsDoNotMarkChanged)
+{
+	Populate();
+	auto since = ChangeVersion::Advance();
+	entityManager.GetQuery<const QueryTestValue, const QueryTestTag>()->ForEach([](EntityID, const QueryTestValue&, const QueryTestTag&) {});
+	// Only the non const argument is stamped
+	entityManager.GetQuery<const QueryTestValue, QueryTestTag>()->ForEach([](EntityID, const QueryTestValue&, QueryTestTag&) {});
+
+	size_t changed = 0;
+	entityManager.GetQuery<const QueryTestValue>()->ForEach(Changed<QueryTestValue>(since), [&](EntityID, const QueryTestValue&) { changed++; });
+	EXPECT_EQ(changed, 0u);
+
+	std::vector<EntityID> tagged;
+	entityManager.GetQuery<const QueryTestTag>()->ForEach(Changed<QueryTestTag>(since), [&](EntityID entity, const QueryTestTag&) { tagged.push_back(entity); });
+	ExpectFiltered(tagged, { entities[0], entities[2] });
+}
+
+TEST_P(QueryTest, AddedSeesOnlyNewComponents)
+{
+	Populate();
+	auto since = ChangeVersion::Advance();
+	entityManager.GetComponent<QueryTestValue>(entities[0]).Value = 10;
+	entityManager.AddComponent<QueryTestTag>(entities[1]);
+
+	std::vector<EntityID> seen;
+	entityManager.GetQuery<const QueryTestTag>()->ForEach(Added<QueryTestTag>(since), [&](EntityID entity, const QueryTestTag&)
+	{
+		seen.push_back(entity);
+	});
+	ExpectFiltered(seen, { entities[1] });
+
+	// A write is not an addition
+	size_t added = 0;
+	entityManager.GetQuery<const QueryTestValue>()->ForEach(Added<QueryTestValue>(since), [&](EntityID, const QueryTestValue&) { added++; });
+	EXPECT_EQ(added, 0u);
+}
+
+//! Adds 10 to the tagged values on the frames it is told to
+class QueryTestWriterSystem : public ISystem
+{
+public:
+	bool Write = false;
+
+	virtual void Init() override
+	{
+		RegisterComponent<QueryTestValue>(ComponentAccessWrite);
+		RegisterComponent<QueryTestTag>(ComponentAccessRead);
+	}
+
+	virtual void Update(float deltaTime) override
+	{
+		if (!Write)
+			return;
+		entity->GetQuery<QueryTestValue, const QueryTestTag>()->ForEach([](EntityID, QueryTestValue& value, const QueryTestTag&)
+		{
+			value.Value += 10;
+		});
+	}
+};
+
+//! Records the entities passing its filter since its last update, reading through a const argument
+template<ComponentFilterType FilterType>
+class QueryTestReaderSystem : public ISystem
+{
+public:
+	std::vector<EntityID> Seen;
+
+	virtual void Init() override
+	{
+		RegisterComponent<QueryTestValue>(ComponentAccessRead);
+	}
+
+	virtual void Update(float deltaTime) override
+	{
+		Seen.clear();
+		entity->GetQuery<const QueryTestValue>()->ForEach(ComponentFilter<QueryTestValue, FilterType>(GetLastVersion()), [&](EntityID e, const QueryTestValue&)
+		{
+			Seen.push_back(e);
+		});
+		std::sort(Seen.begin(), Seen.end());
+	}
+};
+
+TEST_P(QueryTest, SystemsSeeEachChangeOnce)
+{
+	Populate();
+	QueryTestWriterSystem writer;
+	QueryTestReaderSystem<ComponentFilterChanged> reader;
+	QueryTestReaderSystem<ComponentFilterChanged> secondReader; //Would see the first reader's iteration if const args marked changed
+	QueryTestReaderSystem<ComponentFilterAdded> addedReader;
+	SystemContext context = {};
+	SystemManager manager(&entityManager, &context);
+	manager.RegisterSystems({ &writer, &reader, &secondReader, &addedReader });
+	manager.Init();
+	std::vector<EntityID> all(entities, entities + 3);
+	std::vector<EntityID> none;
+
+	// The first update sees everything created before it
+	manager.Update(0.f);
+	EXPECT_EQ(reader.Seen, all);
+	EXPECT_EQ(secondReader.Seen, all);
+	EXPECT_EQ(addedReader.Seen, all);
+
+	writer.Write = true;
+	manager.Update(0.f);
+	std::vector<EntityID> tagged({ entities[0], entities[2] });
+	ExpectFiltered(reader.Seen, tagged);
+	ExpectFiltered(secondReader.Seen, tagged);
+	EXPECT_EQ(addedReader.Seen, none);
+
+	writer.Write = false;
+	manager.Update(0.f);
+	EXPECT_EQ(reader.Seen, none);
+	EXPECT_EQ(secondReader.Seen, none);
+
+	// Added between updates, so the next update sees it once
+	EntityDesc desc;
+	EntityID added;
+	entityManager.CreateEntities(&desc, 1, &added);
+	entityManager.AddComponent<QueryTestValue>(added);
+	manager.Update(0.f);
+	ExpectFiltered(reader.Seen, { added });
+	ExpectFiltered(addedReader.Seen, { added });
+
+	manager.Update(0.f);
+	EXPECT_EQ(reader.Seen, none);
+	EXPECT_EQ(addedReader.Seen, none);
+}
+
+INSTANTIATE_TEST_SUITE_P(StorageModes, QueryTest, ::testing::Values(StorageModePerComponent, StorageModeArchetype));
@@ -0,0 +1,44 @@
+#include "stdafx.h"
+#include <gtest/gtest.h>
+#include "Scene.h"
+#include "ThreadPool.h"
+
+//! Root children with a long chain below each, so a handful of subtrees holds every node
+static void BuildChains(Scene& scene, uint32_t chainCount, uint32_t chainLength)
+{
+	for (uint32_t chain = 0; chain < chainCount; ++chain)
+	{
+		auto parent = RootNodeID;
+		for (uint32_t i = 0; i < chainLength; ++i)
+		{
+			auto position = XMFLOAT3(0.001f * (i % 7), 0.01f * chain, 0.002f);
+			auto rotation = XMFLOAT3(0.001f * (i % 5), 0.f, 0.0005f * chain);
+			parent = scene.CreateNode(parent, Transform::Create(position, rotation));
+		}
+	}
+}
+
+TEST(Scene, ParallelUpdateMatchesSerialWithFewSubtrees)
+{
+	ThreadPool pool(4);
+	Scene serial;
+	Scene parallel;
+	parallel.SetParallelUpdate(true);
+
+	// 3 subtrees of 8000 nodes, fewer subtrees than one batch used to hold
+	BuildChains(serial, 3, 8000);
+	BuildChains(parallel, 3, 8000);
+	for (int frame = 0; frame < 2; ++frame)
+	{
+		serial.SetTranslation(1, XMFLOAT3(1.f, (float)frame, 0.f));
+		parallel.SetTranslation(1, XMFLOAT3(1.f, (float)frame, 0.f));
+		serial.UpdateTransforms();
+		parallel.UpdateTransforms();
+
+		EXPECT_EQ(serial.GetChangedNodes(), parallel.GetChangedNodes());
+		for (NodeID node = 0; node <= 3 * 8000; ++node)
+		{
+			ASSERT_EQ(memcmp(&serial.GetTransformMatrix(node), &parallel.GetTransformMatrix(node), sizeof(XMFLOAT4X4)), 0) << node;
+		}
+	}
+}
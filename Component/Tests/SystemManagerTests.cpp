@@ -0,0 +1,203 @@
+#include "stdafx.h"
+#include <gtest/gtest.h>
+#include <functional>
+#include <thread>
+#include "SystemManager.h"
+#include "Serializable.h"
+
+GameComponent(ScheduleTestA)
+	int Value;
+	template<class Archive>
+	void serialize(Archive& archive)
+	{
+		archive(CEREAL_NVP(Value));
+	}
+EndComponent(ScheduleTestA)
+
+GameComponent(ScheduleTestB)
+	int Value;
+	template<class Archive>
+	void serialize(Archive& archive)
+	{
+		archive(CEREAL_NVP(Value));
+	}
+EndComponent(ScheduleTestB)
+
+RegisterComponent(ScheduleTestA)
+RegisterComponent(ScheduleTestB)
+
+typedef std::chrono::steady_clock ScheduleClock;
+
+//! Declares its access on Init and records when each of its updates started and ended
+class ScheduleTestSystem : public ISystem
+{
+	const char*									name;
+	std::function<void(ScheduleTestSystem&)>	declare;
+public:
+	std::function<void()>	Work;
+	std::vector<std::pair<ScheduleClock::time_point, ScheduleClock::time_point>> Runs;
+
+	ScheduleTestSystem(const char* name, std::function<void(ScheduleTestSystem&)> declare = nullptr) :
+		name(name),
+		declare(declare)
+	{
+	}
+
+	template<typename T>
+	void Declare(ComponentAccess access) { RegisterComponent<T>(access); }
+
+	virtual const char* GetName() override { return name; }
+
+	virtual void Init() override
+	{
+		if (declare)
+			declare(*this);
+	}
+
+	virtual void Update(float deltaTime) override
+	{
+		auto start = ScheduleClock::now();
+		if (Work)
+			Work();
+		Runs.push_back(std::make_pair(start, ScheduleClock::now()));
+	}
+};
+
+class SystemManagerTest : public ::testing::Test
+{
+protected:
+	Scene			scene;
+	EntityManager	entityManager;
+	SystemContext	context;
+	SystemManager	manager;
+
+	SystemManagerTest() :
+		entityManager(&scene),
+		context(),
+		manager(&entityManager, &context)
+	{
+	}
+
+	template<typename T>
+	static std::function<void(ScheduleTestSystem&)> Reads() { return [](ScheduleTestSystem& s) { s.Declare<T>(ComponentAccessRead); }; }
+	template<typename T>
+	static std::function<void(ScheduleTestSystem&)> Writes() { return [](ScheduleTestSystem& s) { s.Declare<T>(ComponentAccessWrite); }; }
+};
+
+TEST_F(SystemManagerTest, ConflictingSystemsNeverOverlap)
+{
+	ScheduleTestSystem writerA("WriterA", Writes<ScheduleTestA>());
+	ScheduleTestSystem secondWriterA("SecondWriterA", Writes<ScheduleTestA>());
+	ScheduleTestSystem readerA("ReaderA", Reads<ScheduleTestA>());
+	ScheduleTestSystem writerB("WriterB", Writes<ScheduleTestB>());
+	ScheduleTestSystem undeclared("Undeclared");
+	ScheduleTestSystem readerB("ReaderB", Reads<ScheduleTestB>());
+	std::vector<ScheduleTestSystem*> systems({ &writerA, &secondWriterA, &readerA, &writerB, &undeclared, &readerB });
+	for (auto system : systems)
+	{
+		system->Work = []() { std::this_thread::sleep_for(std::chrono::milliseconds(1)); };
+	}
+	manager.RegisterSystems(std::vector<ISystem*>(systems.begin(), systems.end()));
+	manager.Init();
+
+	// Write/write, write/read and anything against a system without declared access conflict, the later one waits
+	auto dump = manager.GetScheduleDump();
+	EXPECT_NE(dump.find("[0] WriterA start 0ms duration 0ms after { }"), std::string::npos) << dump;
+	EXPECT_NE(dump.find("[1] SecondWriterA start 0ms duration 0ms after { 0 }"), std::string::npos) << dump;
+	EXPECT_NE(dump.find("[2] ReaderA start 0ms duration 0ms after { 0 1 }"), std::string::npos) << dump;
+	EXPECT_NE(dump.find("[3] WriterB start 0ms duration 0ms after { }"), std::string::npos) << dump;
+	EXPECT_NE(dump.find("[4] Undeclared start 0ms duration 0ms after { 0 1 2 3 }"), std::string::npos) << dump;
+	EXPECT_NE(dump.find("[5] ReaderB start 0ms duration 0ms after { 3 4 }"), std::string::npos) << dump;
+
+	const int frames = 20;
+	for (int frame = 0; frame < frames; ++frame)
+	{
+		manager.Update(0.f);
+	}
+
+	bool conflicts[6][6] = {};
+	auto conflict = [&](int a, int b) { conflicts[a][b] = conflicts[b][a] = true; };
+	conflict(0, 1);
+	conflict(0, 2);
+	conflict(1, 2);
+	conflict(3, 5);
+	conflict(4, 5);
+	for (int i = 0; i < 4; ++i)
+	{
+		conflict(i, 4);
+	}
+	for (int j = 0; j < 6; ++j)
+	{
+		ASSERT_EQ(systems[j]->Runs.size(), (size_t)frames);
+		for (int i = 0; i < j; ++i)
+		{
+			if (!conflicts[i][j])
+				continue;
+			for (int frame = 0; frame < frames; ++frame)
+			{
+				EXPECT_LE(systems[i]->Runs[frame].second, systems[j]->Runs[frame].first)
+					<< systems[i]->GetName() << " overlaps " << systems[j]->GetName() << " in frame " << frame;
+			}
+		}
+	}
+}
+
+TEST_F(SystemManagerTest, NonConflictingSystemsShareAStage)
+{
+	ScheduleTestSystem readerA("ReaderA", Reads<ScheduleTestA>());
+	ScheduleTestSystem secondReaderA("SecondReaderA", Reads<ScheduleTestA>());
+	ScheduleTestSystem writerB("WriterB", Writes<ScheduleTestB>());
+	std::vector<ScheduleTestSystem*> systems({ &readerA, &secondReaderA, &writerB });
+
+	// Each waits for another one to be running, the main thread and at least one worker are always available
+	std::atomic<int> running(0);
+	std::atomic<int> overlapped(0);
+	for (auto system : systems)
+	{
+		system->Work = [&]()
+		{
+			running++;
+			auto timeout = ScheduleClock::now() + std::chrono::seconds(5);
+			while (running < 2 && overlapped == 0 && ScheduleClock::now() < timeout)
+			{
+				std::this_thread::yield();
+			}
+			if (running >= 2)
+				overlapped++;
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			running--;
+		};
+	}
+	manager.RegisterSystems(std::vector<ISystem*>(systems.begin(), systems.end()));
+	manager.Init();
+
+	auto dump = manager.GetScheduleDump();
+	EXPECT_NE(dump.find("[1] SecondReaderA start 0ms duration 0ms after { }"), std::string::npos) << dump;
+	EXPECT_NE(dump.find("[2] WriterB start 0ms duration 0ms after { }"), std::string::npos) << dump;
+
+	manager.Update(0.f);
+	EXPECT_GE(overlapped.load(), 2);
+}
+
+TEST_F(SystemManagerTest, ScheduleDumpReportsCriticalPath)
+{
+	ScheduleTestSystem writerA("WriterA", Writes<ScheduleTestA>());
+	ScheduleTestSystem writerB("WriterB", Writes<ScheduleTestB>());
+	ScheduleTestSystem readerA("ReaderA", Reads<ScheduleTestA>());
+	writerA.Work = []() { std::this_thread::sleep_for(std::chrono::milliseconds(20)); };
+	readerA.Work = []() { std::this_thread::sleep_for(std::chrono::milliseconds(20)); };
+	manager.RegisterSystems({ &writerA, &writerB, &readerA });
+	manager.Init();
+	manager.Update(0.f);
+
+	// WriterB runs alongside the chain, which is longer whether or not it ran in parallel
+	auto dump = manager.GetScheduleDump();
+	EXPECT_NE(dump.find("[2] ReaderA start "), std::string::npos) << dump;
+	EXPECT_NE(dump.find(" after { 0 }\n"), std::string::npos) << dump;
+	auto path = dump.find("Critical path (");
+	ASSERT_NE(path, std::string::npos) << dump;
+	EXPECT_EQ(dump.substr(dump.find("):", path)), "): WriterA ReaderA\n") << dump;
+
+	double pathLength = std::stod(dump.substr(path + strlen("Critical path (")));
+	EXPECT_GE(pathLength, 40.0);
+}
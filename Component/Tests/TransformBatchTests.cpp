@@ -0,0 +1,100 @@
+#include "stdafx.h"
+#include <gtest/gtest.h>
+#include <random>
+#include "MathHelper.h"
+#include "TransformBatch.h"
+
+//Random transforms with unit rotations, stored as the structure of arrays ComposeTransforms reads
+struct RandomTransforms
+{
+	std::vector<XMFLOAT3>	Position;
+	std::vector<XMFLOAT4>	Rotation;
+	std::vector<XMFLOAT3>	Scale;
+
+	RandomTransforms(size_t count)
+	{
+		std::mt19937 random(1234);
+		std::uniform_real_distribution<float> value(-100.f, 100.f);
+		std::uniform_real_distribution<float> angle(-XM_PI, XM_PI);
+		std::uniform_real_distribution<float> scale(0.01f, 10.f);
+		for (size_t i = 0; i < count; ++i)
+		{
+			Position.push_back(XMFLOAT3(value(random), value(random), value(random)));
+			Rotation.push_back(QuaternionFromEuler(XMFLOAT3(angle(random), angle(random), angle(random))));
+			Scale.push_back(XMFLOAT3(scale(random), scale(random), scale(random)));
+		}
+	}
+
+	TransformSOA GetSOA()
+	{
+		return { Position.data(), Rotation.data(), Scale.data(), Position.size() };
+	}
+};
+
+static std::vector<XMFLOAT4X4> Compose(TransformSOA soa, const std::vector<NodeID>* indices, bool avx2)
+{
+	SetAvx2Enabled(avx2);
+	std::vector<XMFLOAT4X4> matrices(indices != nullptr ? indices->size() : soa.Count);
+	if (indices != nullptr)
+		ComposeTransforms(soa, indices->data(), indices->size(), matrices.data());
+	else
+		ComposeTransforms(soa, matrices.data());
+	SetAvx2Enabled(true);
+	return matrices;
+}
+
+TEST(ComposeTransforms, SseAndAvx2AreBitIdentical)
+{
+	if (!CpuSupportsAvx2())
+		GTEST_SKIP() << "CPU without AVX2";
+
+	//Not a multiple of 8 or 4, so both paths also run a partial batch
+	RandomTransforms transforms(1003);
+	auto sse = Compose(transforms.GetSOA(), nullptr, false);
+	auto avx2 = Compose(transforms.GetSOA(), nullptr, true);
+	ASSERT_EQ(sse.size(), avx2.size());
+	for (size_t i = 0; i < sse.size(); ++i)
+	{
+		EXPECT_EQ(memcmp(&sse[i], &avx2[i], sizeof(XMFLOAT4X4)), 0) << "transform " << i;
+	}
+}
+
+TEST(ComposeTransforms, SseAndAvx2AreBitIdenticalWithIndices)
+{
+	if (!CpuSupportsAvx2())
+		GTEST_SKIP() << "CPU without AVX2";
+
+	RandomTransforms transforms(200);
+	std::vector<NodeID> indices;
+	for (NodeID i = 0; i < 200; i += 3)
+	{
+		indices.push_back(199 - i);
+	}
+	auto sse = Compose(transforms.GetSOA(), &indices, false);
+	auto avx2 = Compose(transforms.GetSOA(), &indices, true);
+	ASSERT_EQ(sse.size(), avx2.size());
+	for (size_t i = 0; i < sse.size(); ++i)
+	{
+		EXPECT_EQ(memcmp(&sse[i], &avx2[i], sizeof(XMFLOAT4X4)), 0) << "transform " << indices[i];
+	}
+}
+
+TEST(ComposeTransforms, MatchesTransformMatrix)
+{
+	RandomTransforms transforms(13);
+	auto matrices = Compose(transforms.GetSOA(), nullptr, true);
+	for (size_t i = 0; i < matrices.size(); ++i)
+	{
+		XMFLOAT4X4 expected;
+		XMStoreFloat4x4(&expected, XMMatrixScaling(transforms.Scale[i].x, transforms.Scale[i].y, transforms.Scale[i].z) *
+			XMMatrixRotationQuaternion(XMLoadFloat4(&transforms.Rotation[i])) *
+			XMMatrixTranslation(transforms.Position[i].x, transforms.Position[i].y, transforms.Position[i].z));
+		for (int row = 0; row < 4; ++row)
+		{
+			for (int column = 0; column < 4; ++column)
+			{
+				EXPECT_NEAR(matrices[i].m[row][column], expected.m[row][column], 1e-3f) << "transform " << i;
+			}
+		}
+	}
+}
@@ -0,0 +1,177 @@
+#include "stdafx.h"
+#include "ThreadPool.h"
+
+ThreadPool* ThreadPool::Instance = nullptr;
+
+//Set on worker threads so Submit and RunPendingJob use the worker's own queue
+static thread_local ThreadPool* currentPool = nullptr;
+static thread_local uint32_t currentWorker = 0;
+
+static const size_t MinBatchSize = 64;
+static const size_t MaxBatchCount = 64;
+
+ThreadPool::ThreadPool(uint32_t threadCount) :
+	queuedJobs(0),
+	running(true)
+{
+	if (threadCount == 0)
+	{
+		auto hardwareThreads = std::thread::hardware_concurrency();
+		threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+	}
+
+	sharedQueue = threadCount;
+	for (uint32_t i = 0; i <= threadCount; ++i)
+	{
+		queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+	}
+
+	for (uint32_t i = 0; i < threadCount; ++i)
+	{
+		workers.push_back(std::thread(&ThreadPool::WorkerLoop, this, i));
+	}
+
+	if (Instance == nullptr)
+		Instance = this;
+}
+
+bool ThreadPool::PopJob(uint32_t queueIndex, bool newest, Job & outJob)
+{
+	auto& queue = *queues[queueIndex];
+	std::lock_guard<std::mutex> lock(queue.Lock);
+	if (queue.Jobs.empty())
+		return false;
+
+	if (newest)
+	{
+		outJob = std::move(queue.Jobs.back());
+		queue.Jobs.pop_back();
+	}
+	else
+	{
+		outJob = std::move(queue.Jobs.front());
+		queue.Jobs.pop_front();
+	}
+	queuedJobs--;
+	return true;
+}
+
+bool ThreadPool::FindJob(uint32_t queueIndex, Job & outJob)
+{
+	if (queueIndex != sharedQueue && PopJob(queueIndex, true, outJob))
+		return true;
+
+	if (PopJob(sharedQueue, false, outJob))
+		return true;
+
+	// Steal the oldest job, it is the most likely to spawn more work
+	for (uint32_t i = 1; i <= sharedQueue; ++i)
+	{
+		auto victim = (queueIndex + i) % (sharedQueue + 1);
+		if (victim != sharedQueue && PopJob(victim, false, outJob))
+			return true;
+	}
+	return false;
+}
+
+void ThreadPool::WorkerLoop(uint32_t workerIndex)
+{
+	currentPool = this;
+	currentWorker = workerIndex;
+
+	while (true)
+	{
+		Job job;
+		if (FindJob(workerIndex, job))
+		{
+			job();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepLock);
+		jobSignal.wait(lock, [&]() { return !running || queuedJobs > 0; });
+		if (!running && queuedJobs == 0)
+			return;
+	}
+}
+
+void ThreadPool::Submit(Job job)
+{
+	auto queueIndex = currentPool == this ? currentWorker : sharedQueue;
+	{
+		auto& queue = *queues[queueIndex];
+		std::lock_guard<std::mutex> lock(queue.Lock);
+		queue.Jobs.push_back(std::move(job));
+		queuedJobs++;
+	}
+
+	// Taking the sleep lock makes sure a worker that just saw an empty pool is already waiting
+	{
+		std::lock_guard<std::mutex> lock(sleepLock);
+	}
+	jobSignal.notify_one();
+}
+
+void ThreadPool::Submit(Job job, JobCounter & counter)
+{
+	counter.Pending++;
+	Submit([job, &counter]()
+	{
+		job();
+		counter.Pending--;
+	});
+}
+
+bool ThreadPool::RunPendingJob()
+{
+	auto queueIndex = currentPool == this ? currentWorker : sharedQueue;
+	Job job;
+	if (!FindJob(queueIndex, job))
+		return false;
+
+	job();
+	return true;
+}
+
+void ThreadPool::Wait(JobCounter & counter)
+{
+	while (counter.Pending > 0)
+	{
+		if (!RunPendingJob())
+			std::this_thread::yield();
+	}
+}
+
+size_t ThreadPool::GetBatchSize(size_t count, size_t elementSize)
+{
+	// Smallest element count that covers whole cache lines
+	size_t a = elementSize, b = CacheLineSize;
+	while (b != 0)
+	{
+		auto t = a % b;
+		a = b;
+		b = t;
+	}
+	auto lineElements = CacheLineSize / a;
+
+	auto batchSize = (count + MaxBatchCount - 1) / MaxBatchCount;
+	if (batchSize < MinBatchSize)
+		batchSize = MinBatchSize;
+	return (batchSize + lineElements - 1) / lineElements * lineElements;
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepLock);
+		running = false;
+	}
+	jobSignal.notify_all();
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+
+	if (Instance == this)
+		Instance = nullptr;
+}
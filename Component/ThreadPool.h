@@ -0,0 +1,125 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+
+typedef std::function<void()> Job;
+
+static const size_t CacheLineSize = 64;
+
+//! Counts outstanding jobs so a caller can wait for a batch to finish
+struct JobCounter
+{
+	std::atomic<int> Pending;
+	JobCounter() : Pending(0) {}
+};
+
+//! Work stealing pool. Every worker owns a deque, jobs submitted from a worker go to its own deque and are
+//! popped newest first, idle workers steal the oldest job from the others. Jobs submitted from outside
+//! the pool go to a shared queue.
+class ThreadPool
+{
+	struct WorkQueue
+	{
+		std::mutex		Lock;
+		std::deque<Job>	Jobs;
+	};
+
+	static ThreadPool* Instance;
+
+	std::vector<std::thread>				workers;
+	//One queue per worker, the last one is the shared queue for outside threads
+	std::vector<std::unique_ptr<WorkQueue>>	queues;
+	uint32_t								sharedQueue;
+	std::atomic<int>						queuedJobs;
+	std::mutex								sleepLock;
+	std::condition_variable					jobSignal;
+	bool									running;
+
+	void						WorkerLoop(uint32_t workerIndex);
+	bool						PopJob(uint32_t queueIndex, bool newest, Job& outJob);
+	bool						FindJob(uint32_t queueIndex, Job& outJob);
+public:
+	//! threadCount of 0 uses one worker per hardware thread except the calling one
+	ThreadPool(uint32_t threadCount = 0);
+	static ThreadPool*			GetInstance() { return Instance; }
+
+	void						Submit(Job job);
+	void						Submit(Job job, JobCounter& counter);
+	//! Runs one queued job on the calling thread, returns false if there was nothing to run
+	bool						RunPendingJob();
+	//! Helps with queued jobs until the counter reaches zero
+	void						Wait(JobCounter& counter);
+	inline uint32_t				GetThreadCount() const { return (uint32_t)workers.size(); }
+
+	//! Batch size for count elements of elementSize bytes. Batches are a multiple of a cache line so two
+	//! batches never write to the same line, and only depend on count so results do not change with core count.
+	static size_t				GetBatchSize(size_t count, size_t elementSize);
+
+	//! Calls func(begin, end) for every batch of [0, count) on the shared pool and returns when all are done.
+	//! The calling thread runs the first batch and then helps with the rest. Runs serially without a pool.
+	template<typename FuncType>
+	static void					ParallelFor(size_t count, size_t batchSize, FuncType func);
+
+	//! map(begin, end) produces one partial result per batch, partials are then folded with combine in batch
+	//! order. Batch boundaries only depend on count and batchSize so the result is the same for any thread count.
+	template<typename T, typename MapType, typename CombineType>
+	static T					ParallelReduce(size_t count, size_t batchSize, T identity, MapType map, CombineType combine);
+
+	~ThreadPool();
+};
+
+template<typename FuncType>
+inline void ThreadPool::ParallelFor(size_t count, size_t batchSize, FuncType func)
+{
+	if (count == 0)
+		return;
+	if (batchSize == 0)
+		batchSize = count;
+
+	auto pool = Instance;
+	if (pool == nullptr || pool->GetThreadCount() == 0 || batchSize >= count)
+	{
+		for (size_t begin = 0; begin < count; begin += batchSize)
+		{
+			func(begin, begin + batchSize < count ? begin + batchSize : count);
+		}
+		return;
+	}
+
+	JobCounter counter;
+	for (size_t begin = batchSize; begin < count; begin += batchSize)
+	{
+		auto end = begin + batchSize < count ? begin + batchSize : count;
+		pool->Submit([&func, begin, end]() { func(begin, end); }, counter);
+	}
+	func(0, batchSize);
+	pool->Wait(counter);
+}
+
+template<typename T, typename MapType, typename CombineType>
+inline T ThreadPool::ParallelReduce(size_t count, size_t batchSize, T identity, MapType map, CombineType combine)
+{
+	if (count == 0)
+		return identity;
+	if (batchSize == 0)
+		batchSize = count;
+
+	std::vector<T> partials((count + batchSize - 1) / batchSize, identity);
+	ParallelFor(count, batchSize, [&](size_t begin, size_t end)
+	{
+		partials[begin / batchSize] = map(begin, end);
+	});
+
+	T result = identity;
+	for (auto& partial : partials)
+	{
+		result = combine(result, partial);
+	}
+	return result;
+}
@@ -0,0 +1,87 @@
+#include "stdafx.h"
+#include "TransformBatch.h"
+#include "MathHelper.h"
+#include "SimdLanes.h"
+
+//! Composes up to L::Width transforms at the given indices
+template<typename L>
+SIMD_KERNEL_INLINE static inline void ComposeLanes(const TransformSOA& transforms, const int32_t* indices, size_t count, XMFLOAT4X4* outMatrices)
+{
+	typedef typename L::Vec Vec;
+	int32_t laneIndices[L::Width];
+	for (size_t i = 0; i < L::Width; ++i)
+	{
+		// Unused lanes repeat the last transform so every load stays in bounds
+		laneIndices[i] = indices[i < count ? i : count - 1];
+	}
+
+	Vec x, y, z, w, scaleX, scaleY, scaleZ, positionX, positionY, positionZ;
+	L::Gather(transforms.Rotation, laneIndices, x, y, z, w);
+	L::Gather(transforms.Scale, laneIndices, scaleX, scaleY, scaleZ);
+	L::Gather(transforms.Position, laneIndices, positionX, positionY, positionZ);
+
+	// Rows of XMMatrixRotationQuaternion, each scaled by its axis
+	auto x2 = L::Add(x, x);
+	auto y2 = L::Add(y, y);
+	auto z2 = L::Add(z, z);
+	auto xx = L::Mul(x, x2);
+	auto yy = L::Mul(y, y2);
+	auto zz = L::Mul(z, z2);
+	auto xy = L::Mul(x, y2);
+	auto xz = L::Mul(x, z2);
+	auto yz = L::Mul(y, z2);
+	auto wx = L::Mul(w, x2);
+	auto wy = L::Mul(w, y2);
+	auto wz = L::Mul(w, z2);
+	auto one = L::Set1(1.f);
+	auto zero = L::Set1(0.f);
+	L::StoreRow(L::Mul(L::Sub(one, L::Add(yy, zz)), scaleX), L::Mul(L::Add(xy, wz), scaleX), L::Mul(L::Sub(xz, wy), scaleX),
+		zero, 0, outMatrices, count);
+	L::StoreRow(L::Mul(L::Sub(xy, wz), scaleY), L::Mul(L::Sub(one, L::Add(xx, zz)), scaleY), L::Mul(L::Add(yz, wx), scaleY),
+		zero, 1, outMatrices, count);
+	L::StoreRow(L::Mul(L::Add(xz, wy), scaleZ), L::Mul(L::Sub(yz, wx), scaleZ), L::Mul(L::Sub(one, L::Add(xx, yy)), scaleZ),
+		zero, 2, outMatrices, count);
+	L::StoreRow(positionX, positionY, positionZ, one, 3, outMatrices, count);
+}
+
+template<typename L>
+SIMD_KERNEL_INLINE static inline void ComposeAll(const TransformSOA& transforms, const NodeID* indices, size_t count, XMFLOAT4X4* outMatrices)
+{
+	int32_t indexBatch[L::Width];
+	for (size_t begin = 0; begin < count; begin += L::Width)
+	{
+		auto lanes = count - begin < (size_t)L::Width ? count - begin : (size_t)L::Width;
+		for (size_t i = 0; i < lanes; ++i)
+		{
+			indexBatch[i] = indices != nullptr ? indices[begin + i] : (int32_t)(begin + i);
+		}
+		ComposeLanes<L>(transforms, indexBatch, lanes, outMatrices + begin);
+	}
+	L::Finish();
+}
+
+#ifdef SIMD_LANES_AVX2
+SIMD_AVX2_KERNEL static void ComposeAllAvx2(const TransformSOA& transforms, const NodeID* indices, size_t count, XMFLOAT4X4* outMatrices)
+{
+	ComposeAll<Avx2Lanes>(transforms, indices, count, outMatrices);
+}
+#endif
+
+void ComposeTransforms(const TransformSOA & transforms, XMFLOAT4X4 * outMatrices)
+{
+	ComposeTransforms(transforms, nullptr, transforms.Count, outMatrices);
+}
+
+void ComposeTransforms(const TransformSOA & transforms, const NodeID * indices, size_t count, XMFLOAT4X4 * outMatrices)
+{
+	if (count == 0)
+		return;
+#ifdef SIMD_LANES_AVX2
+	if (count > SseLanes::Width && CpuSupportsAvx2())
+	{
+		ComposeAllAvx2(transforms, indices, count, outMatrices);
+		return;
+	}
+#endif
+	ComposeAll<SseLanes>(transforms, indices, count, outMatrices);
+}
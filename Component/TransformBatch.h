@@ -0,0 +1,10 @@
+#pragma once
+#include "stdafx.h"
+#include "SceneCommon.h"
+
+//! Writes scale * rotation * translation of the first transforms.Count transforms to outMatrices, same layout as GetTransformation.
+//! Composes 8 transforms at a time with AVX2 when the CPU supports it, 4 at a time with SSE otherwise. Both give identical results.
+void ComposeTransforms(const TransformSOA& transforms, XMFLOAT4X4* outMatrices);
+
+//! Same as above for the count transforms at the given indices, outMatrices[i] is the matrix of indices[i]
+void ComposeTransforms(const TransformSOA& transforms, const NodeID* indices, size_t count, XMFLOAT4X4* outMatrices);
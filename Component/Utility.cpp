@@ -46,10 +46,8 @@ XMMATRIX OGLtoXM(const ogldev::Matrix4f& mat)
 	return xm;
 }
 
-bool IsIntersecting(DirectX::BoundingOrientedBox boundingBox, Camera* camera, int mouseX, int mouseY, float& distance)
+void GetPickRay(Camera* camera, int mouseX, int mouseY, float screenWidth, float screenHeight, XMFLOAT3& outOrigin, XMFLOAT3& outDirection)
 {
-	uint16_t screenWidth = 1280;
-	uint16_t screenHeight = 720;
 	auto viewMatrix = XMLoadFloat4x4(&camera->GetViewMatrix());
 	auto projMatrix = XMLoadFloat4x4(&camera->GetProjectionMatrix());
 
@@ -75,9 +73,15 @@ bool IsIntersecting(DirectX::BoundingOrientedBox boundingBox, Camera* camera, in
 		viewMatrix,
 		XMMatrixIdentity());
 
-	auto direction = dest - orig;
-	direction = XMVector3Normalize(direction);
+	XMStoreFloat3(&outOrigin, orig);
+	XMStoreFloat3(&outDirection, XMVector3Normalize(dest - orig));
+}
+
+bool IsIntersecting(DirectX::BoundingOrientedBox boundingBox, Camera* camera, int mouseX, int mouseY, float& distance)
+{
+	XMFLOAT3 orig, direction;
+	GetPickRay(camera, mouseX, mouseY, 1280.f, 720.f, orig, direction);
 	//bool intersecting = entity->GetBoundingSphere().Intersects(orig, direction, distance);
-	bool intersecting = boundingBox.Intersects(orig, direction, distance);
+	bool intersecting = boundingBox.Intersects(XMLoadFloat3(&orig), XMLoadFloat3(&direction), distance);
 	return intersecting;
 }
\ No newline at end of file
@@ -10,4 +10,6 @@ XMFLOAT3X3 aiMatrixToXMFloat3x3(const aiMatrix3x3* aiMe);
 
 XMMATRIX OGLtoXM(const ogldev::Matrix4f& mat);
 
+//! World space ray through a pixel of a screenWidth x screenHeight view, outDirection is normalized
+void GetPickRay(Camera* camera, int mouseX, int mouseY, float screenWidth, float screenHeight, XMFLOAT3& outOrigin, XMFLOAT3& outDirection);
 bool IsIntersecting(DirectX::BoundingOrientedBox boundingBox, Camera* camera, int mouseX, int mouseY, float& distance);
\ No newline at end of file
@@ -1,5 +1,7 @@
 #pragma once
 
+// ENGINE_HEADLESS builds the ECS, scene and culling code without Windows or Direct3D, see CMakeLists.txt
+#ifndef ENGINE_HEADLESS
 #ifndef WIN32_LEAN_AND_MEAN
 #define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers.
 #endif
@@ -8,9 +10,7 @@
 #include <d3d12.h>
 #include <dxgi1_4.h>
 #include <D3Dcompiler.h>
-#include <DirectXMath.h>
 #include "d3dx12.h"
-#include <string>
 #include <wincodec.h>
 #include "WICTextureLoader.h"
 #include "DDSTextureLoader.h"
@@ -18,7 +18,16 @@
 #include "ResourceUploadBatch.h"
 #include "DirectXHelpers.h"
 #include <dxgidebug.h>
+#else
+#include <cfloat>
+#include <cstdint>
+#include <cstring>
+typedef unsigned char byte;
+typedef unsigned int UINT;
+#endif
+#include <DirectXMath.h>
 #include <DirectXCollision.h>
+#include <string>
 #include "FileUtility.h"
 
 #include <cereal/types/complex.hpp>
@@ -125,6 +125,15 @@ XMFLOAT4X4 Camera::GetViewProjectionMatrix()
 	return viewProjT;
 }
 
+Frustum Camera::GetFrustum()
+{
+	auto view = XMLoadFloat4x4(&GetViewMatrix());
+	auto proj = XMLoadFloat4x4(&projectionMatrix);
+	XMFLOAT4X4 viewProj;
+	XMStoreFloat4x4(&viewProj, view * proj);
+	return Frustum::FromViewProjection(viewProj);
+}
+
 XMFLOAT4X4 Camera::GetViewMatrixTransposed()
 {
 	auto mat = XMLoadFloat4x4(&viewMatrix);
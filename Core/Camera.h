@@ -1,5 +1,6 @@
 #pragma once
 #include <DirectXMath.h>
+#include "../Culling.h"
 
 using namespace DirectX;
 
@@ -31,6 +32,8 @@ public:
 	XMFLOAT4X4 GetViewProjectionMatrix();
 	XMFLOAT4X4 GetViewMatrixTransposed();
 	XMFLOAT4X4 GetProjectionMatrixTransposed();
+	//! World space view frustum at the current position and rotation
+	Frustum GetFrustum();
 
 	void Rotate(float x, float y);
 	void SetProjectionMatrix(float width, float height);
@@ -2,7 +2,7 @@
 #include "../stdafx.h"
 #include "Light.h"
 
-static const int MaxPointLights = 16;
+static const int MaxPointLights = 4096; //Capacity of the clustered point light buffer
 static const int MaxDirLights = 4;
 static const int MaxBones = 128;
 
@@ -25,25 +25,27 @@ struct InstanceWorldBuffer
 struct PixelConstantBuffer
 {
 	DirectionalLight	light[MaxDirLights];
-	PointLight			pointLight[MaxPointLights];
 	XMFLOAT4X4			invProjView;
 	XMFLOAT3			cameraPosition;
 	uint32_t			pointLightCount;
-	uint32_t			pointLightIndex;
 	uint32_t			dirLightCount;
 	uint32_t			dirLightIndex;
 };
 
+static const uint32_t CubeFaceCount = 6;
+static const uint32_t AllCubeFaces = (1u << CubeFaceCount) - 1;
+
 struct DirShadowBuffer
 {
 	DirectX::XMFLOAT4X4 world;
 	DirectX::XMFLOAT4X4 shadowView;
 	DirectX::XMFLOAT4X4 shadowProjection;
+	uint32_t			faceMask; //Point shadow cube faces the entity reaches, bit i for viewProjection[i]
 };
 
 struct PointShadowBuffer
 {
-	DirectX::XMFLOAT4X4 viewProjection[6];
+	DirectX::XMFLOAT4X4 viewProjection[CubeFaceCount];
 };
 
 struct PerFrameConstantBuffer
@@ -51,6 +53,13 @@ struct PerFrameConstantBuffer
 	float		nearZ;
 	float		farZ;
 	XMFLOAT2	lightPerspective;
+	XMFLOAT4	viewDepthPlane; //dot(float4(worldPos, 1), plane) is the view space depth
+	XMFLOAT2	clusterTileScale; //Pixel position to light cluster tile
+	float		clusterDepthScale; //Cluster slice is log(depth) * scale + bias
+	float		clusterDepthBias;
+	uint32_t	clusterTilesX;
+	uint32_t	clusterTilesY;
+	uint32_t	clusterSlices;
 };
 
 struct PerArmatureConstantBuffer
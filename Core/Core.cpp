@@ -4,8 +4,17 @@
 #include "ShaderManager.h"
 #include <WindowsX.h>
 #include <algorithm>
+#include <thread>
+#include <chrono>
+#include <timeapi.h>
 #include "../ModelLoader.h"
 
+#pragma comment(lib, "winmm.lib")
+
+static const float DefaultTickRate = 60.f;
+static const float DefaultMaxFrameTime = 0.25f;
+static const double FrameLimiterSpinSeconds = 0.002; //Sleep can overshoot by about a scheduler tick, the rest is spun
+
 using namespace std;
 
 Core* Core::coreInstance = nullptr;
@@ -449,6 +458,8 @@ void Core::Render()
 
 void Core::Cleanup()
 {
+	SetFrameRateLimit(0.f);
+
 	// wait for the gpu to finish all frames
 	for (int i = 0; i < frameBufferCount; ++i)
 	{
@@ -547,6 +558,10 @@ Core::Core(HINSTANCE hInstance, int ShowWnd, int width, int height, bool fullscr
 
 	fpsFrameCount = 0;
 	fpsTimeElapsed = 0.0f;
+	fixedTimeStep = 1.f / DefaultTickRate;
+	maxFrameTime = DefaultMaxFrameTime;
+	interpolationAlpha = 1.f;
+	targetFrameTime = 0.0;
 
 	__int64 perfFreq;
 	QueryPerformanceFrequency((LARGE_INTEGER*)&perfFreq);
@@ -623,6 +638,7 @@ void Core::Run(std::function<void(Core*)> coreLogicCallback)
 	currentTime = now;
 	previousTime = now;
 	FrameCounter = 0;
+	double accumulator = 0.0;
 	MSG msg = {};
 	while (msg.message != WM_QUIT)
 	{
@@ -634,30 +650,64 @@ void Core::Run(std::function<void(Core*)> coreLogicCallback)
 		else
 		{
 			UpdateTimer();
-			if (coreLogicCallback)
+			accumulator += min(deltaTime, maxFrameTime);
+
+			// The simulation advances in fixed ticks whatever the frame rate, zero or several per frame
+			while (accumulator >= fixedTimeStep)
 			{
-				coreLogicCallback(this);
+				deltaTime = fixedTimeStep;
+				if (coreLogicCallback)
+				{
+					coreLogicCallback(this);
+				}
+
+				Update();
+				accumulator -= fixedTimeStep;
 			}
 
-			Update();
+			interpolationAlpha = (float)(accumulator / fixedTimeStep);
 			Render();
-
-			//Quick frame rate limiter to 60fps
-			/*float targetFPS = 60.f;
-			QueryPerformanceCounter((LARGE_INTEGER*)&now);
-			time_t t = now;
-			auto d = (float)((t - previousTime) * perfCounterSeconds);
-			if (d < 1.f / targetFPS)
-			{
-				auto t = 1.f / targetFPS - d;
-				this_thread::sleep_for(std::chrono::milliseconds((INT64)(t * 1000)));
-			}*/
+			LimitFrameRate();
 		}
 	}
 
 	Cleanup();
 }
 
+void Core::SetTickRate(float ticksPerSecond)
+{
+	fixedTimeStep = 1.f / ticksPerSecond;
+}
+
+void Core::SetFrameRateLimit(float framesPerSecond)
+{
+	// Finer sleep granularity than the default 15.6 ms while a limit is set
+	if (targetFrameTime > 0.0)
+		timeEndPeriod(1);
+	targetFrameTime = framesPerSecond > 0.f ? 1.0 / framesPerSecond : 0.0;
+	if (targetFrameTime > 0.0)
+		timeBeginPeriod(1);
+}
+
+void Core::LimitFrameRate()
+{
+	if (targetFrameTime <= 0.0)
+		return;
+
+	__int64 now;
+	QueryPerformanceCounter((LARGE_INTEGER*)&now);
+	auto remaining = targetFrameTime - (now - previousTime) * perfCounterSeconds;
+	while (remaining > 0.0)
+	{
+		if (remaining > FrameLimiterSpinSeconds)
+			this_thread::sleep_for(chrono::duration<double>(remaining - FrameLimiterSpinSeconds));
+		else
+			YieldProcessor();
+		QueryPerformanceCounter((LARGE_INTEGER*)&now);
+		remaining = targetFrameTime - (now - previousTime) * perfCounterSeconds;
+	}
+}
+
 LRESULT Core::HandleWindowsCallback(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
 {
 	switch (msg)
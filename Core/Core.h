@@ -18,6 +18,10 @@ public:
 	static Core* coreInstance;
 	Core(HINSTANCE hInstance, int ShowWnd, int width, int height, bool fullscreen);
 	void Run(std::function<void(Core*)> coreLogicCallback);
+	//! Simulation ticks per second, Update always sees deltaTime = 1 / ticksPerSecond
+	void SetTickRate(float ticksPerSecond);
+	//! Caps rendered frames per second by sleeping and then spinning out the rest of the frame, 0 disables the cap
+	void SetFrameRateLimit(float framesPerSecond);
 	LRESULT HandleWindowsCallback(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam);
 	~Core();
 
@@ -64,6 +68,10 @@ protected:
 	double perfCounterSeconds;
 	float totalTime;
 	float deltaTime;
+	float fixedTimeStep; //Seconds per simulation tick
+	float maxFrameTime; //Longest frame time fed to the simulation, beyond it the game slows down instead of running ever more ticks
+	float interpolationAlpha; //Progress from the last tick to the next one when the frame is drawn, 0 to 1
+	double targetFrameTime; //Seconds per frame of the frame rate limit, 0 when not limited
 	__int64 startTime;
 	__int64 currentTime;
 	__int64 previousTime;
@@ -73,6 +81,7 @@ protected:
 	float fpsTimeElapsed;
 
 	void UpdateTimer();
+	void LimitFrameRate();
 
 	PixelConstantBuffer pixelCb;
 
@@ -5,7 +5,7 @@
 #include "../InputLayout.h"
 #include "../ModelLoader.h"
 #include "../MathHelper.h"
-#include "../AnimationComponent.h"
+#include "../DynamicBvh.h"
 
 struct PrefilterPixelConstBuffer
 {
@@ -200,9 +200,9 @@ void DeferredRenderer::Initialize(ID3D12GraphicsCommandList* command)
 	CreateDSV();
 	CreateShadowBuffers();
 	CreateSelectionFilterBuffers();
+	CreateLightClusterBuffers();
 
 	frame = std::unique_ptr<FrameManager>(new FrameManager(device));
-	sphereMesh = ModelLoader::LoadFile("../../Assets/sphere.obj", command);
 	cubeMesh = ModelLoader::LoadFile("../../Assets/cube.obj", command);
 }
 
@@ -245,7 +245,7 @@ void DeferredRenderer::RenderLightPass(ID3D12GraphicsCommandList * command, cons
 	command->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(gBufferTextures[RTV_ORDER_LIGHTSHAPE], D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_GENERIC_READ));
 }
 
-void DeferredRenderer::RenderLightShapePass(ID3D12GraphicsCommandList * command, PixelConstantBuffer & pixelCb)
+void DeferredRenderer::RenderLightShapePass(ID3D12GraphicsCommandList * command)
 {
 	for (int i = 0; i < numRTV; i++)
 		command->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(gBufferTextures[i], D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_GENERIC_READ));
@@ -259,8 +259,12 @@ void DeferredRenderer::RenderLightShapePass(ID3D12GraphicsCommandList * command,
 	command->SetGraphicsRootDescriptorTable(RootSigCBPixel0, frame->GetGPUHandle(frameHeapParams.PixelCB));
 	command->SetGraphicsRootDescriptorTable(RootSigCBAll1, frame->GetGPUHandle(frameHeapParams.PerFrameCB));
 	command->SetGraphicsRootDescriptorTable(RootSigSRVPixel1, frame->GetGPUHandle(frameHeapParams.GBuffer));
+	command->SetGraphicsRootDescriptorTable(RootSigSRVLights, frame->GetGPUHandle(frameHeapParams.LightClusters));
+	DrawScreenQuad(command); //Every light in one pass, each pixel loops over the lights of its cluster
 
-	DrawLightShapePass(command, pixelCb);
+	//numRTV - 2 is the lightshape pass RTV
+	command->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(gBufferTextures[RTV_ORDER_LIGHTSHAPE], D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_GENERIC_READ));
+	command->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(shadowPosTexture, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_GENERIC_READ));
 }
 
 void DeferredRenderer::RenderAmbientPass(ID3D12GraphicsCommandList * command)
@@ -319,38 +323,47 @@ void DeferredRenderer::RenderShadowMap(ID3D12GraphicsCommandList * commandList,
 	commandList->OMSetRenderTargets(0, nullptr, false, &shadowDSVHeap.handleCPU(0));
 	commandList->SetPipelineState(shadowMapDirLightPSO);
 
-	int sIndex = 0;
-	for (auto e : entities)
+	//Shadow CBs follow the order of entities, so a caster's index is also its CB index
+	CullShadowCasters(entities, instancedEntities);
+	auto entityCount = (uint32_t)entities.size();
+	DirShadowBuffer cb;
+	cb.shadowView = shadowViewTransposed;
+	cb.shadowProjection = shadowProjTransposed;
+	for (uint32_t i = 0; i < entityCount; ++i)
 	{
-		auto mesh = resourceManager->GetMesh(e.Mesh);
-		if (false) continue;
-		commandList->SetGraphicsRootDescriptorTable(RootSigCBVertex0, frame->GetGPUHandle(frameHeapParams.ShadowCB, sIndex));
-		sIndex++;
+		cb.world = Transpose(entities[i].WorldTransform);
+		cb.faceMask = pointShadowFaceMasks[i];
+		shadowCBWrapper.CopyData(&cb, sizeof(DirShadowBuffer), i);
+	}
+	for (auto i : dirShadowCasters)
+	{
+		if (i >= entityCount) break; //Instanced groups, drawn below
+		auto mesh = resourceManager->GetMesh(entities[i].Mesh);
 		if (mesh->IsAnimated()) continue;
+		commandList->SetGraphicsRootDescriptorTable(RootSigCBVertex0, frame->GetGPUHandle(frameHeapParams.ShadowCB, i));
 		Draw(mesh, commandList);
 	}
 
 	//Animated entities
 	commandList->SetPipelineState(sysRM->GetPSO(StringID("shadowMapDirLightAnimatedPSO")));
-	sIndex = 0;
-	int boneIndex = 0;
-	for (auto e : entities)
+	for (auto i : dirShadowCasters)
 	{
+		if (i >= entityCount) break;
+		auto& e = entities[i];
 		auto mesh = resourceManager->GetMesh(e.Mesh);
-		if (false) continue;
-		commandList->SetGraphicsRootDescriptorTable(RootSigCBVertex0, frame->GetGPUHandle(frameHeapParams.ShadowCB, sIndex));
-		commandList->SetGraphicsRootDescriptorTable(RootSigCBAll1, frame->GetGPUHandle(frameHeapParams.BoneCB, boneIndex));
-		sIndex++;
 		if (!mesh->IsAnimated()) continue;
+		commandList->SetGraphicsRootDescriptorTable(RootSigCBVertex0, frame->GetGPUHandle(frameHeapParams.ShadowCB, i));
+		commandList->SetGraphicsRootDescriptorTable(RootSigCBAll1, frame->GetGPUHandle(frameHeapParams.BoneCB, entityBoneCBMap[e.EntityID]));
 		DrawAnimated(mesh, commandList);
-		boneIndex++;
 	}
 
 	//Instanced entities
 	commandList->SetPipelineState(sysRM->GetPSO(StringID("shadowInstancedDirLightPSO")));
 	commandList->SetGraphicsRootDescriptorTable(RootSigCBVertex0, frame->GetGPUHandle(frameHeapParams.ShadowCB, 0)); //Set 0th Shadow CB as we only need view and projection from it
-	for (auto e : instancedEntities)
+	for (auto i : dirShadowCasters)
 	{
+		if (i < entityCount) continue;
+		auto e = instancedEntities[i - entityCount];
 		if (!e->CastsShadow()) continue;
 		auto meshes = e->GetMeshIDs();
 		for (auto meshID : meshes)
@@ -374,23 +387,23 @@ void DeferredRenderer::RenderShadowMap(ID3D12GraphicsCommandList * commandList,
 	commandList->ClearDepthStencilView(shadowDSVHeap.handleCPU(1), D3D12_CLEAR_FLAGS::D3D12_CLEAR_FLAG_DEPTH, mClearDepth, 0xff, 0, nullptr);
 	commandList->OMSetRenderTargets(0, nullptr, false, &shadowDSVHeap.handleCPU(1));
 	commandList->SetPipelineState(shadowMapPointLightPSO);
-	sIndex = 0;
 	auto shadowFrameIndex = frame->CopyAllocate(1, pointShadowCbHeap, 0);
 	commandList->SetGraphicsRootDescriptorTable(RootSigCBAll1, frame->GetGPUHandle(shadowFrameIndex));
-	for (auto e : entities)
+	for (auto i : pointShadowCasters)
 	{
-		auto mesh = resourceManager->GetMesh(e.Mesh);
-		if (false) continue;
-		commandList->SetGraphicsRootDescriptorTable(RootSigCBVertex0, frame->GetGPUHandle(frameHeapParams.ShadowCB, sIndex));
+		if (i >= entityCount) break;
+		auto mesh = resourceManager->GetMesh(entities[i].Mesh);
+		commandList->SetGraphicsRootDescriptorTable(RootSigCBVertex0, frame->GetGPUHandle(frameHeapParams.ShadowCB, i));
 		Draw(mesh, commandList);
-		sIndex++;
 	}
 
 	//Instanced entities
 	commandList->SetPipelineState(sysRM->GetPSO(StringID("shadowInstancedPointLightPSO")));
 	commandList->SetGraphicsRootDescriptorTable(RootSigCBAll1, frame->GetGPUHandle(shadowFrameIndex));
-	for (auto e : instancedEntities)
+	for (auto i : pointShadowCasters)
 	{
+		if (i < entityCount) continue;
+		auto e = instancedEntities[i - entityCount];
 		if (!e->CastsShadow()) continue;
 		auto meshes = e->GetMeshIDs();
 		for (auto meshID : meshes)
@@ -403,6 +416,61 @@ void DeferredRenderer::RenderShadowMap(ID3D12GraphicsCommandList * commandList,
 	commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(shadowMapPointTexture, D3D12_RESOURCE_STATE_DEPTH_WRITE, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE));
 }
 
+//! World box around every instance of every mesh in the group
+static BoundingBox GetInstanceGroupBounds(ResourceManager* resourceManager, MeshInstanceGroupEntity* group)
+{
+	BvhBounds bounds = {};
+	bool first = true;
+	XMFLOAT4X4 world;
+	for (auto meshID : group->GetMeshIDs())
+	{
+		auto& meshBox = resourceManager->GetMesh(meshID)->GetBoundingOrientedBox();
+		for (auto& transposed : group->GetInstanceTransforms())
+		{
+			XMStoreFloat4x4(&world, XMMatrixTranspose(XMLoadFloat4x4(&transposed)));
+			auto instance = BvhBounds::FromOrientedBox(meshBox, world);
+			bounds = first ? instance : BvhBounds::Merge(bounds, instance);
+			first = false;
+		}
+	}
+	return bounds.ToBox();
+}
+
+void DeferredRenderer::CullShadowCasters(const std::vector<Entity>& entities, const std::vector<MeshInstanceGroupEntity*>& instancedEntities)
+{
+	shadowBoxes.Clear();
+	shadowBoxes.Reserve(entities.size() + instancedEntities.size());
+	for (auto& e : entities)
+	{
+		shadowBoxes.Add(resourceManager->GetMesh(e.Mesh)->GetBoundingOrientedBox(), e.WorldTransform);
+	}
+	for (auto group : instancedEntities)
+	{
+		shadowBoxes.Add(GetInstanceGroupBounds(resourceManager, group));
+	}
+
+	CullBoxes(dirShadowFrustum, shadowBoxes, dirShadowCasters);
+	CullBoxes(pointShadowSphere, shadowBoxes, pointShadowCasters);
+
+	//The geometry shader only emits a caster's triangles to the faces in its mask
+	pointShadowFaceMasks.assign(shadowBoxes.Size(), 0);
+	for (uint32_t face = 0; face < CubeFaceCount; ++face)
+	{
+		CullBoxes(pointShadowFaces[face], shadowBoxes, faceCasters);
+		for (auto i : faceCasters)
+		{
+			pointShadowFaceMasks[i] |= (uint8_t)(1u << face);
+		}
+	}
+	size_t write = 0;
+	for (auto i : pointShadowCasters)
+	{
+		if (pointShadowFaceMasks[i] != 0)
+			pointShadowCasters[write++] = i;
+	}
+	pointShadowCasters.resize(write);
+}
+
 void DeferredRenderer::Draw(ID3D12GraphicsCommandList* commandList, std::vector<Entity> entities)
 {
 	commandList->SetGraphicsRootDescriptorTable(RootSigCBAll1, frame->GetGPUHandle(frameHeapParams.PerFrameCB));
@@ -421,7 +489,6 @@ void DeferredRenderer::DrawAnimated(ID3D12GraphicsCommandList * clist, std::vect
 {
 	clist->SetPipelineState(sysRM->GetPSO(StringID("animDeferredPSO")));
 	clist->SetGraphicsRootDescriptorTable(RootSigCBAll1, frame->GetGPUHandle(frameHeapParams.PerFrameCB));
-	auto boneCBIndex = 0;
 	for (auto e : entities)
 	{
 		auto mesh = resourceManager->GetMesh(e.Mesh);
@@ -429,9 +496,8 @@ void DeferredRenderer::DrawAnimated(ID3D12GraphicsCommandList * clist, std::vect
 		if (!mesh->IsAnimated())continue;
 		clist->SetGraphicsRootDescriptorTable(RootSigSRVPixel1, frame->GetGPUHandle(frameHeapParams.Textures, material->GetStartIndex())); //Set start of material texture in root descriptor
 		clist->SetGraphicsRootDescriptorTable(RootSigCBVertex0, frame->GetGPUHandle(frameHeapParams.Entities, entityCBMap[e.EntityID]));
-		clist->SetGraphicsRootDescriptorTable(RootSigCBAll2, frame->GetGPUHandle(frameHeapParams.BoneCB, boneCBIndex));
+		clist->SetGraphicsRootDescriptorTable(RootSigCBAll2, frame->GetGPUHandle(frameHeapParams.BoneCB, entityBoneCBMap[e.EntityID])); //By id, entities may be a culled subset
 		DrawAnimated(mesh, clist);
-		boneCBIndex++;
 	}
 }
 
@@ -479,20 +545,6 @@ void DeferredRenderer::DrawScreenQuad(ID3D12GraphicsCommandList * commandList)
 	commandList->DrawInstanced(4, 1, 0, 0);
 }
 
-void DeferredRenderer::DrawLightShapePass(ID3D12GraphicsCommandList * commandList, PixelConstantBuffer & pixelCb)
-{
-	for (auto i = 0u; i < pixelCb.pointLightCount; ++i)
-	{
-		commandList->SetGraphicsRootDescriptorTable(RootSigCBVertex0, frame->GetGPUHandle(frameHeapParams.LightShapes, i));
-		commandList->SetGraphicsRootDescriptorTable(RootSigCBPixel0, frame->GetGPUHandle(frameHeapParams.PixelCB, i + 1));
-		Draw(sphereMesh, commandList);
-	}
-
-	//numRTV - 2 is the lightshape pass RTV
-	commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(gBufferTextures[RTV_ORDER_LIGHTSHAPE], D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_GENERIC_READ));
-	commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(shadowPosTexture, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_GENERIC_READ));
-}
-
 void DeferredRenderer::DrawResult(ID3D12GraphicsCommandList* commandList, D3D12_CPU_DESCRIPTOR_HANDLE & rtvHandle)
 {
 	commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(gBufferTextures[RTV_ORDER_QUAD], D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_GENERIC_READ));
@@ -520,10 +572,10 @@ void DeferredRenderer::StartFrame(ID3D12GraphicsCommandList* commandList)
 	commandList->SetDescriptorHeaps(1, frameHeap);
 }
 
-void DeferredRenderer::PrepareFrame(std::vector<Entity> entities, Camera * camera, PixelConstantBuffer & pixelCb)
+void DeferredRenderer::PrepareFrame(const std::vector<Entity>& entities, const RenderState& state, Camera * camera, const std::vector<PointLight>& pointLights, PixelConstantBuffer & pixelCb)
 {
 	this->camera = camera;
-	PrepareGPUHeap(entities,  pixelCb);
+	PrepareGPUHeap(entities, state, pointLights, pixelCb);
 }
 
 void DeferredRenderer::TransitionToPostProcess(ID3D12GraphicsCommandList * commandList)
@@ -580,7 +632,7 @@ void DeferredRenderer::DrawInstanced(MeshInstanceGroupEntity * instanced, Mesh *
 }
 
 //Copies constant buffer heaps and other heaps to the frame descriptor heap before drawing 
-void DeferredRenderer::PrepareGPUHeap(std::vector<Entity> entities, PixelConstantBuffer & pixelCb)
+void DeferredRenderer::PrepareGPUHeap(const std::vector<Entity>& entities, const RenderState& state, const std::vector<PointLight>& pointLights, PixelConstantBuffer & pixelCb)
 {
 	auto currentGBufferIndex = frame->CopyAllocate(16, gBufferHeap);
 	auto srvGpuHeapIndex = frame->CopyAllocate(srvHeapIndex, srvHeap); //Copy textures
@@ -591,9 +643,11 @@ void DeferredRenderer::PrepareGPUHeap(std::vector<Entity> entities, PixelConstan
 	auto camProj = camera->GetProjectionMatrix();
 	auto camView = camera->GetViewMatrix();
 	entityCBMap.clear();
+	entityBoneCBMap.clear();
 	//Create Entity Constant Buffers and copy to CBVs
-	for (auto e : entities)
+	for (size_t i = 0; i < entities.size(); ++i)
 	{
+		auto& e = entities[i];
 		//TODO: Store index-EntityID map to use in Draw Calls. IsActive and SetActive entity manager depends on it.
 		entityCBMap.insert(std::pair<EntityID, int>(e.EntityID, index));
 		auto uvScale = XMFLOAT2(1.f,1.f);
@@ -611,11 +665,11 @@ void DeferredRenderer::PrepareGPUHeap(std::vector<Entity> entities, PixelConstan
 		cbWrapper.CopyData(&cb, ConstantBufferSize, index);
 		if (mesh->IsAnimated())
 		{
-			//auto boneCB = mesh->GetArmatureCB(0);
-			auto comp = &entityManager->GetComponent<AnimationBufferComponent>(e.EntityID);
-			//auto boneCB = animationManager->GetConstantBuffer(e.EntityID);
-			perArmatureWrapper.CopyData((void*)&comp->ConstantBuffer, sizeof(PerArmatureConstantBuffer), armatureIndex);
-			//perArmatureWrapper.CopyData((void*)&boneCB, sizeof(PerArmatureConstantBuffer), armatureIndex);
+			//Bone palette copied when the state was published, the live component may already be a frame ahead
+			entityBoneCBMap.insert(std::pair<EntityID, int>(e.EntityID, armatureIndex));
+			auto bones = state.BoneIndices[i];
+			if (bones >= 0)
+				perArmatureWrapper.CopyData((void*)&state.BonePalettes[bones], sizeof(PerArmatureConstantBuffer), armatureIndex);
 			armatureIndex++;
 		}
 		index++;
@@ -640,39 +694,21 @@ void DeferredRenderer::PrepareGPUHeap(std::vector<Entity> entities, PixelConstan
 
 	XMMATRIX shProj = XMMatrixOrthographicLH(40.0f, 40.0f, 0.1f, 100.0f);
 	XMStoreFloat4x4(&shadowProjTransposed, XMMatrixTranspose(shProj));
+	XMFLOAT4X4 shadowViewProjection;
+	XMStoreFloat4x4(&shadowViewProjection, shView * shProj);
+	dirShadowFrustum = Frustum::FromViewProjection(shadowViewProjection);
+	dirShadowFrustum.RemoveNearPlane(); //Casters behind the near plane still shadow the volume
 
-	//Create Point Light CBVs and corresponding mesh CBVs
-	Entity e;
-	for (auto i = 0u; i < pixelCb.pointLightCount; ++i)
-	{
-		e.SetMesh(sphereMesh);
-		e.SetPosition(pixelCb.pointLight[i].Position);
-		float range = pixelCb.pointLight[i].Range;
-		pixelCb.pointLightIndex = i;
-		e.SetScale(XMFLOAT3(range, range, range));
-
-		auto cb = ConstantBuffer{ e.GetWorldViewProjectionTransposed(camera->GetProjectionMatrix(), camera->GetViewMatrix()), e.GetWorldMatrixTransposed() };
-		pixelCbWrapper.CopyData((void*)(&pixelCb), PixelConstantBufferSize, i + 1);
-		cbWrapper.CopyData(&cb, ConstantBufferSize, index);
-		index++;
-	}
-
-	auto pixelCbHeapIndex = frame->CopyAllocate(pixelCb.pointLightCount + 1, pixelCbHeap);
-	auto lightPassCBHeapIndex = frame->CopyAllocate(pixelCb.pointLightCount, cbHeap, constBufferIndex);
-	constBufferIndex = index;
+	auto pixelCbHeapIndex = frame->CopyAllocate(1, pixelCbHeap);
 
+	//Shadow CB contents are written by RenderShadowMap once the casters are known
 	entityShadowCBMap.clear();
-	DirShadowBuffer cb;
-	cb.shadowView = shadowViewTransposed;
-	cb.shadowProjection = shadowProjTransposed;
 	int count = 0;
 	for (auto e : entities)
 	{
 		//if (!e->CastsShadow()) continue;
 		if (false) continue;
 		entityShadowCBMap.insert(std::pair<EntityID, int>(e.EntityID, count)); //count = current CB index
-		cb.world = Transpose(e.WorldTransform);
-		shadowCBWrapper.CopyData(&cb, sizeof(DirShadowBuffer), count); //0th position taken by Point Shadow Buffer
 		count++;
 	}
 
@@ -713,30 +749,41 @@ void DeferredRenderer::PrepareGPUHeap(std::vector<Entity> entities, PixelConstan
 		{ 0.0f, -1.0f, 0.0 }
 	};
 
-	auto proj = XMMatrixPerspectiveFovLH(XM_PIDIV2, 1.f, 0.1f, pixelCb.pointLight[0].Range);
+	PointLight shadowLight = {};
+	if (!pointLights.empty())
+		shadowLight = pointLights[0];
+	auto proj = XMMatrixPerspectiveFovLH(XM_PIDIV2, 1.f, 0.1f, shadowLight.Range);
+	pointShadowSphere = BoundingSphere(shadowLight.Position, shadowLight.Range);
 	XMFLOAT4X4 pointProj;
 	XMStoreFloat4x4(&pointProj, proj);
 	//ZeroMemory(&pShadowBuffer, sizeof(PointShadowBuffer));
 	//for (int i = 0; i < 6; ++i)
 	//{
-	//	auto view = XMMatrixLookToLH(XMLoadFloat3(&pixelCb.pointLight[0].Position), XMLoadFloat3(&dirs[i]), XMLoadFloat3(&ups[i]));
+	//	auto view = XMMatrixLookToLH(XMLoadFloat3(&shadowLight.Position), XMLoadFloat3(&dirs[i]), XMLoadFloat3(&ups[i]));
 	//	XMStoreFloat4x4(&pShadowBuffer.viewProjection[i], XMMatrixTranspose(view * proj));
 	//}
 
-	auto world = XMMatrixTranslationFromVector(-XMLoadFloat3(&pixelCb.pointLight[0].Position));
-	auto view = XMMatrixRotationY(XM_PI + XM_PIDIV2); // +X
-	XMStoreFloat4x4(&pShadowBuffer.viewProjection[0], XMMatrixTranspose(world * view * proj));
-	view = XMMatrixRotationY(XM_PIDIV2); //-X
-	XMStoreFloat4x4(&pShadowBuffer.viewProjection[1], XMMatrixTranspose(world * view * proj));
-
-	view = XMMatrixRotationX(XM_PIDIV2); //+Y
-	XMStoreFloat4x4(&pShadowBuffer.viewProjection[2], XMMatrixTranspose(world * view * proj));
-	view = XMMatrixRotationX(XM_PI + XM_PIDIV2); //-Y
-	XMStoreFloat4x4(&pShadowBuffer.viewProjection[3], XMMatrixTranspose(world * view * proj));
-
-	XMStoreFloat4x4(&pShadowBuffer.viewProjection[4], XMMatrixTranspose(world * proj)); //+Z
-	view = XMMatrixRotationY(XM_PI);
-	XMStoreFloat4x4(&pShadowBuffer.viewProjection[5], XMMatrixTranspose(world * view * proj));//-Z
+	auto world = XMMatrixTranslationFromVector(-XMLoadFloat3(&shadowLight.Position));
+	const XMMATRIX faceViews[CubeFaceCount] =
+	{
+		XMMatrixRotationY(XM_PI + XM_PIDIV2), //+X
+		XMMatrixRotationY(XM_PIDIV2), //-X
+		XMMatrixRotationX(XM_PIDIV2), //+Y
+		XMMatrixRotationX(XM_PI + XM_PIDIV2), //-Y
+		XMMatrixIdentity(), //+Z
+		XMMatrixRotationY(XM_PI) //-Z
+	};
+	for (uint32_t face = 0; face < CubeFaceCount; ++face)
+	{
+		auto faceViewProjection = world * faceViews[face] * proj;
+		XMStoreFloat4x4(&pShadowBuffer.viewProjection[face], XMMatrixTranspose(faceViewProjection));
+
+		//Without the near plane the face is a pyramid from the light, so casters around the light are kept
+		XMFLOAT4X4 viewProjection;
+		XMStoreFloat4x4(&viewProjection, faceViewProjection);
+		pointShadowFaces[face] = Frustum::FromViewProjection(viewProjection);
+		pointShadowFaces[face].RemoveNearPlane();
+	}
 
 	pointShadowCBWrapper.CopyData(&pShadowBuffer, sizeof(PointShadowBuffer), 0);
 
@@ -746,6 +793,7 @@ void DeferredRenderer::PrepareGPUHeap(std::vector<Entity> entities, PixelConstan
 	int PerFrameCBSize = (sizeof(PerFrameConstantBuffer) + 255) & ~255;
 	ZeroMemory(&frameCB, sizeof(PerFrameConstantBuffer));
 	frameCB = { camera->GetNearZ(), camera->GetFarZ() , XMFLOAT2(pointProj._33, pointProj._43) }; //Projection Constants for DOF and Light Perspective for Point Light
+	auto lightClusterHeapIndex = PrepareLightClusters(pointLights, pixelCb); //Fills the cluster constants of frameCB
 	perFrameCbWrapper.CopyData(&frameCB, PerFrameCBSize, 0);
 	auto perFrameCBVHeapIndex = frame->CopyAllocate(1, cbHeap, ConstBufferCount - 1);
 
@@ -756,13 +804,39 @@ void DeferredRenderer::PrepareGPUHeap(std::vector<Entity> entities, PixelConstan
 
 	frameHeapParams.PixelCB = pixelCbHeapIndex;
 	frameHeapParams.Textures = srvGpuHeapIndex;
-	frameHeapParams.LightShapes = lightPassCBHeapIndex;
+	frameHeapParams.LightClusters = lightClusterHeapIndex;
 
 	frameHeapParams.PerFrameCB = perFrameCBVHeapIndex;
 	frameHeapParams.ShadowCB = shadowHeapIndex;
 	frameHeapParams.SkyCB = skyCBIndex;
 }
 
+uint32_t DeferredRenderer::PrepareLightClusters(const std::vector<PointLight>& pointLights, PixelConstantBuffer & pixelCb)
+{
+	auto lightCount = (uint32_t)std::min(pointLights.size(), (size_t)MaxPointLights);
+	auto& view = camera->GetViewMatrix();
+	lightClusters.SetProjection(camera->GetProjectionMatrix(), camera->GetNearZ(), camera->GetFarZ());
+	lightClusters.Build(pointLights.data(), lightCount, view);
+	pixelCb.pointLightCount = lightCount;
+
+	auto& clusters = lightClusters.GetClusters();
+	auto& lightIndices = lightClusters.GetLightIndices();
+	if (lightCount > 0)
+		pointLightWrapper.CopyData((void*)pointLights.data(), (int)(lightCount * sizeof(PointLight)), 0);
+	lightClusterWrapper.CopyData((void*)clusters.data(), (int)(clusters.size() * sizeof(LightCluster)), 0);
+	if (!lightIndices.empty())
+		lightIndexWrapper.CopyData((void*)lightIndices.data(), (int)(lightIndices.size() * sizeof(uint32_t)), 0);
+
+	frameCB.viewDepthPlane = XMFLOAT4(view._13, view._23, view._33, view._43); //Third column of the view matrix
+	frameCB.clusterTileScale = XMFLOAT2((float)lightClusters.GetTilesX() / viewportWidth, (float)lightClusters.GetTilesY() / viewportHeight);
+	frameCB.clusterDepthScale = lightClusters.GetDepthScale();
+	frameCB.clusterDepthBias = lightClusters.GetDepthBias();
+	frameCB.clusterTilesX = lightClusters.GetTilesX();
+	frameCB.clusterTilesY = lightClusters.GetTilesY();
+	frameCB.clusterSlices = lightClusters.GetSlices();
+	return frame->CopyAllocate(3, lightClusterHeap);
+}
+
 CDescriptorHeapWrapper& DeferredRenderer::GetSRVHeap()
 {
 	return srvHeap;
@@ -979,15 +1053,8 @@ void DeferredRenderer::CreateLightPassPSO()
 
 	device->CreateGraphicsPipelineState(&descPipelineState, IID_PPV_ARGS(&dirLightPassPSO));
 
-	auto rasterizer = CD3DX12_RASTERIZER_DESC(D3D12_DEFAULT);
-	rasterizer.CullMode = D3D12_CULL_MODE_FRONT; // Front culling for point light
-	rasterizer.DepthClipEnable = false;
-	descPipelineState.VS = ShaderManager::LoadShader(L"LightShapeVS.cso");
-	descPipelineState.PS = ShaderManager::LoadShader(L"LightShapePassPS.cso");
+	descPipelineState.PS = ShaderManager::LoadShader(L"LightShapePassPS.cso"); //Screen quad over the clustered lights
 	descPipelineState.BlendState = blendState;
-	descPipelineState.InputLayout.pInputElementDescs = InputLayout::DefaultLayout;
-	descPipelineState.InputLayout.NumElements = _countof(InputLayout::DefaultLayout);
-	descPipelineState.RasterizerState = rasterizer;
 	descPipelineState.RTVFormats[0] = DXGI_FORMAT_R32G32B32A32_FLOAT;
 
 	device->CreateGraphicsPipelineState(&descPipelineState, IID_PPV_ARGS(&shapeLightPassPSO));
@@ -1162,7 +1229,7 @@ void DeferredRenderer::CreateDSV()
 
 void DeferredRenderer::CreateRootSignature()
 {
-	CD3DX12_DESCRIPTOR_RANGE range[5];
+	CD3DX12_DESCRIPTOR_RANGE range[6];
 	//view dependent CBV
 	range[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_CBV, 1, 0);
 	//light dependent CBV
@@ -1173,16 +1240,19 @@ void DeferredRenderer::CreateRootSignature()
 	range[3].Init(D3D12_DESCRIPTOR_RANGE_TYPE_CBV, 1, 1);
 	//per bone 
 	range[4].Init(D3D12_DESCRIPTOR_RANGE_TYPE_CBV, 1, 2);
+	//clustered point lights, in their own space so the G-Buffer range keeps t0 to t15
+	range[5].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 3, 0, 1);
 
-	CD3DX12_ROOT_PARAMETER rootParameters[5];
+	CD3DX12_ROOT_PARAMETER rootParameters[6];
 	rootParameters[0].InitAsDescriptorTable(1, &range[0], D3D12_SHADER_VISIBILITY_VERTEX);
 	rootParameters[1].InitAsDescriptorTable(1, &range[1], D3D12_SHADER_VISIBILITY_PIXEL);
 	rootParameters[2].InitAsDescriptorTable(1, &range[2], D3D12_SHADER_VISIBILITY_ALL);
 	rootParameters[3].InitAsDescriptorTable(1, &range[3], D3D12_SHADER_VISIBILITY_ALL);
 	rootParameters[4].InitAsDescriptorTable(1, &range[4], D3D12_SHADER_VISIBILITY_ALL);
+	rootParameters[5].InitAsDescriptorTable(1, &range[5], D3D12_SHADER_VISIBILITY_PIXEL);
 
 	CD3DX12_ROOT_SIGNATURE_DESC descRootSignature;
-	descRootSignature.Init(5, rootParameters, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT | // we can deny shader stages here for better performance
+	descRootSignature.Init(6, rootParameters, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT | // we can deny shader stages here for better performance
 		D3D12_ROOT_SIGNATURE_FLAG_DENY_HULL_SHADER_ROOT_ACCESS |
 		D3D12_ROOT_SIGNATURE_FLAG_DENY_DOMAIN_SHADER_ROOT_ACCESS);
 
@@ -1506,6 +1576,50 @@ void DeferredRenderer::CreateSelectionFilterBuffers()
 	selectedDepthBufferSRV = std::unique_ptr<Texture>(new Texture(this, device, selectedDepthTexture, heapIndex, TextureTypeSRV));
 }
 
+void DeferredRenderer::CreateLightClusterBuffers()
+{
+	//Structured buffers in the upload heap, rewritten every frame like the constant buffers
+	D3D12_RESOURCE_DESC resourceDesc;
+	ZeroMemory(&resourceDesc, sizeof(resourceDesc));
+	resourceDesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+	resourceDesc.Alignment = 0;
+	resourceDesc.SampleDesc.Count = 1;
+	resourceDesc.SampleDesc.Quality = 0;
+	resourceDesc.MipLevels = 1;
+	resourceDesc.Format = DXGI_FORMAT_UNKNOWN;
+	resourceDesc.DepthOrArraySize = 1;
+	resourceDesc.Height = 1;
+	resourceDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
+	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	srvDesc.Buffer.FirstElement = 0;
+	srvDesc.Buffer.Flags = D3D12_BUFFER_SRV_FLAG_NONE;
+
+	lightClusterHeap.Create(device, D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV, 3);
+	auto createBuffer = [&](const char* name, UINT elementCount, UINT stride, int heapIndex)
+	{
+		resourceDesc.Width = (UINT64)elementCount * stride;
+		auto buffer = sysRM->CreateResource(StringID(name), resourceDesc, ResourceTypeConstantBuffer);
+		srvDesc.Buffer.NumElements = elementCount;
+		srvDesc.Buffer.StructureByteStride = stride;
+		device->CreateShaderResourceView(buffer, &srvDesc, lightClusterHeap.handleCPU(heapIndex));
+		return buffer;
+	};
+
+	//A cluster lists at most GetMaxLightsPerCluster lights, which bounds the index list
+	auto clusterCount = lightClusters.GetClusterCount();
+	pointLightBuffer = createBuffer("pointLightBuffer", MaxPointLights, sizeof(PointLight), 0);
+	lightClusterBuffer = createBuffer("lightClusterBuffer", clusterCount, sizeof(LightCluster), 1);
+	lightIndexBuffer = createBuffer("lightIndexBuffer", clusterCount * lightClusters.GetMaxLightsPerCluster(), sizeof(uint32_t), 2);
+
+	pointLightWrapper.Initialize(pointLightBuffer, sizeof(PointLight));
+	lightClusterWrapper.Initialize(lightClusterBuffer, sizeof(LightCluster));
+	lightIndexWrapper.Initialize(lightIndexBuffer, sizeof(uint32_t));
+}
+
 DeferredRenderer::~DeferredRenderer()
 {
 	for (int i = 0; i < numRTV; ++i)
@@ -1534,6 +1648,5 @@ DeferredRenderer::~DeferredRenderer()
 
 	shadowCB->Release();
 	pointShadowCB->Release();
-	delete sphereMesh;
 	delete cubeMesh;
 }
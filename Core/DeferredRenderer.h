@@ -10,6 +10,9 @@
 #include "../SystemResourceManager.h"
 #include "../MeshInstanceGroupEntity.h"
 #include "../ResourceManager.h"
+#include "../RenderState.h"
+#include "../Culling.h"
+#include "../LightClusters.h"
 #include <parallel_hashmap/phmap.h>
 
 enum GBufferRenderTargetOrder
@@ -29,7 +32,8 @@ enum DefaultRootParameterSlotType {
 	RootSigCBPixel0,
 	RootSigSRVPixel1,
 	RootSigCBAll1,
-	RootSigCBAll2
+	RootSigCBAll2,
+	RootSigSRVLights //Clustered point light buffers, t0 to t2 in space1
 };
 
 typedef GBufferRenderTargetOrder GBufferType;
@@ -55,6 +59,7 @@ class DeferredRenderer
 	EntityManager*			entityManager;
 	phmap::flat_hash_map<EntityID, int> entityCBMap;
 	phmap::flat_hash_map<EntityID, int> entityShadowCBMap;
+	phmap::flat_hash_map<EntityID, int> entityBoneCBMap;
 
 	ID3D12Resource* gBufferTextures[numRTV];
 	ID3D12Resource* depthStencilTexture;
@@ -124,6 +129,24 @@ class DeferredRenderer
 	XMFLOAT4X4 shadowViewTransposed;
 	XMFLOAT4X4 shadowProjTransposed;
 
+	//Shadow casters, indices into the entities given to RenderShadowMap followed by the instanced groups
+	Frustum					dirShadowFrustum;
+	BoundingSphere			pointShadowSphere;
+	Frustum					pointShadowFaces[CubeFaceCount];
+	CullBoxList				shadowBoxes;
+	std::vector<uint32_t>	dirShadowCasters;
+	std::vector<uint32_t>	pointShadowCasters;
+	std::vector<uint32_t>	faceCasters;
+	std::vector<uint8_t>	pointShadowFaceMasks; //Per box, cube faces of the point shadow map it reaches
+
+	//Point lights binned into view space clusters every frame, the light shape pass shades each pixel with the
+	//lights of its cluster
+	LightClusterGrid		lightClusters;
+	CDescriptorHeapWrapper	lightClusterHeap;
+	ConstantBufferWrapper	pointLightWrapper;
+	ConstantBufferWrapper	lightClusterWrapper;
+	ConstantBufferWrapper	lightIndexWrapper;
+
 	std::vector<Texture*> textureVector;
 	std::vector<Texture*> gBufferTextureVector;
 
@@ -136,8 +159,10 @@ class DeferredRenderer
 	ID3D12Resource *worldViewCB;
 	ID3D12Resource *perFrameCB;
 	ID3D12Resource *perArmatureCB;
+	ID3D12Resource *pointLightBuffer;
+	ID3D12Resource *lightClusterBuffer;
+	ID3D12Resource *lightIndexBuffer;
 
-	Mesh* sphereMesh;
 	Mesh* cubeMesh;
 
 	DXGI_FORMAT mDsvFormat = DXGI_FORMAT_D24_UNORM_S8_UINT;
@@ -170,10 +195,17 @@ class DeferredRenderer
 	void CreateRootSignature();
 	void CreateShadowBuffers();
 	void CreateSelectionFilterBuffers();
+	void CreateLightClusterBuffers();
 	void Draw(Mesh* m, ID3D12GraphicsCommandList* commandList);
 	void DrawAnimated(Mesh* m, ID3D12GraphicsCommandList* clist);
 	void DrawInstanced(MeshInstanceGroupEntity* instanced, Mesh* mesh, ID3D12GraphicsCommandList* commandList);
-	void PrepareGPUHeap(std::vector<Entity> entities, PixelConstantBuffer& pixelCb);
+	void PrepareGPUHeap(const std::vector<Entity>& entities, const RenderState& state, const std::vector<PointLight>& pointLights, PixelConstantBuffer& pixelCb);
+	//! Bins the lights into the camera's clusters, uploads the light, cluster and light index buffers and returns
+	//! the frame heap index of their SRVs
+	uint32_t PrepareLightClusters(const std::vector<PointLight>& pointLights, PixelConstantBuffer& pixelCb);
+	//! Fills the caster lists of the directional and point light shadow maps and the cube face mask of each
+	//! point light caster
+	void CullShadowCasters(const std::vector<Entity>& entities, const std::vector<MeshInstanceGroupEntity*>& instancedEntities);
 public:
 	DeferredRenderer(ID3D12Device *dxDevice, int width, int height);
 
@@ -204,7 +236,7 @@ public:
 	void Initialize(ID3D12GraphicsCommandList* command);
 	void SetGBUfferPSO(ID3D12GraphicsCommandList* command, Camera* camera, const PixelConstantBuffer& pixelCb);
 	void RenderLightPass(ID3D12GraphicsCommandList* command, const PixelConstantBuffer& pixelCb);
-	void RenderLightShapePass(ID3D12GraphicsCommandList* command, PixelConstantBuffer& pixelCb);
+	void RenderLightShapePass(ID3D12GraphicsCommandList* command);
 	void RenderAmbientPass(ID3D12GraphicsCommandList* clist);
 
 	void RenderSelectionDepthBuffer(ID3D12GraphicsCommandList* commandList, std::vector<Entity*> entities, Camera* camera);
@@ -214,12 +246,13 @@ public:
 	void DrawInstanced(ID3D12GraphicsCommandList* commandList, std::vector<MeshInstanceGroupEntity*> entities);
 	void DrawSkybox(ID3D12GraphicsCommandList* commandList, Texture* skybox);
 	void DrawScreenQuad(ID3D12GraphicsCommandList* commandList);
-	void DrawLightShapePass(ID3D12GraphicsCommandList* commandList, PixelConstantBuffer & pixelCb);
 	void DrawResult(ID3D12GraphicsCommandList* commandList, D3D12_CPU_DESCRIPTOR_HANDLE &rtvHandle);
 	void DrawResult(ID3D12GraphicsCommandList* commandList, D3D12_CPU_DESCRIPTOR_HANDLE &rtvHandle, Texture* resultTex);
 
 	void StartFrame(ID3D12GraphicsCommandList* commandList);
-	void PrepareFrame(std::vector<Entity> entities, Camera* camera, PixelConstantBuffer& pixelCb);
+	//! entities[i] is state.Entities[i], possibly with an interpolated world matrix. Bone palettes come from state.
+	//! pointLights[0] casts the point light shadow, lights past MaxPointLights are dropped.
+	void PrepareFrame(const std::vector<Entity>& entities, const RenderState& state, Camera* camera, const std::vector<PointLight>& pointLights, PixelConstantBuffer& pixelCb);
 	void TransitionToPostProcess(ID3D12GraphicsCommandList* commandList);
 	void EndFrame(ID3D12GraphicsCommandList* commandList);
 
@@ -414,6 +414,16 @@ const UINT Mesh::GetSubMeshCount()
 	return (UINT)subMeshes.size();
 }
 
+const std::vector<Vertex>& Mesh::GetVertices(UINT index)
+{
+	return subMeshes[index].vertices;
+}
+
+const std::vector<UINT>& Mesh::GetIndices(UINT index)
+{
+	return subMeshes[index].indices;
+}
+
 BoneDescriptor & Mesh::GetBoneDescriptor(UINT index)
 {
 	return boneDescriptors[index];
@@ -97,6 +97,9 @@ public:
 	const D3D12_INDEX_BUFFER_VIEW&	GetIndexBufferView(UINT index);
 	const UINT&						GetIndexCount(UINT index);
 	const UINT						GetSubMeshCount();
+	//! CPU copies of the geometry, for occlusion culling
+	const std::vector<Vertex>&		GetVertices(UINT index);
+	const std::vector<UINT>&		GetIndices(UINT index);
 	BoneDescriptor&					GetBoneDescriptor(UINT index = 0);
 
 	const BoundingOrientedBox&		GetBoundingOrientedBox();
@@ -6,6 +6,13 @@ cbuffer PerFrame : register(b1)
 	float	nearZ;
 	float	farZ;
 	float2	lightPerspectiveValues;
+	float4	viewDepthPlane;
+	float2	clusterTileScale;
+	float	clusterDepthScale;
+	float	clusterDepthBias;
+	uint	clusterTilesX;
+	uint	clusterTilesY;
+	uint	clusterSlices;
 };
 
 struct VertexToPixel
@@ -31,6 +38,11 @@ Texture2D gShadowMap				: register(t11);
 Texture2D gShadowPos				: register(t12);
 TextureCube<float> gPointShadowMap	: register(t13);
 
+//Clustered point lights, gLightClusters holds the offset and count of each cluster's run in gLightIndices
+StructuredBuffer<PointLight> gPointLights	: register(t0, space1);
+StructuredBuffer<uint2> gLightClusters		: register(t1, space1);
+StructuredBuffer<uint> gLightIndices		: register(t2, space1);
+
 SamplerState			basicSampler	: register(s0);
 SamplerComparisonState	shadowSampler	: register(s1);
 
@@ -46,19 +58,36 @@ float PointShadow(float3 ToPixel)
 float4 main(VertexToPixel pIn) : SV_TARGET
 {
 	int3 sampleIndices = int3(pIn.position.xy, 0);
+	if (gDepth.Load(sampleIndices).r >= 1.f)
+	{
+		return float4(0.f, 0.f, 0.f, 1.0f); //Nothing drawn here
+	}
+
 	float3 albedo = gAlbedoTexture.Load(sampleIndices).rgb;
-	float3 normal = gNormalTexture.Load(sampleIndices).rgb;
+	float3 normal = normalize(gNormalTexture.Load(sampleIndices).rgb);
 	float3 worldPos = gWorldPosTexture.Load(sampleIndices).rgb;
 	float roughness = gRoughnessTexture.Load(sampleIndices).r;
 	float metal  = gMetalnessTexture.Load(sampleIndices).r;
 	float3 irradiance = skyIrradianceTexture.Sample(basicSampler, normal).rgb;
-	float shadowAmount = 1.f;
-	if (pointLightIndex == 0)
+	float3 specColor = lerp(F0_NON_METAL.rrr, albedo.rgb, metal);
+
+	float depth = max(dot(float4(worldPos, 1.f), viewDepthPlane), nearZ);
+	uint3 cluster;
+	cluster.xy = min(uint2(pIn.position.xy * clusterTileScale), uint2(clusterTilesX - 1, clusterTilesY - 1));
+	cluster.z = (uint)clamp(floor(log(depth) * clusterDepthScale + clusterDepthBias), 0.f, (float)(clusterSlices - 1));
+	uint2 lights = gLightClusters[(cluster.z * clusterTilesY + cluster.y) * clusterTilesX + cluster.x];
+
+	float3 finalColor = 0.f;
+	for (uint i = 0; i < lights.y; ++i)
 	{
-		shadowAmount = PointShadow(worldPos - pointLight[pointLightIndex].Position);
+		uint lightIndex = gLightIndices[lights.x + i];
+		PointLight light = gPointLights[lightIndex];
+		float3 color = PointLightPBR(light, normal, worldPos, cameraPosition, roughness, metal, albedo, specColor, irradiance);
+		if (lightIndex == 0)
+		{
+			color *= PointShadow(worldPos - light.Position); //The first light casts the cube shadow
+		}
+		finalColor += color;
 	}
-
-	float3 specColor = lerp(F0_NON_METAL.rrr, albedo.rgb, metal);
-	float3 finalColor = PointLightPBR(pointLight[pointLightIndex], normalize(normal), worldPos, cameraPosition, roughness, metal, albedo, specColor, irradiance);
-	return float4(finalColor * shadowAmount, 1.0f);
+	return float4(finalColor, 1.0f);
 }
\ No newline at end of file
@@ -28,17 +28,14 @@ struct PointLight
 	float3 Padding;
 };
 
-static const int MaxPointLights = 16;
 static const int MaxDirLights = 4;
 
 cbuffer externalData : register(b0)
 {
 	DirectionalLight dirLight[MaxDirLights];
-	PointLight pointLight[MaxPointLights];
 	float4x4 invProjView;
 	float3 cameraPosition;
 	int pointLightCount;
-	int pointLightIndex;
 	int dirLightCount;
 	int dirLightIndex;
 }
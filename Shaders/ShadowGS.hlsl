@@ -8,6 +8,12 @@ cbuffer	cbuffercbShadowMapCubeGS : register(b1)
 	float4x4 CubeViewProj[6];
 }
 
+struct GeometryInput
+{
+	float4	Pos			: SV_POSITION;
+	uint	FaceMask	: FACEMASK;
+};
+
 struct GeometryOutput
 {
 	float4	Pos		: SV_POSITION;
@@ -15,14 +21,18 @@ struct GeometryOutput
 };
 
 [maxvertexcount(18)]
-void main(triangle float4 InPos[3] : SV_Position, inout	TriangleStream<GeometryOutput> OutStream)
+void main(triangle GeometryInput input[3], inout	TriangleStream<GeometryOutput> OutStream)
 {
 	for (int iFace = 0; iFace < 6; iFace++)
 	{
+		// Faces the caster's bounds miss were culled on the CPU
+		if ((input[0].FaceMask & (1u << iFace)) == 0)
+			continue;
+
 		GeometryOutput output;
 		output.RTIndex = iFace;
 		for (int v = 0; v < 3; v++) {
-			output.Pos = mul(InPos[v], CubeViewProj[iFace]);
+			output.Pos = mul(input[v].Pos, CubeViewProj[iFace]);
 			OutStream.Append(output);
 		}
 		OutStream.RestartStrip();
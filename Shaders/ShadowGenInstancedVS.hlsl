@@ -13,7 +13,16 @@ struct VertexInput
 	float4x4 instanceWorld: WORLD_INSTANCE;
 };
 
-float4 main(VertexInput input) : SV_POSITION
+struct VertexOutput
 {
-	return mul(float4(input.pos.xyz, 1.0f), input.instanceWorld);
+	float4 pos : SV_POSITION;
+	nointerpolation uint faceMask : FACEMASK;
+};
+
+VertexOutput main(VertexInput input)
+{
+	VertexOutput output;
+	output.pos = mul(float4(input.pos.xyz, 1.0f), input.instanceWorld);
+	output.faceMask = 0x3F; // groups are culled as a whole, every face
+	return output;
 }
\ No newline at end of file
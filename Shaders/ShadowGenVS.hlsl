@@ -3,6 +3,7 @@ cbuffer externalData : register(b0)
 	matrix world;
 	matrix view; // not used
 	matrix projection; // not used
+	uint faceMask; // cube faces the entity reaches, bit i for face i
 };
 //TODO: Optimize Constant Buffer
 
@@ -11,7 +12,16 @@ struct VertexInput
 	float4 pos : POSITION;
 };
 
-float4 main(VertexInput input) : SV_POSITION
+struct VertexOutput
 {
-	return mul(float4(input.pos.xyz, 1.0f), world);
+	float4 pos : SV_POSITION;
+	nointerpolation uint faceMask : FACEMASK;
+};
+
+VertexOutput main(VertexInput input)
+{
+	VertexOutput output;
+	output.pos = mul(float4(input.pos.xyz, 1.0f), world);
+	output.faceMask = faceMask;
+	return output;
 }
\ No newline at end of file